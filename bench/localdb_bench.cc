@@ -0,0 +1,276 @@
+#include <benchmark/benchmark.h>
+#include "localdb.h"
+#include <filesystem>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+
+// Table sizes of the size-dependent benchmarks
+constexpr int64_t kMinRows = 1000;
+constexpr int64_t kMaxRows = 100000;
+
+std::vector<localdb::Column> userColumns(bool constraints) {
+    return {
+        {"id", localdb::Column::INT, constraints, constraints, constraints},
+        {"name", localdb::Column::TEXT, false, constraints, false},
+        {"age", localdb::Column::INT, false, false, false}
+    };
+}
+
+localdb::Row userRow(int id) {
+    return {localdb::Value(id), localdb::Value("User " + std::to_string(id)), localdb::Value(id % 100)};
+}
+
+// Database with a users table holding ids [0, rows)
+std::unique_ptr<localdb::Database> makeDatabase(int64_t rows, bool constraints = true, size_t shards = 1) {
+    auto db = std::make_unique<localdb::Database>();
+    db->createTable("users", userColumns(constraints), localdb::Table::ROW_ORIENTED, shards);
+    std::vector<localdb::Row> batch;
+    batch.reserve(rows);
+    for (int64_t i = 0; i < rows; i++) {
+        batch.push_back(userRow(static_cast<int>(i)));
+    }
+    db->getTable("users")->insertBatch(std::move(batch));
+    return db;
+}
+
+// Database shared by the threads of a multi-threaded benchmark. Thread 0
+// sets it up before the timed loop and tears it down after, the loop start
+// and end are barriers for all threads.
+std::unique_ptr<localdb::Database> shared_db;
+
+// Keys of each thread start far apart so inserts never collide
+int threadKey(const benchmark::State& state, int i) {
+    return (state.thread_index() + 1) * 100000000 + i;
+}
+
+// Insert one row at a time, arg 1 adds PRIMARY KEY, NOT NULL and UNIQUE checks
+void BM_Insert(benchmark::State& state) {
+    localdb::Database db;
+    db.createTable("users", userColumns(state.range(0) != 0));
+    localdb::Table* table = db.getTable("users");
+    int id = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(table->insert(userRow(id++)));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Insert)->ArgName("constraints")->Arg(0)->Arg(1);
+
+// Concurrent constraint-checked inserts into one table, split into shards
+void BM_ConcurrentInsert(benchmark::State& state) {
+    if (state.thread_index() == 0) {
+        shared_db = makeDatabase(0, true, static_cast<size_t>(state.range(0)));
+    }
+    int i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(shared_db->getTable("users")->insert(userRow(threadKey(state, i++))));
+    }
+    state.SetItemsProcessed(state.iterations());
+    if (state.thread_index() == 0) {
+        shared_db.reset();
+    }
+}
+BENCHMARK(BM_ConcurrentInsert)->ArgName("shards")->Arg(1)->Arg(8)->ThreadRange(1, 8)->UseRealTime();
+
+// Primary key lookups spread over the table
+void BM_PointSelect(benchmark::State& state) {
+    if (state.thread_index() == 0) {
+        shared_db = makeDatabase(state.range(0));
+    }
+    int64_t rows = state.range(0);
+    uint32_t seed = 2654435761u * static_cast<uint32_t>(state.thread_index() + 1);
+    for (auto _ : state) {
+        seed = seed * 1664525u + 1013904223u;
+        localdb::Value key(static_cast<int>(seed % rows));
+        benchmark::DoNotOptimize(shared_db->getTable("users")->lookup("id", key));
+    }
+    state.SetItemsProcessed(state.iterations());
+    if (state.thread_index() == 0) {
+        shared_db.reset();
+    }
+}
+BENCHMARK(BM_PointSelect)->RangeMultiplier(10)->Range(kMinRows, kMaxRows)->ThreadRange(1, 8)->UseRealTime();
+
+// Row predicate over every row, half of them match
+void BM_FullScan(benchmark::State& state) {
+    auto db = makeDatabase(state.range(0));
+    localdb::Table* table = db->getTable("users");
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(table->select([](const localdb::Row& row) { return row[2].asInt() < 50; }));
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_FullScan)->RangeMultiplier(10)->Range(kMinRows, kMaxRows)->UseRealTime();
+
+// The 100 oldest users, arg index walks an ordered index on age instead of
+// keeping a bounded heap over a full scan
+void BM_OrderByLimit(benchmark::State& state) {
+    auto db = makeDatabase(state.range(0));
+    localdb::Table* table = db->getTable("users");
+    if (state.range(1) != 0) {
+        table->createIndex("age");
+    }
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(table->select(localdb::Expression(), {{"age", true}}, 100));
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_OrderByLimit)
+    ->ArgNames({"rows", "index"})
+    ->ArgsProduct({benchmark::CreateRange(kMinRows, kMaxRows, 10), {0, 1}})
+    ->UseRealTime();
+
+// Change one column of one row found by a predicate scan
+void BM_Update(benchmark::State& state) {
+    auto db = makeDatabase(state.range(0));
+    localdb::Table* table = db->getTable("users");
+    int64_t rows = state.range(0);
+    int i = 0;
+    for (auto _ : state) {
+        int id = static_cast<int>((i * 7919) % rows);
+        benchmark::DoNotOptimize(table->updateColumns({{"age", localdb::Value(i++)}},
+                                                      [id](const localdb::Row& row) { return row[0].asInt() == id; }));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Update)->RangeMultiplier(10)->Range(kMinRows, kMaxRows)->UseRealTime();
+
+// Remove one row, putting it back outside the timed region
+void BM_Remove(benchmark::State& state) {
+    auto db = makeDatabase(state.range(0));
+    localdb::Table* table = db->getTable("users");
+    int64_t rows = state.range(0);
+    int i = 0;
+    for (auto _ : state) {
+        int id = static_cast<int>((i++ * 7919) % rows);
+        benchmark::DoNotOptimize(table->remove([id](const localdb::Row& row) { return row[0].asInt() == id; }));
+        state.PauseTiming();
+        table->insert(userRow(id));
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Remove)->RangeMultiplier(10)->Range(kMinRows, kMaxRows)->UseRealTime();
+
+// A transaction inserting and updating one row, committed
+void BM_TransactionCommit(benchmark::State& state) {
+    if (state.thread_index() == 0) {
+        shared_db = makeDatabase(kMinRows);
+    }
+    int i = 0;
+    for (auto _ : state) {
+        int id = threadKey(state, i++);
+        auto tx = shared_db->beginTransaction();
+        tx->insert("users", userRow(id));
+        tx->updateColumns("users", {{"age", localdb::Value(1)}},
+                          [id](const localdb::Row& row) { return row[0].asInt() == id; });
+        benchmark::DoNotOptimize(tx->commit());
+    }
+    state.SetItemsProcessed(state.iterations());
+    if (state.thread_index() == 0) {
+        shared_db.reset();
+    }
+}
+BENCHMARK(BM_TransactionCommit)->ThreadRange(1, 8)->UseRealTime();
+
+// The same transaction rolled back
+void BM_TransactionRollback(benchmark::State& state) {
+    if (state.thread_index() == 0) {
+        shared_db = makeDatabase(kMinRows);
+    }
+    int i = 0;
+    for (auto _ : state) {
+        int id = static_cast<int>(i++ % kMinRows);
+        auto tx = shared_db->beginTransaction();
+        tx->insert("users", userRow(threadKey(state, i)));
+        tx->updateColumns("users", {{"age", localdb::Value(1)}},
+                          [id](const localdb::Row& row) { return row[0].asInt() == id; });
+        tx->rollback();
+    }
+    state.SetItemsProcessed(state.iterations());
+    if (state.thread_index() == 0) {
+        shared_db.reset();
+    }
+}
+BENCHMARK(BM_TransactionRollback)->ThreadRange(1, 8)->UseRealTime();
+
+std::string snapshotPath() {
+    return (std::filesystem::temp_directory_path() / "localdb_bench.db").string();
+}
+
+// Logged single-insert commits with an fsync each, arg async pipelines them
+// and only waits for the last one
+void BM_WalCommit(benchmark::State& state) {
+    std::string wal_path = snapshotPath() + ".wal";
+    std::filesystem::remove(wal_path);
+    localdb::Database db;
+    db.enableWal(wal_path);
+    db.createTable("users", userColumns(true));
+    bool async = state.range(0) != 0;
+    std::future<bool> durable;
+    int id = 0;
+    for (auto _ : state) {
+        auto tx = db.beginTransaction();
+        tx->insert("users", userRow(id++));
+        if (async) {
+            durable = tx->commitAsync();
+        } else {
+            benchmark::DoNotOptimize(tx->commit());
+        }
+    }
+    if (durable.valid()) {
+        benchmark::DoNotOptimize(durable.get());
+    }
+    state.SetItemsProcessed(state.iterations());
+    db.disableWal();
+    std::filesystem::remove(wal_path);
+}
+BENCHMARK(BM_WalCommit)->ArgName("async")->Arg(0)->Arg(1)->UseRealTime();
+
+localdb::SnapshotOptions snapshotOptions(int64_t lz4) {
+    localdb::SnapshotOptions options;
+    if (lz4 != 0) {
+        options.compression = localdb::SnapshotOptions::COMPRESSION_LZ4;
+    }
+    return options;
+}
+
+// Write a snapshot of the whole database, arg lz4 compresses it
+void BM_Save(benchmark::State& state) {
+    auto db = makeDatabase(state.range(0));
+    std::string path = snapshotPath();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(db->saveToFile(path, snapshotOptions(state.range(1))));
+    }
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(std::filesystem::file_size(path)));
+    std::filesystem::remove(path);
+}
+BENCHMARK(BM_Save)
+    ->ArgNames({"rows", "lz4"})
+    ->ArgsProduct({benchmark::CreateRange(kMinRows, kMaxRows, 10), {0, 1}})
+    ->UseRealTime();
+
+// Open a snapshot and decode its table
+void BM_Load(benchmark::State& state) {
+    std::string path = snapshotPath();
+    makeDatabase(state.range(0))->saveToFile(path, snapshotOptions(state.range(1)));
+    for (auto _ : state) {
+        localdb::Database db;
+        db.loadFromFile(path);
+        benchmark::DoNotOptimize(db.getTable("users"));
+    }
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(std::filesystem::file_size(path)));
+    std::filesystem::remove(path);
+}
+BENCHMARK(BM_Load)
+    ->ArgNames({"rows", "lz4"})
+    ->ArgsProduct({benchmark::CreateRange(kMinRows, kMaxRows, 10), {0, 1}})
+    ->UseRealTime();
+
+} // namespace
+
+BENCHMARK_MAIN();
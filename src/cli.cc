@@ -1,4 +1,9 @@
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <limits>
 #include <string>
 #include <sstream>
 #include <vector>
@@ -6,18 +11,48 @@
 #include <filesystem>
 #include <unistd.h> // For isatty and fileno
 #include "localdb.h"
+#include "row_file.h"
 
 namespace fs = std::filesystem;
 
+namespace {
+
+// Imported rows and pipelined batch inserts reach the transaction in batches of this many
+constexpr size_t kInsertBatch = 10000;
+
+// Elapsed time and rate since start, e.g. " in 0.094s (265684 rows/s)"
+std::string throughput(size_t count, std::chrono::steady_clock::time_point start, const char* unit) {
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(3) << " in " << seconds << "s (" << std::setprecision(0)
+        << count / std::max(seconds, 1e-9) << " " << unit << "/s)";
+    return out.str();
+}
+
+} // namespace
+
 class LocalDBCLI {
 private:
     localdb::Database db;
     std::string current_db_file;
     bool is_running = true;
     std::shared_ptr<localdb::Transaction> current_transaction;
+    
+    // Batch mode: consecutive inserts into one table are parsed against the
+    // column list resolved for the first of them and applied as one batch
+    struct PreparedInsert {
+        std::string table_name;
+        std::vector<localdb::Column> columns;
+        std::vector<localdb::Row> rows;
+        size_t first_line = 0;
+    };
+    PreparedInsert prepared_insert;
+    size_t batch_rows = 0;
+    // Lines of the queued inserts that failed to apply, empty if none did
+    std::string batch_failed_lines;
 
     // Command handlers
-    using CommandHandler = void (LocalDBCLI::*)(const std::vector<std::string>&);
+    using CommandHandler = bool (LocalDBCLI::*)(const std::vector<std::string>&);
     std::unordered_map<std::string, CommandHandler> command_handlers;
     std::unordered_map<std::string, std::string> command_help;
 
@@ -49,26 +84,148 @@ private:
         }
     }
 
-    localdb::Value parseValue(const std::string& value_str, localdb::Column::Type type) {
-        switch (type) {
-            case localdb::Column::INT:
-                return localdb::Value(std::stoi(value_str));
-            case localdb::Column::FLOAT:
-                return localdb::Value(std::stod(value_str));
-            case localdb::Column::TEXT:
-                return localdb::Value(value_str);
-            case localdb::Column::BLOB: {
-                // Parse hex string to blob
-                std::vector<uint8_t> blob;
-                for (size_t i = 0; i < value_str.length(); i += 2) {
-                    std::string byte = value_str.substr(i, 2);
-                    blob.push_back(static_cast<uint8_t>(std::stoi(byte, nullptr, 16)));
-                }
-                return localdb::Value(blob);
+    // Parse the values of one row from fields[first..], one per column
+    bool parseRow(const std::vector<std::string>& fields, size_t first, const std::vector<localdb::Column>& columns,
+                  localdb::Row& row) {
+        if (fields.size() - first != columns.size()) {
+            std::cout << "Error: Expected " << columns.size() << " values, got " << (fields.size() - first) << std::endl;
+            return false;
+        }
+        
+        row.clear();
+        row.reserve(columns.size());
+        for (size_t i = 0; i < columns.size(); ++i) {
+            try {
+                row.push_back(localdb::parseValue(fields[first + i], columns[i].type));
+            } catch (const std::exception& e) {
+                std::cout << "Error parsing value for column '" << columns[i].name << "': " << e.what() << std::endl;
+                return false;
             }
-            default:
-                throw std::runtime_error("Unsupported value type");
         }
+        return true;
+    }
+
+    // Build a predicate from "WHERE COL_INDEX OPERATOR VALUE" at args[1..4]
+    bool parsePredicate(const std::vector<std::string>& args, const std::vector<localdb::Column>& columns,
+                        localdb::ColumnPredicate& predicate) {
+        try {
+            int col_index = std::stoi(args[2]);
+            if (col_index < 0 || col_index >= static_cast<int>(columns.size())) {
+                std::cout << "Invalid column index: " << col_index << std::endl;
+                return false;
+            }
+            
+            if (!localdb::ColumnPredicate::parseOp(args[3], predicate.op)) {
+                std::cout << "Unsupported operator: " << args[3] << std::endl;
+                return false;
+            }
+            
+            predicate.column = columns[col_index].name;
+            predicate.constant = localdb::parseValue(args[4], columns[col_index].type);
+        } catch (const std::exception& e) {
+            std::cout << "Error parsing WHERE clause: " << e.what() << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // Statements run in the open transaction, or in one of their own that
+    // commits if the statement succeeded
+    std::shared_ptr<localdb::Transaction> statementTransaction() {
+        return current_transaction ? current_transaction : db.beginTransaction();
+    }
+    
+    bool finishStatement(const std::shared_ptr<localdb::Transaction>& tx, bool success) {
+        if (tx == current_transaction) {
+            return success;
+        }
+        if (!success) {
+            tx->rollback();
+            return false;
+        }
+        return tx->commit();
+    }
+
+    // Parse a batch-mode insert against the prepared column list, preparing
+    // it again when the table changes
+    bool queueInsert(const std::vector<std::string>& tokens, size_t line) {
+        PreparedInsert& prepared = prepared_insert;
+        if (tokens.size() < 2 || tokens[1] != prepared.table_name) {
+            if (!flushInserts()) {
+                return false;
+            }
+            localdb::Table* table = tokens.size() < 2 ? nullptr : db.getTable(tokens[1]);
+            if (!table) {
+                return handleInsert(std::vector<std::string>(tokens.begin() + 1, tokens.end()));
+            }
+            prepared.table_name = tokens[1];
+            prepared.columns = table->getColumns();
+        }
+        
+        localdb::Row row;
+        if (!parseRow(tokens, 2, prepared.columns, row)) {
+            return false;
+        }
+        if (prepared.rows.empty()) {
+            prepared.first_line = line;
+        }
+        prepared.rows.push_back(std::move(row));
+        return prepared.rows.size() < kInsertBatch || flushInserts();
+    }
+    
+    bool flushInserts() {
+        PreparedInsert& prepared = prepared_insert;
+        if (prepared.rows.empty()) {
+            return true;
+        }
+        size_t count = prepared.rows.size();
+        bool success = current_transaction->insertBatch(prepared.table_name, std::move(prepared.rows));
+        prepared.rows.clear();
+        if (!success) {
+            batch_failed_lines = count == 1 ? "line " + std::to_string(prepared.first_line)
+                                            : "lines " + std::to_string(prepared.first_line) + "-" +
+                                                  std::to_string(prepared.first_line + count - 1);
+            std::cout << "Failed to insert the rows of " << batch_failed_lines << ": "
+                      << current_transaction->status().toString() << std::endl;
+            return false;
+        }
+        batch_rows += count;
+        return true;
+    }
+
+    // Parse a non-negative row count, as taken by LIMIT and OFFSET
+    bool parseCount(const std::string& text, size_t& count) {
+        if (text.empty() || !std::all_of(text.begin(), text.end(), [](unsigned char c) { return std::isdigit(c); })) {
+            return false;
+        }
+        try {
+            count = std::stoull(text);
+        } catch (const std::exception&) {
+            return false;
+        }
+        return true;
+    }
+
+    // Build a filter from the condition tokens args[first..last), e.g.
+    // "age >= 30 AND name = 'Bob'" or the older "2 >= 30"
+    bool parseFilter(const std::vector<std::string>& args, size_t first, size_t last,
+                     const std::vector<localdb::Column>& columns, localdb::Expression& filter) {
+        // Rejoin the tokens, quoting again those splitCommand unquoted
+        std::ostringstream text;
+        for (size_t i = first; i < last; ++i) {
+            if (i > first) text << ' ';
+            if (args[i].empty() || args[i].find(' ') != std::string::npos) {
+                text << std::quoted(args[i]);
+            } else {
+                text << args[i];
+            }
+        }
+        
+        if (!localdb::Expression::parse(text.str(), columns, filter)) {
+            std::cout << "Invalid WHERE clause: " << text.str() << std::endl;
+            return false;
+        }
+        return true;
     }
 
     void displayRow(const localdb::Row& row, const std::vector<localdb::Column>&) {
@@ -123,13 +280,18 @@ public:
         command_handlers["describe_table"] = &LocalDBCLI::handleDescribeTable;
         command_handlers["insert"] = &LocalDBCLI::handleInsert;
         command_handlers["select"] = &LocalDBCLI::handleSelect;
+        command_handlers["aggregate"] = &LocalDBCLI::handleAggregate;
         command_handlers["update"] = &LocalDBCLI::handleUpdate;
         command_handlers["delete"] = &LocalDBCLI::handleDelete;
+        command_handlers["import"] = &LocalDBCLI::handleImport;
+        command_handlers["export"] = &LocalDBCLI::handleExport;
         command_handlers["begin"] = &LocalDBCLI::handleBeginTransaction;
         command_handlers["commit"] = &LocalDBCLI::handleCommitTransaction;
         command_handlers["rollback"] = &LocalDBCLI::handleRollbackTransaction;
         command_handlers["save"] = &LocalDBCLI::handleSaveDatabase;
         command_handlers["load"] = &LocalDBCLI::handleLoadDatabase;
+        command_handlers["checkpoint"] = &LocalDBCLI::handleCheckpoint;
+        command_handlers["stats"] = &LocalDBCLI::handleStats;
         
         // Initialize command help
         command_help["help"] = "Display help information";
@@ -140,14 +302,19 @@ public:
         command_help["list_tables"] = "List all tables in the database";
         command_help["describe_table"] = "Describe table schema. Usage: describe_table TABLE_NAME";
         command_help["insert"] = "Insert a row into a table. Usage: insert TABLE_NAME VAL1 VAL2 ...";
-        command_help["select"] = "Select rows from a table. Usage: select TABLE_NAME [WHERE COL_INDEX OPERATOR VALUE]";
-        command_help["update"] = "Update rows in a table. Usage: update TABLE_NAME COL1=VAL1 [COL2=VAL2 ...] WHERE COL_INDEX OPERATOR VALUE";
+        command_help["select"] = "Select rows from a table. Usage: select TABLE_NAME [WHERE CONDITION] [ORDER BY COL [ASC|DESC], ...] [LIMIT N [OFFSET M]], e.g. WHERE age >= 30 AND NOT (name = 'Bob' OR 0 = 1) ORDER BY age DESC LIMIT 10";
+        command_help["aggregate"] = "Aggregate rows of a table. Usage: aggregate TABLE_NAME FUNC(COL) [FUNC(COL) ...] [WHERE CONDITION] [GROUP BY COL ...], FUNC is COUNT, SUM, MIN, MAX or AVG, COUNT(*) counts rows";
+        command_help["update"] = "Update rows in a table. Usage: update TABLE_NAME COL1=VAL1 [COL2=VAL2 ...] [WHERE CONDITION], quote an assignment holding spaces, e.g. \"name=John Doe\"";
         command_help["delete"] = "Delete rows from a table. Usage: delete TABLE_NAME WHERE COL_INDEX OPERATOR VALUE";
+        command_help["import"] = "Insert the rows of a CSV or binary row file in batches; outside a transaction nothing is kept unless every row is. Usage: import TABLE_NAME FILENAME [csv|binary]";
+        command_help["export"] = "Write the rows of a table to a CSV file with a header line, or a binary row file. Usage: export TABLE_NAME FILENAME [csv|binary]";
         command_help["begin"] = "Begin a transaction";
         command_help["commit"] = "Commit the current transaction";
         command_help["rollback"] = "Rollback the current transaction";
-        command_help["save"] = "Save the database to a file. Usage: save FILENAME";
-        command_help["load"] = "Load the database from a file. Usage: load FILENAME";
+        command_help["save"] = "Save the database to a file, lz4 compresses it. Usage: save FILENAME [lz4]";
+        command_help["load"] = "Load the database from a file or checkpoint manifest. Usage: load FILENAME";
+        command_help["checkpoint"] = "Write the tables changed since the last checkpoint next to a manifest. Usage: checkpoint MANIFEST [lz4]";
+        command_help["stats"] = "Show engine counters: rows scanned and returned, transactions, lock waits, save and load times";
     }
 
     void run() {
@@ -178,9 +345,74 @@ public:
         }
     }
 
-    void processCommand(const std::string& input) {
+    // Run a script non-interactively in one transaction, committed at the end
+    // if every statement succeeded and rolled back at the first failure.
+    // Reports the statement and row throughput.
+    bool runBatch(std::istream& in) {
+        auto start = std::chrono::steady_clock::now();
+        batch_rows = 0;
+        batch_failed_lines.clear();
+        prepared_insert = PreparedInsert();
+        current_transaction = db.beginTransaction();
+        
+        std::string line;
+        size_t line_number = 0;
+        size_t statements = 0;
+        bool success = true;
+        while (success && is_running && std::getline(in, line)) {
+            line_number++;
+            auto tokens = splitCommand(line);
+            if (tokens.empty()) {
+                continue;
+            }
+            statements++;
+            
+            try {
+                if (tokens[0] == "insert") {
+                    success = queueInsert(tokens, line_number);
+                    continue;
+                }
+                // Anything else sees the inserts before it and starts a new prepared insert
+                bool flushed = flushInserts();
+                prepared_insert.table_name.clear();
+                if (!flushed) {
+                    success = false;
+                } else if (tokens[0] == "begin" || tokens[0] == "commit" || tokens[0] == "rollback") {
+                    std::cout << "The batch runs in one transaction, '" << tokens[0] << "' is not allowed"
+                              << std::endl;
+                    success = false;
+                } else {
+                    success = processCommand(line);
+                }
+            } catch (const std::exception& e) {
+                std::cerr << "Error: " << e.what() << std::endl;
+                success = false;
+            }
+        }
+        success = success && flushInserts();
+        
+        auto tx = std::move(current_transaction);
+        if (!success) {
+            tx->rollback();
+            // A failed flush names the inserts it applied, anything else the line the batch stopped at
+            if (batch_failed_lines.empty()) {
+                batch_failed_lines = "line " + std::to_string(line_number);
+            }
+            std::cout << "Batch rolled back, " << batch_failed_lines << " failed" << std::endl;
+        } else if (!tx->commit()) {
+            std::cout << "Failed to commit batch: " << tx->status().toString() << std::endl;
+            success = false;
+        }
+        
+        std::cout << (success ? "Batch committed: " : "Batch: ") << statements << " statement(s), " << batch_rows
+                  << " row(s) inserted" << throughput(statements, start, "statements") << std::endl;
+        return success;
+    }
+
+    // Run one statement, false if it failed
+    bool processCommand(const std::string& input) {
         auto tokens = splitCommand(input);
-        if (tokens.empty()) return;
+        if (tokens.empty()) return true;
         
         std::string cmd = tokens[0];
         auto it = command_handlers.find(cmd);
@@ -190,15 +422,15 @@ public:
             tokens.erase(tokens.begin());
             
             // Call the handler
-            (this->*(it->second))(tokens);
-        } else {
-            std::cout << "Unknown command: " << cmd << std::endl;
-            std::cout << "Type 'help' for a list of commands" << std::endl;
+            return (this->*(it->second))(tokens);
         }
+        std::cout << "Unknown command: " << cmd << std::endl;
+        std::cout << "Type 'help' for a list of commands" << std::endl;
+        return false;
     }
 
     // Command handler implementations
-    void handleHelp(const std::vector<std::string>& args) {
+    bool handleHelp(const std::vector<std::string>& args) {
         if (args.empty()) {
             std::cout << "Available commands:" << std::endl;
             for (const auto& [cmd, help] : command_help) {
@@ -212,17 +444,19 @@ public:
                 std::cout << "No help available for '" << args[0] << "'" << std::endl;
             }
         }
+        return true;
     }
 
-    void handleExit(const std::vector<std::string>&) {
+    bool handleExit(const std::vector<std::string>&) {
         is_running = false;
         std::cout << "Exiting LocalDB CLI" << std::endl;
+        return true;
     }
 
-    void handleCreateTable(const std::vector<std::string>& args) {
+    bool handleCreateTable(const std::vector<std::string>& args) {
         if (args.size() < 2) {
             std::cout << "Usage: create_table TABLE_NAME COL1:TYPE:PK:NN:UQ [COL2:TYPE:PK:NN:UQ ...]" << std::endl;
-            return;
+            return false;
         }
         
         std::string table_name = args[0];
@@ -259,13 +493,15 @@ public:
             std::cout << "Table '" << table_name << "' created successfully" << std::endl;
         } else {
             std::cout << "Failed to create table '" << table_name << "'" << std::endl;
+            return false;
         }
+        return true;
     }
 
-    void handleDropTable(const std::vector<std::string>& args) {
+    bool handleDropTable(const std::vector<std::string>& args) {
         if (args.size() != 1) {
             std::cout << "Usage: drop_table TABLE_NAME" << std::endl;
-            return;
+            return false;
         }
         
         std::string table_name = args[0];
@@ -275,27 +511,30 @@ public:
             std::cout << "Table '" << table_name << "' dropped successfully" << std::endl;
         } else {
             std::cout << "Failed to drop table '" << table_name << "'" << std::endl;
+            return false;
         }
+        return true;
     }
 
-    void handleListTables(const std::vector<std::string>&) {
+    bool handleListTables(const std::vector<std::string>&) {
         auto tables = db.getTableNames();
         
         if (tables.empty()) {
             std::cout << "No tables in database" << std::endl;
-            return;
+            return true;
         }
         
         std::cout << "Tables in database:" << std::endl;
         for (const auto& table : tables) {
             std::cout << "  " << table << std::endl;
         }
+        return true;
     }
 
-    void handleDescribeTable(const std::vector<std::string>& args) {
+    bool handleDescribeTable(const std::vector<std::string>& args) {
         if (args.size() != 1) {
             std::cout << "Usage: describe_table TABLE_NAME" << std::endl;
-            return;
+            return false;
         }
         
         std::string table_name = args[0];
@@ -303,7 +542,7 @@ public:
         
         if (!table) {
             std::cout << "Table '" << table_name << "' does not exist" << std::endl;
-            return;
+            return false;
         }
         
         const auto& columns = table->getColumns();
@@ -327,12 +566,13 @@ public:
                       << (col.not_null ? "Yes" : "No") << " | "
                       << (col.unique ? "Yes" : "No") << std::endl;
         }
+        return true;
     }
 
-    void handleInsert(const std::vector<std::string>& args) {
+    bool handleInsert(const std::vector<std::string>& args) {
         if (args.size() < 2) {
             std::cout << "Usage: insert TABLE_NAME VAL1 VAL2 ..." << std::endl;
-            return;
+            return false;
         }
         
         std::string table_name = args[0];
@@ -340,49 +580,30 @@ public:
         
         if (!table) {
             std::cout << "Table '" << table_name << "' does not exist" << std::endl;
-            return;
+            return false;
         }
         
-        const auto& columns = table->getColumns();
-        
-        if (args.size() - 1 != columns.size()) {
-            std::cout << "Error: Expected " << columns.size() << " values, got " << (args.size() - 1) << std::endl;
-            return;
-        }
-        
-        localdb::Row row;
-        
         // Parse values based on column types
-        for (size_t i = 0; i < columns.size(); ++i) {
-            try {
-                row.push_back(parseValue(args[i + 1], columns[i].type));
-            } catch (const std::exception& e) {
-                std::cout << "Error parsing value for column '" << columns[i].name << "': " << e.what() << std::endl;
-                return;
-            }
+        localdb::Row row;
+        if (!parseRow(args, 1, table->getColumns(), row)) {
+            return false;
         }
         
         // Insert the row
-        bool success;
-        if (current_transaction) {
-            success = current_transaction->insert(table_name, row);
-        } else {
-            auto tx = db.beginTransaction();
-            success = tx->insert(table_name, row);
-            tx->commit();
-        }
-        
-        if (success) {
+        auto tx = statementTransaction();
+        if (finishStatement(tx, tx->insert(table_name, row))) {
             std::cout << "Row inserted successfully" << std::endl;
         } else {
-            std::cout << "Failed to insert row" << std::endl;
+            std::cout << "Failed to insert row: " << tx->status().toString() << std::endl;
+            return false;
         }
+        return true;
     }
 
-    void handleSelect(const std::vector<std::string>& args) {
+    bool handleSelect(const std::vector<std::string>& args) {
         if (args.empty()) {
-            std::cout << "Usage: select TABLE_NAME [WHERE COL_INDEX OPERATOR VALUE]" << std::endl;
-            return;
+            std::cout << "Usage: select TABLE_NAME [WHERE CONDITION] [ORDER BY COL [ASC|DESC], ...] [LIMIT N [OFFSET M]]" << std::endl;
+            return false;
         }
         
         std::string table_name = args[0];
@@ -390,74 +611,82 @@ public:
         
         if (!table) {
             std::cout << "Table '" << table_name << "' does not exist" << std::endl;
-            return;
+            return false;
         }
         
         const auto& columns = table->getColumns();
         
+        // Split the arguments into the WHERE condition, ORDER BY keys and LIMIT
+        size_t where = args.size();
+        size_t order = args.size();
+        size_t limit = args.size();
+        for (size_t i = 1; i < args.size(); ++i) {
+            if (args[i] == "WHERE" && where == args.size()) {
+                where = i;
+            } else if (args[i] == "ORDER" && i + 1 < args.size() && args[i + 1] == "BY") {
+                order = i;
+            } else if (args[i] == "LIMIT") {
+                limit = i;
+            }
+        }
+        
         // Parse where clause if present
-        bool has_where = args.size() > 1 && args[1] == "WHERE";
-        int col_index = -1;
-        std::string op;
-        std::string value_str;
+        // An empty filter selects every row
+        localdb::Expression filter;
+        size_t where_end = std::min(order, limit);
+        // A WHERE without a condition is rejected rather than selecting every row
+        if (where < where_end && where + 1 == where_end) {
+            std::cout << "Usage: select TABLE_NAME [WHERE CONDITION] [ORDER BY COL [ASC|DESC], ...] [LIMIT N [OFFSET M]]" << std::endl;
+            return false;
+        }
+        if (where + 1 < where_end && !parseFilter(args, where + 1, where_end, columns, filter)) {
+            return false;
+        }
         
-        if (has_where && args.size() >= 5) {
-            try {
-                col_index = std::stoi(args[2]);
-                op = args[3];
-                value_str = args[4];
-                
-                if (col_index < 0 || col_index >= static_cast<int>(columns.size())) {
-                    std::cout << "Invalid column index: " << col_index << std::endl;
-                    return;
+        std::vector<localdb::OrderBy> order_by;
+        if (order < args.size()) {
+            std::string text;
+            for (size_t i = order + 2; i < std::max(limit, order + 2) && i < args.size(); ++i) {
+                text += args[i] + " ";
+            }
+            if (!localdb::OrderBy::parse(text, order_by)) {
+                std::cout << "Invalid ORDER BY clause: " << text << std::endl;
+                return false;
+            }
+            for (const auto& key : order_by) {
+                if (std::none_of(columns.begin(), columns.end(),
+                                 [&key](const localdb::Column& col) { return col.name == key.column; })) {
+                    std::cout << "Unknown column in ORDER BY: " << key.column << std::endl;
+                    return false;
                 }
-            } catch (const std::exception& e) {
-                std::cout << "Error parsing WHERE clause: " << e.what() << std::endl;
-                return;
             }
         }
         
-        // Create predicate function
-        auto predicate = [&](const localdb::Row& row) -> bool {
-            if (!has_where) return true;
-            
-            const auto& col_val = row[col_index];
-            const auto& col_type = columns[col_index].type;
-            
-            try {
-                if (op == "=") {
-                    return col_val == parseValue(value_str, col_type);
-                } else if (op == "<") {
-                    return col_val < parseValue(value_str, col_type);
-                } else if (op == ">") {
-                    // Use < in reverse
-                    return parseValue(value_str, col_type) < col_val;
-                } else if (op == "!=") {
-                    return col_val != parseValue(value_str, col_type);
-                } else {
-                    std::cout << "Unsupported operator: " << op << std::endl;
-                    return false;
-                }
-            } catch (const std::exception& e) {
-                std::cout << "Error evaluating predicate: " << e.what() << std::endl;
+        size_t max_rows = localdb::Table::kNoLimit;
+        size_t skip = 0;
+        if (limit < args.size()) {
+            bool valid = limit + 2 == args.size() || (limit + 4 == args.size() && args[limit + 2] == "OFFSET");
+            if (!valid || !parseCount(args[limit + 1], max_rows) ||
+                (limit + 4 == args.size() && !parseCount(args[limit + 3], skip))) {
+                std::cout << "Invalid LIMIT clause, expected LIMIT N [OFFSET M]" << std::endl;
                 return false;
             }
-        };
+        }
+        bool ordered = !order_by.empty() || limit < args.size();
         
-        // Execute the query
-        std::vector<localdb::Row> results;
-        if (current_transaction) {
-            results = current_transaction->select(table_name, predicate);
-        } else {
-            auto tx = db.beginTransaction();
-            results = tx->select(table_name, predicate);
-            tx->commit();
+        // Execute the query; no rows and a failure look alike until the status says
+        auto tx = statementTransaction();
+        std::vector<localdb::Row> results = ordered ? tx->select(table_name, filter, order_by, max_rows, skip)
+                                                    : tx->select(table_name, filter);
+        if (!finishStatement(tx, tx->status().ok())) {
+            std::cout << "Query failed: " << tx->status().toString() << std::endl;
+            return false;
         }
         
         // Display results
         if (results.empty()) {
             std::cout << "No rows found" << std::endl;
-            return;
+            return true;
         }
         
         // Display column headers
@@ -469,17 +698,13 @@ public:
         }
         
         std::cout << results.size() << " row(s) returned" << std::endl;
+        return true;
     }
 
-    void handleUpdate(const std::vector<std::string>&) {
-        std::cout << "Update operation not fully implemented yet." << std::endl;
-        // TODO: Implement update
-    }
-
-    void handleDelete(const std::vector<std::string>& args) {
-        if (args.size() < 4 || args[1] != "WHERE") {
-            std::cout << "Usage: delete TABLE_NAME WHERE COL_INDEX OPERATOR VALUE" << std::endl;
-            return;
+    bool handleAggregate(const std::vector<std::string>& args) {
+        if (args.size() < 2) {
+            std::cout << "Usage: aggregate TABLE_NAME FUNC(COL) [FUNC(COL) ...] [WHERE CONDITION] [GROUP BY COL ...]" << std::endl;
+            return false;
         }
         
         std::string table_name = args[0];
@@ -487,116 +712,330 @@ public:
         
         if (!table) {
             std::cout << "Table '" << table_name << "' does not exist" << std::endl;
-            return;
+            return false;
         }
         
         const auto& columns = table->getColumns();
         
-        // Parse where clause
-        int col_index;
-        std::string op;
-        std::string value_str;
+        // Split the arguments into aggregates, the WHERE condition and GROUP BY columns
+        size_t where = args.size();
+        size_t group = args.size();
+        for (size_t i = 1; i < args.size(); ++i) {
+            if (args[i] == "WHERE" && where == args.size()) {
+                where = i;
+            } else if (args[i] == "GROUP" && i + 1 < args.size() && args[i + 1] == "BY") {
+                group = i;
+            }
+        }
         
-        try {
-            col_index = std::stoi(args[2]);
-            op = args[3];
-            value_str = args[4];
-            
-            if (col_index < 0 || col_index >= static_cast<int>(columns.size())) {
-                std::cout << "Invalid column index: " << col_index << std::endl;
-                return;
+        std::vector<localdb::Aggregate> aggregates;
+        std::vector<localdb::Column> result_columns;
+        for (size_t i = 1; i < std::min(where, group); ++i) {
+            std::string text = args[i];
+            if (text.back() == ',') text.pop_back();
+            localdb::Aggregate aggregate;
+            if (!localdb::Aggregate::parse(text, aggregate)) {
+                std::cout << "Invalid aggregate: " << args[i] << std::endl;
+                return false;
             }
-        } catch (const std::exception& e) {
-            std::cout << "Error parsing WHERE clause: " << e.what() << std::endl;
-            return;
+            aggregates.push_back(aggregate);
+            result_columns.push_back({text, localdb::Column::INT, false, false, false});
+        }
+        if (aggregates.empty()) {
+            std::cout << "No aggregate given" << std::endl;
+            return false;
         }
         
-        // Create predicate function
-        auto predicate = [&](const localdb::Row& row) -> bool {
-            const auto& col_val = row[col_index];
-            const auto& col_type = columns[col_index].type;
-            
+        localdb::Expression filter;
+        if (where < group && !parseFilter(args, where + 1, group, columns, filter)) {
+            return false;
+        }
+        
+        std::vector<std::string> group_by;
+        for (size_t i = group + 2; i < args.size(); ++i) {
+            std::istringstream names(args[i]);
+            std::string name;
+            while (std::getline(names, name, ',')) {
+                if (!name.empty()) group_by.push_back(name);
+            }
+        }
+        for (auto it = group_by.rbegin(); it != group_by.rend(); ++it) {
+            result_columns.insert(result_columns.begin(), {*it, localdb::Column::INT, false, false, false});
+        }
+        
+        // Execute the query
+        std::vector<localdb::Row> results;
+        auto tx = statementTransaction();
+        if (!finishStatement(tx, tx->aggregate(table_name, aggregates, group_by, filter, results))) {
+            if (tx->status().code == localdb::Status::INVALID_ARGUMENT) {
+                std::cout << "Failed to aggregate: unknown column or non-numeric SUM/AVG" << std::endl;
+            } else {
+                std::cout << "Failed to aggregate: " << tx->status().toString() << std::endl;
+            }
+            return false;
+        }
+        
+        displayHeader(result_columns);
+        for (const auto& row : results) {
+            displayRow(row, result_columns);
+        }
+        
+        std::cout << results.size() << " group(s) returned" << std::endl;
+        return true;
+    }
+
+    bool handleUpdate(const std::vector<std::string>& args) {
+        size_t where = std::find(args.begin(), args.end(), "WHERE") - args.begin();
+        // A WHERE without a condition is rejected rather than updating every row
+        if (args.size() < 2 || where < 2 || where + 1 == args.size()) {
+            std::cout << "Usage: update TABLE_NAME COL1=VAL1 [COL2=VAL2 ...] [WHERE CONDITION]" << std::endl;
+            return false;
+        }
+        
+        std::string table_name = args[0];
+        localdb::Table* table = db.getTable(table_name);
+        
+        if (!table) {
+            std::cout << "Table '" << table_name << "' does not exist" << std::endl;
+            return false;
+        }
+        
+        const auto& columns = table->getColumns();
+        
+        // Parse the assignments against the column types
+        localdb::ColumnChanges changes;
+        for (size_t i = 1; i < where; ++i) {
+            size_t eq = args[i].find('=');
+            auto col = std::find_if(columns.begin(), columns.end(), [&](const localdb::Column& column) {
+                return eq != std::string::npos && column.name == args[i].substr(0, eq);
+            });
+            if (col == columns.end()) {
+                std::cout << "Invalid assignment, expected COL=VALUE with a column of '" << table_name
+                          << "': " << args[i] << std::endl;
+                return false;
+            }
             try {
-                if (op == "=") {
-                    return col_val == parseValue(value_str, col_type);
-                } else if (op == "<") {
-                    return col_val < parseValue(value_str, col_type);
-                } else if (op == ">") {
-                    return parseValue(value_str, col_type) < col_val;
-                } else if (op == "!=") {
-                    return col_val != parseValue(value_str, col_type);
-                } else {
-                    std::cout << "Unsupported operator: " << op << std::endl;
-                    return false;
-                }
+                changes.emplace_back(col->name, localdb::parseValue(args[i].substr(eq + 1), col->type));
             } catch (const std::exception& e) {
-                std::cout << "Error evaluating predicate: " << e.what() << std::endl;
+                std::cout << "Error parsing value for column '" << col->name << "': " << e.what() << std::endl;
                 return false;
             }
-        };
+        }
         
-        // Execute the delete
-        bool success;
-        if (current_transaction) {
-            success = current_transaction->remove(table_name, predicate);
+        // Without a WHERE condition every row is updated
+        localdb::Expression filter;
+        if (where + 1 < args.size() && !parseFilter(args, where + 1, args.size(), columns, filter)) {
+            return false;
+        }
+        
+        // Execute the update
+        auto tx = statementTransaction();
+        if (finishStatement(tx, tx->updateColumns(table_name, changes, filter))) {
+            std::cout << "Row(s) updated successfully" << std::endl;
+        } else if (tx->status().code == localdb::Status::NO_MATCH) {
+            std::cout << "No rows matched" << std::endl;
         } else {
-            auto tx = db.beginTransaction();
-            success = tx->remove(table_name, predicate);
-            tx->commit();
+            std::cout << "Failed to update row(s): " << tx->status().toString() << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    bool handleDelete(const std::vector<std::string>& args) {
+        if (args.size() < 5 || args[1] != "WHERE") {
+            std::cout << "Usage: delete TABLE_NAME WHERE COL_INDEX OPERATOR VALUE" << std::endl;
+            return false;
         }
         
-        if (success) {
+        std::string table_name = args[0];
+        localdb::Table* table = db.getTable(table_name);
+        
+        if (!table) {
+            std::cout << "Table '" << table_name << "' does not exist" << std::endl;
+            return false;
+        }
+        
+        const auto& columns = table->getColumns();
+        
+        // Parse where clause
+        localdb::ColumnPredicate predicate;
+        if (!parsePredicate(args, columns, predicate)) {
+            return false;
+        }
+        
+        // Execute the delete
+        auto tx = statementTransaction();
+        if (finishStatement(tx, tx->remove(table_name, predicate))) {
             std::cout << "Row(s) deleted successfully" << std::endl;
+        } else if (tx->status().code == localdb::Status::NO_MATCH) {
+            std::cout << "No rows matched" << std::endl;
         } else {
-            std::cout << "Failed to delete row(s)" << std::endl;
+            std::cout << "Failed to delete row(s): " << tx->status().toString() << std::endl;
+            return false;
         }
+        return true;
     }
 
-    void handleBeginTransaction(const std::vector<std::string>&) {
+    bool handleImport(const std::vector<std::string>& args) {
+        if (args.size() < 2 || args.size() > 3 || (args.size() == 3 && args[2] != "csv" && args[2] != "binary")) {
+            std::cout << "Usage: import TABLE_NAME FILENAME [csv|binary]" << std::endl;
+            return false;
+        }
+        
+        std::string table_name = args[0];
+        localdb::Table* table = db.getTable(table_name);
+        
+        if (!table) {
+            std::cout << "Table '" << table_name << "' does not exist" << std::endl;
+            return false;
+        }
+        
+        std::ifstream in(args[1], std::ios::binary);
+        if (!in) {
+            std::cout << "Cannot open '" << args[1] << "'" << std::endl;
+            return false;
+        }
+        
+        // Parsed rows go to the transaction a batch at a time
+        auto start = std::chrono::steady_clock::now();
+        auto tx = statementTransaction();
+        std::vector<localdb::Row> batch;
+        size_t imported = 0;
+        auto flush = [&]() {
+            imported += batch.size();
+            bool success = batch.empty() || tx->insertBatch(table_name, std::move(batch));
+            batch.clear();
+            return success;
+        };
+        auto sink = [&](localdb::Row&& row) {
+            batch.push_back(std::move(row));
+            return batch.size() < kInsertBatch || flush();
+        };
+        
+        const auto& columns = table->getColumns();
+        std::string error;
+        bool parsed = args.size() == 3 && args[2] == "binary" ? localdb::readBinaryRows(in, columns, sink, error)
+                                                              : localdb::readCsvRows(in, columns, sink, error);
+        if (!error.empty()) {
+            std::cout << error << std::endl;
+        }
+        if (!finishStatement(tx, parsed && flush())) {
+            if (!tx->status().ok()) {
+                std::cout << "Failed to import rows: " << tx->status().toString() << std::endl;
+            }
+            return false;
+        }
+        
+        std::cout << "Imported " << imported << " row(s) into '" << table_name << "'"
+                  << throughput(imported, start, "rows") << std::endl;
+        return true;
+    }
+
+    bool handleExport(const std::vector<std::string>& args) {
+        if (args.size() < 2 || args.size() > 3 || (args.size() == 3 && args[2] != "csv" && args[2] != "binary")) {
+            std::cout << "Usage: export TABLE_NAME FILENAME [csv|binary]" << std::endl;
+            return false;
+        }
+        
+        std::string table_name = args[0];
+        localdb::Table* table = db.getTable(table_name);
+        
+        if (!table) {
+            std::cout << "Table '" << table_name << "' does not exist" << std::endl;
+            return false;
+        }
+        
+        std::ofstream out(args[1], std::ios::binary | std::ios::trunc);
+        if (!out) {
+            std::cout << "Cannot open '" << args[1] << "'" << std::endl;
+            return false;
+        }
+        
+        // CSV starts with the column names, floats keep every digit
+        bool binary = args.size() == 3 && args[2] == "binary";
+        const auto& columns = table->getColumns();
+        if (binary) {
+            localdb::writeBinaryHeader(out);
+        } else {
+            out << std::setprecision(std::numeric_limits<double>::max_digits10);
+            localdb::writeCsvHeader(out, columns);
+        }
+        
+        size_t exported = 0;
+        auto tx = statementTransaction();
+        bool scanned = tx->scan(table_name, [](const localdb::Row&) { return true; }, [&](const localdb::Row& row) {
+            if (binary) {
+                localdb::writeBinaryRow(out, row);
+            } else {
+                localdb::writeCsvRow(out, row);
+            }
+            exported++;
+            return true;
+        });
+        out.flush();
+        if (!finishStatement(tx, scanned) || !out) {
+            std::cout << "Failed to export '" << table_name << "' to '" << args[1] << "'";
+            if (!tx->status().ok()) std::cout << ": " << tx->status().toString();
+            std::cout << std::endl;
+            return false;
+        }
+        
+        std::cout << "Exported " << exported << " row(s) from '" << table_name << "' to '" << args[1] << "'"
+                  << std::endl;
+        return true;
+    }
+
+    bool handleBeginTransaction(const std::vector<std::string>&) {
         if (current_transaction) {
             std::cout << "Transaction already in progress. Commit or rollback first." << std::endl;
-            return;
+            return false;
         }
         
         current_transaction = db.beginTransaction();
         std::cout << "Transaction started" << std::endl;
+        return true;
     }
 
-    void handleCommitTransaction(const std::vector<std::string>&) {
+    bool handleCommitTransaction(const std::vector<std::string>&) {
         if (!current_transaction) {
             std::cout << "No transaction in progress" << std::endl;
-            return;
+            return false;
         }
         
-        bool success = current_transaction->commit();
-        current_transaction = nullptr;
-        
-        if (success) {
+        auto tx = std::move(current_transaction);
+        if (tx->commit()) {
             std::cout << "Transaction committed successfully" << std::endl;
         } else {
-            std::cout << "Failed to commit transaction" << std::endl;
+            std::cout << "Failed to commit transaction: " << tx->status().toString() << std::endl;
+            return false;
         }
+        return true;
     }
 
-    void handleRollbackTransaction(const std::vector<std::string>&) {
+    bool handleRollbackTransaction(const std::vector<std::string>&) {
         if (!current_transaction) {
             std::cout << "No transaction in progress" << std::endl;
-            return;
+            return false;
         }
         
         current_transaction->rollback();
         current_transaction = nullptr;
         std::cout << "Transaction rolled back" << std::endl;
+        return true;
     }
 
-    void handleSaveDatabase(const std::vector<std::string>& args) {
-        if (args.empty()) {
-            std::cout << "Usage: save FILENAME" << std::endl;
-            return;
+    bool handleSaveDatabase(const std::vector<std::string>& args) {
+        if (args.empty() || args.size() > 2 || (args.size() == 2 && args[1] != "lz4")) {
+            std::cout << "Usage: save FILENAME [lz4]" << std::endl;
+            return false;
         }
         
         std::string filename = args[0];
-        bool success = db.saveToFile(filename);
+        localdb::SnapshotOptions options;
+        if (args.size() == 2) {
+            options.compression = localdb::SnapshotOptions::COMPRESSION_LZ4;
+        }
+        bool success = db.saveToFile(filename, options);
         
         if (success) {
             current_db_file = filename;
@@ -611,13 +1050,35 @@ public:
             }
         } else {
             std::cout << "Failed to save database to '" << filename << "'" << std::endl;
+            return false;
         }
+        return true;
     }
 
-    void handleLoadDatabase(const std::vector<std::string>& args) {
+    bool handleCheckpoint(const std::vector<std::string>& args) {
+        if (args.empty() || args.size() > 2 || (args.size() == 2 && args[1] != "lz4")) {
+            std::cout << "Usage: checkpoint MANIFEST [lz4]" << std::endl;
+            return false;
+        }
+        
+        localdb::SnapshotOptions options;
+        if (args.size() == 2) {
+            options.compression = localdb::SnapshotOptions::COMPRESSION_LZ4;
+        }
+        if (db.checkpoint(args[0], options)) {
+            current_db_file = args[0];
+            std::cout << "Checkpoint written to '" << args[0] << "'" << std::endl;
+        } else {
+            std::cout << "Failed to write checkpoint '" << args[0] << "'" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    bool handleLoadDatabase(const std::vector<std::string>& args) {
         if (args.empty()) {
             std::cout << "Usage: load FILENAME" << std::endl;
-            return;
+            return false;
         }
         
         std::string filename = args[0];
@@ -625,7 +1086,7 @@ public:
         // Check if file exists
         if (!fs::exists(filename)) {
             std::cout << "File '" << filename << "' does not exist" << std::endl;
-            return;
+            return false;
         }
         
         bool success = db.loadFromFile(filename);
@@ -642,7 +1103,41 @@ public:
             }
         } else {
             std::cout << "Failed to load database from '" << filename << "'" << std::endl;
+            return false;
         }
+        return true;
+    }
+    
+    bool handleStats(const std::vector<std::string>&) {
+        localdb::DatabaseStats stats = db.stats();
+        auto micros = [](std::chrono::nanoseconds ns) { return ns.count() / 1000; };
+        auto timing = [&micros](const char* label, const localdb::DatabaseStats::Histogram& h) {
+            std::cout << "  " << label << ": " << h.count;
+            if (h.count > 0) {
+                std::cout << ", avg " << micros(h.total) / static_cast<int64_t>(h.count) << "us, max "
+                          << micros(h.max) << "us";
+            }
+            std::cout << std::endl;
+        };
+        
+        std::cout << "Scans: " << stats.scans << std::endl;
+        std::cout << "  rows scanned: " << stats.rows_scanned << std::endl;
+        std::cout << "  rows returned: " << stats.rows_returned << std::endl;
+        std::cout << "Transactions:" << std::endl;
+        timing("commits", stats.commit_time);
+        std::cout << "  rollbacks: " << stats.rollbacks << std::endl;
+        std::cout << "  lock timeouts: " << stats.lock_timeouts << std::endl;
+        std::cout << "Table locks: " << stats.locks.acquisitions << " acquisitions" << std::endl;
+        std::cout << "  contended: " << stats.locks.contended << std::endl;
+        std::cout << "  timeouts: " << stats.locks.timeouts << std::endl;
+        std::cout << "  wait time: " << micros(stats.locks.wait_time) << "us, max "
+                  << micros(stats.locks.max_wait) << "us" << std::endl;
+        std::cout << "Persistence:" << std::endl;
+        timing("saves", stats.save_time);
+        std::cout << "  saved bytes: " << stats.saved_bytes << std::endl;
+        timing("loads", stats.load_time);
+        std::cout << "  loaded bytes: " << stats.loaded_bytes << std::endl;
+        return true;
     }
 };
 
@@ -650,18 +1145,33 @@ int main(int argc, char* argv[]) {
     LocalDBCLI cli;
     
     // Handle command-line arguments
-    if (argc > 1) {
-        std::string arg = argv[1];
+    std::string batch_file;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
         if (arg == "--help" || arg == "-h") {
-            std::cout << "Usage: localdb [--load FILENAME]" << std::endl;
+            std::cout << "Usage: localdb [--load FILENAME] [--batch SCRIPT]" << std::endl;
             std::cout << "Options:" << std::endl;
-            std::cout << "  --help, -h     Show this help message" << std::endl;
-            std::cout << "  --load FILE    Load database from FILE" << std::endl;
+            std::cout << "  --help, -h       Show this help message" << std::endl;
+            std::cout << "  --load FILE      Load database from FILE" << std::endl;
+            std::cout << "  --batch SCRIPT   Run the statements of SCRIPT (- for stdin) in one transaction and exit" << std::endl;
             return 0;
-        } else if (arg == "--load" && argc > 2) {
-            std::vector<std::string> load_args = {argv[2]};
-            cli.processCommand("load " + std::string(argv[2]));
+        } else if (arg == "--load" && i + 1 < argc) {
+            cli.processCommand("load " + std::string(argv[++i]));
+        } else if (arg == "--batch" && i + 1 < argc) {
+            batch_file = argv[++i];
+        }
+    }
+    
+    if (!batch_file.empty()) {
+        if (batch_file == "-") {
+            return cli.runBatch(std::cin) ? 0 : 1;
+        }
+        std::ifstream script(batch_file);
+        if (!script) {
+            std::cerr << "Cannot open '" << batch_file << "'" << std::endl;
+            return 1;
         }
+        return cli.runBatch(script) ? 0 : 1;
     }
     
     cli.run();
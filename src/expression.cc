@@ -0,0 +1,414 @@
+#include "expression.h"
+#include <algorithm>
+#include <cctype>
+#include <string_view>
+
+namespace localdb {
+
+Expression Expression::compare(const std::string& column, ColumnPredicate::Op op, const Value& constant) {
+    Expression expr;
+    expr.kind = COMPARE;
+    expr.comparison.column = column;
+    expr.comparison.op = op;
+    expr.comparison.constant = constant;
+    return expr;
+}
+
+Expression Expression::allOf(std::vector<Expression> operands) {
+    Expression expr;
+    expr.kind = AND;
+    expr.operands = std::move(operands);
+    return expr;
+}
+
+Expression Expression::anyOf(std::vector<Expression> operands) {
+    Expression expr;
+    expr.kind = OR;
+    expr.operands = std::move(operands);
+    return expr;
+}
+
+Expression Expression::negate(Expression operand) {
+    Expression expr;
+    expr.kind = NOT;
+    expr.operands.push_back(std::move(operand));
+    return expr;
+}
+
+namespace {
+
+class Parser {
+public:
+    Parser(const std::string& text, const std::vector<Column>& columns) : text_(text), columns_(columns) {}
+
+    bool parse(Expression& out) {
+        next();
+        if (!parseOr(out)) {
+            return false;
+        }
+        return token_.empty() && pos_ >= text_.size();
+    }
+
+private:
+    // Tokens are words, quoted strings, parentheses and comparison operators
+    void next() {
+        while (pos_ < text_.size() && std::isspace(static_cast<unsigned char>(text_[pos_]))) {
+            pos_++;
+        }
+        token_.clear();
+        quoted_ = false;
+        if (pos_ >= text_.size()) {
+            return;
+        }
+
+        char c = text_[pos_];
+        if (c == '(' || c == ')') {
+            token_ = std::string(1, c);
+            pos_++;
+        } else if (c == '\'' || c == '"') {
+            size_t end = text_.find(c, pos_ + 1);
+            if (end == std::string::npos) {
+                failed_ = true;
+                pos_ = text_.size();
+                return;
+            }
+            token_ = text_.substr(pos_ + 1, end - pos_ - 1);
+            quoted_ = true;
+            pos_ = end + 1;
+        } else if (isOperatorChar(c)) {
+            size_t start = pos_;
+            while (pos_ < text_.size() && isOperatorChar(text_[pos_])) {
+                pos_++;
+            }
+            token_ = text_.substr(start, pos_ - start);
+        } else {
+            size_t start = pos_;
+            while (pos_ < text_.size() && !std::isspace(static_cast<unsigned char>(text_[pos_])) &&
+                   text_[pos_] != '(' && text_[pos_] != ')' && !isOperatorChar(text_[pos_])) {
+                pos_++;
+            }
+            token_ = text_.substr(start, pos_ - start);
+        }
+    }
+
+    static bool isOperatorChar(char c) { return c == '=' || c == '!' || c == '<' || c == '>'; }
+
+    bool isKeyword(const char* keyword) const {
+        if (quoted_ || token_.size() != std::char_traits<char>::length(keyword)) {
+            return false;
+        }
+        for (size_t i = 0; i < token_.size(); i++) {
+            if (std::toupper(static_cast<unsigned char>(token_[i])) != keyword[i]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool parseOr(Expression& out) {
+        std::vector<Expression> operands(1);
+        if (!parseAnd(operands.back())) {
+            return false;
+        }
+        while (isKeyword("OR")) {
+            next();
+            operands.emplace_back();
+            if (!parseAnd(operands.back())) {
+                return false;
+            }
+        }
+        out = operands.size() == 1 ? std::move(operands[0]) : Expression::anyOf(std::move(operands));
+        return true;
+    }
+
+    bool parseAnd(Expression& out) {
+        std::vector<Expression> operands(1);
+        if (!parseUnary(operands.back())) {
+            return false;
+        }
+        while (isKeyword("AND")) {
+            next();
+            operands.emplace_back();
+            if (!parseUnary(operands.back())) {
+                return false;
+            }
+        }
+        out = operands.size() == 1 ? std::move(operands[0]) : Expression::allOf(std::move(operands));
+        return true;
+    }
+
+    bool parseUnary(Expression& out) {
+        if (failed_ || token_.empty()) {
+            return false;
+        }
+        if (isKeyword("NOT")) {
+            next();
+            Expression operand;
+            if (!parseUnary(operand)) {
+                return false;
+            }
+            out = Expression::negate(std::move(operand));
+            return true;
+        }
+        if (token_ == "(" && !quoted_) {
+            next();
+            if (!parseOr(out) || token_ != ")" || quoted_) {
+                return false;
+            }
+            next();
+            return true;
+        }
+        return parseComparison(out);
+    }
+
+    bool parseComparison(Expression& out) {
+        int column = findColumn(token_);
+        if (column < 0) {
+            return false;
+        }
+        next();
+
+        ColumnPredicate::Op op;
+        if (quoted_ || !ColumnPredicate::parseOp(token_, op)) {
+            return false;
+        }
+        next();
+
+        Value constant;
+        if (failed_ || (token_.empty() && !quoted_) || !parseConstant(token_, columns_[column].type, constant)) {
+            return false;
+        }
+        next();
+
+        out = Expression::compare(columns_[column].name, op, constant);
+        return true;
+    }
+
+    // A column name, or its index as the CLI has always accepted
+    int findColumn(const std::string& name) const {
+        if (quoted_) {
+            return -1;
+        }
+        for (size_t i = 0; i < columns_.size(); i++) {
+            if (columns_[i].name == name) {
+                return static_cast<int>(i);
+            }
+        }
+        if (!name.empty() && std::all_of(name.begin(), name.end(), [](char c) { return std::isdigit(static_cast<unsigned char>(c)); })) {
+            // Accumulated by hand, stopping once past the last column, so a
+            // long run of digits cannot overflow
+            size_t index = 0;
+            for (char c : name) {
+                index = index * 10 + static_cast<size_t>(c - '0');
+                if (index >= columns_.size()) {
+                    return -1;
+                }
+            }
+            return static_cast<int>(index);
+        }
+        return -1;
+    }
+
+    static bool parseConstant(const std::string& text, Column::Type type, Value& out) {
+        try {
+            size_t used = 0;
+            switch (type) {
+                case Column::INT:
+                    out = Value(std::stoi(text, &used));
+                    return used == text.size();
+                case Column::FLOAT:
+                    out = Value(std::stod(text, &used));
+                    return used == text.size();
+                case Column::TEXT:
+                    out = Value(text);
+                    return true;
+                case Column::BLOB:
+                    out = Value(std::vector<uint8_t>(text.begin(), text.end()));
+                    return true;
+            }
+        } catch (const std::exception&) {
+            // Not a number, or out of range
+        }
+        return false;
+    }
+
+    const std::string& text_;
+    const std::vector<Column>& columns_;
+    size_t pos_ = 0;
+    std::string token_;
+    bool quoted_ = false;
+    bool failed_ = false;
+};
+
+} // namespace
+
+bool Expression::parse(const std::string& text, const std::vector<Column>& columns, Expression& out) {
+    Expression parsed;
+    if (!Parser(text, columns).parse(parsed)) {
+        return false;
+    }
+    out = std::move(parsed);
+    return true;
+}
+
+namespace expression {
+
+namespace {
+
+using Op = ColumnPredicate::Op;
+
+template <Op kOp, typename T>
+inline bool holds(const T& a, const T& b) {
+    switch (kOp) {
+        case ColumnPredicate::EQ: return a == b;
+        case ColumnPredicate::NE: return a != b;
+        case ColumnPredicate::LT: return a < b;
+        case ColumnPredicate::LE: return a <= b;
+        case ColumnPredicate::GT: return a > b;
+        case ColumnPredicate::GE: return a >= b;
+    }
+    return false;
+}
+
+// The fast path handles cells of the constant's own type, anything else
+// (numeric mixes, NULL, mismatches) goes through ColumnPredicate::matches
+template <Op kOp>
+Evaluator compileComparison(size_t column, const ColumnPredicate& predicate) {
+    const Value& constant = predicate.constant;
+    switch (constant.type) {
+        case Value::INT: {
+            int value = constant.asInt();
+            return [column, value, predicate](const Row& row) {
+                const Value& cell = row[column];
+                return cell.type == Value::INT ? holds<kOp>(cell.asInt(), value) : predicate.matches(cell);
+            };
+        }
+        case Value::FLOAT: {
+            double value = constant.asFloat();
+            return [column, value, predicate](const Row& row) {
+                const Value& cell = row[column];
+                return cell.type == Value::FLOAT ? holds<kOp>(cell.asFloat(), value) : predicate.matches(cell);
+            };
+        }
+        case Value::TEXT:
+        case Value::BLOB: {
+            Value::Type type = constant.type;
+            std::string bytes(type == Value::TEXT ? constant.textView() : constant.blobView());
+            return [column, type, bytes](const Row& row) {
+                const Value& cell = row[column];
+                if (cell.type != type) {
+                    return false;
+                }
+                std::string_view view = type == Value::TEXT ? cell.textView() : cell.blobView();
+                return holds<kOp>(view, std::string_view(bytes));
+            };
+        }
+        case Value::NULL_TYPE:
+            break;
+    }
+
+    // Nothing compares to NULL
+    return [](const Row&) { return false; };
+}
+
+// Rough evaluation cost, used to run cheap operands of AND and OR first
+int cost(const Expression& filter) {
+    switch (filter.kind) {
+        case Expression::COMPARE: {
+            Value::Type type = filter.comparison.constant.type;
+            return type == Value::TEXT || type == Value::BLOB ? 2 : 1;
+        }
+        case Expression::NOT:
+            return filter.operands.empty() ? 1 : cost(filter.operands[0]);
+        case Expression::AND:
+        case Expression::OR: {
+            int total = 1;
+            for (const auto& operand : filter.operands) {
+                total += cost(operand);
+            }
+            return total;
+        }
+    }
+    return 1;
+}
+
+bool compileNode(const Expression& filter, const std::vector<Column>& columns, Evaluator& out) {
+    switch (filter.kind) {
+        case Expression::COMPARE: {
+            const ColumnPredicate& predicate = filter.comparison;
+            auto it = std::find_if(columns.begin(), columns.end(),
+                                   [&predicate](const Column& column) { return column.name == predicate.column; });
+            if (it == columns.end()) {
+                return false;
+            }
+            size_t column = static_cast<size_t>(it - columns.begin());
+            switch (predicate.op) {
+                case ColumnPredicate::EQ: out = compileComparison<ColumnPredicate::EQ>(column, predicate); break;
+                case ColumnPredicate::NE: out = compileComparison<ColumnPredicate::NE>(column, predicate); break;
+                case ColumnPredicate::LT: out = compileComparison<ColumnPredicate::LT>(column, predicate); break;
+                case ColumnPredicate::LE: out = compileComparison<ColumnPredicate::LE>(column, predicate); break;
+                case ColumnPredicate::GT: out = compileComparison<ColumnPredicate::GT>(column, predicate); break;
+                case ColumnPredicate::GE: out = compileComparison<ColumnPredicate::GE>(column, predicate); break;
+            }
+            return true;
+        }
+        case Expression::NOT: {
+            Evaluator operand;
+            if (filter.operands.size() != 1 || !compileNode(filter.operands[0], columns, operand)) {
+                return false;
+            }
+            out = [operand](const Row& row) { return !operand(row); };
+            return true;
+        }
+        case Expression::AND:
+        case Expression::OR:
+            break;
+    }
+
+    std::vector<const Expression*> order;
+    for (const auto& operand : filter.operands) {
+        order.push_back(&operand);
+    }
+    std::stable_sort(order.begin(), order.end(),
+                     [](const Expression* a, const Expression* b) { return cost(*a) < cost(*b); });
+
+    std::vector<Evaluator> operands(order.size());
+    for (size_t i = 0; i < order.size(); i++) {
+        if (!compileNode(*order[i], columns, operands[i])) {
+            return false;
+        }
+    }
+
+    bool any = filter.kind == Expression::OR;
+    if (operands.size() == 1) {
+        out = std::move(operands[0]);
+    } else if (any) {
+        out = [operands](const Row& row) {
+            return std::any_of(operands.begin(), operands.end(), [&row](const Evaluator& e) { return e(row); });
+        };
+    } else {
+        out = [operands](const Row& row) {
+            return std::all_of(operands.begin(), operands.end(), [&row](const Evaluator& e) { return e(row); });
+        };
+    }
+    return true;
+}
+
+} // namespace
+
+bool compile(const Expression& filter, const std::vector<Column>& columns, Evaluator& out) {
+    return compileNode(filter, columns, out);
+}
+
+void conjuncts(const Expression& filter, std::vector<const ColumnPredicate*>& out) {
+    if (filter.kind == Expression::COMPARE) {
+        out.push_back(&filter.comparison);
+    } else if (filter.kind == Expression::AND) {
+        for (const auto& operand : filter.operands) {
+            conjuncts(operand, out);
+        }
+    }
+}
+
+} // namespace expression
+} // namespace localdb
@@ -0,0 +1,26 @@
+#ifndef LOCALDB_EXPRESSION_H
+#define LOCALDB_EXPRESSION_H
+
+#include <functional>
+#include <vector>
+#include "localdb.h"
+
+namespace localdb {
+namespace expression {
+
+// Row evaluator with column names resolved to indexes and every comparison
+// specialized for its operator and constant type
+using Evaluator = std::function<bool(const Row&)>;
+
+// Compile a filter once per query. AND and OR operands are reordered so cheap
+// comparisons run first. False if a column is unknown.
+bool compile(const Expression& filter, const std::vector<Column>& columns, Evaluator& out);
+
+// Comparisons that must all hold for the filter to match: the filter itself
+// or the operands of its top-level ANDs. OR and NOT subtrees contribute none.
+void conjuncts(const Expression& filter, std::vector<const ColumnPredicate*>& out);
+
+} // namespace expression
+} // namespace localdb
+
+#endif // LOCALDB_EXPRESSION_H
@@ -0,0 +1,269 @@
+#include "filter_kernels.h"
+#include <algorithm>
+
+// AVX2 kernels are compiled with a target attribute and picked at runtime, so
+// the default build still runs on CPUs without AVX2. NEON is part of the
+// AArch64 baseline and needs no dispatch.
+#if !defined(LOCALDB_NO_SIMD) && defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define LOCALDB_KERNELS_AVX2 1
+#include <immintrin.h>
+#elif !defined(LOCALDB_NO_SIMD) && defined(__aarch64__) && defined(__ARM_NEON)
+#define LOCALDB_KERNELS_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace localdb {
+namespace kernels {
+
+namespace {
+
+using Op = ColumnPredicate::Op;
+
+template <Op kOp, typename T>
+inline bool compare(T a, T b) {
+    switch (kOp) {
+        case ColumnPredicate::EQ: return a == b;
+        case ColumnPredicate::NE: return a != b;
+        case ColumnPredicate::LT: return a < b;
+        case ColumnPredicate::LE: return a <= b;
+        case ColumnPredicate::GT: return a > b;
+        case ColumnPredicate::GE: return a >= b;
+    }
+    return false;
+}
+
+// Portable kernel, also used for the tail that does not fill a 64-bit word
+template <Op kOp, typename T>
+void compareScalar(const T* data, size_t n, T constant, uint64_t* out) {
+    size_t words = (n + 63) / 64;
+    for (size_t w = 0; w < words; w++) {
+        size_t base = w * 64;
+        size_t limit = std::min<size_t>(64, n - base);
+        uint64_t word = 0;
+        for (size_t j = 0; j < limit; j++) {
+            word |= static_cast<uint64_t>(compare<kOp>(data[base + j], constant)) << j;
+        }
+        out[w] = word;
+    }
+}
+
+#if defined(LOCALDB_KERNELS_AVX2)
+
+bool hasAvx2() {
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+}
+
+// 8 lanes per compare, 8 compares per output word. LT/GT map to cmpgt with
+// swapped operands; NE, LE and GE are the complements of EQ, GT and LT.
+template <Op kOp>
+__attribute__((target("avx2")))
+void compareInt32Avx2(const int32_t* data, size_t n, int32_t constant, uint64_t* out) {
+    const __m256i splat = _mm256_set1_epi32(constant);
+    size_t blocks = n / 64;
+
+    for (size_t b = 0; b < blocks; b++) {
+        uint64_t word = 0;
+        for (size_t j = 0; j < 8; j++) {
+            __m256i values = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + b * 64 + j * 8));
+            __m256i mask;
+            if (kOp == ColumnPredicate::EQ || kOp == ColumnPredicate::NE) {
+                mask = _mm256_cmpeq_epi32(values, splat);
+            } else if (kOp == ColumnPredicate::LT || kOp == ColumnPredicate::GE) {
+                mask = _mm256_cmpgt_epi32(splat, values);
+            } else {
+                mask = _mm256_cmpgt_epi32(values, splat);
+            }
+            uint32_t bits = static_cast<uint32_t>(_mm256_movemask_ps(_mm256_castsi256_ps(mask)));
+            word |= static_cast<uint64_t>(bits) << (j * 8);
+        }
+
+        if (kOp == ColumnPredicate::NE || kOp == ColumnPredicate::LE || kOp == ColumnPredicate::GE) {
+            word = ~word;
+        }
+        out[b] = word;
+    }
+
+    compareScalar<kOp>(data + blocks * 64, n - blocks * 64, constant, out + blocks);
+}
+
+// 4 lanes per compare, 16 compares per output word. Ordered predicates keep
+// NaN semantics identical to the scalar operators.
+template <Op kOp>
+__attribute__((target("avx2")))
+void compareDoubleAvx2(const double* data, size_t n, double constant, uint64_t* out) {
+    const __m256d splat = _mm256_set1_pd(constant);
+    size_t blocks = n / 64;
+
+    for (size_t b = 0; b < blocks; b++) {
+        uint64_t word = 0;
+        for (size_t j = 0; j < 16; j++) {
+            __m256d values = _mm256_loadu_pd(data + b * 64 + j * 4);
+            __m256d mask;
+            switch (kOp) {
+                case ColumnPredicate::EQ: mask = _mm256_cmp_pd(values, splat, _CMP_EQ_OQ); break;
+                case ColumnPredicate::NE: mask = _mm256_cmp_pd(values, splat, _CMP_NEQ_UQ); break;
+                case ColumnPredicate::LT: mask = _mm256_cmp_pd(values, splat, _CMP_LT_OQ); break;
+                case ColumnPredicate::LE: mask = _mm256_cmp_pd(values, splat, _CMP_LE_OQ); break;
+                case ColumnPredicate::GT: mask = _mm256_cmp_pd(values, splat, _CMP_GT_OQ); break;
+                case ColumnPredicate::GE: mask = _mm256_cmp_pd(values, splat, _CMP_GE_OQ); break;
+            }
+            uint32_t bits = static_cast<uint32_t>(_mm256_movemask_pd(mask));
+            word |= static_cast<uint64_t>(bits) << (j * 4);
+        }
+        out[b] = word;
+    }
+
+    compareScalar<kOp>(data + blocks * 64, n - blocks * 64, constant, out + blocks);
+}
+
+#elif defined(LOCALDB_KERNELS_NEON)
+
+template <Op kOp>
+inline uint32x4_t compareLanes(int32x4_t values, int32x4_t splat) {
+    switch (kOp) {
+        case ColumnPredicate::EQ: return vceqq_s32(values, splat);
+        case ColumnPredicate::NE: return vmvnq_u32(vceqq_s32(values, splat));
+        case ColumnPredicate::LT: return vcltq_s32(values, splat);
+        case ColumnPredicate::LE: return vcleq_s32(values, splat);
+        case ColumnPredicate::GT: return vcgtq_s32(values, splat);
+        case ColumnPredicate::GE: return vcgeq_s32(values, splat);
+    }
+    return vdupq_n_u32(0);
+}
+
+template <Op kOp>
+inline uint64x2_t compareLanes(float64x2_t values, float64x2_t splat) {
+    switch (kOp) {
+        case ColumnPredicate::EQ: return vceqq_f64(values, splat);
+        case ColumnPredicate::NE:
+            return vreinterpretq_u64_u32(vmvnq_u32(vreinterpretq_u32_u64(vceqq_f64(values, splat))));
+        case ColumnPredicate::LT: return vcltq_f64(values, splat);
+        case ColumnPredicate::LE: return vcleq_f64(values, splat);
+        case ColumnPredicate::GT: return vcgtq_f64(values, splat);
+        case ColumnPredicate::GE: return vcgeq_f64(values, splat);
+    }
+    return vdupq_n_u64(0);
+}
+
+// 4 lanes per compare, lane masks are folded into bits by weighting and adding
+template <Op kOp>
+void compareInt32Neon(const int32_t* data, size_t n, int32_t constant, uint64_t* out) {
+    static const uint32_t kLaneBits[4] = {1, 2, 4, 8};
+    const int32x4_t splat = vdupq_n_s32(constant);
+    const uint32x4_t lane_bits = vld1q_u32(kLaneBits);
+    size_t blocks = n / 64;
+
+    for (size_t b = 0; b < blocks; b++) {
+        uint64_t word = 0;
+        for (size_t j = 0; j < 16; j++) {
+            uint32x4_t mask = compareLanes<kOp>(vld1q_s32(data + b * 64 + j * 4), splat);
+            uint64_t bits = vaddvq_u32(vandq_u32(mask, lane_bits));
+            word |= bits << (j * 4);
+        }
+        out[b] = word;
+    }
+
+    compareScalar<kOp>(data + blocks * 64, n - blocks * 64, constant, out + blocks);
+}
+
+template <Op kOp>
+void compareDoubleNeon(const double* data, size_t n, double constant, uint64_t* out) {
+    static const uint64_t kLaneBits[2] = {1, 2};
+    const float64x2_t splat = vdupq_n_f64(constant);
+    const uint64x2_t lane_bits = vld1q_u64(kLaneBits);
+    size_t blocks = n / 64;
+
+    for (size_t b = 0; b < blocks; b++) {
+        uint64_t word = 0;
+        for (size_t j = 0; j < 32; j++) {
+            uint64x2_t mask = compareLanes<kOp>(vld1q_f64(data + b * 64 + j * 2), splat);
+            uint64_t bits = vaddvq_u64(vandq_u64(mask, lane_bits));
+            word |= bits << (j * 2);
+        }
+        out[b] = word;
+    }
+
+    compareScalar<kOp>(data + blocks * 64, n - blocks * 64, constant, out + blocks);
+}
+
+#endif
+
+template <Op kOp>
+void compareInt32Op(const int32_t* data, size_t n, int32_t constant, uint64_t* out) {
+#if defined(LOCALDB_KERNELS_AVX2)
+    if (hasAvx2()) {
+        compareInt32Avx2<kOp>(data, n, constant, out);
+        return;
+    }
+#elif defined(LOCALDB_KERNELS_NEON)
+    compareInt32Neon<kOp>(data, n, constant, out);
+    return;
+#endif
+    compareScalar<kOp>(data, n, constant, out);
+}
+
+template <Op kOp>
+void compareDoubleOp(const double* data, size_t n, double constant, uint64_t* out) {
+#if defined(LOCALDB_KERNELS_AVX2)
+    if (hasAvx2()) {
+        compareDoubleAvx2<kOp>(data, n, constant, out);
+        return;
+    }
+#elif defined(LOCALDB_KERNELS_NEON)
+    compareDoubleNeon<kOp>(data, n, constant, out);
+    return;
+#endif
+    compareScalar<kOp>(data, n, constant, out);
+}
+
+} // namespace
+
+void compareInt32(const int32_t* data, size_t n, ColumnPredicate::Op op, int32_t constant, uint64_t* out) {
+    switch (op) {
+        case ColumnPredicate::EQ: compareInt32Op<ColumnPredicate::EQ>(data, n, constant, out); break;
+        case ColumnPredicate::NE: compareInt32Op<ColumnPredicate::NE>(data, n, constant, out); break;
+        case ColumnPredicate::LT: compareInt32Op<ColumnPredicate::LT>(data, n, constant, out); break;
+        case ColumnPredicate::LE: compareInt32Op<ColumnPredicate::LE>(data, n, constant, out); break;
+        case ColumnPredicate::GT: compareInt32Op<ColumnPredicate::GT>(data, n, constant, out); break;
+        case ColumnPredicate::GE: compareInt32Op<ColumnPredicate::GE>(data, n, constant, out); break;
+    }
+}
+
+void compareDouble(const double* data, size_t n, ColumnPredicate::Op op, double constant, uint64_t* out) {
+    switch (op) {
+        case ColumnPredicate::EQ: compareDoubleOp<ColumnPredicate::EQ>(data, n, constant, out); break;
+        case ColumnPredicate::NE: compareDoubleOp<ColumnPredicate::NE>(data, n, constant, out); break;
+        case ColumnPredicate::LT: compareDoubleOp<ColumnPredicate::LT>(data, n, constant, out); break;
+        case ColumnPredicate::LE: compareDoubleOp<ColumnPredicate::LE>(data, n, constant, out); break;
+        case ColumnPredicate::GT: compareDoubleOp<ColumnPredicate::GT>(data, n, constant, out); break;
+        case ColumnPredicate::GE: compareDoubleOp<ColumnPredicate::GE>(data, n, constant, out); break;
+    }
+}
+
+size_t countBits(const uint64_t* bits, size_t words) {
+    size_t count = 0;
+    for (size_t w = 0; w < words; w++) {
+#if defined(__GNUC__) || defined(__clang__)
+        count += static_cast<size_t>(__builtin_popcountll(bits[w]));
+#else
+        for (uint64_t word = bits[w]; word != 0; word &= word - 1) {
+            count++;
+        }
+#endif
+    }
+    return count;
+}
+
+const char* activeInstructionSet() {
+#if defined(LOCALDB_KERNELS_AVX2)
+    return hasAvx2() ? "avx2" : "scalar";
+#elif defined(LOCALDB_KERNELS_NEON)
+    return "neon";
+#else
+    return "scalar";
+#endif
+}
+
+} // namespace kernels
+} // namespace localdb
@@ -0,0 +1,48 @@
+#ifndef LOCALDB_FILTER_KERNELS_H
+#define LOCALDB_FILTER_KERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+#include "localdb.h"
+
+namespace localdb {
+namespace kernels {
+
+// Compare n values against a constant and write the result as a bitmap:
+// bit i of out is set when data[i] OP constant holds. out must hold
+// (n + 63) / 64 words; bits past n in the last word are cleared.
+void compareInt32(const int32_t* data, size_t n, ColumnPredicate::Op op, int32_t constant, uint64_t* out);
+void compareDouble(const double* data, size_t n, ColumnPredicate::Op op, double constant, uint64_t* out);
+
+// Number of set bits in a bitmap of the given word count
+size_t countBits(const uint64_t* bits, size_t words);
+
+// Instruction set the comparison kernels dispatch to: "avx2", "neon" or "scalar"
+const char* activeInstructionSet();
+
+// Call fn(position) for every set bit in ascending order, stopping when fn returns false
+template <typename Fn>
+inline void forEachSetBit(const uint64_t* bits, size_t words, Fn&& fn) {
+    for (size_t w = 0; w < words; w++) {
+        uint64_t word = bits[w];
+        while (word != 0) {
+#if defined(__GNUC__) || defined(__clang__)
+            size_t bit = static_cast<size_t>(__builtin_ctzll(word));
+#else
+            size_t bit = 0;
+            while (((word >> bit) & 1) == 0) {
+                bit++;
+            }
+#endif
+            if (!fn(w * 64 + bit)) {
+                return;
+            }
+            word &= word - 1;
+        }
+    }
+}
+
+} // namespace kernels
+} // namespace localdb
+
+#endif // LOCALDB_FILTER_KERNELS_H
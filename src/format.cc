@@ -0,0 +1,240 @@
+#include "format.h"
+#include <algorithm>
+#include <cerrno>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace localdb {
+
+namespace {
+
+struct CrcTable {
+    uint32_t entries[256];
+
+    CrcTable() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            entries[i] = c;
+        }
+    }
+};
+
+} // namespace
+
+uint32_t crc32(const void* data, size_t size, uint32_t seed) {
+    static const CrcTable table;
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    uint32_t c = seed ^ 0xFFFFFFFFu;
+    for (size_t i = 0; i < size; i++) {
+        c = table.entries[(c ^ bytes[i]) & 0xFF] ^ (c >> 8);
+    }
+    return c ^ 0xFFFFFFFFu;
+}
+
+namespace {
+
+// Matches are at least 4 bytes and reach back at most 64 KiB. The format
+// requires the last 5 bytes to be literals and the last match to start at
+// least 12 bytes before the end.
+constexpr size_t kLz4MinMatch = 4;
+constexpr size_t kLz4MaxOffset = 65535;
+constexpr size_t kLz4LastLiterals = 5;
+constexpr size_t kLz4MatchLimit = 12;
+constexpr int kLz4HashBits = 12;
+
+uint32_t load32(const char* p) {
+    uint32_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+// Lengths of 15 and more continue in bytes of 255 ended by a smaller one
+void putLz4Length(std::string& out, size_t length) {
+    for (; length >= 255; length -= 255) {
+        out.push_back(static_cast<char>(255));
+    }
+    out.push_back(static_cast<char>(length));
+}
+
+bool getLz4Length(const char* src, size_t size, size_t& pos, size_t& length) {
+    uint8_t byte;
+    do {
+        if (pos >= size) {
+            return false;
+        }
+        byte = static_cast<uint8_t>(src[pos++]);
+        length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+// A sequence is a token, the literals and, except for the last one, a match
+void putLz4Sequence(std::string& out, const char* literals, size_t literal_length,
+                    size_t offset, size_t match_length) {
+    size_t match_code = match_length > 0 ? match_length - kLz4MinMatch : 0;
+    out.push_back(static_cast<char>((std::min<size_t>(literal_length, 15) << 4) |
+                                    std::min<size_t>(match_code, 15)));
+    if (literal_length >= 15) {
+        putLz4Length(out, literal_length - 15);
+    }
+    out.append(literals, literal_length);
+    if (match_length == 0) {
+        return;
+    }
+    out.push_back(static_cast<char>(offset));
+    out.push_back(static_cast<char>(offset >> 8));
+    if (match_code >= 15) {
+        putLz4Length(out, match_code - 15);
+    }
+}
+
+} // namespace
+
+void lz4Compress(const char* src, size_t size, std::string& out) {
+    size_t anchor = 0;
+    if (size > kLz4MatchLimit) {
+        // Last position seen for each hash of 4 bytes
+        std::vector<uint32_t> table(size_t(1) << kLz4HashBits, 0);
+        const size_t match_end = size - kLz4LastLiterals;
+        size_t pos = 0;
+        while (pos + kLz4MatchLimit <= size) {
+            uint32_t sequence = load32(src + pos);
+            uint32_t hash = (sequence * 2654435761u) >> (32 - kLz4HashBits);
+            size_t candidate = table[hash];
+            table[hash] = static_cast<uint32_t>(pos);
+            if (candidate >= pos || pos - candidate > kLz4MaxOffset || load32(src + candidate) != sequence) {
+                // Step faster through data that keeps missing
+                pos += 1 + ((pos - anchor) >> 6);
+                continue;
+            }
+            size_t length = kLz4MinMatch;
+            while (pos + length < match_end && src[candidate + length] == src[pos + length]) {
+                length++;
+            }
+            putLz4Sequence(out, src + anchor, pos - anchor, pos - candidate, length);
+            pos += length;
+            anchor = pos;
+        }
+    }
+    putLz4Sequence(out, src + anchor, size - anchor, 0, 0);
+}
+
+bool lz4Decompress(const char* src, size_t size, char* dst, size_t dst_size) {
+    size_t in = 0;
+    size_t out = 0;
+    while (true) {
+        if (in >= size) {
+            return false;
+        }
+        uint8_t token = static_cast<uint8_t>(src[in++]);
+        size_t literals = token >> 4;
+        if (literals == 15 && !getLz4Length(src, size, in, literals)) {
+            return false;
+        }
+        if (literals > size - in || literals > dst_size - out) {
+            return false;
+        }
+        std::memcpy(dst + out, src + in, literals);
+        in += literals;
+        out += literals;
+        if (in == size) {
+            return out == dst_size;
+        }
+        
+        if (size - in < 2) {
+            return false;
+        }
+        size_t offset = static_cast<uint8_t>(src[in]) | (static_cast<size_t>(static_cast<uint8_t>(src[in + 1])) << 8);
+        in += 2;
+        size_t length = token & 15;
+        if (length == 15 && !getLz4Length(src, size, in, length)) {
+            return false;
+        }
+        length += kLz4MinMatch;
+        if (offset == 0 || offset > out || length > dst_size - out) {
+            return false;
+        }
+        // Matches may overlap their own output, which repeats a short run
+        const char* match = dst + out - offset;
+        if (offset >= length) {
+            std::memcpy(dst + out, match, length);
+        } else {
+            for (size_t i = 0; i < length; i++) {
+                dst[out + i] = match[i];
+            }
+        }
+        out += length;
+    }
+}
+
+std::shared_ptr<MappedFile> MappedFile::open(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return nullptr;
+    }
+
+    struct stat info;
+    if (::fstat(fd, &info) != 0 || info.st_size <= 0) {
+        ::close(fd);
+        return nullptr;
+    }
+
+    // The mapping stays valid after the descriptor is closed
+    size_t size = static_cast<size_t>(info.st_size);
+    void* data = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        return nullptr;
+    }
+
+    return std::shared_ptr<MappedFile>(new MappedFile(static_cast<const char*>(data), size));
+}
+
+MappedFile::~MappedFile() {
+    ::munmap(const_cast<char*>(data_), size_);
+}
+
+bool writeAll(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t written = ::write(fd, data, size);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += written;
+        size -= static_cast<size_t>(written);
+    }
+    return true;
+}
+
+bool syncFile(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = ::fsync(fd) == 0;
+    ::close(fd);
+    return ok;
+}
+
+bool syncDirectoryOf(const std::string& path) {
+    size_t slash = path.find_last_of('/');
+    std::string dir = slash == std::string::npos ? "." : path.substr(0, slash + 1);
+    int fd = ::open(dir.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = ::fsync(fd) == 0;
+    ::close(fd);
+    return ok;
+}
+
+} // namespace localdb
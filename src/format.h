@@ -0,0 +1,204 @@
+#ifndef LOCALDB_FORMAT_H
+#define LOCALDB_FORMAT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace localdb {
+
+// Helpers shared by the on-disk formats. All fixed-width fields are written
+// little-endian regardless of the host byte order.
+
+// CRC-32 (IEEE) of a byte range, seed chains partial computations
+uint32_t crc32(const void* data, size_t size, uint32_t seed = 0);
+
+// LZ4 block format. Compression appends to out and never fails, though the
+// output can be slightly larger than incompressible input. Decompression
+// must produce exactly dst_size bytes and rejects malformed input.
+void lz4Compress(const char* src, size_t size, std::string& out);
+bool lz4Decompress(const char* src, size_t size, char* dst, size_t dst_size);
+
+// Appends fixed-width little-endian fields to a string
+class ByteWriter {
+public:
+    explicit ByteWriter(std::string& out) : out_(out) {}
+
+    void putU8(uint8_t value) { out_.push_back(static_cast<char>(value)); }
+
+    void putU32(uint32_t value) {
+        char bytes[4];
+        for (int i = 0; i < 4; i++) {
+            bytes[i] = static_cast<char>(value >> (8 * i));
+        }
+        out_.append(bytes, sizeof(bytes));
+    }
+
+    void putU64(uint64_t value) {
+        char bytes[8];
+        for (int i = 0; i < 8; i++) {
+            bytes[i] = static_cast<char>(value >> (8 * i));
+        }
+        out_.append(bytes, sizeof(bytes));
+    }
+
+    void putI32(int32_t value) { putU32(static_cast<uint32_t>(value)); }
+
+    void putF64(double value) {
+        uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        putU64(bits);
+    }
+
+    void putBytes(const char* data, size_t size) { out_.append(data, size); }
+
+    // LEB128: seven bits per byte, low bits first
+    void putVarint(uint64_t value) {
+        while (value >= 0x80) {
+            out_.push_back(static_cast<char>(value | 0x80));
+            value >>= 7;
+        }
+        out_.push_back(static_cast<char>(value));
+    }
+
+    // u32 length followed by the bytes
+    void putString(std::string_view str) {
+        putU32(static_cast<uint32_t>(str.size()));
+        out_.append(str.data(), str.size());
+    }
+
+    size_t size() const { return out_.size(); }
+
+private:
+    std::string& out_;
+};
+
+// Bounds-checked reader for data written by ByteWriter. A read past the end
+// fails and leaves the output untouched.
+class ByteReader {
+public:
+    ByteReader(const char* data, size_t size) : data_(data), size_(size) {}
+
+    bool getU8(uint8_t& value) {
+        if (remaining() < 1) {
+            return false;
+        }
+        value = static_cast<uint8_t>(data_[pos_++]);
+        return true;
+    }
+
+    bool getU32(uint32_t& value) {
+        if (remaining() < 4) {
+            return false;
+        }
+        value = 0;
+        for (int i = 0; i < 4; i++) {
+            value |= static_cast<uint32_t>(static_cast<uint8_t>(data_[pos_ + i])) << (8 * i);
+        }
+        pos_ += 4;
+        return true;
+    }
+
+    bool getU64(uint64_t& value) {
+        if (remaining() < 8) {
+            return false;
+        }
+        value = 0;
+        for (int i = 0; i < 8; i++) {
+            value |= static_cast<uint64_t>(static_cast<uint8_t>(data_[pos_ + i])) << (8 * i);
+        }
+        pos_ += 8;
+        return true;
+    }
+
+    bool getI32(int32_t& value) {
+        uint32_t bits;
+        if (!getU32(bits)) {
+            return false;
+        }
+        value = static_cast<int32_t>(bits);
+        return true;
+    }
+
+    bool getF64(double& value) {
+        uint64_t bits;
+        if (!getU64(bits)) {
+            return false;
+        }
+        std::memcpy(&value, &bits, sizeof(value));
+        return true;
+    }
+
+    // View of the next size bytes, valid as long as the underlying buffer
+    bool getBytes(size_t size, const char*& bytes) {
+        if (remaining() < size) {
+            return false;
+        }
+        bytes = data_ + pos_;
+        pos_ += size;
+        return true;
+    }
+
+    bool getVarint(uint64_t& value) {
+        uint64_t result = 0;
+        for (size_t i = pos_, shift = 0; i < size_ && shift < 64; i++, shift += 7) {
+            uint8_t byte = static_cast<uint8_t>(data_[i]);
+            result |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0) {
+                value = result;
+                pos_ = i + 1;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool getString(std::string& str) {
+        uint32_t size;
+        const char* bytes;
+        if (!getU32(size) || !getBytes(size, bytes)) {
+            return false;
+        }
+        str.assign(bytes, size);
+        return true;
+    }
+
+    size_t position() const { return pos_; }
+    size_t remaining() const { return size_ - pos_; }
+
+private:
+    const char* data_;
+    size_t size_;
+    size_t pos_ = 0;
+};
+
+// Read-only mapping of a whole file, pages are read in on first access
+class MappedFile {
+public:
+    static std::shared_ptr<MappedFile> open(const std::string& path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
+
+private:
+    MappedFile(const char* data, size_t size) : data_(data), size_(size) {}
+
+    const char* data_;
+    size_t size_;
+};
+
+// POSIX file helpers
+bool writeAll(int fd, const char* data, size_t size);
+bool syncFile(const std::string& path);
+bool syncDirectoryOf(const std::string& path);
+
+} // namespace localdb
+
+#endif // LOCALDB_FORMAT_H
@@ -2,16 +2,24 @@
 #define LOCALDB_H
 
 #include <string>
+#include <string_view>
 #include <vector>
+#include <cstdint>
+#include <cstring>
+#include <limits>
 #include <map>
 #include <unordered_map>
+#include <unordered_set>
 #include <mutex>
 #include <memory>
+#include <memory_resource>
 #include <functional>
 #include <atomic>
 #include <condition_variable>
+#include <deque>
 #include <shared_mutex>
 #include <fstream>
+#include <future>
 #include <chrono>
 #include <thread>
 
@@ -118,6 +126,11 @@ namespace localdb {
 class Table;
 class Database;
 class Transaction;
+class WriteAheadLog;
+class VersionClock;
+class MappedFile;
+class WorkerPool;
+struct Metrics;
 
 // Column definition
 struct Column {
@@ -133,10 +146,12 @@ struct Column {
     bool unique = false;
 };
 
-// Value type that can store any supported data type
-class Value {
+// Value type that can store any supported data type.
+// Values use a compact 16-byte tagged layout: TEXT and BLOB payloads of up to
+// kInlineCapacity bytes are stored inline, longer ones in a single heap buffer.
+class alignas(8) Value {
 public:
-    enum Type {
+    enum Type : uint8_t {
         NULL_TYPE,
         INT,
         FLOAT,
@@ -144,12 +159,17 @@ public:
         BLOB
     } type;
 
+    // Largest TEXT/BLOB payload stored without a heap allocation
+    static constexpr size_t kInlineCapacity = 14;
+
     // Constructors
-    Value() : type(NULL_TYPE) {}
-    explicit Value(int val) : type(INT), int_val(val) {}
-    explicit Value(double val) : type(FLOAT), float_val(val) {}
-    explicit Value(const std::string& val) : type(TEXT), text_val(new std::string(val)) {}
-    explicit Value(const std::vector<uint8_t>& val) : type(BLOB), blob_val(new std::vector<uint8_t>(val)) {}
+    Value() : type(NULL_TYPE), inline_size_(0) {}
+    explicit Value(int val) : type(INT), inline_size_(0) { store(kScalarOffset, val); }
+    explicit Value(double val) : type(FLOAT), inline_size_(0) { store(kScalarOffset, val); }
+    explicit Value(const std::string& val) : type(TEXT) { assignBytes(val.data(), val.size()); }
+    explicit Value(const std::vector<uint8_t>& val) : type(BLOB) {
+        assignBytes(reinterpret_cast<const char*>(val.data()), val.size());
+    }
 
     // Copy and move constructors
     Value(const Value& other);
@@ -168,72 +188,828 @@ public:
     std::string asText() const;
     std::vector<uint8_t> asBlob() const;
 
+    // Non-owning views of TEXT/BLOB bytes, valid while the Value is alive and unmodified
+    std::string_view textView() const;
+    std::string_view blobView() const;
+
+    // True if the TEXT/BLOB payload lives in a heap buffer
+    bool isHeapAllocated() const { return inline_size_ == kHeapTag; }
+
     // Comparison operators
     bool operator==(const Value& other) const;
     bool operator!=(const Value& other) const;
     bool operator<(const Value& other) const;
 
+    // Hash consistent with operator==
+    size_t hash() const;
+
     // Serialization/Deserialization
     void serialize(std::ostream& out) const;
     static Value deserialize(std::istream& in);
 
+    // Build a TEXT or BLOB value from raw bytes
+    static Value fromBytes(Type type, const char* data, size_t size);
+
 private:
-    union {
-        int int_val;
-        double float_val;
-        std::string* text_val;
-        std::vector<uint8_t>* blob_val;
-    };
+    // Layout after the type tag: inline_size_ at byte 1, payload_ at bytes 2-15.
+    // INT/FLOAT and the heap pointer sit at byte 8 so they stay 8-byte aligned,
+    // the heap length is a 32-bit field at byte 4.
+    static constexpr uint8_t kHeapTag = 0xFF;
+    static constexpr size_t kScalarOffset = 6;
+    static constexpr size_t kHeapSizeOffset = 2;
+    static constexpr size_t kHeapDataOffset = 6;
+
+    uint8_t inline_size_;
+    char payload_[kInlineCapacity];
+
+    template <typename T>
+    T load(size_t offset) const {
+        T val;
+        std::memcpy(&val, payload_ + offset, sizeof(T));
+        return val;
+    }
+
+    template <typename T>
+    void store(size_t offset, T val) {
+        std::memcpy(payload_ + offset, &val, sizeof(T));
+    }
 
+    // TEXT/BLOB payload access
+    const char* bytes() const;
+    size_t byteSize() const;
+    std::string_view byteView() const { return std::string_view(bytes(), byteSize()); }
+
+    // Allocates storage for size bytes (inline or heap) and returns it for filling
+    char* allocateBytes(size_t size);
+    void assignBytes(const char* data, size_t size);
+    void copyFrom(const Value& other);
     void clear();
 };
 
+static_assert(sizeof(Value) == 16, "Value layout must stay compact");
+
+// Hash functor so Value can be used as an unordered container key
+struct ValueHash {
+    size_t operator()(const Value& value) const { return value.hash(); }
+};
+
 // Row representation
 using Row = std::vector<Value>;
 
+// Streaming row callback, return false to stop the scan early
+using RowVisitor = std::function<bool(const Row&)>;
+
+// Streaming join callback with one row of each input, return false to stop
+using JoinVisitor = std::function<bool(const Row& left, const Row& right)>;
+
+// New values for named columns, as applied by updateColumns
+using ColumnChanges = std::vector<std::pair<std::string, Value>>;
+
+// Comparison of one column against a constant, e.g. age >= 30. Unlike an opaque
+// row predicate it can be evaluated with vectorized kernels over typed columns.
+// NULL cells never match; INT and FLOAT compare numerically, TEXT and BLOB
+// byte-wise, and any other type mismatch does not match.
+struct ColumnPredicate {
+    enum Op {
+        EQ,
+        NE,
+        LT,
+        LE,
+        GT,
+        GE
+    };
+    
+    std::string column;
+    Op op = EQ;
+    Value constant;
+    
+    bool matches(const Value& cell) const;
+    
+    // Parse "=", "!=", "<", "<=", ">" or ">=" ("==" and "<>" also accepted), false if unsupported
+    static bool parseOp(const std::string& text, Op& op);
+};
+
+// Filter over named columns: column-constant comparisons combined with AND, OR
+// and NOT. Unlike an opaque row predicate the engine can inspect it, so select
+// plans an index lookup or range scan from the AND-ed comparisons and compiles
+// the whole filter once into an evaluator with resolved columns. Comparisons
+// follow ColumnPredicate; NOT inverts a match, so it also matches NULL cells.
+struct Expression {
+    enum Kind {
+        COMPARE,
+        AND,    // Empty AND matches every row
+        OR,
+        NOT
+    };
+    
+    Kind kind = AND;
+    ColumnPredicate comparison;        // COMPARE
+    std::vector<Expression> operands;  // AND and OR: any number, NOT: one
+    
+    static Expression compare(const std::string& column, ColumnPredicate::Op op, const Value& constant);
+    static Expression allOf(std::vector<Expression> operands);
+    static Expression anyOf(std::vector<Expression> operands);
+    static Expression negate(Expression operand);
+    
+    // Parse e.g. "age >= 30 AND (name = 'Bob' OR NOT id = 3)". Columns are
+    // names or indexes, constants take their column's type and may be quoted.
+    // Keywords are case-insensitive. False on a syntax error, an unknown
+    // column or a constant that does not fit its column.
+    static bool parse(const std::string& text, const std::vector<Column>& columns, Expression& out);
+};
+
+// Aggregate over one column, or over whole rows for COUNT without a column.
+// NULL cells are skipped. COUNT yields an INT, AVG a FLOAT, SUM an INT while
+// every summed cell is an INT and the total fits, a FLOAT otherwise. MIN and
+// MAX keep the cell, comparing INT and FLOAT by value. SUM, AVG, MIN and MAX
+// of no cells are NULL.
+struct Aggregate {
+    enum Function {
+        COUNT,
+        SUM,
+        MIN,
+        MAX,
+        AVG
+    };
+    
+    Function function = COUNT;
+    std::string column;   // Empty counts rows
+    
+    // Parse "COUNT(*)", "SUM(age)", ...; names are case-insensitive. False if
+    // the text is not an aggregate call.
+    static bool parse(const std::string& text, Aggregate& out);
+};
+
+// Sort key of an ordered select. Cells compare with Value::operator<, so they
+// order by type first (NULL, INT, FLOAT, TEXT, BLOB) and then by value.
+struct OrderBy {
+    std::string column;
+    bool descending = false;
+    
+    // Parse "age DESC, name" into sort keys, each a column name optionally
+    // followed by ASC or DESC (case-insensitive). False on a syntax error.
+    static bool parse(const std::string& text, std::vector<OrderBy>& out);
+};
+
+// Outcome of a transaction operation, see Transaction::status. Only ABORTED
+// carries a message, so recording a result costs no allocation otherwise.
+struct Status {
+    enum Code : uint8_t {
+        OK,
+        NOT_FOUND,         // No such table
+        INVALID_ARGUMENT,  // Row of the wrong size or cell type, unknown column or bad filter
+        NO_MATCH,          // An update or remove matched no row
+        CONSTRAINT,        // A committed row holds the PRIMARY KEY or UNIQUE value
+        CONFLICT,          // A running or newer transaction wrote the row or holds the key
+        TIMEOUT,           // A table lock was not granted in time
+        INACTIVE,          // The transaction already committed or rolled back
+        IO_ERROR,          // The write-ahead log could not be written
+        ABORTED            // A predicate or visitor threw, message holds what()
+    };
+    
+    Code code = OK;
+    std::string message;
+    
+    bool ok() const { return code == OK; }
+    
+    // TIMEOUT may pass on a later try, CONFLICT in a new transaction
+    bool retryable() const { return code == TIMEOUT || code == CONFLICT; }
+    
+    // "OK", "TIMEOUT", "ABORTED: predicate failed", ...
+    std::string toString() const;
+    static const char* codeName(Code code);
+};
+
+// Read-only view of one column in contiguous typed arrays. NULL cells are
+// flagged in the null bitmap and hold 0 or an empty byte range.
+struct ColumnView {
+    Column::Type type;
+    size_t size = 0;
+    const int32_t* ints = nullptr;      // INT
+    const double* floats = nullptr;     // FLOAT
+    const uint64_t* offsets = nullptr;  // TEXT/BLOB cell start in bytes
+    const uint32_t* lengths = nullptr;  // TEXT/BLOB cell length
+    const char* bytes = nullptr;        // TEXT/BLOB payload buffer
+    const uint64_t* nulls = nullptr;    // Bit i set when cell i is NULL
+    
+    bool isNull(size_t i) const { return (nulls[i / 64] >> (i % 64)) & 1; }
+    std::string_view bytesAt(size_t i) const { return std::string_view(bytes + offsets[i], lengths[i]); }
+};
+
+// Reader-writer lock that queues waiters and grants them in arrival order: a
+// writer waits for the readers ahead of it, readers arriving behind a queued
+// writer wait for it. Each waiter sleeps on its own condition variable until
+// a release hands it the lock. Meets the SharedTimedLockable requirements, so
+// std::unique_lock and std::shared_lock work with it, including timeouts.
+class TableLock {
+public:
+    // Acquisition counts and time spent queued, over the lock's lifetime
+    struct Stats {
+        uint64_t acquisitions = 0;
+        uint64_t contended = 0;                     // Acquisitions that had to queue
+        uint64_t timeouts = 0;                      // Timed acquisitions that gave up
+        std::chrono::nanoseconds wait_time{0};
+        std::chrono::nanoseconds max_wait{0};
+    };
+    
+    TableLock() = default;
+    TableLock(const TableLock&) = delete;
+    TableLock& operator=(const TableLock&) = delete;
+    
+    void lock() { acquire(true, nullptr); }
+    bool try_lock() { return acquire(true, &kNoWait); }
+    template <class Rep, class Period>
+    bool try_lock_for(const std::chrono::duration<Rep, Period>& timeout) {
+        return try_lock_until(std::chrono::steady_clock::now() +
+                              std::chrono::ceil<std::chrono::steady_clock::duration>(timeout));
+    }
+    bool try_lock_until(std::chrono::steady_clock::time_point deadline) { return acquire(true, &deadline); }
+    void unlock() { release(true); }
+    
+    void lock_shared() { acquire(false, nullptr); }
+    bool try_lock_shared() { return acquire(false, &kNoWait); }
+    template <class Rep, class Period>
+    bool try_lock_shared_for(const std::chrono::duration<Rep, Period>& timeout) {
+        return try_lock_shared_until(std::chrono::steady_clock::now() +
+                                     std::chrono::ceil<std::chrono::steady_clock::duration>(timeout));
+    }
+    bool try_lock_shared_until(std::chrono::steady_clock::time_point deadline) { return acquire(false, &deadline); }
+    void unlock_shared() { release(false); }
+    
+    Stats stats() const;
+    
+private:
+    struct Waiter {
+        bool exclusive;
+        bool granted = false;
+        std::condition_variable cv;
+    };
+    
+    // Deadline of the try_lock variants, which never queue
+    static const std::chrono::steady_clock::time_point kNoWait;
+    
+    // Wait until granted or, with a deadline, until it passes
+    bool acquire(bool exclusive, const std::chrono::steady_clock::time_point* deadline);
+    void release(bool exclusive);
+    
+    // Caller holds mutex_
+    bool available(bool exclusive) const { return !writer_ && (!exclusive || readers_ == 0); }
+    void take(bool exclusive);
+    void grantWaiters();
+    
+    mutable std::mutex mutex_;
+    size_t readers_ = 0;
+    bool writer_ = false;
+    std::deque<Waiter*> queue_;
+    Stats stats_;
+};
+
 // Table class
 class Table {
 public:
-    Table(const std::string& name, const std::vector<Column>& columns);
+    // Secondary index kinds: ORDERED supports lookup and range, HASH supports lookup only
+    enum IndexType {
+        ORDERED,
+        HASH
+    };
+
+    // Storage layouts: ROW_ORIENTED keeps one Row per record, COLUMNAR keeps one
+    // typed array per column for fast single-column filters and aggregates
+    enum Layout {
+        ROW_ORIENTED,
+        COLUMNAR
+    };
+
+    // With shards > 1 the table is split into that many internal tables by
+    // primary key hash, each with its own rows, indexes and lock. Writes to
+    // different shards run in parallel and queries fan out across shards, so
+    // select may call the predicate from several threads at once.
+    // Sharded tables need a primary key and enforce no other UNIQUE columns.
+    // Tables of a Database also split large scans into morsels that run on
+    // its worker pool, so select, update and remove may call a predicate from
+    // several threads at once on any layout.
+    Table(const std::string& name, const std::vector<Column>& columns, Layout layout = ROW_ORIENTED,
+          size_t shards = 1);
     ~Table();
 
-    // Basic operations
+    // Basic operations. The Row&& overloads move the row into the table
+    // instead of copying its values.
     bool insert(const Row& row);
+    bool insert(Row&& row);
     bool update(const Row& row, const std::function<bool(const Row&)>& predicate);
+    bool update(Row&& row, const std::function<bool(const Row&)>& predicate);
+    
+    // Build the row from one argument per column, e.g. emplace(1, "Alice", 25)
+    template <typename... Args>
+    bool emplace(Args&&... args) {
+        Row row;
+        row.reserve(sizeof...(Args));
+        (row.emplace_back(std::forward<Args>(args)), ...);
+        return insert(std::move(row));
+    }
+    
+    // Set only the named columns of every matching row, keeping its other cells
+    bool updateColumns(const ColumnChanges& changes, const std::function<bool(const Row&)>& predicate);
+    
+    // Bulk load: the rows are checked together, including for keys repeated
+    // within the batch, and moved in under one lock. All or nothing.
+    bool insertBatch(std::vector<Row>&& rows);
     bool remove(const std::function<bool(const Row&)>& predicate);
     
     // Query operations
     std::vector<Row> select(const std::function<bool(const Row&)>& predicate);
+    std::vector<Row> project(const std::vector<std::string>& columns,
+                             const std::function<bool(const Row&)>& predicate);
+    std::vector<Row> lookup(const std::string& column, const Value& value);
+    std::vector<Row> range(const std::string& column, const Value& lo, const Value& hi);
+    
+    // Zero-copy scan: the visitor sees each matching row in place while the table
+    // is read-locked, so it must not write to this table. Returns rows visited.
+    size_t scan(const std::function<bool(const Row&)>& predicate, const RowVisitor& visitor);
+    
+    // Vectorized single-column filters
+    std::vector<Row> select(const ColumnPredicate& predicate);
+    size_t scan(const ColumnPredicate& predicate, const RowVisitor& visitor);
+    size_t count(const ColumnPredicate& predicate);
+    bool remove(const ColumnPredicate& predicate);
+    
+    // Structured filters, compiled once per query. The AND-ed comparisons pick
+    // the access path: an index lookup, an ordered index range or, on COLUMNAR
+    // tables, vectorized filters; each candidate row is then checked against
+    // the whole filter. A filter naming an unknown column matches nothing.
+    std::vector<Row> select(const Expression& filter);
+    size_t scan(const Expression& filter, const RowVisitor& visitor);
+    size_t count(const Expression& filter);
+    
+    // Access path select would take, e.g. "index range on age"; empty if the
+    // filter names an unknown column
+    std::string explain(const Expression& filter);
+    
+    // Ordered select: the rows matching filter sorted by order, ties in table
+    // order, skipping the first offset rows and returning at most limit. Only
+    // the best offset + limit rows are kept while scanning, in a bounded heap
+    // per morsel and shard. With a limit, a single sort key on an ORDERED
+    // index and no other index narrowing the filter, the index is walked in
+    // order and the walk stops once enough rows matched. Empty if a column is
+    // unknown.
+    static constexpr size_t kNoLimit = std::numeric_limits<size_t>::max();
+    std::vector<Row> select(const Expression& filter, const std::vector<OrderBy>& order,
+                            size_t limit = kNoLimit, size_t offset = 0);
+    
+    // Aggregates of the rows matching filter in one pass, without copying
+    // rows: one result row per distinct group_by combination, holding the
+    // group cells and then one cell per aggregate, ordered by group. Without
+    // group_by there is exactly one row. Large tables are aggregated in
+    // parallel morsels whose partial results are merged. False for an unknown
+    // column or SUM/AVG over a column that is not INT or FLOAT.
+    bool aggregate(const std::vector<Aggregate>& aggregates, const std::vector<std::string>& group_by,
+                   const Expression& filter, std::vector<Row>& out);
+    
+    // Inner equi-join of this table's column with right's right_column. Pairs
+    // stream to the visitor while both tables are read-locked, nothing but
+    // join keys is copied. With an index on either join column the other side
+    // streams and probes it per row (index nested loop); otherwise the smaller
+    // side's keys go into a hash table that the larger side streams past.
+    // Only rows matching each side's filter take part. Keys match when equal
+    // as Values, NULL keys match nothing. Returns pairs visited, 0 if a column
+    // is unknown.
+    size_t join(const std::string& column, Table& right, const std::string& right_column,
+                const JoinVisitor& visitor, const Expression& filter = Expression(),
+                const Expression& right_filter = Expression());
+    
+    // Join method join would use, e.g. "index nested loop probing orders.customer_id"
+    std::string explainJoin(const std::string& column, Table& right, const std::string& right_column);
+    
+    // Column access: the reader gets a typed view of one column while the table is
+    // read-locked. ROW_ORIENTED tables gather the column first, COLUMNAR tables
+    // hand out their storage directly. Returns false for an unknown column or,
+    // on ROW_ORIENTED tables, a cell whose type does not match the column.
+    bool readColumn(const std::string& column, const std::function<void(const ColumnView&)>& reader);
+    
+    // Secondary index operations
+    bool createIndex(const std::string& column, IndexType type = ORDERED);
+    bool dropIndex(const std::string& column);
+    bool hasIndex(const std::string& column) const;
     
     // Schema operations
     const std::vector<Column>& getColumns() const;
     const std::string& getName() const;
+    Layout getLayout() const;
+    size_t getShardCount() const;
 
-    // Thread-safe operations
+    // Thread-safe operations. Waiters queue in arrival order; false if the
+    // lock was not granted within the timeout.
     bool beginRead(std::chrono::milliseconds timeout = std::chrono::milliseconds(5000));
     void endRead();
     bool beginWrite(std::chrono::milliseconds timeout = std::chrono::milliseconds(5000));
     void endWrite();
+    
+    // Lock acquisitions and time spent waiting for this table's lock, summed
+    // over the shards of a sharded table
+    TableLock::Stats lockStats() const;
 
     // Serialization/Deserialization
     void serialize(std::ostream& out) const;
     static std::unique_ptr<Table> deserialize(std::istream& in);
 
-    // Thread synchronization (public for low-level access by Transaction)
-    std::shared_mutex mutex_;
+    // Thread synchronization (public for low-level access by Transaction).
+    // A sharded table keeps no rows itself, its shards are locked instead.
+    TableLock mutex_;
 
 private:
     std::string name_;
     std::vector<Column> columns_;
-    std::vector<Row> rows_;
+    Layout layout_;
+    
+    // Shards of a sharded table, empty otherwise
+    std::vector<std::unique_ptr<Table>> shards_;
+    
+    // Worker threads and counters of the owning Database, null for a
+    // standalone table
+    std::shared_ptr<WorkerPool> pool_;
+    std::shared_ptr<Metrics> metrics_;
+    void countScan(size_t scanned, size_t returned) const;
+    
+    // Run fn(index, begin, end) for every range of up to kMorselRows positions
+    // in [0, count), in parallel on the pool when there are several
+    static constexpr size_t kMorselRows = 4096;
+    template <typename Fn> void forEachMorsel(size_t count, Fn&& fn) const;
+    
+    // Run fn(i) for i in [0, count) at once, on the pool or on new threads
+    template <typename Fn> void runParallel(size_t count, const Fn& fn) const;
+    
+    // Tables holding the rows: the shards, or this table itself
+    std::vector<Table*> parts() const;
+    Table* shardFor(const Row& row);
+    Table* shardForKey(const Value& key);
+    size_t shardIndex(const Value& key) const;
+    
+    // Lock every part in shard order, optionally giving up after a timeout
+    template <typename Lock> void lockParts(std::vector<Lock>& locks);
+    template <typename Lock> bool lockParts(std::vector<Lock>& locks, std::chrono::milliseconds timeout);
+    
+    // Per-row storage in fixed-size chunks. Copies share chunks and the first
+    // write to a shared chunk clones it, so capturing a table for a snapshot
+    // costs one pointer per chunk.
+    template <typename T>
+    class Chunks {
+    public:
+        static constexpr size_t kChunkShift = 10;
+        static constexpr size_t kChunkRows = size_t(1) << kChunkShift;
+        
+        size_t size() const { return size_; }
+        const T& operator[](size_t pos) const {
+            return (*chunks_[pos >> kChunkShift])[pos & (kChunkRows - 1)];
+        }
+        T& mutableAt(size_t pos) { return own(pos >> kChunkShift)[pos & (kChunkRows - 1)]; }
+        void push_back(T value);
+        void truncate(size_t count);
+        void reserve(size_t count) { chunks_.reserve((count + kChunkRows - 1) >> kChunkShift); }
+        bool shared(size_t pos) const { return chunks_[pos >> kChunkShift].use_count() > 1; }
+        
+    private:
+        std::vector<T>& own(size_t chunk);
+        
+        std::vector<std::shared_ptr<std::vector<T>>> chunks_;
+        size_t size_ = 0;
+    };
+    
+    // ROW_ORIENTED storage
+    Chunks<Row> rows_;
+    
+    // Buffers of rows dropped by compaction, reused by rows the table copies
+    // in, so version churn recycles the same allocations instead of handing
+    // them back to malloc. The caller must hold mutex_ exclusively.
+    static constexpr size_t kMaxSpareRows = 1024;
+    std::vector<Row> spare_rows_;
+    Row makeRow(const Row& source);
+    
+    // Multi-version concurrency control: every row position is one version,
+    // visible to readers between its begin and end stamps (see mvcc.h).
+    // Updates and removes inside a transaction end the old version and append
+    // the new one; garbage collection drops versions no reader can see.
+    struct Version {
+        uint64_t begin;
+        uint64_t end;
+    };
+    Chunks<Version> versions_;
+    std::shared_ptr<VersionClock> clock_;
+    size_t unsettled_ = 0;         // Versions not plainly live: pending, ended or rolled back
+    uint64_t max_begin_ = 0;       // Latest commit timestamp of a live version
+    size_t gc_threshold_ = 1024;
+    
+    // Positions stamped by each running transaction, keyed by its tag
+    std::unordered_map<uint64_t, std::vector<size_t>> pending_;
+    
+    // What a reader sees: versions committed at or before read_ts and its own.
+    // Writes stamp new versions with self; self 0 writes in place.
+    struct VersionView {
+        uint64_t read_ts;
+        uint64_t self;
+    };
+    
+    // COLUMNAR storage, one entry per column
+    struct ColumnData {
+        Column::Type type;
+        size_t size = 0;
+        std::vector<int32_t> ints;
+        std::vector<double> floats;
+        std::vector<uint64_t> offsets;
+        std::vector<uint32_t> lengths;
+        std::vector<char> bytes;
+        size_t garbage_bytes = 0;   // Bytes orphaned by overwritten TEXT/BLOB cells
+        std::vector<uint64_t> nulls;
+        
+        bool accepts(const Value& value) const;
+        void append(const Value& value);
+        void set(size_t pos, const Value& value);
+        Value get(size_t pos) const;
+        void compact(const std::vector<bool>& keep);
+        ColumnView view() const;
+        
+        bool isNull(size_t pos) const { return (nulls[pos / 64] >> (pos % 64)) & 1; }
+        void setNull(size_t pos, bool null);
+        uint64_t appendBytes(std::string_view data);
+    };
+    // Shared with snapshots like row chunks, a write to a shared column clones it
+    std::vector<std::shared_ptr<ColumnData>> column_data_;
+    ColumnData& mutableColumn(size_t index);
+    
+    // Incremental checkpoints tell tables apart by an id unique in the
+    // process and see their changes through a count that every change to
+    // rows, versions or indexes bumps under mutex_ exclusively. changeCount
+    // sums the parts, the caller holds them locked.
+    static uint64_t nextId();
+    uint64_t id_ = nextId();
+    uint64_t changes_ = 0;
+    uint64_t changeCount() const;
+    
+    // Point-in-time copy of a table that is encoded without holding the lock
+    struct Snapshot {
+        std::string name;
+        Layout layout;
+        std::vector<Column> columns;
+        std::vector<std::pair<size_t, IndexType>> indexes;
+        size_t positions = 0;    // Row positions, including versions the snapshot skips
+        size_t row_count = 0;    // Rows visible at read_ts
+        Chunks<Row> rows;
+        std::vector<std::shared_ptr<const ColumnData>> column_data;
+        Chunks<Version> versions;
+        uint64_t read_ts = 0;
+        bool all_visible = true;
+        std::vector<Snapshot> shards;   // Per-shard captures of a sharded table, which holds no rows
+        
+        bool visible(size_t pos) const;
+        size_t countVisible() const;
+        
+        // Block header and positions [begin, end), concatenated they form the block
+        void encodeHeader(std::string& out) const;
+        void encodeRows(size_t begin, size_t end, std::string& out) const;
+        
+        // Positions [begin, end) column by column, for compressed blocks
+        void encodeColumns(size_t begin, size_t end, std::string& out) const;
+    };
+    
+    // Hash indexes over PRIMARY KEY and UNIQUE columns, mapping key to the
+    // positions of its versions
+    struct KeyIndex {
+        size_t column;
+        std::unordered_multimap<Value, size_t, ValueHash> positions;
+    };
+    std::vector<KeyIndex> key_indexes_;
+    
+    // Secondary indexes created with createIndex, mapping value to row positions
+    struct SecondaryIndex {
+        size_t column;
+        IndexType type;
+        std::multimap<Value, size_t> ordered;
+        std::unordered_multimap<Value, size_t, ValueHash> hashed;
+    };
+    std::vector<SecondaryIndex> indexes_;
     
     // Find primary key column index
     int findPrimaryKeyIndex() const;
     
+    // Find column index by name, -1 if there is no such column
+    int findColumnIndex(const std::string& column) const;
+    
+    // Resolve column names to indexes, false if any name is unknown
+    bool findColumnIndexes(const std::vector<std::string>& columns, std::vector<size_t>& indexes) const;
+    
+    // Layout-independent row access, the caller must hold mutex_. COLUMNAR tables
+    // materialize each row into a scratch Row that is only valid during the callback.
+    // forEachRow visits every version, forEachVisible only those the view sees.
+    size_t rowCount() const;
+    Row rowAt(size_t pos) const;
+    template <typename Fn> void forEachRow(Fn&& fn) const;
+    template <typename Fn> void forEachVisible(const VersionView& view, Fn&& fn) const;
+    template <typename Fn> void forEachVisible(const VersionView& view, size_t begin, size_t end, Fn&& fn) const;
+    bool acceptsRow(const Row& row) const;
+    
+    // Version visibility, the caller must hold mutex_
+    VersionView latestView() const;
+    bool isVisible(size_t pos, const VersionView& view) const;
+    bool allVisible(const VersionView& view) const;
+    
+    // Visible rows or positions matching a predicate in table order, the
+    // caller must hold mutex_. Large tables are scanned in parallel morsels.
+    std::vector<Row> selectRows(const std::function<bool(const Row&)>& predicate, const VersionView& view) const;
+    std::vector<size_t> matchPositions(const std::function<bool(const Row&)>& predicate,
+                                       const VersionView& view) const;
+    
+    // Scan rows in place, the caller must hold mutex_
+    size_t scanRows(const std::function<bool(const Row&)>& predicate, const RowVisitor& visitor,
+                    const VersionView& view) const;
+    
+    // Evaluate a column predicate into a selection bitmap with one bit per row
+    // position, the caller must hold mutex_. False if the column is unknown.
+    bool evaluate(const ColumnPredicate& predicate, const VersionView& view, std::vector<uint64_t>& selection) const;
+    static void evaluateColumn(const ColumnData& data, const ColumnPredicate& predicate,
+                               std::vector<uint64_t>& selection);
+    size_t scanSelected(const std::vector<uint64_t>& selection, const RowVisitor& visitor) const;
+    
+    // Gather the visible cells of a column, the caller must hold mutex_. False
+    // if a ROW_ORIENTED cell does not match the column type.
+    bool gatherColumn(size_t column, const VersionView& view, ColumnData& out) const;
+    
+    // Access path chosen for a structured filter, the caller must hold mutex_
+    struct AccessPath {
+        enum Kind {
+            FULL_SCAN,
+            INDEX_LOOKUP,    // EQ on a key or secondary index column
+            INDEX_RANGE,     // Bounds on an ORDERED index column
+            COLUMN_FILTER    // Selection bitmaps of every comparison, COLUMNAR only
+        };
+        
+        Kind kind = FULL_SCAN;
+        size_t column = 0;
+        std::vector<const ColumnPredicate*> predicates;   // Comparisons the path narrows on
+    };
+    AccessPath planAccess(const Expression& filter) const;
+    std::string describe(const AccessPath& path) const;
+    std::vector<size_t> candidatePositions(const AccessPath& path, const VersionView& view) const;
+    
+    // Partial aggregates per group, merged across morsels and shards
+    struct Groups;
+    bool prepareAggregate(const std::vector<Aggregate>& aggregates, const std::vector<std::string>& group_by,
+                          Groups& groups) const;
+    void collectGroups(const Expression& filter, const std::function<bool(const Row&)>& evaluator,
+                       const VersionView& view, Groups& groups) const;
+    static void finishGroups(Groups& groups, std::vector<Row>& out);
+    
+    // Rows an ordered select keeps, merged across morsels and shards
+    struct TopRows;
+    bool prepareOrder(const std::vector<OrderBy>& order, size_t limit, size_t offset, TopRows& top) const;
+    void collectTop(const Expression& filter, const std::function<bool(const Row&)>& evaluator,
+                    const VersionView& view, TopRows& top) const;
+    bool walkOrderIndex(const std::function<bool(const Row&)>& evaluator, const VersionView& view,
+                        TopRows& top) const;
+    static void finishTop(TopRows& top, size_t limit, size_t offset, std::vector<Row>& out);
+    
+    // Join helpers. lockJoin read-locks both tables, the one at the lower
+    // address first, like snapshots lock every table, so concurrent joins
+    // and snapshots cannot deadlock; joinRows and
+    // describeJoin need those locks. The timed variant gives up, holding
+    // nothing, once timeout has passed.
+    void lockJoin(Table& right, std::vector<std::shared_lock<TableLock>>& locks);
+    bool lockJoin(Table& right, std::vector<std::shared_lock<TableLock>>& locks, std::chrono::milliseconds timeout);
+    bool hasLookupIndex(size_t column) const;
+    std::string describeJoin(size_t column, const Table& right, size_t right_column) const;
+    size_t joinRows(size_t column, const VersionView& view, const std::function<bool(const Row&)>& filter,
+                    const Table& right, size_t right_column, const VersionView& right_view,
+                    const std::function<bool(const Row&)>& right_filter, const JoinVisitor& visitor) const;
+    
+    // Scan the rows matching a compiled filter, the caller must hold mutex_
+    size_t scanFiltered(const Expression& filter, const std::function<bool(const Row&)>& evaluator,
+                        const RowVisitor& visitor, const VersionView& view) const;
+    
+    // Index lookups returning visible row positions, the caller must hold mutex_
+    std::vector<size_t> lookupPositions(size_t column, const Value& value, const VersionView& view) const;
+    std::vector<size_t> rangePositions(size_t column, const Value& lo, const Value& hi,
+                                       const VersionView& view) const;
+    
+    // Versioned writes, the caller must hold mutex_ exclusively. They return
+    // OK or why they wrote nothing: a cell of the wrong type, no matching row,
+    // a constraint violation, or a conflict when a matching row was changed
+    // by a transaction the view does not see or a running one holds the key.
+    // Before-images of changed rows go to originals.
+    // On a sharded table scanRows, insertRow, updateRows and eraseRows work
+    // across the shards, whose locks the caller holds instead, as do the
+    // version finishing helpers below.
+    template <typename Fn> auto autocommit(Fn&& write);
+    Status::Code violatesKeyConstraints(const Row& row, const VersionView& view,
+                                        const std::vector<size_t>& replaced = {}) const;
+    Status::Code insertRow(const Row& row, const VersionView& view);
+    Status::Code insertRow(Row&& row, const VersionView& view);
+    Status::Code acceptsRows(const std::vector<Row>& rows, const VersionView& view) const;
+    Status::Code insertRows(std::vector<Row>& rows, const VersionView& view);
+    Status::Code updateRows(Row&& row, const std::function<bool(const Row&)>& predicate,
+                            const VersionView& view, std::vector<Row>* originals = nullptr);
+    Status::Code changeRows(const ColumnChanges& changes, const std::function<bool(const Row&)>& predicate,
+                            const VersionView& view, std::vector<Row>* originals = nullptr,
+                            std::vector<Row>* updated = nullptr);
+    Status::Code eraseRows(const std::function<bool(const Row&)>& predicate,
+                           const VersionView& view, std::vector<Row>* originals = nullptr);
+    Status::Code updateShards(Row&& row, const std::function<bool(const Row&)>& predicate,
+                              const VersionView& view, std::vector<Row>* originals);
+    Status::Code erasePositions(const std::vector<size_t>& positions, const VersionView& view);
+    
+    // Finish a transaction's versions, the caller must hold mutex_ exclusively
+    void commitVersions(uint64_t tag, uint64_t ts);
+    void abortVersions(uint64_t tag);
+    void collectGarbage();
+    void maybeCollectGarbage();
+    
+    // Physical storage helpers, the caller must hold mutex_ exclusively
+    void appendRow(const Row& row, uint64_t begin = 0);
+    void appendRow(Row&& row, uint64_t begin = 0);
+    void appendRows(std::vector<Row>& rows, uint64_t begin);
+    void assignRow(size_t pos, const Row& row);
+    void assignRow(size_t pos, Row&& row);
+    void setVersion(size_t pos, const Version& version);
+    size_t compact(const std::vector<bool>& keep);
+    void indexRow(size_t pos, const Row& row);
+    void unindexRow(size_t pos, const Row& row);
+    void rebuildIndexes();
+    
+    // Positions of live rows equal to the targets, one distinct row per target;
+    // the caller must hold mutex_
+    std::vector<size_t> matchRows(const std::vector<Row>& targets) const;
+    
+    // Snapshot capture needs at least a read lock, decoding builds a new table
+    Snapshot snapshot(uint64_t read_ts) const;
+    static std::unique_ptr<Table> decodeSnapshot(const char* data, size_t size, uint8_t encoding);
+    
     friend class Transaction;
     friend class Database;
 };
 
+// Engine counters of a Database since it was created, see Database::stats
+struct DatabaseStats {
+    // Durations in power-of-two buckets: bucket 0 counts those under 1us,
+    // bucket i those under 2^i us, the last one everything longer
+    static constexpr size_t kBuckets = 24;
+    struct Histogram {
+        uint64_t count = 0;
+        std::chrono::nanoseconds total{0};
+        std::chrono::nanoseconds max{0};
+        uint64_t buckets[kBuckets] = {};
+    };
+    
+    // Reads of a table or shard by select, scan, count, lookup, range and
+    // aggregate, in and outside transactions; a sharded table counts each
+    // shard it reads. Scanned rows are the versions a read examined: every
+    // position for a scan, the candidates of an index lookup.
+    uint64_t scans = 0;
+    uint64_t rows_scanned = 0;
+    uint64_t rows_returned = 0;
+    
+    uint64_t commits = 0;
+    uint64_t rollbacks = 0;          // Including commits that failed
+    uint64_t lock_timeouts = 0;      // Transaction operations that gave up waiting for a table lock
+    Histogram commit_time;
+    
+    // Lock statistics summed over the loaded tables
+    TableLock::Stats locks;
+    
+    uint64_t saved_bytes = 0;
+    uint64_t loaded_bytes = 0;
+    Histogram save_time;
+    Histogram load_time;
+};
+
+// Snapshot settings for saveToFile
+struct SnapshotOptions {
+    enum Compression {
+        COMPRESSION_NONE,  // Tagged values row by row
+        COMPRESSION_LZ4    // Column-wise varints and TEXT dictionaries, in LZ4 frames
+    };
+    
+    Compression compression = COMPRESSION_NONE;
+};
+
+// Write-ahead log settings
+struct WalOptions {
+    enum SyncMode {
+        SYNC_NONE,   // Write at commit and leave flushing to the OS
+        SYNC_COMMIT  // fsync before commit returns, shared by concurrent committers
+    };
+    
+    SyncMode sync_mode = SYNC_COMMIT;
+    
+    // How long a group commit leader waits for other committers to join
+    std::chrono::microseconds group_commit_window{0};
+};
+
+// Transaction settings for beginTransaction
+struct TransactionOptions {
+    // How long one table lock wait may take before the operation fails with
+    // TIMEOUT. No wait runs past the deadline; once it has passed, locks are
+    // only taken if they are free.
+    std::chrono::milliseconds lock_timeout{500};
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+};
+
 // Database class
 class Database {
 public:
@@ -241,48 +1017,259 @@ public:
     ~Database();
 
     // Table operations
-    bool createTable(const std::string& name, const std::vector<Column>& columns);
+    bool createTable(const std::string& name, const std::vector<Column>& columns,
+                     Table::Layout layout = Table::ROW_ORIENTED, size_t shards = 1);
     bool dropTable(const std::string& name);
+    
+    // Lookups read a published copy of the catalog and take no lock once the
+    // table is loaded. The shared pointer keeps a dropped table alive until
+    // its last holder lets go; getTable's pointer is only valid until the
+    // table is dropped.
+    std::shared_ptr<Table> acquireTable(const std::string& name);
     Table* getTable(const std::string& name);
     
+    // Secondary index operations
+    bool createIndex(const std::string& table_name, const std::string& column,
+                     Table::IndexType type = Table::ORDERED);
+    bool dropIndex(const std::string& table_name, const std::string& column);
+    
     // Transaction support
-    std::shared_ptr<Transaction> beginTransaction();
+    std::shared_ptr<Transaction> beginTransaction(const TransactionOptions& options = TransactionOptions());
     
-    // Disk persistence
-    bool saveToFile(const std::string& filename) const;
+    // Disk persistence. Snapshots are little-endian with a table directory
+    // and checksums; loading maps the file and decodes each table the first
+    // time getTable asks for it. Files in the older format load eagerly.
+    // Compressed blocks are read whatever the options of the current save.
+    bool saveToFile(const std::string& filename, const SnapshotOptions& options = SnapshotOptions()) const;
     bool loadFromFile(const std::string& filename);
     
+    // Incremental checkpoints. The manifest lists the segment files next to
+    // it that hold each table's block. A checkpoint writes the tables changed
+    // since the last checkpoint to the same manifest into a new segment,
+    // <manifest>.<n>, keeps the others where they are and removes segments no
+    // table uses any more. loadFromFile opens a manifest like a snapshot; a
+    // logged database drops the records the checkpoint covers.
+    bool checkpoint(const std::string& manifest, const SnapshotOptions& options = SnapshotOptions());
+    
+    // Write-ahead logging. Committed transactions and schema changes are
+    // appended to the log; loadFromFile replays it on top of the snapshot and
+    // saveToFile drops the records the new snapshot covers. Enable it before
+    // loading or starting transactions.
+    bool enableWal(const std::string& path, const WalOptions& options = WalOptions());
+    void disableWal();
+    
     // Get all table names
     std::vector<std::string> getTableNames() const;
     
+    // Snapshot of the engine counters. They are kept per thread slot, so
+    // counting costs an uncontended atomic add on the hot paths.
+    DatabaseStats stats() const;
+    
 private:
-    std::unordered_map<std::string, std::unique_ptr<Table>> tables_;
+    // Catalog copy-on-write: writers hold mutex_, copy the map and swap the
+    // new one in, readers atomically load whichever copy is current
+    using Catalog = std::unordered_map<std::string, std::shared_ptr<Table>>;
+    std::shared_ptr<const Catalog> tables_;
     std::mutex mutex_;
+    std::shared_ptr<WriteAheadLog> wal_;
+    std::shared_ptr<VersionClock> clock_;
+    std::shared_ptr<WorkerPool> pool_;
+    std::shared_ptr<Metrics> metrics_;
+    
+    // Tables of mapped snapshots or segments not decoded yet. table_id is
+    // what the table's id will be once it is decoded.
+    struct SnapshotEntry {
+        uint64_t offset = 0;
+        uint64_t size = 0;
+        uint32_t checksum = 0;
+        uint8_t encoding = 0;
+        uint64_t table_id = 0;
+        std::shared_ptr<MappedFile> file;
+    };
+    std::unordered_map<std::string, SnapshotEntry> unloaded_;
+    
+    // Tables as of the last checkpoint to checkpoint_manifest_: the segment
+    // holding each block and the table id and change count it was written
+    // at, kUnknownChanges when commits were still stamping versions then
+    static constexpr uint64_t kUnknownChanges = ~uint64_t(0);
+    struct CheckpointBlock {
+        std::string segment;
+        SnapshotEntry entry;
+        uint64_t changes = kUnknownChanges;
+    };
+    using CheckpointBlocks = std::unordered_map<std::string, CheckpointBlock>;
+    std::string checkpoint_manifest_;
+    CheckpointBlocks checkpoint_;
+    std::mutex checkpoint_mutex_;   // Held for a whole checkpoint, before mutex_
+    
+    std::shared_ptr<const Catalog> catalog() const { return std::atomic_load(&tables_); }
+    
+    // Catalog helpers, the caller holds mutex_
+    std::shared_ptr<Table> findTable(const std::string& name);
+    std::shared_ptr<Table> adoptTable(std::unique_ptr<Table> table);
+    bool eraseTable(const std::string& name);
+    void clearTables();
+    bool openSnapshot(const std::string& filename);
+    bool openManifest(const std::string& filename);
+    bool loadLegacyFile(std::istream& file);
+    
+    // What writeSnapshot covered: with a log the position it reaches and the
+    // transactions whose records it misses, the blocks it wrote and the
+    // tables it left out because base already holds them unchanged
+    struct SnapshotResult {
+        uint64_t lsn = 0;
+        std::vector<uint64_t> unfinished_logs;
+        std::vector<std::pair<std::string, CheckpointBlock>> written;
+        std::vector<std::string> unchanged;
+    };
+    bool writeSnapshot(const std::string& filename, const SnapshotOptions& options, WriteAheadLog* wal,
+                       const CheckpointBlocks* base, SnapshotResult& result) const;
+    
+    // Log replay, called with mutex_ held
+    bool replayWal();
+    bool applyLogRecord(uint8_t type, const std::string& payload);
+    
+    friend class Transaction;
 };
 
 // Transaction class for ACID properties
 class Transaction {
 public:
-    explicit Transaction(Database* db);
+    explicit Transaction(Database* db, const TransactionOptions& options = TransactionOptions());
     ~Transaction();
     
     // Transaction operations
     bool commit();
     void rollback();
     
-    // Table operations within transaction
+    // Why the last operation failed, or OK. Reads that fail return no rows,
+    // so this tells an empty result from a timeout. A failed commit keeps its
+    // reason, e.g. CONFLICT when another transaction claimed a buffered key.
+    const Status& status() const { return status_; }
+    
+    // Commit without waiting for the log. The changes are visible to other
+    // transactions once the call returns, and on_durable is told whether the
+    // commit record reached the disk, on the log's flush thread, or at once
+    // when there is nothing to log. A crash before then loses the
+    // transaction. Returns false, without calling on_durable, if the commit
+    // fails.
+    bool commitAsync(std::function<void(bool durable)> on_durable);
+    
+    // The future is false if the commit failed or never became durable
+    std::future<bool> commitAsync();
+    
+    // Table operations within transaction. Inserts are checked against the
+    // table under a shared lock and buffered; the buffer is applied with one
+    // exclusive lock at commit or before the next other operation on the
+    // table. If another transaction claims a buffered key first, commit fails.
     bool insert(const std::string& table_name, const Row& row);
+    bool insert(const std::string& table_name, Row&& row);
+    bool insertBatch(const std::string& table_name, std::vector<Row>&& rows);
     bool update(const std::string& table_name, const Row& row, 
                 const std::function<bool(const Row&)>& predicate);
+    bool update(const std::string& table_name, Row&& row,
+                const std::function<bool(const Row&)>& predicate);
+    bool updateColumns(const std::string& table_name, const ColumnChanges& changes,
+                       const std::function<bool(const Row&)>& predicate);
     bool remove(const std::string& table_name, 
                 const std::function<bool(const Row&)>& predicate);
     std::vector<Row> select(const std::string& table_name,
                             const std::function<bool(const Row&)>& predicate);
+    std::vector<Row> project(const std::string& table_name, const std::vector<std::string>& columns,
+                             const std::function<bool(const Row&)>& predicate);
+    std::vector<Row> lookup(const std::string& table_name, const std::string& column,
+                            const Value& value);
+    std::vector<Row> range(const std::string& table_name, const std::string& column,
+                           const Value& lo, const Value& hi);
+    
+    // Zero-copy scan over the transaction's snapshot. Returns false if the
+    // table does not exist.
+    bool scan(const std::string& table_name,
+              const std::function<bool(const Row&)>& predicate, const RowVisitor& visitor);
+    
+    // Vectorized single-column filters
+    std::vector<Row> select(const std::string& table_name, const ColumnPredicate& predicate);
+    bool scan(const std::string& table_name, const ColumnPredicate& predicate, const RowVisitor& visitor);
+    bool remove(const std::string& table_name, const ColumnPredicate& predicate);
+    
+    // Structured filters, planned per shard like Table::select
+    std::vector<Row> select(const std::string& table_name, const Expression& filter);
+    bool scan(const std::string& table_name, const Expression& filter, const RowVisitor& visitor);
+    bool updateColumns(const std::string& table_name, const ColumnChanges& changes, const Expression& filter);
+    bool aggregate(const std::string& table_name, const std::vector<Aggregate>& aggregates,
+                   const std::vector<std::string>& group_by, const Expression& filter, std::vector<Row>& out);
+    
+    // Ordered select over the transaction's snapshot, see Table::select
+    std::vector<Row> select(const std::string& table_name, const Expression& filter,
+                            const std::vector<OrderBy>& order, size_t limit = Table::kNoLimit, size_t offset = 0);
+    
+    // Join two tables within this transaction's snapshot, see Table::join
+    bool join(const std::string& table_name, const std::string& column, const std::string& right_table,
+              const std::string& right_column, const JoinVisitor& visitor,
+              const Expression& filter = Expression(), const Expression& right_filter = Expression());
     
 private:
     Database* db_;
     bool active_;
-    std::map<std::string, std::vector<std::function<void()>>> rollback_operations_;
+    
+    // Outcome of the last operation. fail records a reason and returns
+    // false; failOnException, called in a catch block, records what() of
+    // the exception in flight as ABORTED.
+    Status status_;
+    bool fail(Status::Code code, std::string message = std::string());
+    bool failOnException();
+    
+    // Lock wait of the next operation: the lock timeout, cut short by the deadline
+    TransactionOptions options_;
+    std::chrono::milliseconds lockTimeout() const;
+    
+    // Bookkeeping that lives as long as the transaction (pinned tables,
+    // written shards, buffered keys) is carved from one arena whose first
+    // kilobyte is inline, and released in one step at commit or rollback
+    alignas(std::max_align_t) char arena_buffer_[1024];
+    std::pmr::monotonic_buffer_resource arena_{arena_buffer_, sizeof(arena_buffer_)};
+    void releaseArena();
+    
+    // Tables used so far, held until the transaction ends so a concurrent
+    // dropTable cannot free one it still writes to
+    std::pmr::unordered_map<std::string, std::shared_ptr<Table>> tables_{&arena_};
+    Table* acquireTable(const std::string& table_name);
+    
+    // Snapshot isolation: reads see what was committed when the transaction
+    // began plus its own writes, which are pending versions stamped with tag_
+    std::shared_ptr<VersionClock> clock_;
+    std::shared_ptr<Metrics> metrics_;
+    uint64_t read_ts_ = 0;
+    uint64_t tag_ = 0;
+    std::pmr::vector<Table*> written_{&arena_};
+    
+    Table::VersionView view() const { return {read_ts_, tag_}; }
+    void markWritten(Table* table);
+    
+    // Buffered inserts per table, with the keys they claim per key index
+    struct InsertBatch {
+        explicit InsertBatch(std::pmr::memory_resource* arena) : keys(arena) {}
+        
+        std::string table_name;
+        std::vector<Row> rows;
+        std::pmr::vector<std::pmr::unordered_set<Value, ValueHash>> keys;
+    };
+    std::pmr::unordered_map<Table*, InsertBatch> inserts_{&arena_};
+    Status::Code insert_failure_ = Status::OK;  // Why a buffered insert failed, commit must fail too
+    
+    // Apply a table's buffered inserts as pending versions. False if the lock
+    // timed out or a row no longer satisfies its constraints.
+    bool applyInserts(Table* table);
+    
+    // commit, waiting for the log unless on_durable is set
+    bool finishCommit(std::function<void(bool)> on_durable);
+    
+    // Redo logging, the id is assigned on the first logged operation
+    std::shared_ptr<WriteAheadLog> wal_;
+    uint64_t wal_txn_id_ = 0;
+    
+    // Log an applied operation, caller holds the table write lock
+    void logOperation(uint8_t type, const std::string& payload);
 };
 
 // Example retry logic for transaction operations
@@ -297,6 +1284,21 @@ inline bool performTransactionOperation(std::function<bool()> operation, int max
     return false;
 }
 
+// Retry an operation of tx only while a table lock times out; the lock wait
+// itself is the backoff, and any other failure returns at once
+inline bool performTransactionOperation(Transaction& tx, const std::function<bool()>& operation,
+                                        int maxRetries = 3) {
+    for (int attempt = 0; attempt < maxRetries; attempt++) {
+        if (operation()) {
+            return true;
+        }
+        if (tx.status().code != Status::TIMEOUT) {
+            return false;
+        }
+    }
+    return false;
+}
+
 } // namespace localdb
 
 #endif // LOCALDB_H
@@ -1,73 +1,43 @@
 #include "localdb.h"
+#include "expression.h"
+#include "filter_kernels.h"
+#include "format.h"
+#include "metrics.h"
+#include "mvcc.h"
+#include "wal.h"
+#include "worker_pool.h"
 #include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <limits>
+#include <numeric>
 #include <stdexcept>
 #include <iostream>
 #include <fstream>
+#include <string_view>
+#include <sstream>
+#include <iterator>
+#include <fcntl.h>
+#include <unistd.h>
 
 namespace localdb {
 
 // Value implementation
-Value::Value(const Value& other) : type(other.type) {
-    switch (type) {
-        case INT:
-            int_val = other.int_val;
-            break;
-        case FLOAT:
-            float_val = other.float_val;
-            break;
-        case TEXT:
-            text_val = new std::string(*other.text_val);
-            break;
-        case BLOB:
-            blob_val = new std::vector<uint8_t>(*other.blob_val);
-            break;
-        case NULL_TYPE:
-            break;
-    }
+Value::Value(const Value& other) : type(NULL_TYPE), inline_size_(0) {
+    copyFrom(other);
 }
 
-Value::Value(Value&& other) noexcept : type(other.type) {
-    switch (type) {
-        case INT:
-            int_val = other.int_val;
-            break;
-        case FLOAT:
-            float_val = other.float_val;
-            break;
-        case TEXT:
-            text_val = other.text_val;
-            other.text_val = nullptr;
-            break;
-        case BLOB:
-            blob_val = other.blob_val;
-            other.blob_val = nullptr;
-            break;
-        case NULL_TYPE:
-            break;
-    }
+Value::Value(Value&& other) noexcept : type(other.type), inline_size_(other.inline_size_) {
+    // The heap pointer, if any, moves with the payload bytes
+    std::memcpy(payload_, other.payload_, sizeof(payload_));
     other.type = NULL_TYPE;
+    other.inline_size_ = 0;
 }
 
 Value& Value::operator=(const Value& other) {
     if (this != &other) {
         clear();
-        type = other.type;
-        switch (type) {
-            case INT:
-                int_val = other.int_val;
-                break;
-            case FLOAT:
-                float_val = other.float_val;
-                break;
-            case TEXT:
-                text_val = new std::string(*other.text_val);
-                break;
-            case BLOB:
-                blob_val = new std::vector<uint8_t>(*other.blob_val);
-                break;
-            case NULL_TYPE:
-                break;
-        }
+        copyFrom(other);
     }
     return *this;
 }
@@ -76,25 +46,10 @@ Value& Value::operator=(Value&& other) noexcept {
     if (this != &other) {
         clear();
         type = other.type;
-        switch (type) {
-            case INT:
-                int_val = other.int_val;
-                break;
-            case FLOAT:
-                float_val = other.float_val;
-                break;
-            case TEXT:
-                text_val = other.text_val;
-                other.text_val = nullptr;
-                break;
-            case BLOB:
-                blob_val = other.blob_val;
-                other.blob_val = nullptr;
-                break;
-            case NULL_TYPE:
-                break;
-        }
+        inline_size_ = other.inline_size_;
+        std::memcpy(payload_, other.payload_, sizeof(payload_));
         other.type = NULL_TYPE;
+        other.inline_size_ = 0;
     }
     return *this;
 }
@@ -103,46 +58,101 @@ Value::~Value() {
     clear();
 }
 
+void Value::copyFrom(const Value& other) {
+    if (other.isHeapAllocated()) {
+        type = other.type;
+        assignBytes(other.bytes(), other.byteSize());
+        return;
+    }
+    
+    // Scalars and inline payloads are plain bytes
+    type = other.type;
+    inline_size_ = other.inline_size_;
+    std::memcpy(payload_, other.payload_, sizeof(payload_));
+}
+
 void Value::clear() {
-    switch (type) {
-        case TEXT:
-            delete text_val;
-            break;
-        case BLOB:
-            delete blob_val;
-            break;
-        default:
-            break;
+    if (isHeapAllocated()) {
+        delete[] load<char*>(kHeapDataOffset);
     }
     type = NULL_TYPE;
+    inline_size_ = 0;
+}
+
+const char* Value::bytes() const {
+    return isHeapAllocated() ? load<char*>(kHeapDataOffset) : payload_;
+}
+
+size_t Value::byteSize() const {
+    return isHeapAllocated() ? load<uint32_t>(kHeapSizeOffset) : inline_size_;
+}
+
+char* Value::allocateBytes(size_t size) {
+    if (size <= kInlineCapacity) {
+        inline_size_ = static_cast<uint8_t>(size);
+        return payload_;
+    }
+    
+    if (size > UINT32_MAX) {
+        throw std::length_error("Value payload too large");
+    }
+    
+    char* data = new char[size];
+    inline_size_ = kHeapTag;
+    store(kHeapSizeOffset, static_cast<uint32_t>(size));
+    store(kHeapDataOffset, data);
+    return data;
+}
+
+void Value::assignBytes(const char* data, size_t size) {
+    inline_size_ = 0;
+    char* dest = allocateBytes(size);
+    if (size > 0) {
+        std::memcpy(dest, data, size);
+    }
 }
 
 int Value::asInt() const {
     if (type != INT) {
         throw std::runtime_error("Value is not an integer");
     }
-    return int_val;
+    return load<int>(kScalarOffset);
 }
 
 double Value::asFloat() const {
     if (type != FLOAT) {
         throw std::runtime_error("Value is not a float");
     }
-    return float_val;
+    return load<double>(kScalarOffset);
 }
 
 std::string Value::asText() const {
     if (type != TEXT) {
         throw std::runtime_error("Value is not a text");
     }
-    return *text_val;
+    return std::string(bytes(), byteSize());
 }
 
 std::vector<uint8_t> Value::asBlob() const {
     if (type != BLOB) {
         throw std::runtime_error("Value is not a blob");
     }
-    return *blob_val;
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(bytes());
+    return std::vector<uint8_t>(data, data + byteSize());
+}
+
+std::string_view Value::textView() const {
+    if (type != TEXT) {
+        throw std::runtime_error("Value is not a text");
+    }
+    return byteView();
+}
+
+std::string_view Value::blobView() const {
+    if (type != BLOB) {
+        throw std::runtime_error("Value is not a blob");
+    }
+    return byteView();
 }
 
 bool Value::operator==(const Value& other) const {
@@ -152,13 +162,12 @@ bool Value::operator==(const Value& other) const {
     
     switch (type) {
         case INT:
-            return int_val == other.int_val;
+            return load<int>(kScalarOffset) == other.load<int>(kScalarOffset);
         case FLOAT:
-            return float_val == other.float_val;
+            return load<double>(kScalarOffset) == other.load<double>(kScalarOffset);
         case TEXT:
-            return *text_val == *other.text_val;
         case BLOB:
-            return *blob_val == *other.blob_val;
+            return byteView() == other.byteView();
         case NULL_TYPE:
             return true;
     }
@@ -177,13 +186,13 @@ bool Value::operator<(const Value& other) const {
     
     switch (type) {
         case INT:
-            return int_val < other.int_val;
+            return load<int>(kScalarOffset) < other.load<int>(kScalarOffset);
         case FLOAT:
-            return float_val < other.float_val;
+            return load<double>(kScalarOffset) < other.load<double>(kScalarOffset);
         case TEXT:
-            return *text_val < *other.text_val;
         case BLOB:
-            return *blob_val < *other.blob_val;
+            // Byte-wise unsigned comparison, same order as std::string and std::vector<uint8_t>
+            return byteView() < other.byteView();
         case NULL_TYPE:
             return false;
     }
@@ -191,30 +200,48 @@ bool Value::operator<(const Value& other) const {
     return false;
 }
 
+size_t Value::hash() const {
+    size_t seed = static_cast<size_t>(type) * 0x9e3779b97f4a7c15ULL;
+    
+    switch (type) {
+        case INT:
+            return seed ^ std::hash<int>()(load<int>(kScalarOffset));
+        case FLOAT:
+            return seed ^ std::hash<double>()(load<double>(kScalarOffset));
+        case TEXT:
+        case BLOB:
+            return seed ^ std::hash<std::string_view>()(byteView());
+        case NULL_TYPE:
+            break;
+    }
+    
+    return seed;
+}
+
 // Value serialization
 void Value::serialize(std::ostream& out) const {
-    // Write the type
-    out.write(reinterpret_cast<const char*>(&type), sizeof(type));
+    // Write the type as a 4-byte tag
+    uint32_t tag = type;
+    out.write(reinterpret_cast<const char*>(&tag), sizeof(tag));
     
     // Write the data based on type
     switch (type) {
-        case INT:
+        case INT: {
+            int int_val = load<int>(kScalarOffset);
             out.write(reinterpret_cast<const char*>(&int_val), sizeof(int_val));
             break;
-        case FLOAT:
+        }
+        case FLOAT: {
+            double float_val = load<double>(kScalarOffset);
             out.write(reinterpret_cast<const char*>(&float_val), sizeof(float_val));
             break;
-        case TEXT: {
-            size_t len = text_val->length();
-            out.write(reinterpret_cast<const char*>(&len), sizeof(len));
-            out.write(text_val->c_str(), len);
-            break;
         }
+        case TEXT:
         case BLOB: {
-            size_t len = blob_val->size();
+            size_t len = byteSize();
             out.write(reinterpret_cast<const char*>(&len), sizeof(len));
             if (len > 0) {
-                out.write(reinterpret_cast<const char*>(blob_val->data()), len);
+                out.write(bytes(), len);
             }
             break;
         }
@@ -228,36 +255,37 @@ Value Value::deserialize(std::istream& in) {
     Value value;
     
     // Read the type
-    in.read(reinterpret_cast<char*>(&value.type), sizeof(value.type));
+    uint32_t tag = NULL_TYPE;
+    in.read(reinterpret_cast<char*>(&tag), sizeof(tag));
+    if (tag > BLOB) {
+        throw std::runtime_error("Invalid value type");
+    }
     
     // Read the data based on type
-    switch (value.type) {
-        case INT:
-            in.read(reinterpret_cast<char*>(&value.int_val), sizeof(value.int_val));
+    switch (static_cast<Type>(tag)) {
+        case INT: {
+            int int_val = 0;
+            in.read(reinterpret_cast<char*>(&int_val), sizeof(int_val));
+            value = Value(int_val);
             break;
-        case FLOAT:
-            in.read(reinterpret_cast<char*>(&value.float_val), sizeof(value.float_val));
-            break;
-        case TEXT: {
-            size_t len = 0;
-            in.read(reinterpret_cast<char*>(&len), sizeof(len));
-            
-            std::string str(len, '\0');
-            in.read(&str[0], len);
-            
-            value.text_val = new std::string(std::move(str));
+        }
+        case FLOAT: {
+            double float_val = 0;
+            in.read(reinterpret_cast<char*>(&float_val), sizeof(float_val));
+            value = Value(float_val);
             break;
         }
+        case TEXT:
         case BLOB: {
             size_t len = 0;
             in.read(reinterpret_cast<char*>(&len), sizeof(len));
             
-            std::vector<uint8_t> blob(len);
+            // Read straight into the value's own storage
+            value.type = static_cast<Type>(tag);
+            char* dest = value.allocateBytes(len);
             if (len > 0) {
-                in.read(reinterpret_cast<char*>(blob.data()), len);
+                in.read(dest, len);
             }
-            
-            value.blob_val = new std::vector<uint8_t>(std::move(blob));
             break;
         }
         case NULL_TYPE:
@@ -268,737 +296,5900 @@ Value Value::deserialize(std::istream& in) {
     return value;
 }
 
-// Table implementation
-Table::Table(const std::string& name, const std::vector<Column>& columns)
-    : name_(name), columns_(columns) {
-    // Validate there's at most one primary key
-    int primary_keys = 0;
-    for (const auto& col : columns) {
-        if (col.primary_key) {
-            primary_keys++;
-        }
+Value Value::fromBytes(Type type, const char* data, size_t size) {
+    if (type != TEXT && type != BLOB) {
+        throw std::runtime_error("Value type does not hold bytes");
     }
     
-    if (primary_keys > 1) {
-        throw std::runtime_error("Table can have at most one primary key");
+    Value value;
+    value.type = type;
+    value.assignBytes(data, size);
+    return value;
+}
+
+namespace {
+
+static_assert(sizeof(int) == sizeof(int32_t), "INT values are stored as int32_t columns");
+
+// Value type stored in a column of the given type
+Value::Type toValueType(Column::Type type) {
+    switch (type) {
+        case Column::INT:
+            return Value::INT;
+        case Column::FLOAT:
+            return Value::FLOAT;
+        case Column::TEXT:
+            return Value::TEXT;
+        case Column::BLOB:
+            return Value::BLOB;
     }
+    return Value::NULL_TYPE;
 }
 
-Table::~Table() = default;
+// Overwritten TEXT/BLOB bytes are reclaimed once they exceed both limits
+constexpr size_t kColumnGarbageMinBytes = 64 * 1024;
 
-bool Table::insert(const Row& row) {
-    // Check if row size matches columns size
-    if (row.size() != columns_.size()) {
-        return false;
+} // namespace
+
+// Column predicate implementation
+namespace {
+
+bool applyOp(ColumnPredicate::Op op, int cmp) {
+    switch (op) {
+        case ColumnPredicate::EQ: return cmp == 0;
+        case ColumnPredicate::NE: return cmp != 0;
+        case ColumnPredicate::LT: return cmp < 0;
+        case ColumnPredicate::LE: return cmp <= 0;
+        case ColumnPredicate::GT: return cmp > 0;
+        case ColumnPredicate::GE: return cmp >= 0;
     }
-    
-    // Begin write lock
-    std::unique_lock<std::shared_mutex> lock(mutex_);
-    
-    // Check for primary key constraint
-    int pk_index = findPrimaryKeyIndex();
-    if (pk_index >= 0) {
-        for (const auto& existing_row : rows_) {
-            if (existing_row[pk_index] == row[pk_index]) {
-                return false; // Primary key constraint violation
-            }
+    return false;
+}
+
+bool isNumeric(const Value& value) {
+    return value.type == Value::INT || value.type == Value::FLOAT;
+}
+
+double numericValue(const Value& value) {
+    return value.type == Value::INT ? value.asInt() : value.asFloat();
+}
+
+} // namespace
+
+bool ColumnPredicate::matches(const Value& cell) const {
+    if (isNumeric(cell) && isNumeric(constant)) {
+        if (cell.type == Value::INT && constant.type == Value::INT) {
+            int a = cell.asInt();
+            int b = constant.asInt();
+            return applyOp(op, (a > b) - (a < b));
+        }
+        
+        // Same operators as the double kernel, so NaN never compares equal
+        double a = numericValue(cell);
+        double b = numericValue(constant);
+        switch (op) {
+            case EQ: return a == b;
+            case NE: return a != b;
+            case LT: return a < b;
+            case LE: return a <= b;
+            case GT: return a > b;
+            case GE: return a >= b;
         }
+        return false;
     }
     
-    // Check for unique constraints
-    for (size_t i = 0; i < columns_.size(); i++) {
-        if (columns_[i].unique) {
-            for (const auto& existing_row : rows_) {
-                if (existing_row[i] == row[i]) {
-                    return false; // Unique constraint violation
-                }
-            }
-        }
+    if ((cell.type == Value::TEXT || cell.type == Value::BLOB) && cell.type == constant.type) {
+        std::string_view a = cell.type == Value::TEXT ? cell.textView() : cell.blobView();
+        std::string_view b = cell.type == Value::TEXT ? constant.textView() : constant.blobView();
+        return applyOp(op, a.compare(b));
     }
     
-    // All constraints passed, insert the row
-    rows_.push_back(row);
+    // NULL cells and other type mismatches never match
+    return false;
+}
+
+bool ColumnPredicate::parseOp(const std::string& text, Op& op) {
+    if (text == "=" || text == "==") {
+        op = EQ;
+    } else if (text == "!=" || text == "<>") {
+        op = NE;
+    } else if (text == "<") {
+        op = LT;
+    } else if (text == "<=") {
+        op = LE;
+    } else if (text == ">") {
+        op = GT;
+    } else if (text == ">=") {
+        op = GE;
+    } else {
+        return false;
+    }
     return true;
 }
 
-bool Table::update(const Row& row, const std::function<bool(const Row&)>& predicate) {
-    // Check if row size matches columns size
-    if (row.size() != columns_.size()) {
+// Aggregate implementation
+bool Aggregate::parse(const std::string& text, Aggregate& out) {
+    size_t open = text.find('(');
+    if (open == std::string::npos || text.size() < open + 2 || text.back() != ')') {
         return false;
     }
     
-    // Begin write lock
-    std::unique_lock<std::shared_mutex> lock(mutex_);
-    
-    bool updated = false;
-    for (auto& existing_row : rows_) {
-        if (predicate(existing_row)) {
-            existing_row = row;
-            updated = true;
-        }
+    std::string name = text.substr(0, open);
+    std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return std::toupper(c); });
+    std::string column = text.substr(open + 1, text.size() - open - 2);
+    Aggregate parsed;
+    if (name == "COUNT") {
+        parsed.function = COUNT;
+    } else if (name == "SUM") {
+        parsed.function = SUM;
+    } else if (name == "MIN") {
+        parsed.function = MIN;
+    } else if (name == "MAX") {
+        parsed.function = MAX;
+    } else if (name == "AVG") {
+        parsed.function = AVG;
+    } else {
+        return false;
     }
     
-    return updated;
+    // Only COUNT works on whole rows
+    if (column == "*") {
+        column.clear();
+    }
+    if (column.empty() && parsed.function != COUNT) {
+        return false;
+    }
+    parsed.column = column;
+    out = parsed;
+    return true;
 }
 
-bool Table::remove(const std::function<bool(const Row&)>& predicate) {
-    // Begin write lock
-    std::unique_lock<std::shared_mutex> lock(mutex_);
-    
-    size_t original_size = rows_.size();
-    rows_.erase(
-        std::remove_if(rows_.begin(), rows_.end(), predicate),
-        rows_.end()
-    );
-    
-    return rows_.size() < original_size;
+// Status implementation
+const char* Status::codeName(Code code) {
+    switch (code) {
+        case OK: return "OK";
+        case NOT_FOUND: return "NOT_FOUND";
+        case INVALID_ARGUMENT: return "INVALID_ARGUMENT";
+        case NO_MATCH: return "NO_MATCH";
+        case CONSTRAINT: return "CONSTRAINT";
+        case CONFLICT: return "CONFLICT";
+        case TIMEOUT: return "TIMEOUT";
+        case INACTIVE: return "INACTIVE";
+        case IO_ERROR: return "IO_ERROR";
+        case ABORTED: return "ABORTED";
+    }
+    return "UNKNOWN";
 }
 
-std::vector<Row> Table::select(const std::function<bool(const Row&)>& predicate) {
-    // Begin read lock
-    std::shared_lock<std::shared_mutex> lock(mutex_);
-    
-    std::vector<Row> result;
-    for (const auto& row : rows_) {
-        if (predicate(row)) {
-            result.push_back(row);
-        }
+std::string Status::toString() const {
+    std::string text = codeName(code);
+    if (!message.empty()) {
+        text += ": " + message;
     }
-    
-    return result;
+    return text;
 }
 
-const std::vector<Column>& Table::getColumns() const {
-    return columns_;
+// OrderBy implementation
+bool OrderBy::parse(const std::string& text, std::vector<OrderBy>& out) {
+    std::vector<OrderBy> parsed;
+    std::istringstream terms(text);
+    std::string term;
+    while (std::getline(terms, term, ',')) {
+        std::istringstream words(term);
+        OrderBy key;
+        std::string direction;
+        std::string extra;
+        if (!(words >> key.column) || (words >> direction && words >> extra)) {
+            return false;
+        }
+        
+        std::transform(direction.begin(), direction.end(), direction.begin(),
+                       [](unsigned char c) { return std::toupper(c); });
+        if (direction == "DESC") {
+            key.descending = true;
+        } else if (!direction.empty() && direction != "ASC") {
+            return false;
+        }
+        parsed.push_back(key);
+    }
+    
+    if (parsed.empty()) {
+        return false;
+    }
+    out = std::move(parsed);
+    return true;
 }
 
-const std::string& Table::getName() const {
-    return name_;
+// Columnar storage implementation
+bool Table::ColumnData::accepts(const Value& value) const {
+    return value.type == Value::NULL_TYPE || value.type == toValueType(type);
 }
 
-bool Table::beginRead(std::chrono::milliseconds timeout) {
-    auto end_time = std::chrono::steady_clock::now() + timeout;
-    while (std::chrono::steady_clock::now() < end_time) {
-        if (mutex_.try_lock_shared()) {
-            return true;
-        }
-        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+void Table::ColumnData::setNull(size_t pos, bool null) {
+    uint64_t mask = uint64_t(1) << (pos % 64);
+    if (null) {
+        nulls[pos / 64] |= mask;
+    } else {
+        nulls[pos / 64] &= ~mask;
     }
-    return false;
 }
 
-void Table::endRead() {
-    mutex_.unlock_shared();
+uint64_t Table::ColumnData::appendBytes(std::string_view data) {
+    uint64_t offset = bytes.size();
+    bytes.insert(bytes.end(), data.begin(), data.end());
+    return offset;
 }
 
-bool Table::beginWrite(std::chrono::milliseconds timeout) {
-    auto end_time = std::chrono::steady_clock::now() + timeout;
-    while (std::chrono::steady_clock::now() < end_time) {
-        if (mutex_.try_lock()) {
-            return true;
+void Table::ColumnData::append(const Value& value) {
+    size_t pos = size++;
+    if (nulls.size() * 64 < size) {
+        nulls.push_back(0);
+    }
+    
+    bool null = value.type == Value::NULL_TYPE;
+    setNull(pos, null);
+    
+    switch (type) {
+        case Column::INT:
+            ints.push_back(null ? 0 : value.asInt());
+            break;
+        case Column::FLOAT:
+            floats.push_back(null ? 0.0 : value.asFloat());
+            break;
+        case Column::TEXT:
+        case Column::BLOB: {
+            std::string_view data = null ? std::string_view() :
+                (type == Column::TEXT ? value.textView() : value.blobView());
+            offsets.push_back(appendBytes(data));
+            lengths.push_back(static_cast<uint32_t>(data.size()));
+            break;
         }
-        std::this_thread::sleep_for(std::chrono::milliseconds(1));
     }
-    return false;
 }
 
-void Table::endWrite() {
-    mutex_.unlock();
-}
-
-int Table::findPrimaryKeyIndex() const {
-    for (size_t i = 0; i < columns_.size(); i++) {
-        if (columns_[i].primary_key) {
-            return static_cast<int>(i);
+void Table::ColumnData::set(size_t pos, const Value& value) {
+    bool null = value.type == Value::NULL_TYPE;
+    setNull(pos, null);
+    
+    switch (type) {
+        case Column::INT:
+            ints[pos] = null ? 0 : value.asInt();
+            break;
+        case Column::FLOAT:
+            floats[pos] = null ? 0.0 : value.asFloat();
+            break;
+        case Column::TEXT:
+        case Column::BLOB: {
+            std::string_view data = null ? std::string_view() :
+                (type == Column::TEXT ? value.textView() : value.blobView());
+            
+            // Shrinking cells are rewritten in place, growing ones move to the end
+            if (data.size() <= lengths[pos]) {
+                std::memcpy(bytes.data() + offsets[pos], data.data(), data.size());
+                garbage_bytes += lengths[pos] - data.size();
+            } else {
+                garbage_bytes += lengths[pos];
+                offsets[pos] = appendBytes(data);
+            }
+            lengths[pos] = static_cast<uint32_t>(data.size());
+            
+            if (garbage_bytes > kColumnGarbageMinBytes && garbage_bytes > bytes.size() / 2) {
+                compact(std::vector<bool>(size, true));
+            }
+            break;
         }
     }
-    return -1;
 }
 
-// Table serialization
-void Table::serialize(std::ostream& out) const {
-    // Making a copy of the data under a shared lock
-    std::vector<Row> rows_copy;
-    std::vector<Column> columns_copy;
-    std::string name_copy;
-    
-    {
-        std::shared_lock<std::shared_mutex> lock(const_cast<std::shared_mutex&>(mutex_));
-        rows_copy = rows_;
-        columns_copy = columns_;
-        name_copy = name_;
+Value Table::ColumnData::get(size_t pos) const {
+    if (isNull(pos)) {
+        return Value();
     }
     
-    // Write table name
-    size_t name_len = name_copy.length();
-    out.write(reinterpret_cast<const char*>(&name_len), sizeof(name_len));
-    out.write(name_copy.c_str(), name_len);
+    switch (type) {
+        case Column::INT:
+            return Value(static_cast<int>(ints[pos]));
+        case Column::FLOAT:
+            return Value(floats[pos]);
+        case Column::TEXT:
+        case Column::BLOB:
+            return Value::fromBytes(toValueType(type), bytes.data() + offsets[pos], lengths[pos]);
+    }
     
-    // Write columns
-    size_t col_count = columns_copy.size();
-    out.write(reinterpret_cast<const char*>(&col_count), sizeof(col_count));
+    return Value();
+}
+
+void Table::ColumnData::compact(const std::vector<bool>& keep) {
+    ColumnData kept;
+    kept.type = type;
     
-    for (const auto& col : columns_copy) {
-        // Write column name
-        size_t col_name_len = col.name.length();
-        out.write(reinterpret_cast<const char*>(&col_name_len), sizeof(col_name_len));
-        out.write(col.name.c_str(), col_name_len);
+    for (size_t pos = 0; pos < size; pos++) {
+        if (!keep[pos]) {
+            continue;
+        }
         
-        // Write column type
-        out.write(reinterpret_cast<const char*>(&col.type), sizeof(col.type));
+        size_t new_pos = kept.size++;
+        if (kept.nulls.size() * 64 < kept.size) {
+            kept.nulls.push_back(0);
+        }
+        kept.setNull(new_pos, isNull(pos));
         
-        // Write constraints
-        out.write(reinterpret_cast<const char*>(&col.primary_key), sizeof(col.primary_key));
-        out.write(reinterpret_cast<const char*>(&col.not_null), sizeof(col.not_null));
-        out.write(reinterpret_cast<const char*>(&col.unique), sizeof(col.unique));
+        switch (type) {
+            case Column::INT:
+                kept.ints.push_back(ints[pos]);
+                break;
+            case Column::FLOAT:
+                kept.floats.push_back(floats[pos]);
+                break;
+            case Column::TEXT:
+            case Column::BLOB:
+                kept.offsets.push_back(kept.appendBytes(std::string_view(bytes.data() + offsets[pos], lengths[pos])));
+                kept.lengths.push_back(lengths[pos]);
+                break;
+        }
     }
     
-    // Write rows
-    size_t row_count = rows_copy.size();
-    out.write(reinterpret_cast<const char*>(&row_count), sizeof(row_count));
-    
-    for (const auto& row : rows_copy) {
-        // Write values in the row
-        size_t value_count = row.size();
-        out.write(reinterpret_cast<const char*>(&value_count), sizeof(value_count));
+    *this = std::move(kept);
+}
+
+ColumnView Table::ColumnData::view() const {
+    ColumnView view;
+    view.type = type;
+    view.size = size;
+    view.ints = ints.data();
+    view.floats = floats.data();
+    view.offsets = offsets.data();
+    view.lengths = lengths.data();
+    view.bytes = bytes.data();
+    view.nulls = nulls.data();
+    return view;
+}
+
+// Copy-on-write chunks
+template <typename T>
+void Table::Chunks<T>::push_back(T value) {
+    if ((size_ & (kChunkRows - 1)) == 0) {
+        auto chunk = std::make_shared<std::vector<T>>();
+        chunk->reserve(kChunkRows);
+        chunks_.push_back(std::move(chunk));
+    }
+    own(chunks_.size() - 1).push_back(std::move(value));
+    size_++;
+}
+
+template <typename T>
+void Table::Chunks<T>::truncate(size_t count) {
+    chunks_.resize((count + kChunkRows - 1) >> kChunkShift);
+    if ((count & (kChunkRows - 1)) != 0) {
+        own(chunks_.size() - 1).resize(count & (kChunkRows - 1));
+    }
+    size_ = count;
+}
+
+template <typename T>
+std::vector<T>& Table::Chunks<T>::own(size_t chunk) {
+    auto& values = chunks_[chunk];
+    if (values.use_count() > 1) {
+        auto copy = std::make_shared<std::vector<T>>();
+        copy->reserve(kChunkRows);
+        copy->assign(values->begin(), values->end());
+        values = std::move(copy);
+    } else {
+        // Pairs with the release when a snapshot drops its reference, so its
+        // last reads of this chunk happen before our writes
+        std::atomic_thread_fence(std::memory_order_acquire);
+    }
+    return *values;
+}
+
+Table::ColumnData& Table::mutableColumn(size_t index) {
+    auto& column = column_data_[index];
+    if (column.use_count() > 1) {
+        column = std::make_shared<ColumnData>(*column);
+    } else {
+        std::atomic_thread_fence(std::memory_order_acquire);
+    }
+    return *column;
+}
+
+// Table implementation
+template <typename Fn>
+void Table::forEachRow(Fn&& fn) const {
+    if (layout_ == ROW_ORIENTED) {
+        for (size_t pos = 0; pos < rows_.size(); pos++) {
+            if (!fn(pos, rows_[pos])) {
+                return;
+            }
+        }
+        return;
+    }
+    
+    Row scratch(column_data_.size());
+    size_t count = rowCount();
+    for (size_t pos = 0; pos < count; pos++) {
+        for (size_t i = 0; i < column_data_.size(); i++) {
+            scratch[i] = column_data_[i]->get(pos);
+        }
+        if (!fn(pos, static_cast<const Row&>(scratch))) {
+            return;
+        }
+    }
+}
+
+template <typename Fn>
+void Table::forEachVisible(const VersionView& view, Fn&& fn) const {
+    forEachVisible(view, 0, rowCount(), fn);
+}
+
+template <typename Fn>
+void Table::forEachVisible(const VersionView& view, size_t begin, size_t end, Fn&& fn) const {
+    bool all_visible = allVisible(view);
+    Row scratch;
+    for (size_t pos = begin; pos < end; pos++) {
+        if (!all_visible && !isVisible(pos, view)) {
+            continue;
+        }
+        if (layout_ == ROW_ORIENTED) {
+            if (!fn(pos, rows_[pos])) {
+                return;
+            }
+            continue;
+        }
+        
+        // Only materialize the versions the view sees
+        scratch.resize(column_data_.size());
+        for (size_t i = 0; i < column_data_.size(); i++) {
+            scratch[i] = column_data_[i]->get(pos);
+        }
+        if (!fn(pos, static_cast<const Row&>(scratch))) {
+            return;
+        }
+    }
+}
+
+template <typename Fn>
+void Table::forEachMorsel(size_t count, Fn&& fn) const {
+    size_t morsels = (count + kMorselRows - 1) / kMorselRows;
+    auto run = [&](size_t index) {
+        fn(index, index * kMorselRows, std::min(count, (index + 1) * kMorselRows));
+    };
+    if (pool_ && morsels > 1) {
+        pool_->run(morsels, run);
+        return;
+    }
+    for (size_t index = 0; index < morsels; index++) {
+        run(index);
+    }
+}
+
+template <typename Fn>
+void Table::runParallel(size_t count, const Fn& fn) const {
+    if (pool_) {
+        pool_->run(count, fn);
+        return;
+    }
+    
+    // Standalone tables start a thread per task
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < count; i++) {
+        threads.emplace_back([&fn, i] { fn(i); });
+    }
+    if (count > 0) {
+        fn(0);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+Table::VersionView Table::latestView() const {
+    return {clock_->visible(), kNoTransaction};
+}
+
+bool Table::isVisible(size_t pos, const VersionView& view) const {
+    const Version& version = versions_[pos];
+    bool begun = version.begin <= view.read_ts || version.begin == view.self;
+    bool ended = version.end <= view.read_ts || version.end == view.self;
+    return begun && !ended;
+}
+
+bool Table::allVisible(const VersionView& view) const {
+    return unsettled_ == 0 && max_begin_ <= view.read_ts;
+}
+
+bool Table::Snapshot::visible(size_t pos) const {
+    const Version& version = versions[pos];
+    return all_visible || (version.begin <= read_ts && version.end > read_ts);
+}
+
+size_t Table::Snapshot::countVisible() const {
+    if (!shards.empty()) {
+        size_t count = 0;
+        for (const auto& shard : shards) {
+            count += shard.countVisible();
+        }
+        return count;
+    }
+    if (all_visible) {
+        return positions;
+    }
+    size_t count = 0;
+    for (size_t pos = 0; pos < positions; pos++) {
+        count += visible(pos) ? 1 : 0;
+    }
+    return count;
+}
+
+Table::Table(const std::string& name, const std::vector<Column>& columns, Layout layout, size_t shards)
+    : name_(name), columns_(columns), layout_(layout), clock_(std::make_shared<VersionClock>()) {
+    // Validate there's at most one primary key
+    int primary_keys = 0;
+    for (const auto& col : columns) {
+        if (col.primary_key) {
+            primary_keys++;
+        }
+    }
+    
+    if (primary_keys > 1) {
+        throw std::runtime_error("Table can have at most one primary key");
+    }
+    
+    if (shards > 1) {
+        // Shards only see their own rows, so only the key that picks the shard can be enforced
+        if (primary_keys == 0) {
+            throw std::runtime_error("Sharded table needs a primary key");
+        }
+        for (const auto& col : columns) {
+            if (col.unique && !col.primary_key) {
+                throw std::runtime_error("Sharded table cannot have UNIQUE columns besides the primary key");
+            }
+        }
+        
+        for (size_t i = 0; i < shards; i++) {
+            shards_.push_back(std::make_unique<Table>(name, columns, layout));
+            shards_.back()->clock_ = clock_;
+        }
+        return;
+    }
+    
+    // One hash index per PRIMARY KEY or UNIQUE column
+    for (size_t i = 0; i < columns_.size(); i++) {
+        if (columns_[i].primary_key || columns_[i].unique) {
+            key_indexes_.push_back({i, {}});
+        }
+    }
+    
+    if (layout_ == COLUMNAR) {
+        for (size_t i = 0; i < columns_.size(); i++) {
+            column_data_.push_back(std::make_shared<ColumnData>());
+            column_data_[i]->type = columns_[i].type;
+        }
+    }
+}
+
+Table::~Table() = default;
+
+uint64_t Table::nextId() {
+    static std::atomic<uint64_t> next{1};
+    return next.fetch_add(1, std::memory_order_relaxed);
+}
+
+uint64_t Table::changeCount() const {
+    uint64_t changes = changes_;
+    for (const auto& shard : shards_) {
+        changes += shard->changes_;
+    }
+    return changes;
+}
+
+std::vector<Table*> Table::parts() const {
+    if (shards_.empty()) {
+        return {const_cast<Table*>(this)};
+    }
+    std::vector<Table*> parts;
+    for (const auto& shard : shards_) {
+        parts.push_back(shard.get());
+    }
+    return parts;
+}
+
+Table* Table::shardFor(const Row& row) {
+    return shards_.empty() ? this : shardForKey(row[findPrimaryKeyIndex()]);
+}
+
+Table* Table::shardForKey(const Value& key) {
+    return shards_.empty() ? this : shards_[shardIndex(key)].get();
+}
+
+size_t Table::shardIndex(const Value& key) const {
+    return key.hash() % shards_.size();
+}
+
+template <typename Lock>
+void Table::lockParts(std::vector<Lock>& locks) {
+    for (Table* part : parts()) {
+        locks.emplace_back(part->mutex_);
+    }
+}
+
+template <typename Lock>
+bool Table::lockParts(std::vector<Lock>& locks, std::chrono::milliseconds timeout) {
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    for (Table* part : parts()) {
+        locks.emplace_back(part->mutex_, deadline);
+        if (!locks.back().owns_lock()) {
+            locks.clear();
+            return false;
+        }
+    }
+    return true;
+}
+
+template <typename Fn>
+auto Table::autocommit(Fn&& write) {
+    // With no snapshot open nobody can see the old state, so write in place.
+    // Versions left over from the last open snapshot are all dead by now.
+    if (clock_->quiescent()) {
+        if (unsettled_ > 0 || !shards_.empty()) {
+            collectGarbage();
+        }
+        return write(VersionView{clock_->visible(), 0});
+    }
+    
+    // Otherwise the write is a transaction of its own that commits at once
+    uint64_t ts = clock_->beginCommit();
+    auto result = write(VersionView{ts - 1, ts});
+    clock_->endCommit(ts);
+    maybeCollectGarbage();
+    return result;
+}
+
+bool Table::insert(const Row& row) {
+    return insert(Row(row));
+}
+
+bool Table::insert(Row&& row) {
+    // Check if row size matches columns size
+    if (row.size() != columns_.size()) {
+        return false;
+    }
+    if (!shards_.empty()) {
+        return shardFor(row)->insert(std::move(row));
+    }
+    
+    // Begin write lock
+    std::unique_lock<TableLock> lock(mutex_);
+    
+    return autocommit([&](const VersionView& view) { return insertRow(std::move(row), view); }) == Status::OK;
+}
+
+bool Table::insertBatch(std::vector<Row>&& rows) {
+    for (const auto& row : rows) {
+        if (row.size() != columns_.size()) {
+            return false;
+        }
+    }
+    if (rows.empty()) {
+        return true;
+    }
+    
+    // Begin write lock, once for the whole batch
+    std::vector<std::unique_lock<TableLock>> locks;
+    lockParts(locks);
+    
+    return autocommit([&](const VersionView& view) { return insertRows(rows, view); }) == Status::OK;
+}
+
+bool Table::update(const Row& row, const std::function<bool(const Row&)>& predicate) {
+    return update(Row(row), predicate);
+}
+
+bool Table::update(Row&& row, const std::function<bool(const Row&)>& predicate) {
+    // Check if row size matches columns size
+    if (row.size() != columns_.size()) {
+        return false;
+    }
+    
+    // Begin write lock. A changed key can move the row to another shard, so a
+    // sharded table locks all of them.
+    std::vector<std::unique_lock<TableLock>> locks;
+    lockParts(locks);
+    
+    return autocommit([&](const VersionView& view) { return updateRows(std::move(row), predicate, view); }) ==
+           Status::OK;
+}
+
+bool Table::updateColumns(const ColumnChanges& changes, const std::function<bool(const Row&)>& predicate) {
+    // Begin write lock
+    std::vector<std::unique_lock<TableLock>> locks;
+    lockParts(locks);
+    
+    return autocommit([&](const VersionView& view) { return changeRows(changes, predicate, view); }) == Status::OK;
+}
+
+bool Table::remove(const std::function<bool(const Row&)>& predicate) {
+    // Begin write lock
+    std::vector<std::unique_lock<TableLock>> locks;
+    lockParts(locks);
+    
+    return autocommit([&](const VersionView& view) { return eraseRows(predicate, view); }) == Status::OK;
+}
+
+namespace {
+
+// Concatenate per-shard results in shard order
+std::vector<Row> concatRows(std::vector<std::vector<Row>>& parts) {
+    size_t total = 0;
+    for (const auto& part : parts) {
+        total += part.size();
+    }
+    std::vector<Row> result;
+    result.reserve(total);
+    for (auto& part : parts) {
+        std::move(part.begin(), part.end(), std::back_inserter(result));
+    }
+    return result;
+}
+
+} // namespace
+
+std::vector<Row> Table::select(const std::function<bool(const Row&)>& predicate) {
+    if (!shards_.empty()) {
+        // Shards are filtered in parallel
+        std::vector<std::vector<Row>> parts(shards_.size());
+        runParallel(shards_.size(), [&](size_t i) { parts[i] = shards_[i]->select(predicate); });
+        return concatRows(parts);
+    }
+    
+    // Begin read lock
+    std::shared_lock<TableLock> lock(mutex_);
+    
+    return selectRows(predicate, latestView());
+}
+
+std::vector<Row> Table::project(const std::vector<std::string>& columns,
+                                const std::function<bool(const Row&)>& predicate) {
+    std::vector<size_t> indexes;
+    if (!findColumnIndexes(columns, indexes)) {
+        return {};
+    }
+    
+    // Copy out only the requested cells
+    std::vector<Row> result;
+    scan(predicate, [&result, &indexes](const Row& row) {
+        Row projected;
+        projected.reserve(indexes.size());
+        for (size_t index : indexes) {
+            projected.push_back(row[index]);
+        }
+        result.push_back(std::move(projected));
+        return true;
+    });
+    
+    return result;
+}
+
+size_t Table::scan(const std::function<bool(const Row&)>& predicate, const RowVisitor& visitor) {
+    if (!shards_.empty()) {
+        // One shard at a time, the visitor is not required to be thread-safe
+        size_t visited = 0;
+        bool stopped = false;
+        RowVisitor until_stopped = [&](const Row& row) { return !(stopped = !visitor(row)); };
+        for (size_t i = 0; i < shards_.size() && !stopped; i++) {
+            visited += shards_[i]->scan(predicate, until_stopped);
+        }
+        return visited;
+    }
+    
+    // Begin read lock
+    std::shared_lock<TableLock> lock(mutex_);
+    
+    return scanRows(predicate, visitor, latestView());
+}
+
+std::vector<Row> Table::lookup(const std::string& column, const Value& value) {
+    int col_index = findColumnIndex(column);
+    if (col_index < 0) {
+        return {};
+    }
+    if (!shards_.empty()) {
+        // A primary key value lives in one shard, other columns in any
+        if (col_index == findPrimaryKeyIndex()) {
+            return shardForKey(value)->lookup(column, value);
+        }
+        std::vector<std::vector<Row>> parts;
+        for (const auto& shard : shards_) {
+            parts.push_back(shard->lookup(column, value));
+        }
+        return concatRows(parts);
+    }
+    
+    // Begin read lock
+    std::shared_lock<TableLock> lock(mutex_);
+    
+    std::vector<Row> result;
+    for (size_t pos : lookupPositions(col_index, value, latestView())) {
+        result.push_back(rowAt(pos));
+    }
+    countScan(result.size(), result.size());
+    
+    return result;
+}
+
+std::vector<Row> Table::range(const std::string& column, const Value& lo, const Value& hi) {
+    int col_index = findColumnIndex(column);
+    if (col_index < 0) {
+        return {};
+    }
+    if (!shards_.empty()) {
+        // Merge the shards back into value order
+        std::vector<std::vector<Row>> parts;
+        for (const auto& shard : shards_) {
+            parts.push_back(shard->range(column, lo, hi));
+        }
+        std::vector<Row> result = concatRows(parts);
+        std::stable_sort(result.begin(), result.end(), [col_index](const Row& a, const Row& b) {
+            return a[col_index] < b[col_index];
+        });
+        return result;
+    }
+    
+    // Begin read lock
+    std::shared_lock<TableLock> lock(mutex_);
+    
+    std::vector<Row> result;
+    for (size_t pos : rangePositions(col_index, lo, hi, latestView())) {
+        result.push_back(rowAt(pos));
+    }
+    countScan(result.size(), result.size());
+    
+    return result;
+}
+
+std::vector<Row> Table::select(const ColumnPredicate& predicate) {
+    if (!shards_.empty()) {
+        std::vector<std::vector<Row>> parts(shards_.size());
+        runParallel(shards_.size(), [&](size_t i) { parts[i] = shards_[i]->select(predicate); });
+        return concatRows(parts);
+    }
+    
+    std::vector<Row> result;
+    scan(predicate, [&result](const Row& row) {
+        result.push_back(row);
+        return true;
+    });
+    
+    return result;
+}
+
+size_t Table::scan(const ColumnPredicate& predicate, const RowVisitor& visitor) {
+    if (!shards_.empty()) {
+        size_t visited = 0;
+        bool stopped = false;
+        RowVisitor until_stopped = [&](const Row& row) { return !(stopped = !visitor(row)); };
+        for (size_t i = 0; i < shards_.size() && !stopped; i++) {
+            visited += shards_[i]->scan(predicate, until_stopped);
+        }
+        return visited;
+    }
+    
+    // Begin read lock
+    std::shared_lock<TableLock> lock(mutex_);
+    
+    std::vector<uint64_t> selection;
+    if (!evaluate(predicate, latestView(), selection)) {
+        return 0;
+    }
+    
+    size_t visited = scanSelected(selection, visitor);
+    countScan(rowCount(), visited);
+    return visited;
+}
+
+size_t Table::count(const ColumnPredicate& predicate) {
+    if (!shards_.empty()) {
+        std::vector<size_t> counts(shards_.size());
+        runParallel(shards_.size(), [&](size_t i) { counts[i] = shards_[i]->count(predicate); });
+        size_t total = 0;
+        for (size_t count : counts) {
+            total += count;
+        }
+        return total;
+    }
+    
+    // Begin read lock
+    std::shared_lock<TableLock> lock(mutex_);
+    
+    std::vector<uint64_t> selection;
+    if (!evaluate(predicate, latestView(), selection)) {
+        return 0;
+    }
+    
+    size_t matched = kernels::countBits(selection.data(), selection.size());
+    countScan(rowCount(), matched);
+    return matched;
+}
+
+bool Table::remove(const ColumnPredicate& predicate) {
+    // Begin write lock
+    std::vector<std::unique_lock<TableLock>> locks;
+    lockParts(locks);
+    
+    return autocommit([&](const VersionView& view) {
+        std::vector<Table*> targets = parts();
+        std::vector<std::vector<size_t>> positions(targets.size());
+        bool matched = false;
+        for (size_t i = 0; i < targets.size(); i++) {
+            std::vector<uint64_t> selection;
+            if (!targets[i]->evaluate(predicate, view, selection)) {
+                return false;
+            }
+            kernels::forEachSetBit(selection.data(), selection.size(), [&](size_t pos) {
+                positions[i].push_back(pos);
+                return true;
+            });
+            matched = matched || !positions[i].empty();
+        }
+        
+        // Check every shard for conflicts before removing from any of them
+        for (size_t i = 0; i < targets.size(); i++) {
+            for (size_t pos : positions[i]) {
+                if (targets[i]->versions_[pos].end != kInfinity) {
+                    return false;
+                }
+            }
+        }
+        for (size_t i = 0; i < targets.size(); i++) {
+            if (!positions[i].empty()) {
+                targets[i]->erasePositions(positions[i], view);
+            }
+        }
+        return matched;
+    });
+}
+
+namespace {
+
+struct RowHash {
+    size_t operator()(const Row& row) const {
+        size_t seed = row.size();
+        for (const Value& value : row) {
+            seed ^= value.hash() + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2);
+        }
+        return seed;
+    }
+};
+
+// Numbers compare by value across INT and FLOAT, other cells by Value order
+bool aggregateLess(const Value& a, const Value& b) {
+    if (isNumeric(a) && isNumeric(b)) {
+        return numericValue(a) < numericValue(b);
+    }
+    return a < b;
+}
+
+} // namespace
+
+struct Table::Groups {
+    struct Spec {
+        Aggregate::Function function;
+        int column;   // -1 counts rows
+    };
+    
+    struct Accumulator {
+        int64_t count = 0;
+        int64_t int_sum = 0;
+        double sum = 0;
+        bool all_int = true;
+        Value extreme;   // MIN or MAX so far, NULL until a cell is seen
+    };
+    
+    std::vector<size_t> keys;
+    std::vector<Spec> specs;
+    std::vector<Accumulator> total;   // Without group columns
+    std::unordered_map<Row, std::vector<Accumulator>, RowHash> groups;
+    
+    Groups emptyCopy() const {
+        Groups copy;
+        copy.keys = keys;
+        copy.specs = specs;
+        copy.total.resize(specs.size());
+        return copy;
+    }
+    
+    void add(const Row& row) {
+        std::vector<Accumulator>* accumulators = &total;
+        if (!keys.empty()) {
+            Row key;
+            key.reserve(keys.size());
+            for (size_t column : keys) {
+                key.push_back(row[column]);
+            }
+            auto it = groups.find(key);
+            if (it == groups.end()) {
+                it = groups.emplace(std::move(key), std::vector<Accumulator>(specs.size())).first;
+            }
+            accumulators = &it->second;
+        }
+        
+        for (size_t i = 0; i < specs.size(); i++) {
+            const Spec& spec = specs[i];
+            Accumulator& acc = (*accumulators)[i];
+            if (spec.column < 0) {
+                acc.count++;
+                continue;
+            }
+            
+            const Value& cell = row[spec.column];
+            if (cell.type == Value::NULL_TYPE) {
+                continue;
+            }
+            switch (spec.function) {
+                case Aggregate::COUNT:
+                    break;
+                case Aggregate::SUM:
+                case Aggregate::AVG:
+                    // Cells a ROW_ORIENTED table holds against its column type are skipped
+                    if (!isNumeric(cell)) {
+                        continue;
+                    }
+                    if (cell.type == Value::INT) {
+                        acc.int_sum += cell.asInt();
+                    } else {
+                        acc.all_int = false;
+                    }
+                    acc.sum += numericValue(cell);
+                    break;
+                case Aggregate::MIN:
+                    if (acc.extreme.type == Value::NULL_TYPE || aggregateLess(cell, acc.extreme)) {
+                        acc.extreme = cell;
+                    }
+                    break;
+                case Aggregate::MAX:
+                    if (acc.extreme.type == Value::NULL_TYPE || aggregateLess(acc.extreme, cell)) {
+                        acc.extreme = cell;
+                    }
+                    break;
+            }
+            acc.count++;
+        }
+    }
+    
+    void merge(Groups& other) {
+        mergeInto(total, other.total);
+        for (auto& [key, accumulators] : other.groups) {
+            auto it = groups.find(key);
+            if (it == groups.end()) {
+                groups.emplace(key, std::move(accumulators));
+            } else {
+                mergeInto(it->second, accumulators);
+            }
+        }
+    }
+    
+    void mergeInto(std::vector<Accumulator>& into, const std::vector<Accumulator>& from) const {
+        for (size_t i = 0; i < specs.size(); i++) {
+            Accumulator& acc = into[i];
+            const Accumulator& part = from[i];
+            acc.count += part.count;
+            acc.int_sum += part.int_sum;
+            acc.sum += part.sum;
+            acc.all_int = acc.all_int && part.all_int;
+            if (part.extreme.type != Value::NULL_TYPE &&
+                (acc.extreme.type == Value::NULL_TYPE ||
+                 (specs[i].function == Aggregate::MIN ? aggregateLess(part.extreme, acc.extreme)
+                                                       : aggregateLess(acc.extreme, part.extreme)))) {
+                acc.extreme = part.extreme;
+            }
+        }
+    }
+};
+
+std::vector<Row> Table::select(const Expression& filter) {
+    if (!shards_.empty()) {
+        std::vector<std::vector<Row>> parts(shards_.size());
+        runParallel(shards_.size(), [&](size_t i) { parts[i] = shards_[i]->select(filter); });
+        return concatRows(parts);
+    }
+    
+    std::vector<Row> result;
+    scan(filter, [&result](const Row& row) {
+        result.push_back(row);
+        return true;
+    });
+    
+    return result;
+}
+
+size_t Table::scan(const Expression& filter, const RowVisitor& visitor) {
+    if (!shards_.empty()) {
+        size_t visited = 0;
+        bool stopped = false;
+        RowVisitor until_stopped = [&](const Row& row) { return !(stopped = !visitor(row)); };
+        for (size_t i = 0; i < shards_.size() && !stopped; i++) {
+            visited += shards_[i]->scan(filter, until_stopped);
+        }
+        return visited;
+    }
+    
+    expression::Evaluator evaluator;
+    if (!expression::compile(filter, columns_, evaluator)) {
+        return 0;
+    }
+    
+    // Begin read lock
+    std::shared_lock<TableLock> lock(mutex_);
+    
+    return scanFiltered(filter, evaluator, visitor, latestView());
+}
+
+size_t Table::count(const Expression& filter) {
+    if (!shards_.empty()) {
+        std::vector<size_t> counts(shards_.size());
+        runParallel(shards_.size(), [&](size_t i) { counts[i] = shards_[i]->count(filter); });
+        size_t total = 0;
+        for (size_t count : counts) {
+            total += count;
+        }
+        return total;
+    }
+    
+    return scan(filter, [](const Row&) { return true; });
+}
+
+std::string Table::explain(const Expression& filter) {
+    expression::Evaluator evaluator;
+    if (!expression::compile(filter, columns_, evaluator)) {
+        return "";
+    }
+    if (!shards_.empty()) {
+        // Every shard has the same indexes, so they all plan alike
+        return std::to_string(shards_.size()) + " shards, each " + shards_[0]->explain(filter);
+    }
+    
+    // Begin read lock
+    std::shared_lock<TableLock> lock(mutex_);
+    
+    return describe(planAccess(filter));
+}
+
+bool Table::aggregate(const std::vector<Aggregate>& aggregates, const std::vector<std::string>& group_by,
+                      const Expression& filter, std::vector<Row>& out) {
+    Groups groups;
+    expression::Evaluator evaluator;
+    if (!prepareAggregate(aggregates, group_by, groups) || !expression::compile(filter, columns_, evaluator)) {
+        return false;
+    }
+    
+    if (!shards_.empty()) {
+        // Shards aggregate in parallel, each under its own read lock
+        std::vector<Groups> parts(shards_.size(), groups.emptyCopy());
+        runParallel(shards_.size(), [&](size_t i) {
+            std::shared_lock<TableLock> lock(shards_[i]->mutex_);
+            shards_[i]->collectGroups(filter, evaluator, shards_[i]->latestView(), parts[i]);
+        });
+        for (auto& part : parts) {
+            groups.merge(part);
+        }
+    } else {
+        // Begin read lock
+        std::shared_lock<TableLock> lock(mutex_);
+        
+        collectGroups(filter, evaluator, latestView(), groups);
+    }
+    
+    finishGroups(groups, out);
+    return true;
+}
+
+// Best rows of an ordered select so far. Until keep rows are held they are
+// simply appended; from then on they form a heap with the row that sorts
+// last on top, which each better row replaces.
+struct Table::TopRows {
+    struct Key {
+        size_t column;
+        bool descending;
+    };
+    
+    // A kept row and where it came from, which breaks ties in table order
+    struct Entry {
+        Row row;
+        size_t part;
+        size_t order;
+    };
+    
+    std::vector<Key> keys;
+    size_t keep = 0;      // offset + limit, at most kNoLimit
+    size_t part = 0;      // Shard of the rows added next
+    std::vector<Entry> entries;
+    
+    TopRows emptyCopy() const {
+        TopRows copy;
+        copy.keys = keys;
+        copy.keep = keep;
+        copy.part = part;
+        return copy;
+    }
+    
+    bool before(const Row& row, size_t row_part, size_t order, const Entry& entry) const {
+        for (const Key& key : keys) {
+            const Value& a = row[key.column];
+            const Value& b = entry.row[key.column];
+            if (a < b) {
+                return !key.descending;
+            }
+            if (b < a) {
+                return key.descending;
+            }
+        }
+        return row_part != entry.part ? row_part < entry.part : order < entry.order;
+    }
+    bool before(const Entry& a, const Entry& b) const { return before(a.row, a.part, a.order, b); }
+    
+    // Positions within a table order its rows, the row is only copied if kept
+    void add(const Row& row, size_t order) {
+        if (entries.size() == keep && (keep == 0 || !before(row, part, order, entries.front()))) {
+            return;
+        }
+        insert(Entry{row, part, order});
+    }
+    
+    void insert(Entry&& entry) {
+        auto last = [this](const Entry& a, const Entry& b) { return before(a, b); };
+        if (entries.size() < keep) {
+            entries.push_back(std::move(entry));
+            if (entries.size() == keep) {
+                std::make_heap(entries.begin(), entries.end(), last);
+            }
+        } else if (keep > 0 && before(entry, entries.front())) {
+            std::pop_heap(entries.begin(), entries.end(), last);
+            entries.back() = std::move(entry);
+            std::push_heap(entries.begin(), entries.end(), last);
+        }
+    }
+    
+    void merge(TopRows& other) {
+        for (auto& entry : other.entries) {
+            insert(std::move(entry));
+        }
+    }
+};
+
+std::vector<Row> Table::select(const Expression& filter, const std::vector<OrderBy>& order, size_t limit,
+                               size_t offset) {
+    TopRows top;
+    expression::Evaluator evaluator;
+    if (!prepareOrder(order, limit, offset, top) || !expression::compile(filter, columns_, evaluator)) {
+        return {};
+    }
+    
+    if (!shards_.empty()) {
+        // Shards keep their best rows in parallel, each under its own read lock
+        std::vector<TopRows> parts(shards_.size(), top.emptyCopy());
+        runParallel(shards_.size(), [&](size_t i) {
+            parts[i].part = i;
+            std::shared_lock<TableLock> lock(shards_[i]->mutex_);
+            shards_[i]->collectTop(filter, evaluator, shards_[i]->latestView(), parts[i]);
+        });
+        for (auto& part : parts) {
+            top.merge(part);
+        }
+    } else {
+        // Begin read lock
+        std::shared_lock<TableLock> lock(mutex_);
+        
+        collectTop(filter, evaluator, latestView(), top);
+    }
+    
+    std::vector<Row> result;
+    finishTop(top, limit, offset, result);
+    return result;
+}
+
+size_t Table::join(const std::string& column, Table& right, const std::string& right_column,
+                  const JoinVisitor& visitor, const Expression& filter, const Expression& right_filter) {
+    int col_index = findColumnIndex(column);
+    int right_index = right.findColumnIndex(right_column);
+    expression::Evaluator evaluator;
+    expression::Evaluator right_evaluator;
+    if (col_index < 0 || right_index < 0 || !expression::compile(filter, columns_, evaluator) ||
+        !expression::compile(right_filter, right.columns_, right_evaluator)) {
+        return 0;
+    }
+    
+    // Begin read locks on both tables
+    std::vector<std::shared_lock<TableLock>> locks;
+    lockJoin(right, locks);
+    
+    return joinRows(col_index, latestView(), evaluator, right, right_index, right.latestView(), right_evaluator,
+                    visitor);
+}
+
+std::string Table::explainJoin(const std::string& column, Table& right, const std::string& right_column) {
+    int col_index = findColumnIndex(column);
+    int right_index = right.findColumnIndex(right_column);
+    if (col_index < 0 || right_index < 0) {
+        return "";
+    }
+    
+    std::vector<std::shared_lock<TableLock>> locks;
+    lockJoin(right, locks);
+    
+    return describeJoin(col_index, right, right_index);
+}
+
+bool Table::createIndex(const std::string& column, IndexType type) {
+    int col_index = findColumnIndex(column);
+    if (col_index < 0) {
+        return false;
+    }
+    if (!shards_.empty()) {
+        bool created = true;
+        for (const auto& shard : shards_) {
+            created = shard->createIndex(column, type) && created;
+        }
+        return created;
+    }
+    
+    // Begin write lock
+    std::unique_lock<TableLock> lock(mutex_);
+    
+    for (const auto& index : indexes_) {
+        if (index.column == static_cast<size_t>(col_index)) {
+            return false; // Column is already indexed
+        }
+    }
+    
+    SecondaryIndex index;
+    index.column = col_index;
+    index.type = type;
+    forEachRow([&index, col_index](size_t pos, const Row& row) {
+        if (index.type == ORDERED) {
+            index.ordered.emplace(row[col_index], pos);
+        } else {
+            index.hashed.emplace(row[col_index], pos);
+        }
+        return true;
+    });
+    
+    indexes_.push_back(std::move(index));
+    changes_++;
+    return true;
+}
+
+bool Table::dropIndex(const std::string& column) {
+    int col_index = findColumnIndex(column);
+    if (col_index < 0) {
+        return false;
+    }
+    if (!shards_.empty()) {
+        bool dropped = true;
+        for (const auto& shard : shards_) {
+            dropped = shard->dropIndex(column) && dropped;
+        }
+        return dropped;
+    }
+    
+    // Begin write lock
+    std::unique_lock<TableLock> lock(mutex_);
+    
+    for (auto it = indexes_.begin(); it != indexes_.end(); ++it) {
+        if (it->column == static_cast<size_t>(col_index)) {
+            indexes_.erase(it);
+            changes_++;
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+bool Table::hasIndex(const std::string& column) const {
+    int col_index = findColumnIndex(column);
+    if (col_index < 0) {
+        return false;
+    }
+    if (!shards_.empty()) {
+        return shards_[0]->hasIndex(column);
+    }
+    
+    std::shared_lock<TableLock> lock(const_cast<TableLock&>(mutex_));
+    
+    for (const auto& index : indexes_) {
+        if (index.column == static_cast<size_t>(col_index)) {
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+const std::vector<Column>& Table::getColumns() const {
+    return columns_;
+}
+
+const std::string& Table::getName() const {
+    return name_;
+}
+
+Table::Layout Table::getLayout() const {
+    return layout_;
+}
+
+size_t Table::getShardCount() const {
+    return shards_.empty() ? 1 : shards_.size();
+}
+
+bool Table::readColumn(const std::string& column, const std::function<void(const ColumnView&)>& reader) {
+    int col_index = findColumnIndex(column);
+    if (col_index < 0) {
+        return false;
+    }
+    
+    ColumnData gathered;
+    gathered.type = columns_[col_index].type;
+    if (!shards_.empty()) {
+        for (const auto& shard : shards_) {
+            std::shared_lock<TableLock> lock(shard->mutex_);
+            if (!shard->gatherColumn(col_index, shard->latestView(), gathered)) {
+                return false;
+            }
+        }
+        reader(gathered.view());
+        return true;
+    }
+    
+    // Begin read lock
+    std::shared_lock<TableLock> lock(mutex_);
+    
+    VersionView view = latestView();
+    if (layout_ == COLUMNAR && allVisible(view)) {
+        reader(column_data_[col_index]->view());
+        return true;
+    }
+    
+    if (!gatherColumn(col_index, view, gathered)) {
+        return false;
+    }
+    reader(gathered.view());
+    return true;
+}
+
+bool Table::gatherColumn(size_t column, const VersionView& view, ColumnData& out) const {
+    for (size_t pos = 0; pos < rowCount(); pos++) {
+        if (!isVisible(pos, view)) {
+            continue;
+        }
+        if (layout_ == COLUMNAR) {
+            out.append(column_data_[column]->get(pos));
+            continue;
+        }
+        const Value& value = rows_[pos][column];
+        if (!out.accepts(value)) {
+            return false;
+        }
+        out.append(value);
+    }
+    return true;
+}
+
+bool Table::beginRead(std::chrono::milliseconds timeout) {
+    // Every shard of a sharded table, released again if one times out
+    std::vector<std::shared_lock<TableLock>> locks;
+    if (!lockParts(locks, timeout)) {
+        return false;
+    }
+    for (auto& lock : locks) {
+        lock.release();
+    }
+    return true;
+}
+
+void Table::endRead() {
+    for (Table* part : parts()) {
+        part->mutex_.unlock_shared();
+    }
+}
+
+bool Table::beginWrite(std::chrono::milliseconds timeout) {
+    std::vector<std::unique_lock<TableLock>> locks;
+    if (!lockParts(locks, timeout)) {
+        return false;
+    }
+    for (auto& lock : locks) {
+        lock.release();
+    }
+    return true;
+}
+
+void Table::endWrite() {
+    for (Table* part : parts()) {
+        part->mutex_.unlock();
+    }
+}
+
+void Table::countScan(size_t scanned, size_t returned) const {
+    if (metrics_) {
+        metrics_->scans.add();
+        metrics_->rows_scanned.add(scanned);
+        metrics_->rows_returned.add(returned);
+    }
+}
+
+TableLock::Stats Table::lockStats() const {
+    TableLock::Stats total;
+    for (Table* part : parts()) {
+        TableLock::Stats stats = part->mutex_.stats();
+        total.acquisitions += stats.acquisitions;
+        total.contended += stats.contended;
+        total.timeouts += stats.timeouts;
+        total.wait_time += stats.wait_time;
+        total.max_wait = std::max(total.max_wait, stats.max_wait);
+    }
+    return total;
+}
+
+int Table::findPrimaryKeyIndex() const {
+    for (size_t i = 0; i < columns_.size(); i++) {
+        if (columns_[i].primary_key) {
+            return static_cast<int>(i);
+        }
+    }
+    return -1;
+}
+
+int Table::findColumnIndex(const std::string& column) const {
+    for (size_t i = 0; i < columns_.size(); i++) {
+        if (columns_[i].name == column) {
+            return static_cast<int>(i);
+        }
+    }
+    return -1;
+}
+
+bool Table::findColumnIndexes(const std::vector<std::string>& columns, std::vector<size_t>& indexes) const {
+    indexes.clear();
+    indexes.reserve(columns.size());
+    for (const auto& column : columns) {
+        int col_index = findColumnIndex(column);
+        if (col_index < 0) {
+            return false;
+        }
+        indexes.push_back(col_index);
+    }
+    return true;
+}
+
+size_t Table::rowCount() const {
+    if (layout_ == ROW_ORIENTED) {
+        return rows_.size();
+    }
+    return column_data_.empty() ? 0 : column_data_[0]->size;
+}
+
+Row Table::rowAt(size_t pos) const {
+    if (layout_ == ROW_ORIENTED) {
+        return rows_[pos];
+    }
+    
+    Row row;
+    row.reserve(column_data_.size());
+    for (const auto& column : column_data_) {
+        row.push_back(column->get(pos));
+    }
+    return row;
+}
+
+bool Table::acceptsRow(const Row& row) const {
+    // A sharded table keeps no column data itself, its shards share the layout
+    if (!shards_.empty()) {
+        return shards_.front()->acceptsRow(row);
+    }
+    if (layout_ == ROW_ORIENTED) {
+        return true;
+    }
+    
+    // Columnar cells must match the column type or be NULL
+    for (size_t i = 0; i < column_data_.size(); i++) {
+        if (!column_data_[i]->accepts(row[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t Table::scanRows(const std::function<bool(const Row&)>& predicate, const RowVisitor& visitor,
+                       const VersionView& view) const {
+    if (!shards_.empty()) {
+        size_t visited = 0;
+        bool stopped = false;
+        RowVisitor until_stopped = [&](const Row& row) { return !(stopped = !visitor(row)); };
+        for (size_t i = 0; i < shards_.size() && !stopped; i++) {
+            visited += shards_[i]->scanRows(predicate, until_stopped, view);
+        }
+        return visited;
+    }
+    
+    size_t visited = 0;
+    size_t scanned = rowCount();
+    forEachVisible(view, [&](size_t pos, const Row& row) {
+        if (predicate(row)) {
+            visited++;
+            if (!visitor(row)) {
+                scanned = pos + 1;
+                return false;
+            }
+        }
+        return true;
+    });
+    countScan(scanned, visited);
+    return visited;
+}
+
+std::vector<Row> Table::selectRows(const std::function<bool(const Row&)>& predicate,
+                                   const VersionView& view) const {
+    if (!shards_.empty()) {
+        std::vector<std::vector<Row>> parts;
+        for (const auto& shard : shards_) {
+            parts.push_back(shard->selectRows(predicate, view));
+        }
+        return concatRows(parts);
+    }
+    
+    // Each morsel collects its own matches, concatenated in morsel order
+    std::vector<std::vector<Row>> morsels((rowCount() + kMorselRows - 1) / kMorselRows);
+    forEachMorsel(rowCount(), [&](size_t index, size_t begin, size_t end) {
+        forEachVisible(view, begin, end, [&](size_t, const Row& row) {
+            if (predicate(row)) {
+                morsels[index].push_back(row);
+            }
+            return true;
+        });
+    });
+    std::vector<Row> result = concatRows(morsels);
+    countScan(rowCount(), result.size());
+    return result;
+}
+
+std::vector<size_t> Table::matchPositions(const std::function<bool(const Row&)>& predicate,
+                                          const VersionView& view) const {
+    std::vector<std::vector<size_t>> morsels((rowCount() + kMorselRows - 1) / kMorselRows);
+    forEachMorsel(rowCount(), [&](size_t index, size_t begin, size_t end) {
+        forEachVisible(view, begin, end, [&](size_t pos, const Row& row) {
+            if (predicate(row)) {
+                morsels[index].push_back(pos);
+            }
+            return true;
+        });
+    });
+    
+    std::vector<size_t> positions;
+    for (const auto& morsel : morsels) {
+        positions.insert(positions.end(), morsel.begin(), morsel.end());
+    }
+    return positions;
+}
+
+bool Table::evaluate(const ColumnPredicate& predicate, const VersionView& view,
+                     std::vector<uint64_t>& selection) const {
+    int col_index = findColumnIndex(predicate.column);
+    if (col_index < 0) {
+        return false;
+    }
+    
+    size_t count = rowCount();
+    selection.assign((count + 63) / 64, 0);
+    
+    if (layout_ == ROW_ORIENTED) {
+        for (size_t pos = 0; pos < count; pos++) {
+            if (predicate.matches(rows_[pos][col_index])) {
+                selection[pos / 64] |= uint64_t(1) << (pos % 64);
+            }
+        }
+    } else {
+        evaluateColumn(*column_data_[col_index], predicate, selection);
+    }
+    
+    // Drop versions the view does not see
+    if (!allVisible(view)) {
+        for (size_t pos = 0; pos < count; pos++) {
+            if (!isVisible(pos, view)) {
+                selection[pos / 64] &= ~(uint64_t(1) << (pos % 64));
+            }
+        }
+    }
+    return true;
+}
+
+void Table::evaluateColumn(const ColumnData& data, const ColumnPredicate& predicate,
+                           std::vector<uint64_t>& selection) {
+    size_t count = data.size;
+    const Value& constant = predicate.constant;
+    
+    if (data.type == Column::INT && constant.type == Value::INT) {
+        kernels::compareInt32(data.ints.data(), count, predicate.op, constant.asInt(), selection.data());
+    } else if (data.type == Column::FLOAT && isNumeric(constant)) {
+        kernels::compareDouble(data.floats.data(), count, predicate.op, numericValue(constant), selection.data());
+    } else if ((data.type == Column::TEXT && constant.type == Value::TEXT) ||
+               (data.type == Column::BLOB && constant.type == Value::BLOB)) {
+        std::string_view bytes = constant.type == Value::TEXT ? constant.textView() : constant.blobView();
+        for (size_t pos = 0; pos < count; pos++) {
+            std::string_view cell(data.bytes.data() + data.offsets[pos], data.lengths[pos]);
+            if (applyOp(predicate.op, cell.compare(bytes))) {
+                selection[pos / 64] |= uint64_t(1) << (pos % 64);
+            }
+        }
+    } else {
+        // Mixed numeric types or a constant of another type, compare cell by cell
+        for (size_t pos = 0; pos < count; pos++) {
+            if (predicate.matches(data.get(pos))) {
+                selection[pos / 64] |= uint64_t(1) << (pos % 64);
+            }
+        }
+    }
+    
+    // NULL cells never match
+    for (size_t w = 0; w < selection.size(); w++) {
+        selection[w] &= ~data.nulls[w];
+    }
+}
+
+size_t Table::scanSelected(const std::vector<uint64_t>& selection, const RowVisitor& visitor) const {
+    size_t visited = 0;
+    Row scratch;
+    kernels::forEachSetBit(selection.data(), selection.size(), [&](size_t pos) {
+        visited++;
+        if (layout_ == ROW_ORIENTED) {
+            return visitor(rows_[pos]);
+        }
+        scratch = rowAt(pos);
+        return visitor(static_cast<const Row&>(scratch));
+    });
+    return visited;
+}
+
+std::vector<size_t> Table::lookupPositions(size_t column, const Value& value, const VersionView& view) const {
+    std::vector<size_t> positions;
+    auto collect = [&](auto matches) {
+        for (auto it = matches.first; it != matches.second; ++it) {
+            if (isVisible(it->second, view)) {
+                positions.push_back(it->second);
+            }
+        }
+    };
+    
+    // Unique keys resolve to at most one visible version
+    for (const auto& index : key_indexes_) {
+        if (index.column == column) {
+            collect(index.positions.equal_range(value));
+            return positions;
+        }
+    }
+    
+    for (const auto& index : indexes_) {
+        if (index.column != column) {
+            continue;
+        }
+        
+        if (index.type == HASH) {
+            collect(index.hashed.equal_range(value));
+        } else {
+            collect(index.ordered.equal_range(value));
+        }
+        
+        // Return matches in table order, as select does
+        std::sort(positions.begin(), positions.end());
+        return positions;
+    }
+    
+    // No index on this column, fall back to a full scan
+    forEachVisible(view, [&](size_t pos, const Row& row) {
+        if (row[column] == value) {
+            positions.push_back(pos);
+        }
+        return true;
+    });
+    return positions;
+}
+
+std::vector<size_t> Table::rangePositions(size_t column, const Value& lo, const Value& hi,
+                                          const VersionView& view) const {
+    std::vector<size_t> positions;
+    // Inverted bounds match nothing, and would walk an ordered index off its end
+    if (hi < lo) {
+        return positions;
+    }
+    
+    for (const auto& index : indexes_) {
+        if (index.column == column && index.type == ORDERED) {
+            // Inclusive bounds, results in key order
+            auto end = index.ordered.upper_bound(hi);
+            for (auto it = index.ordered.lower_bound(lo); it != end; ++it) {
+                if (isVisible(it->second, view)) {
+                    positions.push_back(it->second);
+                }
+            }
+            return positions;
+        }
+    }
+    
+    // No ordered index on this column, fall back to a full scan
+    forEachVisible(view, [&](size_t pos, const Row& row) {
+        const Value& value = row[column];
+        if (!(value < lo) && !(hi < value)) {
+            positions.push_back(pos);
+        }
+        return true;
+    });
+    return positions;
+}
+
+Table::AccessPath Table::planAccess(const Expression& filter) const {
+    std::vector<const ColumnPredicate*> predicates;
+    expression::conjuncts(filter, predicates);
+    
+    AccessPath path;
+    std::vector<int> columns;
+    for (const ColumnPredicate* predicate : predicates) {
+        columns.push_back(findColumnIndex(predicate->column));
+    }
+    auto hasIndex = [this](int column, bool ordered_only) {
+        return std::any_of(indexes_.begin(), indexes_.end(), [&](const SecondaryIndex& index) {
+            return static_cast<int>(index.column) == column && (!ordered_only || index.type == ORDERED);
+        });
+    };
+    auto isKey = [this](int column) {
+        return std::any_of(key_indexes_.begin(), key_indexes_.end(),
+                           [column](const KeyIndex& index) { return static_cast<int>(index.column) == column; });
+    };
+    
+    // An equality on a unique key matches at most one row, then other indexes
+    for (int pass = 0; pass < 2; pass++) {
+        for (size_t i = 0; i < predicates.size(); i++) {
+            if (predicates[i]->op == ColumnPredicate::EQ && columns[i] >= 0 &&
+                (pass == 0 ? isKey(columns[i]) : hasIndex(columns[i], false))) {
+                path.kind = AccessPath::INDEX_LOOKUP;
+                path.column = columns[i];
+                path.predicates.push_back(predicates[i]);
+                return path;
+            }
+        }
+    }
+    
+    // Bounds on an ordered index column, every one of them narrows the range
+    for (size_t i = 0; i < predicates.size(); i++) {
+        ColumnPredicate::Op op = predicates[i]->op;
+        if (op == ColumnPredicate::EQ || op == ColumnPredicate::NE || columns[i] < 0 || !hasIndex(columns[i], true)) {
+            continue;
+        }
+        path.kind = AccessPath::INDEX_RANGE;
+        path.column = columns[i];
+        for (size_t j = i; j < predicates.size(); j++) {
+            op = predicates[j]->op;
+            if (columns[j] == columns[i] && op != ColumnPredicate::EQ && op != ColumnPredicate::NE) {
+                path.predicates.push_back(predicates[j]);
+            }
+        }
+        return path;
+    }
+    
+    // Columnar storage evaluates each comparison with the filter kernels
+    if (layout_ == COLUMNAR && !predicates.empty()) {
+        path.kind = AccessPath::COLUMN_FILTER;
+        path.predicates = predicates;
+    }
+    return path;
+}
+
+std::string Table::describe(const AccessPath& path) const {
+    switch (path.kind) {
+        case AccessPath::INDEX_LOOKUP:
+            return "index lookup on " + columns_[path.column].name;
+        case AccessPath::INDEX_RANGE:
+            return "index range on " + columns_[path.column].name;
+        case AccessPath::COLUMN_FILTER: {
+            std::string text = "vectorized filter on ";
+            for (size_t i = 0; i < path.predicates.size(); i++) {
+                text += (i > 0 ? ", " : "") + path.predicates[i]->column;
+            }
+            return text;
+        }
+        case AccessPath::FULL_SCAN:
+            break;
+    }
+    return "full scan";
+}
+
+namespace {
+
+// The same number as the other numeric type, false if there is none
+bool otherNumeric(const Value& value, Value& out) {
+    if (value.type == Value::INT) {
+        out = Value(static_cast<double>(value.asInt()));
+        return true;
+    }
+    if (value.type == Value::FLOAT) {
+        double number = value.asFloat();
+        if (number >= std::numeric_limits<int>::min() && number <= std::numeric_limits<int>::max() &&
+            number == std::floor(number)) {
+            out = Value(static_cast<int>(number));
+            return true;
+        }
+    }
+    return false;
+}
+
+// Inclusive index bound of the given type that keeps every cell a comparison
+// against constant can match. False if the constant gives no usable bound,
+// empty is set when no cell of that type can match.
+bool looseBound(const Value& constant, Value::Type type, bool lower, Value& out, bool& empty) {
+    if (constant.type == type) {
+        if (type == Value::FLOAT && std::isnan(constant.asFloat())) {
+            return false;
+        }
+        out = constant;
+        return true;
+    }
+    if (type == Value::FLOAT && constant.type == Value::INT) {
+        out = Value(static_cast<double>(constant.asInt()));
+        return true;
+    }
+    if (type != Value::INT || constant.type != Value::FLOAT || std::isnan(constant.asFloat())) {
+        return false;
+    }
+    
+    double number = lower ? std::floor(constant.asFloat()) : std::ceil(constant.asFloat());
+    double min = std::numeric_limits<int>::min();
+    double max = std::numeric_limits<int>::max();
+    if ((lower && number > max) || (!lower && number < min)) {
+        empty = true;
+        return false;
+    }
+    out = Value(static_cast<int>(std::min(std::max(number, min), max)));
+    return true;
+}
+
+} // namespace
+
+std::vector<size_t> Table::candidatePositions(const AccessPath& path, const VersionView& view) const {
+    std::vector<size_t> positions;
+    const Value& constant = path.predicates[0]->constant;
+    
+    // Numeric comparisons also match cells of the other numeric type
+    std::vector<Value::Type> types = {constant.type};
+    if (constant.type == Value::INT || constant.type == Value::FLOAT) {
+        types.push_back(constant.type == Value::INT ? Value::FLOAT : Value::INT);
+    }
+    
+    if (path.kind == AccessPath::INDEX_LOOKUP) {
+        positions = lookupPositions(path.column, constant, view);
+        Value other;
+        if (otherNumeric(constant, other)) {
+            std::vector<size_t> more = lookupPositions(path.column, other, view);
+            positions.insert(positions.end(), more.begin(), more.end());
+        }
+        std::sort(positions.begin(), positions.end());
+        return positions;
+    }
+    
+    const SecondaryIndex* ordered = nullptr;
+    for (const auto& index : indexes_) {
+        if (index.column == path.column && index.type == ORDERED) {
+            ordered = &index;
+        }
+    }
+    
+    // Index entries are ordered by type first, so each type is its own run
+    for (Value::Type type : types) {
+        bool empty = false;
+        bool has_lo = false;
+        bool has_hi = false;
+        Value lo;
+        Value hi;
+        for (const ColumnPredicate* predicate : path.predicates) {
+            bool lower = predicate->op == ColumnPredicate::GT || predicate->op == ColumnPredicate::GE;
+            Value bound;
+            if (!looseBound(predicate->constant, type, lower, bound, empty)) {
+                continue;
+            }
+            if (lower && (!has_lo || lo < bound)) {
+                lo = bound;
+                has_lo = true;
+            } else if (!lower && (!has_hi || bound < hi)) {
+                hi = bound;
+                has_hi = true;
+            }
+        }
+        if (empty) {
+            continue;
+        }
+        
+        auto it = has_lo ? ordered->ordered.lower_bound(lo)
+                         : std::find_if(ordered->ordered.begin(), ordered->ordered.end(),
+                                        [type](const auto& entry) { return !(entry.first.type < type); });
+        for (; it != ordered->ordered.end() && it->first.type == type && !(has_hi && hi < it->first); ++it) {
+            if (isVisible(it->second, view)) {
+                positions.push_back(it->second);
+            }
+        }
+    }
+    
+    // Visit candidates in table order, as a full scan would
+    std::sort(positions.begin(), positions.end());
+    return positions;
+}
+
+size_t Table::scanFiltered(const Expression& filter, const std::function<bool(const Row&)>& evaluator,
+                           const RowVisitor& visitor, const VersionView& view) const {
+    if (!shards_.empty()) {
+        size_t visited = 0;
+        bool stopped = false;
+        RowVisitor until_stopped = [&](const Row& row) { return !(stopped = !visitor(row)); };
+        for (size_t i = 0; i < shards_.size() && !stopped; i++) {
+            visited += shards_[i]->scanFiltered(filter, evaluator, until_stopped, view);
+        }
+        return visited;
+    }
+    
+    AccessPath path = planAccess(filter);
+    if (path.kind == AccessPath::FULL_SCAN) {
+        return scanRows(evaluator, visitor, view);
+    }
+    
+    size_t visited = 0;
+    Row scratch;
+    auto visit = [&](size_t pos) {
+        const Row* row = &scratch;
+        if (layout_ == ROW_ORIENTED) {
+            row = &rows_[pos];
+        } else {
+            scratch = rowAt(pos);
+        }
+        
+        // The path only narrows the scan, the whole filter decides
+        if (!evaluator(*row)) {
+            return true;
+        }
+        visited++;
+        return visitor(*row);
+    };
+    
+    if (path.kind == AccessPath::COLUMN_FILTER) {
+        std::vector<uint64_t> selection;
+        std::vector<uint64_t> next;
+        for (const ColumnPredicate* predicate : path.predicates) {
+            if (!evaluate(*predicate, view, selection.empty() ? selection : next)) {
+                return 0;
+            }
+            for (size_t w = 0; w < next.size(); w++) {
+                selection[w] &= next[w];
+            }
+            next.clear();
+        }
+        kernels::forEachSetBit(selection.data(), selection.size(), visit);
+        countScan(rowCount(), visited);
+        return visited;
+    }
+    
+    std::vector<size_t> candidates = candidatePositions(path, view);
+    for (size_t pos : candidates) {
+        if (!visit(pos)) {
+            break;
+        }
+    }
+    countScan(candidates.size(), visited);
+    return visited;
+}
+
+bool Table::prepareAggregate(const std::vector<Aggregate>& aggregates, const std::vector<std::string>& group_by,
+                             Groups& groups) const {
+    if (!findColumnIndexes(group_by, groups.keys)) {
+        return false;
+    }
+    for (const auto& aggregate : aggregates) {
+        int column = -1;
+        if (!aggregate.column.empty()) {
+            column = findColumnIndex(aggregate.column);
+            if (column < 0) {
+                return false;
+            }
+            Column::Type type = columns_[column].type;
+            bool numeric = type == Column::INT || type == Column::FLOAT;
+            if ((aggregate.function == Aggregate::SUM || aggregate.function == Aggregate::AVG) && !numeric) {
+                return false;
+            }
+        } else if (aggregate.function != Aggregate::COUNT) {
+            return false;
+        }
+        groups.specs.push_back({aggregate.function, column});
+    }
+    groups.total.resize(groups.specs.size());
+    return true;
+}
+
+void Table::collectGroups(const Expression& filter, const std::function<bool(const Row&)>& evaluator,
+                          const VersionView& view, Groups& groups) const {
+    if (!shards_.empty()) {
+        for (const auto& shard : shards_) {
+            shard->collectGroups(filter, evaluator, view, groups);
+        }
+        return;
+    }
+    
+    // An index or the filter kernels narrow the scan, the plain scan runs in
+    // parallel morsels with partial aggregates
+    if (planAccess(filter).kind != AccessPath::FULL_SCAN) {
+        scanFiltered(filter, evaluator, [&groups](const Row& row) {
+            groups.add(row);
+            return true;
+        }, view);
+        return;
+    }
+    
+    std::vector<Groups> morsels((rowCount() + kMorselRows - 1) / kMorselRows, groups.emptyCopy());
+    std::vector<size_t> matched(morsels.size());
+    forEachMorsel(rowCount(), [&](size_t index, size_t begin, size_t end) {
+        forEachVisible(view, begin, end, [&](size_t, const Row& row) {
+            if (evaluator(row)) {
+                morsels[index].add(row);
+                matched[index]++;
+            }
+            return true;
+        });
+    });
+    for (auto& morsel : morsels) {
+        groups.merge(morsel);
+    }
+    countScan(rowCount(), std::accumulate(matched.begin(), matched.end(), size_t(0)));
+}
+
+void Table::finishGroups(Groups& groups, std::vector<Row>& out) {
+    auto finish = [&groups](Row key, const std::vector<Groups::Accumulator>& accumulators) {
+        for (size_t i = 0; i < groups.specs.size(); i++) {
+            const Groups::Accumulator& acc = accumulators[i];
+            switch (groups.specs[i].function) {
+                case Aggregate::COUNT:
+                    key.push_back(Value(static_cast<int>(acc.count)));
+                    break;
+                case Aggregate::SUM:
+                    if (acc.count == 0) {
+                        key.push_back(Value());
+                    } else if (acc.all_int && acc.int_sum >= std::numeric_limits<int>::min() &&
+                               acc.int_sum <= std::numeric_limits<int>::max()) {
+                        key.push_back(Value(static_cast<int>(acc.int_sum)));
+                    } else {
+                        key.push_back(Value(acc.sum));
+                    }
+                    break;
+                case Aggregate::AVG:
+                    key.push_back(acc.count == 0 ? Value() : Value(acc.sum / acc.count));
+                    break;
+                case Aggregate::MIN:
+                case Aggregate::MAX:
+                    key.push_back(acc.extreme);
+                    break;
+            }
+        }
+        return key;
+    };
+    
+    out.clear();
+    if (groups.keys.empty()) {
+        out.push_back(finish(Row(), groups.total));
+        return;
+    }
+    
+    for (const auto& [key, accumulators] : groups.groups) {
+        out.push_back(finish(key, accumulators));
+    }
+    size_t key_size = groups.keys.size();
+    std::sort(out.begin(), out.end(), [key_size](const Row& a, const Row& b) {
+        return std::lexicographical_compare(a.begin(), a.begin() + key_size, b.begin(), b.begin() + key_size);
+    });
+}
+
+bool Table::prepareOrder(const std::vector<OrderBy>& order, size_t limit, size_t offset, TopRows& top) const {
+    for (const auto& key : order) {
+        int column = findColumnIndex(key.column);
+        if (column < 0) {
+            return false;
+        }
+        top.keys.push_back({static_cast<size_t>(column), key.descending});
+    }
+    top.keep = limit > kNoLimit - offset ? kNoLimit : offset + limit;
+    return true;
+}
+
+void Table::collectTop(const Expression& filter, const std::function<bool(const Row&)>& evaluator,
+                       const VersionView& view, TopRows& top) const {
+    if (!shards_.empty()) {
+        for (size_t i = 0; i < shards_.size(); i++) {
+            top.part = i;
+            shards_[i]->collectTop(filter, evaluator, view, top);
+        }
+        return;
+    }
+    
+    // An index narrowing the filter beats walking the sort index, which in
+    // turn beats scanning everything
+    AccessPath path = planAccess(filter);
+    bool narrowed = path.kind == AccessPath::INDEX_LOOKUP || path.kind == AccessPath::INDEX_RANGE;
+    if (!narrowed && walkOrderIndex(evaluator, view, top)) {
+        return;
+    }
+    if (path.kind != AccessPath::FULL_SCAN) {
+        // These paths visit rows in table order
+        size_t order = 0;
+        scanFiltered(filter, evaluator, [&](const Row& row) {
+            top.add(row, order++);
+            return true;
+        }, view);
+        return;
+    }
+    
+    std::vector<TopRows> morsels((rowCount() + kMorselRows - 1) / kMorselRows, top.emptyCopy());
+    std::vector<size_t> matched(morsels.size());
+    forEachMorsel(rowCount(), [&](size_t index, size_t begin, size_t end) {
+        forEachVisible(view, begin, end, [&](size_t pos, const Row& row) {
+            if (evaluator(row)) {
+                morsels[index].add(row, pos);
+                matched[index]++;
+            }
+            return true;
+        });
+    });
+    for (auto& morsel : morsels) {
+        top.merge(morsel);
+    }
+    countScan(rowCount(), std::accumulate(matched.begin(), matched.end(), size_t(0)));
+}
+
+bool Table::walkOrderIndex(const std::function<bool(const Row&)>& evaluator, const VersionView& view,
+                           TopRows& top) const {
+    if (top.keys.size() != 1 || top.keep == kNoLimit) {
+        return false;
+    }
+    const SecondaryIndex* ordered = nullptr;
+    for (const auto& index : indexes_) {
+        if (index.column == top.keys[0].column && index.type == ORDERED) {
+            ordered = &index;
+        }
+    }
+    if (!ordered) {
+        return false;
+    }
+    
+    // Runs of equal keys arrive in sort order, their rows in any order, so
+    // the walk may stop at the end of the run that fills the heap
+    size_t scanned = 0;
+    size_t matched = 0;
+    Row scratch;
+    auto walk = [&](auto it, auto end) {
+        while (it != end && matched < top.keep) {
+            const Value& key = it->first;
+            for (; it != end && !(key < it->first) && !(it->first < key); ++it) {
+                scanned++;
+                size_t pos = it->second;
+                if (!isVisible(pos, view)) {
+                    continue;
+                }
+                const Row* row = &scratch;
+                if (layout_ == ROW_ORIENTED) {
+                    row = &rows_[pos];
+                } else {
+                    scratch = rowAt(pos);
+                }
+                if (evaluator(*row)) {
+                    top.add(*row, pos);
+                    matched++;
+                }
+            }
+        }
+    };
+    if (top.keys[0].descending) {
+        walk(ordered->ordered.rbegin(), ordered->ordered.rend());
+    } else {
+        walk(ordered->ordered.begin(), ordered->ordered.end());
+    }
+    countScan(scanned, matched);
+    return true;
+}
+
+void Table::finishTop(TopRows& top, size_t limit, size_t offset, std::vector<Row>& out) {
+    std::sort(top.entries.begin(), top.entries.end(),
+              [&top](const TopRows::Entry& a, const TopRows::Entry& b) { return top.before(a, b); });
+    out.clear();
+    for (size_t i = offset; i < top.entries.size() && i - offset < limit; i++) {
+        out.push_back(std::move(top.entries[i].row));
+    }
+}
+
+void Table::lockJoin(Table& right, std::vector<std::shared_lock<TableLock>>& locks) {
+    // A self-join locks the table once
+    if (&right == this) {
+        lockParts(locks);
+        return;
+    }
+    Table* first = std::less<Table*>()(this, &right) ? this : &right;
+    Table* second = first == this ? &right : this;
+    first->lockParts(locks);
+    second->lockParts(locks);
+}
+
+bool Table::lockJoin(Table& right, std::vector<std::shared_lock<TableLock>>& locks,
+                     std::chrono::milliseconds timeout) {
+    if (&right == this) {
+        return lockParts(locks, timeout);
+    }
+    // Both tables share the one wait, so the second gets what the first left
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    Table* first = std::less<Table*>()(this, &right) ? this : &right;
+    Table* second = first == this ? &right : this;
+    if (!first->lockParts(locks, timeout)) {
+        return false;
+    }
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+    return second->lockParts(locks, std::max(std::chrono::milliseconds(0), left));
+}
+
+bool Table::hasLookupIndex(size_t column) const {
+    const Table& part = *parts().front();
+    return std::any_of(part.key_indexes_.begin(), part.key_indexes_.end(),
+                       [column](const KeyIndex& index) { return index.column == column; }) ||
+           std::any_of(part.indexes_.begin(), part.indexes_.end(),
+                       [column](const SecondaryIndex& index) { return index.column == column; });
+}
+
+namespace {
+
+size_t partRows(const std::vector<Table*>& parts, size_t (Table::*count)() const) {
+    size_t rows = 0;
+    for (const Table* part : parts) {
+        rows += (part->*count)();
+    }
+    return rows;
+}
+
+} // namespace
+
+std::string Table::describeJoin(size_t column, const Table& right, size_t right_column) const {
+    if (right.hasLookupIndex(right_column)) {
+        return "index nested loop probing " + right.name_ + "." + right.columns_[right_column].name;
+    }
+    if (hasLookupIndex(column)) {
+        return "index nested loop probing " + name_ + "." + columns_[column].name;
+    }
+    bool build_left = partRows(parts(), &Table::rowCount) < partRows(right.parts(), &Table::rowCount);
+    return "hash join building " + (build_left ? name_ : right.name_);
+}
+
+size_t Table::joinRows(size_t column, const VersionView& view, const std::function<bool(const Row&)>& filter,
+                       const Table& right, size_t right_column, const VersionView& right_view,
+                       const std::function<bool(const Row&)>& right_filter, const JoinVisitor& visitor) const {
+    // Describe both sides alike, the outer one streams and the inner one is
+    // probed, by its index or by a hash table built from it
+    struct Side {
+        const Table* table;
+        size_t column;
+        const VersionView* view;
+        const std::function<bool(const Row&)>* filter;
+    };
+    Side outer = {this, column, &view, &filter};
+    Side inner = {&right, right_column, &right_view, &right_filter};
+    bool swapped = false;
+    bool probe_index = right.hasLookupIndex(right_column);
+    if (!probe_index && hasLookupIndex(column)) {
+        probe_index = true;
+        swapped = true;
+    } else if (!probe_index &&
+               partRows(parts(), &Table::rowCount) < partRows(right.parts(), &Table::rowCount)) {
+        swapped = true;
+    }
+    if (swapped) {
+        std::swap(outer, inner);
+    }
+    
+    // Pairs are always passed as (this row, right row)
+    size_t visited = 0;
+    bool stopped = false;
+    Row scratch;
+    auto emit = [&](const Row& outer_row, const Table& part, size_t pos) {
+        const Row* inner_row = &scratch;
+        if (part.layout_ == ROW_ORIENTED) {
+            inner_row = &part.rows_[pos];
+        } else {
+            scratch = part.rowAt(pos);
+        }
+        // Built entries were filtered already
+        if (probe_index && !(*inner.filter)(*inner_row)) {
+            return true;
+        }
+        visited++;
+        stopped = swapped ? !visitor(*inner_row, outer_row) : !visitor(outer_row, *inner_row);
+        return !stopped;
+    };
+    
+    std::unordered_multimap<Value, std::pair<const Table*, size_t>, ValueHash> built;
+    std::vector<Table*> inner_parts = inner.table->parts();
+    if (!probe_index) {
+        for (const Table* part : inner_parts) {
+            part->forEachVisible(*inner.view, [&](size_t pos, const Row& row) {
+                const Value& key = row[inner.column];
+                if (key.type != Value::NULL_TYPE && (*inner.filter)(row)) {
+                    built.emplace(key, std::make_pair(part, pos));
+                }
+                return true;
+            });
+        }
+    }
+    bool inner_by_key = probe_index && !inner.table->shards_.empty() &&
+                        static_cast<int>(inner.column) == inner.table->findPrimaryKeyIndex();
+    
+    for (const Table* part : outer.table->parts()) {
+        part->forEachVisible(*outer.view, [&](size_t, const Row& row) {
+            const Value& key = row[outer.column];
+            if (key.type == Value::NULL_TYPE || !(*outer.filter)(row)) {
+                return true;
+            }
+            
+            if (!probe_index) {
+                auto matches = built.equal_range(key);
+                for (auto it = matches.first; it != matches.second; ++it) {
+                    if (!emit(row, *it->second.first, it->second.second)) {
+                        return false;
+                    }
+                }
+                return true;
+            }
+            
+            // A primary key value lives in one shard
+            if (inner_by_key) {
+                const Table& shard = *inner.table->shards_[inner.table->shardIndex(key)];
+                for (size_t pos : shard.lookupPositions(inner.column, key, *inner.view)) {
+                    if (!emit(row, shard, pos)) {
+                        return false;
+                    }
+                }
+                return true;
+            }
+            for (const Table* inner_part : inner_parts) {
+                for (size_t pos : inner_part->lookupPositions(inner.column, key, *inner.view)) {
+                    if (!emit(row, *inner_part, pos)) {
+                        return false;
+                    }
+                }
+            }
+            return true;
+        });
+        if (stopped) {
+            break;
+        }
+    }
+    return visited;
+}
+
+Status::Code Table::violatesKeyConstraints(const Row& row, const VersionView& view,
+                                           const std::vector<size_t>& replaced) const {
+    for (const auto& index : key_indexes_) {
+        auto matches = index.positions.equal_range(row[index.column]);
+        for (auto it = matches.first; it != matches.second; ++it) {
+            // A key held by a row that is about to be replaced is not a conflict
+            if (std::find(replaced.begin(), replaced.end(), it->second) != replaced.end()) {
+                continue;
+            }
+            
+            // A version keeps its key unless it was rolled back, removed by a
+            // committed write or removed by this writer. Versions a running
+            // transaction inserted or is removing still hold their keys.
+            const Version& version = versions_[it->second];
+            if (version.begin == kInfinity || version.end < kPendingBit || version.end == view.self) {
+                continue;
+            }
+            
+            // A live row the view sees holds its key for good, a running or
+            // newer writer's version might still let go of it
+            bool seen = version.begin == view.self || version.begin <= view.read_ts;
+            return seen && version.end == kInfinity ? Status::CONSTRAINT : Status::CONFLICT;
+        }
+    }
+    return Status::OK;
+}
+
+Status::Code Table::insertRow(const Row& row, const VersionView& view) {
+    Table* part = shards_.empty() ? this : shardFor(row);
+    return insertRow(part->makeRow(row), view);
+}
+
+Status::Code Table::insertRow(Row&& row, const VersionView& view) {
+    // Check column types and primary key and unique constraints
+    if (!acceptsRow(row)) {
+        return Status::INVALID_ARGUMENT;
+    }
+    if (!shards_.empty()) {
+        return shardFor(row)->insertRow(std::move(row), view);
+    }
+    Status::Code violation = violatesKeyConstraints(row, view);
+    if (violation != Status::OK) {
+        return violation;
+    }
+    
+    // All constraints passed, insert the row
+    indexRow(rowCount(), row);
+    appendRow(std::move(row), view.self);
+    return Status::OK;
+}
+
+Status::Code Table::acceptsRows(const std::vector<Row>& rows, const VersionView& view) const {
+    // Keys must be free in the table and appear once in the batch
+    std::vector<std::unordered_set<Value, ValueHash>> batch_keys(key_indexes_.size());
+    for (const auto& row : rows) {
+        if (!acceptsRow(row)) {
+            return Status::INVALID_ARGUMENT;
+        }
+        Status::Code violation = violatesKeyConstraints(row, view);
+        if (violation != Status::OK) {
+            return violation;
+        }
+        for (size_t i = 0; i < key_indexes_.size(); i++) {
+            if (!batch_keys[i].insert(row[key_indexes_[i].column]).second) {
+                return Status::CONSTRAINT;
+            }
+        }
+    }
+    return Status::OK;
+}
+
+Status::Code Table::insertRows(std::vector<Row>& rows, const VersionView& view) {
+    if (shards_.empty()) {
+        Status::Code result = acceptsRows(rows, view);
+        if (result == Status::OK) {
+            appendRows(rows, view.self);
+        }
+        return result;
+    }
+    
+    // Split the batch by shard and check every part before writing any
+    std::vector<std::vector<Row>> parts(shards_.size());
+    int pk_index = findPrimaryKeyIndex();
+    for (auto& row : rows) {
+        parts[shardIndex(row[pk_index])].push_back(std::move(row));
+    }
+    for (size_t i = 0; i < shards_.size(); i++) {
+        Status::Code result = shards_[i]->acceptsRows(parts[i], view);
+        if (result != Status::OK) {
+            return result;
+        }
+    }
+    for (size_t i = 0; i < shards_.size(); i++) {
+        shards_[i]->appendRows(parts[i], view.self);
+    }
+    return Status::OK;
+}
+
+Status::Code Table::updateRows(Row&& row, const std::function<bool(const Row&)>& predicate,
+                               const VersionView& view, std::vector<Row>* originals) {
+    if (!acceptsRow(row)) {
+        return Status::INVALID_ARGUMENT;
+    }
+    if (!shards_.empty()) {
+        return updateShards(std::move(row), predicate, view, originals);
+    }
+    
+    // Another writer already replaced or is replacing a matching version
+    std::vector<size_t> matches = matchPositions(predicate, view);
+    if (matches.empty()) {
+        return Status::NO_MATCH;
+    }
+    if (std::any_of(matches.begin(), matches.end(), [this](size_t pos) { return versions_[pos].end != kInfinity; })) {
+        return Status::CONFLICT;
+    }
+    
+    // Writing the same key into several rows, or over another row's key, violates the constraint
+    if (!key_indexes_.empty()) {
+        Status::Code violation = matches.size() > 1 ? Status::CONSTRAINT : violatesKeyConstraints(row, view, matches);
+        if (violation != Status::OK) {
+            return violation;
+        }
+    }
+    
+    if (originals) {
+        for (size_t pos : matches) {
+            originals->push_back(rowAt(pos));
+        }
+    }
+    
+    // The last match takes the row itself, others get copies
+    if (view.self == 0) {
+        for (size_t i = 0; i + 1 < matches.size(); i++) {
+            assignRow(matches[i], row);
+        }
+        assignRow(matches.back(), std::move(row));
+        return Status::OK;
+    }
+    
+    // End each old version and append its replacement
+    for (size_t i = 0; i < matches.size(); i++) {
+        setVersion(matches[i], {versions_[matches[i]].begin, view.self});
+        indexRow(rowCount(), row);
+        if (i + 1 < matches.size()) {
+            appendRow(row, view.self);
+        } else {
+            appendRow(std::move(row), view.self);
+        }
+    }
+    return Status::OK;
+}
+
+Status::Code Table::changeRows(const ColumnChanges& changes, const std::function<bool(const Row&)>& predicate,
+                               const VersionView& view, std::vector<Row>* originals, std::vector<Row>* updated) {
+    std::vector<std::pair<size_t, const Value*>> assignments;
+    bool keys_changed = false;
+    for (const auto& [column, value] : changes) {
+        int col_index = findColumnIndex(column);
+        if (col_index < 0) {
+            return Status::INVALID_ARGUMENT;
+        }
+        assignments.emplace_back(col_index, &value);
+        keys_changed = keys_changed || columns_[col_index].primary_key || columns_[col_index].unique;
+    }
+    
+    // Find the matching rows in every part and build their new images
+    struct Change {
+        Table* part;
+        size_t pos;
+        Row row;
+        Table* target;
+    };
+    std::vector<Change> found;
+    for (Table* part : parts()) {
+        for (size_t pos : part->matchPositions(predicate, view)) {
+            // Another writer already replaced or is replacing this version
+            if (part->versions_[pos].end != kInfinity) {
+                return Status::CONFLICT;
+            }
+            Row row = part->layout_ == ROW_ORIENTED ? part->makeRow(part->rows_[pos]) : part->rowAt(pos);
+            for (const auto& [col_index, value] : assignments) {
+                row[col_index] = *value;
+            }
+            found.push_back({part, pos, std::move(row), nullptr});
+        }
+    }
+    if (found.empty()) {
+        return Status::NO_MATCH;
+    }
+    
+    // Type-check against the part that will store the row, before any change
+    for (auto& change : found) {
+        change.target = shardFor(change.row);
+        if (!change.target->acceptsRow(change.row)) {
+            return Status::INVALID_ARGUMENT;
+        }
+    }
+    
+    // New keys must not repeat among the updated rows or hit a row that stays
+    if (keys_changed) {
+        for (const auto& index : parts().front()->key_indexes_) {
+            std::unordered_set<Value, ValueHash> keys;
+            for (const auto& change : found) {
+                if (!keys.insert(change.row[index.column]).second) {
+                    return Status::CONSTRAINT;
+                }
+            }
+        }
+        for (const auto& change : found) {
+            std::vector<size_t> replaced;
+            for (const auto& other : found) {
+                if (other.part == change.target) {
+                    replaced.push_back(other.pos);
+                }
+            }
+            Status::Code violation = change.target->violatesKeyConstraints(change.row, view, replaced);
+            if (violation != Status::OK) {
+                return violation;
+            }
+        }
+    }
+    
+    for (const auto& change : found) {
+        if (originals) {
+            originals->push_back(change.part->rowAt(change.pos));
+        }
+        if (updated) {
+            updated->push_back(change.row);
+        }
+    }
+    
+    // Rows that change shard are appended to their new shard first and
+    // removed from the old one last, so positions stay valid until then
+    std::unordered_map<Table*, std::vector<size_t>> moved;
+    for (auto& change : found) {
+        Table* part = change.part;
+        if (change.target != part) {
+            change.target->indexRow(change.target->rowCount(), change.row);
+            change.target->appendRow(std::move(change.row), view.self);
+            moved[part].push_back(change.pos);
+        } else if (view.self == 0) {
+            part->assignRow(change.pos, std::move(change.row));
+        } else {
+            part->setVersion(change.pos, {part->versions_[change.pos].begin, view.self});
+            part->indexRow(part->rowCount(), change.row);
+            part->appendRow(std::move(change.row), view.self);
+        }
+    }
+    for (const auto& [part, positions] : moved) {
+        part->erasePositions(positions, view);
+    }
+    return Status::OK;
+}
+
+Status::Code Table::updateShards(Row&& row, const std::function<bool(const Row&)>& predicate,
+                                 const VersionView& view, std::vector<Row>* originals) {
+    // Every shard has a primary key, so at most one row may match
+    Table* source = nullptr;
+    size_t match = 0;
+    for (const auto& shard : shards_) {
+        size_t found = 0;
+        bool conflict = false;
+        shard->forEachVisible(view, [&](size_t pos, const Row& existing_row) {
+            if (predicate(existing_row)) {
+                conflict = shard->versions_[pos].end != kInfinity;
+                match = pos;
+                found++;
+            }
+            return !conflict && found < 2;
+        });
+        if (conflict) {
+            return Status::CONFLICT;
+        }
+        if (found > 1 || (found == 1 && source)) {
+            return Status::CONSTRAINT;
+        }
+        if (found == 1) {
+            source = shard.get();
+        }
+    }
+    if (!source) {
+        return Status::NO_MATCH;
+    }
+    
+    // A row keeping its shard is updated there, a changed key moves it
+    Table* target = shardFor(row);
+    if (target == source) {
+        return source->updateRows(std::move(row), predicate, view, originals);
+    }
+    Status::Code violation = target->violatesKeyConstraints(row, view);
+    if (violation != Status::OK) {
+        return violation;
+    }
+    if (originals) {
+        originals->push_back(source->rowAt(match));
+    }
+    Status::Code erased = source->erasePositions({match}, view);
+    return erased != Status::OK ? erased : target->insertRow(std::move(row), view);
+}
+
+Status::Code Table::eraseRows(const std::function<bool(const Row&)>& predicate,
+                              const VersionView& view, std::vector<Row>* originals) {
+    if (!shards_.empty()) {
+        std::vector<std::vector<size_t>> matches(shards_.size());
+        for (size_t i = 0; i < shards_.size(); i++) {
+            const Table& shard = *shards_[i];
+            matches[i] = shard.matchPositions(predicate, view);
+            
+            // Nothing is removed if any shard conflicts
+            for (size_t pos : matches[i]) {
+                if (shard.versions_[pos].end != kInfinity) {
+                    return Status::CONFLICT;
+                }
+            }
+        }
+        
+        size_t erased = 0;
+        for (size_t i = 0; i < shards_.size(); i++) {
+            if (matches[i].empty()) {
+                continue;
+            }
+            if (originals) {
+                for (size_t pos : matches[i]) {
+                    originals->push_back(shards_[i]->rowAt(pos));
+                }
+            }
+            shards_[i]->erasePositions(matches[i], view);
+            erased += matches[i].size();
+        }
+        return erased > 0 ? Status::OK : Status::NO_MATCH;
+    }
+    
+    std::vector<size_t> matches = matchPositions(predicate, view);
+    if (matches.empty()) {
+        return Status::NO_MATCH;
+    }
+    if (originals) {
+        for (size_t pos : matches) {
+            originals->push_back(rowAt(pos));
+        }
+    }
+    return erasePositions(matches, view);
+}
+
+Status::Code Table::erasePositions(const std::vector<size_t>& positions, const VersionView& view) {
+    for (size_t pos : positions) {
+        if (versions_[pos].end != kInfinity) {
+            return Status::CONFLICT; // Removed by a writer the view does not see
+        }
+    }
+    
+    if (view.self == 0) {
+        std::vector<bool> keep(rowCount(), true);
+        for (size_t pos : positions) {
+            keep[pos] = false;
+        }
+        compact(keep);
+        return Status::OK;
+    }
+    
+    for (size_t pos : positions) {
+        setVersion(pos, {versions_[pos].begin, view.self});
+    }
+    return Status::OK;
+}
+
+void Table::commitVersions(uint64_t tag, uint64_t ts) {
+    for (const auto& shard : shards_) {
+        shard->commitVersions(tag, ts);
+    }
+    auto it = pending_.find(tag);
+    if (it == pending_.end()) {
+        return;
+    }
+    std::vector<size_t> positions = std::move(it->second);
+    pending_.erase(it);
+    
+    for (size_t pos : positions) {
+        Version version = versions_[pos];
+        version.begin = version.begin == tag ? ts : version.begin;
+        version.end = version.end == tag ? ts : version.end;
+        setVersion(pos, version);
+    }
+}
+
+void Table::abortVersions(uint64_t tag) {
+    for (const auto& shard : shards_) {
+        shard->abortVersions(tag);
+    }
+    auto it = pending_.find(tag);
+    if (it == pending_.end()) {
+        return;
+    }
+    std::vector<size_t> positions = std::move(it->second);
+    pending_.erase(it);
+    
+    // Versions the transaction added never become visible, the ones it
+    // ended are live again
+    for (size_t pos : positions) {
+        Version version = versions_[pos];
+        version.begin = version.begin == tag ? kInfinity : version.begin;
+        version.end = version.end == tag ? kInfinity : version.end;
+        setVersion(pos, version);
+    }
+}
+
+void Table::collectGarbage() {
+    if (!shards_.empty()) {
+        for (const auto& shard : shards_) {
+            if (shard->unsettled_ > 0) {
+                shard->collectGarbage();
+            }
+        }
+        return;
+    }
+    
+    // Rolled back versions and versions that ended before every open
+    // snapshot can go
+    uint64_t horizon = clock_->horizon();
+    std::vector<bool> keep(rowCount(), true);
+    bool dropped = false;
+    for (size_t pos = 0; pos < keep.size(); pos++) {
+        const Version& version = versions_[pos];
+        if (version.begin == kInfinity || version.end <= horizon) {
+            keep[pos] = false;
+            dropped = true;
+        }
+    }
+    if (dropped) {
+        compact(keep);
+    }
+}
+
+void Table::maybeCollectGarbage() {
+    for (const auto& shard : shards_) {
+        shard->maybeCollectGarbage();
+    }
+    if (unsettled_ < gc_threshold_) {
+        return;
+    }
+    
+    // Versions open snapshots still need survive, so the threshold grows with
+    // them and collection stays amortized
+    collectGarbage();
+    gc_threshold_ = std::max({size_t(1024), rowCount() / 8, unsettled_ * 2});
+}
+
+Row Table::makeRow(const Row& source) {
+    if (spare_rows_.empty()) {
+        return source;
+    }
+    Row row = std::move(spare_rows_.back());
+    spare_rows_.pop_back();
+    row.assign(source.begin(), source.end());
+    return row;
+}
+
+void Table::appendRow(const Row& row, uint64_t begin) {
+    if (layout_ == ROW_ORIENTED) {
+        rows_.push_back(makeRow(row));
+    } else {
+        for (size_t i = 0; i < column_data_.size(); i++) {
+            mutableColumn(i).append(row[i]);
+        }
+    }
+    
+    versions_.push_back({0, kInfinity});
+    setVersion(versions_.size() - 1, {begin, kInfinity});
+}
+
+void Table::appendRow(Row&& row, uint64_t begin) {
+    if (layout_ != ROW_ORIENTED) {
+        appendRow(static_cast<const Row&>(row), begin);
+        return;
+    }
+    rows_.push_back(std::move(row));
+    versions_.push_back({0, kInfinity});
+    setVersion(versions_.size() - 1, {begin, kInfinity});
+}
+
+void Table::appendRows(std::vector<Row>& rows, uint64_t begin) {
+    if (layout_ == ROW_ORIENTED) {
+        rows_.reserve(rows_.size() + rows.size());
+    }
+    versions_.reserve(versions_.size() + rows.size());
+    
+    // Index first, the row is moved into storage afterwards
+    for (auto& row : rows) {
+        indexRow(rowCount(), row);
+        appendRow(std::move(row), begin);
+    }
+}
+
+void Table::assignRow(size_t pos, Row&& row) {
+    if (layout_ != ROW_ORIENTED) {
+        assignRow(pos, static_cast<const Row&>(row));
+        return;
+    }
+    unindexRow(pos, rows_[pos]);
+    indexRow(pos, row);
+    rows_.mutableAt(pos) = std::move(row);
+    changes_++;
+}
+
+void Table::assignRow(size_t pos, const Row& row) {
+    if (layout_ == ROW_ORIENTED) {
+        unindexRow(pos, rows_[pos]);
+        rows_.mutableAt(pos) = row;
+    } else {
+        unindexRow(pos, rowAt(pos));
+        for (size_t i = 0; i < column_data_.size(); i++) {
+            mutableColumn(i).set(pos, row[i]);
+        }
+    }
+    indexRow(pos, row);
+    changes_++;
+}
+
+void Table::setVersion(size_t pos, const Version& version) {
+    auto unsettled = [](const Version& v) { return (v.begin & kPendingBit) != 0 || v.end != kInfinity; };
+    const Version& old = versions_[pos];
+    unsettled_ += (unsettled(version) ? 1 : 0) - (unsettled(old) ? 1 : 0);
+    if (version.begin < kPendingBit) {
+        max_begin_ = std::max(max_begin_, version.begin);
+    }
+    
+    // Remember what a running transaction stamped so it can finish it later
+    bool begin_tagged = (version.begin & kPendingBit) && version.begin != kInfinity && version.begin != old.begin;
+    bool end_tagged = (version.end & kPendingBit) && version.end != kInfinity && version.end != old.end;
+    if (begin_tagged) {
+        pending_[version.begin].push_back(pos);
+    } else if (end_tagged) {
+        pending_[version.end].push_back(pos);
+    }
+    versions_.mutableAt(pos) = version;
+    changes_++;
+}
+
+size_t Table::compact(const std::vector<bool>& keep) {
+    size_t original_size = rowCount();
+    changes_++;
+    
+    if (layout_ == ROW_ORIENTED) {
+        // Stable compaction, surviving rows keep their relative order. Swapping
+        // gathers the dropped rows at the end, where their buffers are kept.
+        size_t out = 0;
+        for (size_t pos = 0; pos < rows_.size(); pos++) {
+            if (keep[pos]) {
+                if (out != pos) {
+                    std::swap(rows_.mutableAt(out), rows_.mutableAt(pos));
+                }
+                out++;
+            }
+        }
+        for (size_t pos = out; pos < rows_.size() && spare_rows_.size() < kMaxSpareRows; pos++) {
+            // A chunk a snapshot still reads would be cloned just to take them
+            if (rows_.shared(pos)) {
+                continue;
+            }
+            Row& dropped = rows_.mutableAt(pos);
+            dropped.clear();
+            spare_rows_.push_back(std::move(dropped));
+        }
+        rows_.truncate(out);
+    } else {
+        for (size_t i = 0; i < column_data_.size(); i++) {
+            mutableColumn(i).compact(keep);
+        }
+    }
+    
+    // Versions move with their rows, and pending positions with them
+    std::vector<size_t> moved(original_size);
+    size_t out = 0;
+    unsettled_ = 0;
+    for (size_t pos = 0; pos < original_size; pos++) {
+        moved[pos] = out;
+        if (keep[pos]) {
+            Version version = versions_[pos];
+            unsettled_ += ((version.begin & kPendingBit) || version.end != kInfinity) ? 1 : 0;
+            versions_.mutableAt(out++) = version;
+        }
+    }
+    versions_.truncate(out);
+    for (auto& entry : pending_) {
+        for (auto& pos : entry.second) {
+            pos = moved[pos];
+        }
+    }
+    
+    size_t erased = original_size - rowCount();
+    if (erased > 0) {
+        // Surviving rows have shifted, so positions must be recomputed
+        rebuildIndexes();
+    }
+    return erased;
+}
+
+void Table::indexRow(size_t pos, const Row& row) {
+    for (auto& index : key_indexes_) {
+        index.positions.emplace(row[index.column], pos);
+    }
+    for (auto& index : indexes_) {
+        if (index.type == ORDERED) {
+            index.ordered.emplace(row[index.column], pos);
+        } else {
+            index.hashed.emplace(row[index.column], pos);
+        }
+    }
+}
+
+void Table::unindexRow(size_t pos, const Row& row) {
+    for (auto& index : key_indexes_) {
+        auto matches = index.positions.equal_range(row[index.column]);
+        for (auto it = matches.first; it != matches.second; ++it) {
+            if (it->second == pos) {
+                index.positions.erase(it);
+                break;
+            }
+        }
+    }
+    for (auto& index : indexes_) {
+        if (index.type == ORDERED) {
+            auto matches = index.ordered.equal_range(row[index.column]);
+            for (auto it = matches.first; it != matches.second; ++it) {
+                if (it->second == pos) {
+                    index.ordered.erase(it);
+                    break;
+                }
+            }
+        } else {
+            auto matches = index.hashed.equal_range(row[index.column]);
+            for (auto it = matches.first; it != matches.second; ++it) {
+                if (it->second == pos) {
+                    index.hashed.erase(it);
+                    break;
+                }
+            }
+        }
+    }
+}
+
+void Table::rebuildIndexes() {
+    for (auto& index : key_indexes_) {
+        index.positions.clear();
+        index.positions.reserve(rowCount());
+    }
+    for (auto& index : indexes_) {
+        index.ordered.clear();
+        index.hashed.clear();
+        index.hashed.reserve(rowCount());
+    }
+    forEachRow([this](size_t pos, const Row& row) {
+        indexRow(pos, row);
+        return true;
+    });
+}
+
+// Table serialization
+void Table::serialize(std::ostream& out) const {
+    std::vector<std::shared_lock<TableLock>> locks;
+    const_cast<Table*>(this)->lockParts(locks);
+    
+    // Write table name
+    size_t name_len = name_.length();
+    out.write(reinterpret_cast<const char*>(&name_len), sizeof(name_len));
+    out.write(name_.c_str(), name_len);
+    
+    // Write columns
+    size_t col_count = columns_.size();
+    out.write(reinterpret_cast<const char*>(&col_count), sizeof(col_count));
+    
+    for (const auto& col : columns_) {
+        // Write column name
+        size_t col_name_len = col.name.length();
+        out.write(reinterpret_cast<const char*>(&col_name_len), sizeof(col_name_len));
+        out.write(col.name.c_str(), col_name_len);
+        
+        // Write column type
+        out.write(reinterpret_cast<const char*>(&col.type), sizeof(col.type));
+        
+        // Write constraints
+        out.write(reinterpret_cast<const char*>(&col.primary_key), sizeof(col.primary_key));
+        out.write(reinterpret_cast<const char*>(&col.not_null), sizeof(col.not_null));
+        out.write(reinterpret_cast<const char*>(&col.unique), sizeof(col.unique));
+    }
+    
+    // Write rows, only the latest committed version of each. The format has
+    // no shards, the rows of all of them are written as one table.
+    size_t row_count = 0;
+    for (Table* part : parts()) {
+        part->forEachVisible(part->latestView(), [&row_count](size_t, const Row&) {
+            row_count++;
+            return true;
+        });
+    }
+    out.write(reinterpret_cast<const char*>(&row_count), sizeof(row_count));
+    
+    for (Table* part : parts()) {
+        part->forEachVisible(part->latestView(), [&out](size_t, const Row& row) {
+            // Write values in the row
+            size_t value_count = row.size();
+            out.write(reinterpret_cast<const char*>(&value_count), sizeof(value_count));
+            
+            for (const auto& value : row) {
+                value.serialize(out);
+            }
+            return true;
+        });
+    }
+}
+
+std::unique_ptr<Table> Table::deserialize(std::istream& in) {
+    // Read table name
+    size_t name_len = 0;
+    if (!in.read(reinterpret_cast<char*>(&name_len), sizeof(name_len))) {
+        return nullptr;
+    }
+    
+    std::string table_name(name_len, '\0');
+    in.read(&table_name[0], name_len);
+    
+    // Read columns
+    size_t col_count = 0;
+    if (!in.read(reinterpret_cast<char*>(&col_count), sizeof(col_count))) {
+        return nullptr;
+    }
+    
+    std::vector<Column> columns;
+    
+    for (size_t i = 0; i < col_count; i++) {
+        Column col;
+        
+        // Read column name
+        size_t col_name_len = 0;
+        in.read(reinterpret_cast<char*>(&col_name_len), sizeof(col_name_len));
+        
+        std::string col_name(col_name_len, '\0');
+        in.read(&col_name[0], col_name_len);
+        col.name = std::move(col_name);
+        
+        // Read column type
+        in.read(reinterpret_cast<char*>(&col.type), sizeof(col.type));
+        
+        // Read constraints
+        in.read(reinterpret_cast<char*>(&col.primary_key), sizeof(col.primary_key));
+        in.read(reinterpret_cast<char*>(&col.not_null), sizeof(col.not_null));
+        in.read(reinterpret_cast<char*>(&col.unique), sizeof(col.unique));
+        if (!in || col.type > Column::BLOB) {
+            return nullptr;
+        }
+        
+        columns.push_back(std::move(col));
+    }
+    
+    // Create the table with name and columns
+    auto table = std::make_unique<Table>(table_name, columns);
+    
+    // Read rows
+    size_t row_count = 0;
+    in.read(reinterpret_cast<char*>(&row_count), sizeof(row_count));
+    
+    for (size_t i = 0; i < row_count && in; i++) {
+        // Read values in the row
+        size_t value_count = 0;
+        in.read(reinterpret_cast<char*>(&value_count), sizeof(value_count));
+        if (!in || value_count != columns.size()) {
+            return nullptr;
+        }
+        
+        Row row;
+        row.reserve(value_count);
+        
+        for (size_t j = 0; j < value_count; j++) {
+            row.push_back(Value::deserialize(in));
+        }
+        
+        // Insert the row directly without triggering constraints check
+        // since the data was already validated when it was first inserted
+        table->appendRow(row);
+    }
+    
+    if (!in) {
+        return nullptr;
+    }
+    
+    table->rebuildIndexes();
+    return table;
+}
+
+// Database implementation
+// Shared encoding for snapshot blocks and log records. Values are a u8 type
+// tag followed by an i32, the f64 bits, or a u32 length and the bytes.
+namespace {
+
+constexpr char kSnapshotMagic[8] = {'L', 'D', 'B', 'S', 'N', 'A', 'P', '\0'};
+constexpr uint32_t kSnapshotVersion = 2;
+
+// magic | u32 version | u32 table count | u64 directory offset |
+// u64 directory size | u32 directory crc | u32 header crc
+constexpr size_t kSnapshotHeaderSize = 40;
+
+// Directory entries: name | u64 offset | u64 size | u32 block crc |
+// u8 block encoding, the last field since version 2
+
+// Set in a table block's layout byte when a shard count follows it
+constexpr uint8_t kShardedLayout = 0x80;
+
+// Rows per independently encoded piece of a table block, and how much output
+// is collected before it goes to the file
+constexpr size_t kSnapshotPieceRows = 16384;
+constexpr size_t kSnapshotWriteBuffer = 1 << 20;
+
+// Encode count pieces on worker threads and hand them to consume in order.
+// Workers stay at most a few pieces ahead of the consumer, which bounds the
+// memory held by encoded output.
+bool encodeOrdered(size_t count, const std::function<void(size_t, std::string&)>& encode,
+                   const std::function<bool(size_t, const std::string&)>& consume) {
+    size_t threads = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), count);
+    if (threads <= 1) {
+        std::string piece;
+        for (size_t i = 0; i < count; i++) {
+            piece.clear();
+            encode(i, piece);
+            if (!consume(i, piece)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    
+    const size_t window = threads * 2;
+    std::vector<std::string> encoded(count);
+    std::vector<bool> ready(count, false);
+    std::mutex mutex;
+    std::condition_variable cv;
+    size_t next = 0;
+    size_t consumed = 0;
+    bool stop = false;
+    
+    auto worker = [&]() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            cv.wait(lock, [&] { return stop || next >= count || next < consumed + window; });
+            if (stop || next >= count) {
+                return;
+            }
+            size_t index = next++;
+            lock.unlock();
+            
+            std::string piece;
+            encode(index, piece);
+            
+            lock.lock();
+            encoded[index] = std::move(piece);
+            ready[index] = true;
+            cv.notify_all();
+        }
+    };
+    
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < threads; i++) {
+        workers.emplace_back(worker);
+    }
+    
+    bool ok = true;
+    std::string piece;
+    for (size_t i = 0; i < count && ok; i++) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [&] { return ready[i]; });
+            piece = std::move(encoded[i]);
+            encoded[i] = std::string();
+            consumed = i + 1;
+        }
+        cv.notify_all();
+        ok = consume(i, piece);
+    }
+    
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    cv.notify_all();
+    for (auto& thread : workers) {
+        thread.join();
+    }
+    return ok;
+}
+
+void putValue(ByteWriter& out, const Value& value) {
+    out.putU8(value.type);
+    switch (value.type) {
+        case Value::INT:
+            out.putI32(value.asInt());
+            break;
+        case Value::FLOAT:
+            out.putF64(value.asFloat());
+            break;
+        case Value::TEXT:
+            out.putString(value.textView());
+            break;
+        case Value::BLOB:
+            out.putString(value.blobView());
+            break;
+        case Value::NULL_TYPE:
+            break;
+    }
+}
+
+bool getValue(ByteReader& in, Value& value) {
+    uint8_t tag = 0;
+    if (!in.getU8(tag)) {
+        return false;
+    }
+    
+    switch (tag) {
+        case Value::NULL_TYPE:
+            value = Value();
+            return true;
+        case Value::INT: {
+            int32_t int_val = 0;
+            if (!in.getI32(int_val)) {
+                return false;
+            }
+            value = Value(static_cast<int>(int_val));
+            return true;
+        }
+        case Value::FLOAT: {
+            double float_val = 0;
+            if (!in.getF64(float_val)) {
+                return false;
+            }
+            value = Value(float_val);
+            return true;
+        }
+        case Value::TEXT:
+        case Value::BLOB: {
+            uint32_t size = 0;
+            const char* bytes = nullptr;
+            if (!in.getU32(size) || !in.getBytes(size, bytes)) {
+                return false;
+            }
+            value = Value::fromBytes(static_cast<Value::Type>(tag), bytes, size);
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+void putRow(ByteWriter& out, const Row& row) {
+    out.putU32(static_cast<uint32_t>(row.size()));
+    for (const auto& value : row) {
+        putValue(out, value);
+    }
+}
+
+bool getRow(ByteReader& in, Row& row) {
+    uint32_t count = 0;
+    if (!in.getU32(count) || count > in.remaining()) {
+        return false;
+    }
+    row.resize(count);
+    for (auto& value : row) {
+        if (!getValue(in, value)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void putRows(ByteWriter& out, const std::vector<Row>& rows) {
+    out.putU32(static_cast<uint32_t>(rows.size()));
+    for (const auto& row : rows) {
+        putRow(out, row);
+    }
+}
+
+bool getRows(ByteReader& in, std::vector<Row>& rows) {
+    uint32_t count = 0;
+    if (!in.getU32(count) || count > in.remaining() / 4) {
+        return false;
+    }
+    rows.resize(count);
+    for (auto& row : rows) {
+        if (!getRow(in, row)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void putColumnList(ByteWriter& out, const std::vector<Column>& columns) {
+    out.putU32(static_cast<uint32_t>(columns.size()));
+    for (const auto& column : columns) {
+        out.putString(column.name);
+        out.putU8(static_cast<uint8_t>(column.type));
+        out.putU8((column.primary_key ? 1 : 0) | (column.not_null ? 2 : 0) | (column.unique ? 4 : 0));
+    }
+}
+
+bool getColumnList(ByteReader& in, std::vector<Column>& columns) {
+    uint32_t count = 0;
+    if (!in.getU32(count) || count > in.remaining()) {
+        return false;
+    }
+    columns.resize(count);
+    for (auto& column : columns) {
+        uint8_t type = 0;
+        uint8_t flags = 0;
+        if (!in.getString(column.name) || !in.getU8(type) || !in.getU8(flags) || type > Column::BLOB) {
+            return false;
+        }
+        column.type = static_cast<Column::Type>(type);
+        column.primary_key = flags & 1;
+        column.not_null = flags & 2;
+        column.unique = flags & 4;
+    }
+    return true;
+}
+
+// Directory encodings of a table block. Compressed blocks are a sequence of
+// frames, u8 method | varint raw size | varint stored size | the bytes: the
+// first frame holds the block header, each further one a piece of rows
+// column by column.
+constexpr uint8_t kPlainBlock = 0;
+constexpr uint8_t kCompressedBlock = 1;
+constexpr uint8_t kRawFrame = 0;
+constexpr uint8_t kLz4Frame = 1;
+
+// Frames that do not shrink are stored as they are
+void putFrame(std::string& out, const std::string& raw) {
+    std::string compressed;
+    lz4Compress(raw.data(), raw.size(), compressed);
+    bool smaller = compressed.size() < raw.size();
+    const std::string& stored = smaller ? compressed : raw;
+    ByteWriter writer(out);
+    writer.putU8(smaller ? kLz4Frame : kRawFrame);
+    writer.putVarint(raw.size());
+    writer.putVarint(stored.size());
+    writer.putBytes(stored.data(), stored.size());
+}
+
+// LZ4 expands at most about 255 times, which bounds the size a frame claims
+bool getFrame(ByteReader& in, std::string& raw) {
+    uint8_t method = 0;
+    uint64_t raw_size = 0;
+    uint64_t stored_size = 0;
+    const char* stored = nullptr;
+    if (!in.getU8(method) || !in.getVarint(raw_size) || !in.getVarint(stored_size) ||
+        !in.getBytes(stored_size, stored)) {
+        return false;
+    }
+    if (method == kRawFrame && raw_size == stored_size) {
+        raw.assign(stored, stored_size);
+        return true;
+    }
+    if (method != kLz4Frame || raw_size > stored_size * 255 + 16) {
+        return false;
+    }
+    raw.resize(raw_size);
+    return lz4Decompress(stored, stored_size, &raw[0], raw.size());
+}
+
+// A column of a compressed piece starts with a kind byte: the type of its
+// non-null cells, with kCompactNulls when a null bitmap follows and
+// kCompactDictionary when TEXT is coded against a dictionary of the piece.
+// Row-oriented tables may mix types in a column, such columns tag each cell.
+// INT is a zigzag varint, FLOAT its f64 bits, TEXT and BLOB a varint length
+// and the bytes.
+constexpr uint8_t kCompactTypeMask = 0x0F;
+constexpr uint8_t kCompactMixed = 0x0F;
+constexpr uint8_t kCompactDictionary = 0x20;
+constexpr uint8_t kCompactNulls = 0x40;
+
+void putCompactValue(ByteWriter& out, const Value& value) {
+    switch (value.type) {
+        case Value::INT: {
+            int32_t int_val = value.asInt();
+            out.putVarint((static_cast<uint32_t>(int_val) << 1) ^ static_cast<uint32_t>(int_val >> 31));
+            break;
+        }
+        case Value::FLOAT:
+            out.putF64(value.asFloat());
+            break;
+        case Value::TEXT:
+        case Value::BLOB: {
+            std::string_view bytes = value.type == Value::TEXT ? value.textView() : value.blobView();
+            out.putVarint(bytes.size());
+            out.putBytes(bytes.data(), bytes.size());
+            break;
+        }
+        case Value::NULL_TYPE:
+            break;
+    }
+}
+
+bool getCompactValue(ByteReader& in, uint8_t type, Value& value) {
+    switch (type) {
+        case Value::NULL_TYPE:
+            value = Value();
+            return true;
+        case Value::INT: {
+            uint64_t bits = 0;
+            if (!in.getVarint(bits) || bits > UINT32_MAX) {
+                return false;
+            }
+            uint32_t zigzag = static_cast<uint32_t>(bits);
+            value = Value(static_cast<int>(static_cast<int32_t>((zigzag >> 1) ^ (0u - (zigzag & 1)))));
+            return true;
+        }
+        case Value::FLOAT: {
+            double float_val = 0;
+            if (!in.getF64(float_val)) {
+                return false;
+            }
+            value = Value(float_val);
+            return true;
+        }
+        case Value::TEXT:
+        case Value::BLOB: {
+            uint64_t size = 0;
+            const char* bytes = nullptr;
+            if (!in.getVarint(size) || !in.getBytes(size, bytes)) {
+                return false;
+            }
+            value = Value::fromBytes(static_cast<Value::Type>(type), bytes, size);
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+// cell(i) returns a reference that stays valid while the column is encoded
+template <typename CellAt>
+void putCompactColumn(ByteWriter& out, size_t count, const CellAt& cell) {
+    size_t nulls = 0;
+    uint8_t type = Value::NULL_TYPE;
+    bool mixed = false;
+    for (size_t i = 0; i < count; i++) {
+        const Value& value = cell(i);
+        if (value.type == Value::NULL_TYPE) {
+            nulls++;
+        } else if (type == Value::NULL_TYPE) {
+            type = value.type;
+        } else if (value.type != type) {
+            mixed = true;
+        }
+    }
+    if (mixed) {
+        out.putU8(kCompactMixed);
+        for (size_t i = 0; i < count; i++) {
+            out.putU8(cell(i).type);
+            putCompactValue(out, cell(i));
+        }
+        return;
+    }
+    if (nulls == count) {
+        out.putU8(Value::NULL_TYPE);
+        return;
+    }
+    
+    // TEXT with at most one distinct value per two cells goes through a dictionary
+    std::unordered_map<std::string_view, uint32_t> dictionary;
+    if (type == Value::TEXT) {
+        size_t limit = (count - nulls) / 2;
+        for (size_t i = 0; i < count && dictionary.size() <= limit; i++) {
+            const Value& value = cell(i);
+            if (value.type != Value::NULL_TYPE) {
+                uint32_t code = static_cast<uint32_t>(dictionary.size());
+                dictionary.emplace(value.textView(), code);
+            }
+        }
+        if (dictionary.size() > limit) {
+            dictionary.clear();
+        }
+    }
+    
+    out.putU8(type | (nulls > 0 ? kCompactNulls : 0) | (dictionary.empty() ? 0 : kCompactDictionary));
+    if (nulls > 0) {
+        std::string bitmap((count + 7) / 8, '\0');
+        for (size_t i = 0; i < count; i++) {
+            if (cell(i).type == Value::NULL_TYPE) {
+                bitmap[i / 8] = static_cast<char>(bitmap[i / 8] | (1 << (i % 8)));
+            }
+        }
+        out.putBytes(bitmap.data(), bitmap.size());
+    }
+    if (!dictionary.empty()) {
+        std::vector<std::string_view> entries(dictionary.size());
+        for (const auto& [text, code] : dictionary) {
+            entries[code] = text;
+        }
+        out.putVarint(entries.size());
+        for (const auto& text : entries) {
+            out.putVarint(text.size());
+            out.putBytes(text.data(), text.size());
+        }
+    }
+    for (size_t i = 0; i < count; i++) {
+        const Value& value = cell(i);
+        if (value.type == Value::NULL_TYPE) {
+            continue;
+        }
+        if (dictionary.empty()) {
+            putCompactValue(out, value);
+        } else {
+            out.putVarint(dictionary.find(value.textView())->second);
+        }
+    }
+}
+
+// Fill one column of rows, which start out NULL
+bool getCompactColumn(ByteReader& in, std::vector<Row>& rows, size_t column) {
+    uint8_t kind = 0;
+    if (!in.getU8(kind)) {
+        return false;
+    }
+    if (kind == kCompactMixed) {
+        for (auto& row : rows) {
+            uint8_t tag = 0;
+            if (!in.getU8(tag) || tag == kCompactMixed || !getCompactValue(in, tag, row[column])) {
+                return false;
+            }
+        }
+        return true;
+    }
+    
+    uint8_t type = kind & kCompactTypeMask;
+    if (type > Value::BLOB || (kind & ~(kCompactTypeMask | kCompactNulls | kCompactDictionary)) != 0 ||
+        (type == Value::NULL_TYPE && kind != Value::NULL_TYPE) ||
+        ((kind & kCompactDictionary) && type != Value::TEXT)) {
+        return false;
+    }
+    if (type == Value::NULL_TYPE) {
+        return true;
+    }
+    
+    const char* bitmap = nullptr;
+    if ((kind & kCompactNulls) && !in.getBytes((rows.size() + 7) / 8, bitmap)) {
+        return false;
+    }
+    std::vector<Value> dictionary;
+    if (kind & kCompactDictionary) {
+        uint64_t entries = 0;
+        if (!in.getVarint(entries) || entries > in.remaining()) {
+            return false;
+        }
+        dictionary.resize(entries);
+        for (auto& entry : dictionary) {
+            if (!getCompactValue(in, Value::TEXT, entry)) {
+                return false;
+            }
+        }
+    }
+    for (size_t i = 0; i < rows.size(); i++) {
+        if (bitmap && ((static_cast<uint8_t>(bitmap[i / 8]) >> (i % 8)) & 1)) {
+            continue;
+        }
+        if (dictionary.empty()) {
+            if (!getCompactValue(in, type, rows[i][column])) {
+                return false;
+            }
+            continue;
+        }
+        uint64_t code = 0;
+        if (!in.getVarint(code) || code >= dictionary.size()) {
+            return false;
+        }
+        rows[i][column] = dictionary[code];
+    }
+    return true;
+}
+
+// Manifest of incremental checkpoints: magic | u32 version | u32 segment
+// count | segment names | u32 table count | tables | u32 crc of everything
+// before it. A table is name | u32 segment | u64 offset | u64 size | u32
+// block crc | u8 block encoding. Segments are snapshot files named relative
+// to the manifest's directory.
+constexpr char kManifestMagic[8] = {'L', 'D', 'B', 'M', 'A', 'N', 'I', '\0'};
+constexpr uint32_t kManifestVersion = 1;
+
+struct ManifestEntry {
+    std::string name;
+    uint32_t segment = 0;
+    uint64_t offset = 0;
+    uint64_t size = 0;
+    uint32_t checksum = 0;
+    uint8_t encoding = 0;
+};
+
+std::string siblingPath(const std::string& path, const std::string& name) {
+    size_t slash = path.rfind('/');
+    return slash == std::string::npos ? name : path.substr(0, slash + 1) + name;
+}
+
+std::string baseName(const std::string& path) {
+    size_t slash = path.rfind('/');
+    return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+bool readManifest(const std::string& path, std::vector<std::string>& segments,
+                  std::vector<ManifestEntry>& entries) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        return false;
+    }
+    std::string bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (bytes.size() < sizeof(kManifestMagic) + 4 ||
+        std::memcmp(bytes.data(), kManifestMagic, sizeof(kManifestMagic)) != 0) {
+        return false;
+    }
+    
+    size_t body = bytes.size() - 4;
+    uint32_t crc = 0;
+    ByteReader(bytes.data() + body, 4).getU32(crc);
+    if (crc32(bytes.data(), body) != crc) {
+        return false;
+    }
+    
+    ByteReader in(bytes.data() + sizeof(kManifestMagic), body - sizeof(kManifestMagic));
+    uint32_t version = 0;
+    uint32_t segment_count = 0;
+    if (!in.getU32(version) || version != kManifestVersion || !in.getU32(segment_count) ||
+        segment_count > in.remaining()) {
+        return false;
+    }
+    segments.resize(segment_count);
+    for (auto& segment : segments) {
+        if (!in.getString(segment)) {
+            return false;
+        }
+    }
+    
+    uint32_t table_count = 0;
+    if (!in.getU32(table_count) || table_count > in.remaining()) {
+        return false;
+    }
+    entries.resize(table_count);
+    for (auto& entry : entries) {
+        if (!in.getString(entry.name) || !in.getU32(entry.segment) || !in.getU64(entry.offset) ||
+            !in.getU64(entry.size) || !in.getU32(entry.checksum) || !in.getU8(entry.encoding) ||
+            entry.segment >= segments.size()) {
+            return false;
+        }
+    }
+    return in.remaining() == 0;
+}
+
+// Replaces the manifest atomically, like a snapshot
+bool writeManifest(const std::string& path, const std::vector<std::string>& segments,
+                   const std::vector<ManifestEntry>& entries) {
+    std::string bytes;
+    ByteWriter out(bytes);
+    out.putBytes(kManifestMagic, sizeof(kManifestMagic));
+    out.putU32(kManifestVersion);
+    out.putU32(static_cast<uint32_t>(segments.size()));
+    for (const auto& segment : segments) {
+        out.putString(segment);
+    }
+    out.putU32(static_cast<uint32_t>(entries.size()));
+    for (const auto& entry : entries) {
+        out.putString(entry.name);
+        out.putU32(entry.segment);
+        out.putU64(entry.offset);
+        out.putU64(entry.size);
+        out.putU32(entry.checksum);
+        out.putU8(entry.encoding);
+    }
+    out.putU32(crc32(bytes.data(), bytes.size()));
+    
+    std::string temp_path = path + ".tmp";
+    int fd = ::open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = writeAll(fd, bytes.data(), bytes.size()) && ::fsync(fd) == 0;
+    ok = ::close(fd) == 0 && ok;
+    if (!ok || std::rename(temp_path.c_str(), path.c_str()) != 0) {
+        std::remove(temp_path.c_str());
+        return false;
+    }
+    syncDirectoryOf(path);
+    return true;
+}
+
+// Logs written before sharding end after the column list, a missing shard
+// count reads as one
+std::string encodeTableSchema(const std::string& name, const std::vector<Column>& columns,
+                              Table::Layout layout, size_t shards) {
+    std::string payload;
+    ByteWriter out(payload);
+    out.putString(name);
+    out.putU8(static_cast<uint8_t>(layout));
+    putColumnList(out, columns);
+    out.putU32(static_cast<uint32_t>(shards));
+    return payload;
+}
+
+std::string encodeRows(const std::string& table_name, const Row* row, const std::vector<Row>& rows) {
+    std::string payload;
+    ByteWriter out(payload);
+    out.putString(table_name);
+    if (row) {
+        putRow(out, *row);
+    }
+    putRows(out, rows);
+    return payload;
+}
+
+size_t rowHash(const Row& row) {
+    size_t hash = 0;
+    for (const auto& value : row) {
+        hash = hash * 31 + ValueHash()(value);
+    }
+    return hash;
+}
+
+} // namespace
+
+std::vector<size_t> Table::matchRows(const std::vector<Row>& targets) const {
+    // A primary key names at most one row, so its index finds each target
+    // without a scan
+    int pk_index = findPrimaryKeyIndex();
+    for (const auto& index : key_indexes_) {
+        if (static_cast<int>(index.column) != pk_index) {
+            continue;
+        }
+        std::vector<size_t> positions;
+        for (const auto& target : targets) {
+            auto matches = index.positions.equal_range(target[index.column]);
+            for (auto it = matches.first; it != matches.second; ++it) {
+                if (versions_[it->second].end == kInfinity && rowAt(it->second) == target) {
+                    positions.push_back(it->second);
+                    break;
+                }
+            }
+        }
+        return positions;
+    }
+    
+    // Otherwise one pass over the table. Equal rows are interchangeable, so
+    // any match will do.
+    std::unordered_multimap<size_t, size_t> pending;
+    for (size_t i = 0; i < targets.size(); i++) {
+        pending.emplace(rowHash(targets[i]), i);
+    }
+    
+    std::vector<size_t> positions;
+    forEachRow([&](size_t pos, const Row& row) {
+        auto range = pending.equal_range(rowHash(row));
+        for (auto it = range.first; it != range.second; ++it) {
+            if (targets[it->second] == row) {
+                positions.push_back(pos);
+                pending.erase(it);
+                break;
+            }
+        }
+        return !pending.empty();
+    });
+    return positions;
+}
+
+// Snapshot block: name | u8 layout | columns | u32 index count, per index
+// u32 column and u8 type | u64 row count | rows of one value per column.
+// Sharded tables set kShardedLayout in the layout byte and follow it with a
+// u32 shard count; their rows are those of all shards in shard order.
+Table::Snapshot Table::snapshot(uint64_t read_ts) const {
+    Snapshot snapshot;
+    snapshot.name = name_;
+    snapshot.layout = layout_;
+    snapshot.columns = columns_;
+    if (!shards_.empty()) {
+        for (const auto& index : shards_[0]->indexes_) {
+            snapshot.indexes.emplace_back(index.column, index.type);
+        }
+        for (const auto& shard : shards_) {
+            snapshot.shards.push_back(shard->snapshot(read_ts));
+        }
+        return snapshot;
+    }
+    for (const auto& index : indexes_) {
+        snapshot.indexes.emplace_back(index.column, index.type);
+    }
+    snapshot.positions = rowCount();
+    snapshot.rows = rows_;
+    snapshot.column_data.assign(column_data_.begin(), column_data_.end());
+    snapshot.versions = versions_;
+    snapshot.read_ts = read_ts;
+    snapshot.all_visible = allVisible({read_ts, kNoTransaction});
+    return snapshot;
+}
+
+void Table::Snapshot::encodeHeader(std::string& out) const {
+    ByteWriter writer(out);
+    writer.putString(name);
+    if (shards.empty()) {
+        writer.putU8(static_cast<uint8_t>(layout));
+    } else {
+        writer.putU8(static_cast<uint8_t>(layout | kShardedLayout));
+        writer.putU32(static_cast<uint32_t>(shards.size()));
+    }
+    putColumnList(writer, columns);
+    
+    writer.putU32(static_cast<uint32_t>(indexes.size()));
+    for (const auto& [column, type] : indexes) {
+        writer.putU32(static_cast<uint32_t>(column));
+        writer.putU8(static_cast<uint8_t>(type));
+    }
+    writer.putU64(row_count);
+}
+
+void Table::Snapshot::encodeRows(size_t begin, size_t end, std::string& out) const {
+    ByteWriter writer(out);
+    if (layout == ROW_ORIENTED) {
+        for (size_t pos = begin; pos < end; pos++) {
+            if (!visible(pos)) {
+                continue;
+            }
+            for (const auto& value : rows[pos]) {
+                putValue(writer, value);
+            }
+        }
+        return;
+    }
+    
+    // Columnar cells are encoded straight from the arrays
+    for (size_t pos = begin; pos < end; pos++) {
+        if (!visible(pos)) {
+            continue;
+        }
+        for (const auto& column : column_data) {
+            if (column->isNull(pos)) {
+                writer.putU8(Value::NULL_TYPE);
+                continue;
+            }
+            switch (column->type) {
+                case Column::INT:
+                    writer.putU8(Value::INT);
+                    writer.putI32(column->ints[pos]);
+                    break;
+                case Column::FLOAT:
+                    writer.putU8(Value::FLOAT);
+                    writer.putF64(column->floats[pos]);
+                    break;
+                case Column::TEXT:
+                case Column::BLOB:
+                    writer.putU8(column->type == Column::TEXT ? Value::TEXT : Value::BLOB);
+                    writer.putString(std::string_view(column->bytes.data() + column->offsets[pos],
+                                                      column->lengths[pos]));
+                    break;
+            }
+        }
+    }
+}
+
+void Table::Snapshot::encodeColumns(size_t begin, size_t end, std::string& out) const {
+    std::vector<size_t> positions;
+    for (size_t pos = begin; pos < end; pos++) {
+        if (visible(pos)) {
+            positions.push_back(pos);
+        }
+    }
+    ByteWriter writer(out);
+    writer.putVarint(positions.size());
+    if (layout == ROW_ORIENTED) {
+        for (size_t c = 0; c < columns.size(); c++) {
+            putCompactColumn(writer, positions.size(),
+                             [&](size_t i) -> const Value& { return rows[positions[i]][c]; });
+        }
+        return;
+    }
+    
+    std::vector<Value> cells(positions.size());
+    for (const auto& column : column_data) {
+        for (size_t i = 0; i < positions.size(); i++) {
+            cells[i] = column->get(positions[i]);
+        }
+        putCompactColumn(writer, cells.size(), [&](size_t i) -> const Value& { return cells[i]; });
+    }
+}
+
+std::unique_ptr<Table> Table::decodeSnapshot(const char* data, size_t size, uint8_t encoding) {
+    // A compressed block has its header in a frame of its own
+    ByteReader block(data, size);
+    std::string frame;
+    if (encoding == kCompressedBlock) {
+        if (!getFrame(block, frame)) {
+            return nullptr;
+        }
+    } else if (encoding != kPlainBlock) {
+        return nullptr;
+    }
+    ByteReader reader = encoding == kCompressedBlock ? ByteReader(frame.data(), frame.size()) : block;
+    
+    std::string name;
+    uint8_t layout = 0;
+    uint32_t shards = 1;
+    std::vector<Column> columns;
+    if (!reader.getString(name) || !reader.getU8(layout)) {
+        return nullptr;
+    }
+    if ((layout & kShardedLayout) && !reader.getU32(shards)) {
+        return nullptr;
+    }
+    layout &= ~kShardedLayout;
+    if (layout > COLUMNAR || shards == 0 || !getColumnList(reader, columns)) {
+        return nullptr;
+    }
+    
+    // The constructor rejects schemas a corrupt block may carry
+    std::unique_ptr<Table> table;
+    try {
+        table = std::make_unique<Table>(name, columns, static_cast<Layout>(layout), shards);
+    } catch (const std::exception&) {
+        return nullptr;
+    }
+    std::vector<Table*> parts = table->parts();
+    
+    uint32_t index_count = 0;
+    if (!reader.getU32(index_count)) {
+        return nullptr;
+    }
+    for (uint32_t i = 0; i < index_count; i++) {
+        uint32_t column = 0;
+        uint8_t type = 0;
+        if (!reader.getU32(column) || !reader.getU8(type) || column >= columns.size() || type > HASH) {
+            return nullptr;
+        }
+        SecondaryIndex index;
+        index.column = column;
+        index.type = static_cast<IndexType>(type);
+        for (Table* part : parts) {
+            part->indexes_.push_back(index);
+        }
+    }
+    
+    uint64_t row_count = 0;
+    if (!reader.getU64(row_count)) {
+        return nullptr;
+    }
+    
+    if (encoding == kCompressedBlock) {
+        // Pieces end with the block and hold at most kSnapshotPieceRows rows
+        std::vector<Row> rows;
+        uint64_t loaded = 0;
+        while (block.remaining() > 0) {
+            if (!getFrame(block, frame)) {
+                return nullptr;
+            }
+            ByteReader piece(frame.data(), frame.size());
+            uint64_t count = 0;
+            if (!piece.getVarint(count) || count > kSnapshotPieceRows || count > row_count - loaded) {
+                return nullptr;
+            }
+            rows.assign(count, Row(columns.size()));
+            for (size_t c = 0; c < columns.size(); c++) {
+                if (!getCompactColumn(piece, rows, c)) {
+                    return nullptr;
+                }
+            }
+            if (piece.remaining() != 0) {
+                return nullptr;
+            }
+            for (auto& row : rows) {
+                if (!table->acceptsRow(row)) {
+                    return nullptr;
+                }
+                table->shardFor(row)->appendRow(std::move(row));
+            }
+            loaded += count;
+        }
+        if (loaded != row_count) {
+            return nullptr;
+        }
+        
+        for (Table* part : parts) {
+            part->rebuildIndexes();
+        }
+        return table;
+    }
+    
+    // Every value takes at least its tag byte, which bounds the row count
+    if (row_count * std::max<size_t>(columns.size(), 1) > reader.remaining()) {
+        return nullptr;
+    }
+    
+    Row row(columns.size());
+    if (layout == ROW_ORIENTED && parts.size() == 1) {
+        table->rows_.reserve(row_count);
+    }
+    if (parts.size() == 1) {
+        table->versions_.reserve(row_count);
+    }
+    for (uint64_t i = 0; i < row_count; i++) {
+        for (auto& value : row) {
+            if (!getValue(reader, value)) {
+                return nullptr;
+            }
+        }
+        if (!table->acceptsRow(row)) {
+            return nullptr;
+        }
+        table->shardFor(row)->appendRow(row);
+    }
+    
+    for (Table* part : parts) {
+        part->rebuildIndexes();
+    }
+    return table;
+}
+
+Database::Database()
+    : tables_(std::make_shared<const Catalog>()),
+      clock_(std::make_shared<VersionClock>()),
+      pool_(std::make_shared<WorkerPool>()),
+      metrics_(std::make_shared<Metrics>()) {}
+
+Database::~Database() = default;
+
+bool Database::createTable(const std::string& name, const std::vector<Column>& columns,
+                           Table::Layout layout, size_t shards) {
+    std::shared_ptr<WriteAheadLog> wal;
+    uint64_t lsn = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        
+        if (tables_->count(name) > 0 || unloaded_.count(name) > 0) {
+            return false; // Table already exists
+        }
+        
+        adoptTable(std::make_unique<Table>(name, columns, layout, shards));
+        
+        if (!wal_) {
+            return true;
+        }
+        
+        // Logged under the catalog lock so schema records keep their order
+        wal = wal_;
+        lsn = wal->append(0, WriteAheadLog::CREATE_TABLE, encodeTableSchema(name, columns, layout, shards));
+    }
+    
+    // Schema changes are logged outside any transaction and synced at once
+    return wal->sync(lsn);
+}
+
+bool Database::dropTable(const std::string& name) {
+    std::shared_ptr<WriteAheadLog> wal;
+    uint64_t lsn = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        
+        if (!eraseTable(name) && unloaded_.erase(name) == 0) {
+            return false; // Table doesn't exist
+        }
+        
+        if (!wal_) {
+            return true;
+        }
+        
+        std::string payload;
+        ByteWriter(payload).putString(name);
+        wal = wal_;
+        lsn = wal->append(0, WriteAheadLog::DROP_TABLE, payload);
+    }
+    
+    return wal->sync(lsn);
+}
+
+std::shared_ptr<Table> Database::acquireTable(const std::string& name) {
+    std::shared_ptr<const Catalog> tables = catalog();
+    auto it = tables->find(name);
+    if (it != tables->end()) {
+        return it->second;
+    }
+    
+    // Missing names and tables still in the mapped snapshot take the lock
+    std::lock_guard<std::mutex> lock(mutex_);
+    return findTable(name);
+}
+
+Table* Database::getTable(const std::string& name) {
+    return acquireTable(name).get();
+}
+
+std::shared_ptr<Table> Database::findTable(const std::string& name) {
+    auto it = tables_->find(name);
+    if (it != tables_->end()) {
+        return it->second;
+    }
+    
+    auto entry = unloaded_.find(name);
+    if (entry == unloaded_.end()) {
+        return nullptr; // Table doesn't exist
+    }
+    
+    // Decode the table from the mapped snapshot on first access. A block that
+    // fails its checksum stays unloaded so saving keeps its original bytes.
+    const char* block = entry->second.file->data() + entry->second.offset;
+    if (crc32(block, entry->second.size) != entry->second.checksum) {
+        return nullptr;
+    }
+    auto table = Table::decodeSnapshot(block, entry->second.size, entry->second.encoding);
+    if (!table || table->getName() != name) {
+        return nullptr;
+    }
+    
+    // Still the contents the block was checkpointed with
+    table->id_ = entry->second.table_id;
+    for (Table* part : table->parts()) {
+        part->changes_ = 0;
+    }
+    unloaded_.erase(entry);
+    
+    return adoptTable(std::move(table));
+}
+
+std::shared_ptr<Table> Database::adoptTable(std::unique_ptr<Table> table) {
+    // Tables share the database clock so transactions see one timeline, its
+    // worker pool for parallel scans and its counters
+    table->clock_ = clock_;
+    table->pool_ = pool_;
+    table->metrics_ = metrics_;
+    for (const auto& shard : table->shards_) {
+        shard->clock_ = clock_;
+        shard->pool_ = pool_;
+        shard->metrics_ = metrics_;
+    }
+    std::shared_ptr<Table> result = std::move(table);
+    auto tables = std::make_shared<Catalog>(*tables_);
+    (*tables)[result->getName()] = result;
+    std::atomic_store(&tables_, std::shared_ptr<const Catalog>(std::move(tables)));
+    return result;
+}
+
+bool Database::eraseTable(const std::string& name) {
+    if (tables_->count(name) == 0) {
+        return false;
+    }
+    auto tables = std::make_shared<Catalog>(*tables_);
+    tables->erase(name);
+    std::atomic_store(&tables_, std::shared_ptr<const Catalog>(std::move(tables)));
+    return true;
+}
+
+bool Database::createIndex(const std::string& table_name, const std::string& column,
+                           Table::IndexType type) {
+    std::shared_ptr<Table> table = acquireTable(table_name);
+    if (!table || !table->createIndex(column, type)) {
+        return false;
+    }
+    
+    std::shared_ptr<WriteAheadLog> wal;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        wal = wal_;
+    }
+    if (!wal) {
+        return true;
+    }
+    
+    std::string payload;
+    ByteWriter out(payload);
+    out.putString(table_name);
+    out.putString(column);
+    out.putU8(static_cast<uint8_t>(type));
+    return wal->sync(wal->append(0, WriteAheadLog::CREATE_INDEX, payload));
+}
+
+bool Database::dropIndex(const std::string& table_name, const std::string& column) {
+    std::shared_ptr<Table> table = acquireTable(table_name);
+    if (!table || !table->dropIndex(column)) {
+        return false;
+    }
+    
+    std::shared_ptr<WriteAheadLog> wal;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        wal = wal_;
+    }
+    if (!wal) {
+        return true;
+    }
+    
+    std::string payload;
+    ByteWriter out(payload);
+    out.putString(table_name);
+    out.putString(column);
+    return wal->sync(wal->append(0, WriteAheadLog::DROP_INDEX, payload));
+}
+
+bool Database::enableWal(const std::string& path, const WalOptions& options) {
+    auto wal = std::make_shared<WriteAheadLog>(path, options);
+    if (!wal->open()) {
+        return false;
+    }
+    
+    std::lock_guard<std::mutex> lock(mutex_);
+    wal_ = std::move(wal);
+    return true;
+}
+
+void Database::disableWal() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    wal_.reset();
+}
+
+bool Database::applyLogRecord(uint8_t type, const std::string& payload) {
+    ByteReader in(payload.data(), payload.size());
+    std::string table_name;
+    if (!in.getString(table_name)) {
+        return false;
+    }
+    
+    if (type == WriteAheadLog::CREATE_TABLE) {
+        uint8_t layout = 0;
+        uint32_t shards = 1;
+        std::vector<Column> columns;
+        if (!in.getU8(layout) || !getColumnList(in, columns) || (in.remaining() > 0 && !in.getU32(shards))) {
+            return false;
+        }
+        
+        if (tables_->count(table_name) == 0 && unloaded_.count(table_name) == 0) {
+            adoptTable(std::make_unique<Table>(table_name, columns, static_cast<Table::Layout>(layout), shards));
+        }
+        return true;
+    }
+    
+    if (type == WriteAheadLog::DROP_TABLE) {
+        eraseTable(table_name);
+        unloaded_.erase(table_name);
+        return true;
+    }
+    
+    // Operations on a table dropped later in the log have nothing to apply to
+    std::shared_ptr<Table> table = findTable(table_name);
+    if (!table) {
+        return true;
+    }
+    
+    switch (type) {
+        case WriteAheadLog::CREATE_INDEX: {
+            std::string column;
+            uint8_t index_type = 0;
+            if (!in.getString(column) || !in.getU8(index_type)) {
+                return false;
+            }
+            table->createIndex(column, static_cast<Table::IndexType>(index_type));
+            return true;
+        }
+        case WriteAheadLog::DROP_INDEX: {
+            std::string column;
+            if (!in.getString(column)) {
+                return false;
+            }
+            table->dropIndex(column);
+            return true;
+        }
+        case WriteAheadLog::INSERT: {
+            std::vector<Row> rows;
+            if (!getRows(in, rows)) {
+                return false;
+            }
+            // Replay writes in place, no snapshot can be open yet
+            for (const auto& row : rows) {
+                table->insertRow(row, Table::VersionView{0, 0});
+            }
+            return true;
+        }
+        case WriteAheadLog::UPDATE: {
+            Row row;
+            std::vector<Row> originals;
+            if (!getRow(in, row) || !getRows(in, originals)) {
+                return false;
+            }
+            // A changed primary key moves the row to another shard
+            Table* target = table->shardFor(row);
+            for (Table* part : table->parts()) {
+                std::vector<size_t> matches = part->matchRows(originals);
+                if (part == target) {
+                    for (size_t pos : matches) {
+                        part->assignRow(pos, row);
+                    }
+                    continue;
+                }
+                std::vector<bool> keep(part->rowCount(), true);
+                for (size_t pos : matches) {
+                    keep[pos] = false;
+                }
+                part->compact(keep);
+                for (size_t i = 0; i < matches.size(); i++) {
+                    target->insertRow(row, Table::VersionView{0, 0});
+                }
+            }
+            return true;
+        }
+        case WriteAheadLog::REMOVE: {
+            std::vector<Row> removed;
+            if (!getRows(in, removed)) {
+                return false;
+            }
+            for (Table* part : table->parts()) {
+                std::vector<bool> keep(part->rowCount(), true);
+                for (size_t pos : part->matchRows(removed)) {
+                    keep[pos] = false;
+                }
+                part->compact(keep);
+            }
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+std::shared_ptr<Transaction> Database::beginTransaction(const TransactionOptions& options) {
+    return std::make_shared<Transaction>(this, options);
+}
+
+// Transaction implementation
+Transaction::Transaction(Database* db, const TransactionOptions& options)
+    : db_(db), active_(true), options_(options) {
+    {
+        std::lock_guard<std::mutex> lock(db->mutex_);
+        wal_ = db->wal_;
+        clock_ = db->clock_;
+        metrics_ = db->metrics_;
+    }
+    read_ts_ = clock_->beginSnapshot();
+    tag_ = clock_->nextTag();
+}
+
+Transaction::~Transaction() {
+    if (active_) {
+        rollback();
+    }
+}
+
+bool Transaction::fail(Status::Code code, std::string message) {
+    if (code == Status::TIMEOUT) {
+        metrics_->lock_timeouts.add();
+    }
+    status_.code = code;
+    status_.message = std::move(message);
+    return false;
+}
+
+bool Transaction::failOnException() {
+    try {
+        throw;
+    } catch (const std::exception& e) {
+        return fail(Status::ABORTED, e.what());
+    } catch (...) {
+        return fail(Status::ABORTED, "unknown exception");
+    }
+}
+
+std::chrono::milliseconds Transaction::lockTimeout() const {
+    if (options_.deadline == std::chrono::steady_clock::time_point::max()) {
+        return options_.lock_timeout;
+    }
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(options_.deadline -
+                                                                      std::chrono::steady_clock::now());
+    return std::max(std::chrono::milliseconds(0), std::min(left, options_.lock_timeout));
+}
+
+bool Transaction::commit() {
+    return finishCommit(nullptr);
+}
+
+bool Transaction::commitAsync(std::function<void(bool durable)> on_durable) {
+    if (!on_durable) {
+        on_durable = [](bool) {};
+    }
+    return finishCommit(std::move(on_durable));
+}
+
+std::future<bool> Transaction::commitAsync() {
+    auto durable = std::make_shared<std::promise<bool>>();
+    std::future<bool> result = durable->get_future();
+    if (!finishCommit([durable](bool ok) { durable->set_value(ok); })) {
+        durable->set_value(false);
+    }
+    return result;
+}
+
+bool Transaction::finishCommit(std::function<void(bool)> on_durable) {
+    status_ = Status();
+    if (!active_) {
+        return fail(Status::INACTIVE);
+    }
+    auto start = std::chrono::steady_clock::now();
+    
+    // Validate and apply buffered inserts before anything becomes durable
+    if (insert_failure_ != Status::OK) {
+        fail(insert_failure_);
+    }
+    while (status_.ok() && !inserts_.empty()) {
+        applyInserts(inserts_.begin()->first);
+    }
+    if (!status_.ok()) {
+        rollback();
+        return false;
+    }
+    
+    active_ = false;
+    
+    // Changes are only committed once the commit record is durable, unless
+    // the caller asked not to wait for it
+    uint64_t lsn = 0;
+    if (wal_ && wal_txn_id_ != 0) {
+        lsn = wal_->append(wal_txn_id_, WriteAheadLog::COMMIT, std::string());
+        if (!on_durable && !wal_->sync(lsn)) {
+            active_ = true;
+            rollback();
+            return fail(Status::IO_ERROR);
+        }
+    }
+    
+    // Stamp the pending versions; readers see all of them once the commit
+    // timestamp becomes visible
+    if (!written_.empty()) {
+        uint64_t ts = clock_->beginCommit(wal_txn_id_);
+        for (Table* table : written_) {
+            std::unique_lock<TableLock> lock(table->mutex_);
+            table->commitVersions(tag_, ts);
+            table->maybeCollectGarbage();
+        }
+        clock_->endCommit(ts);
+    }
+    
+    clock_->endSnapshot(read_ts_);
+    releaseArena();
+    metrics_->commits.add();
+    metrics_->commit_time.record(std::chrono::steady_clock::now() - start);
+    
+    if (on_durable) {
+        if (lsn != 0) {
+            wal_->syncAsync(lsn, std::move(on_durable));
+        } else {
+            on_durable(true);
+        }
+    }
+    return true;
+}
+
+bool Transaction::applyInserts(Table* table) {
+    // Rows are buffered per shard
+    for (const auto& shard : table->shards_) {
+        if (!applyInserts(shard.get())) {
+            return false;
+        }
+    }
+    
+    auto it = inserts_.find(table);
+    if (it == inserts_.end()) {
+        return true;
+    }
+    
+    // Encode the log record before taking the lock
+    std::string payload = wal_ ? encodeRows(it->second.table_name, nullptr, it->second.rows) : std::string();
+    std::unique_lock<TableLock> lock(table->mutex_, lockTimeout());
+    if (!lock.owns_lock()) {
+        return fail(Status::TIMEOUT);
+    }
+    
+    InsertBatch batch = std::move(it->second);
+    inserts_.erase(it);
+    markWritten(table);
+    Status::Code result = table->insertRows(batch.rows, view());
+    if (result != Status::OK) {
+        insert_failure_ = result;
+        return fail(result);
+    }
+    
+    if (wal_) {
+        logOperation(WriteAheadLog::INSERT, payload);
+    }
+    return true;
+}
+
+void Transaction::releaseArena() {
+    // Containers let go of their arena memory before it is dropped at once
+    decltype(tables_)(&arena_).swap(tables_);
+    decltype(written_)(&arena_).swap(written_);
+    decltype(inserts_)(&arena_).swap(inserts_);
+    arena_.release();
+}
+
+void Transaction::markWritten(Table* table) {
+    // Versions are finished per shard, so only the shards written are kept
+    for (Table* part : table->parts()) {
+        if (!table->shards_.empty() && part->pending_.count(tag_) == 0) {
+            continue;
+        }
+        if (std::find(written_.begin(), written_.end(), part) == written_.end()) {
+            written_.push_back(part);
+        }
+    }
+}
+
+void Transaction::logOperation(uint8_t type, const std::string& payload) {
+    if (!wal_) {
+        return;
+    }
+    if (wal_txn_id_ == 0) {
+        wal_txn_id_ = wal_->nextTransactionId();
+        clock_->logStarted(wal_txn_id_);
+    }
+    wal_->append(wal_txn_id_, static_cast<WriteAheadLog::RecordType>(type), payload);
+}
+
+Table* Transaction::acquireTable(const std::string& table_name) {
+    auto it = tables_.find(table_name);
+    if (it != tables_.end()) {
+        return it->second.get();
+    }
+    std::shared_ptr<Table> table = db_->acquireTable(table_name);
+    if (!table) {
+        return nullptr;
+    }
+    return tables_.emplace(table_name, std::move(table)).first->second.get();
+}
+
+void Transaction::rollback() {
+    if (!active_) {
+        return;
+    }
+    
+    active_ = false;
+    metrics_->rollbacks.add();
+    
+    // Buffered inserts never reached the table. Drop the versions written so
+    // far and reopen the ones ended.
+    inserts_.clear();
+    for (Table* table : written_) {
+        std::unique_lock<TableLock> lock(table->mutex_);
+        table->abortVersions(tag_);
+        table->maybeCollectGarbage();
+    }
+    
+    if (wal_txn_id_ != 0) {
+        clock_->logAbandoned(wal_txn_id_);
+    }
+    clock_->endSnapshot(read_ts_);
+    releaseArena();
+}
+
+bool Transaction::insert(const std::string& table_name, const Row& row) {
+    return insert(table_name, Row(row));
+}
+
+bool Transaction::insert(const std::string& table_name, Row&& row) {
+    std::vector<Row> rows;
+    rows.push_back(std::move(row));
+    return insertBatch(table_name, std::move(rows));
+}
+
+bool Transaction::insertBatch(const std::string& table_name, std::vector<Row>&& rows) {
+    status_ = Status();
+    if (!active_) {
+        return fail(Status::INACTIVE);
+    }
+    
+    Table* table = acquireTable(table_name);
+    if (!table) {
+        return fail(Status::NOT_FOUND);
+    }
+    
+    // Check if row size matches columns size
+    for (const auto& row : rows) {
+        if (row.size() != table->getColumns().size()) {
+            return fail(Status::INVALID_ARGUMENT);
+        }
+    }
+    
+    // 分片表按分片拆分，每个分片单独缓冲
+    std::vector<std::pair<Table*, std::vector<Row>>> parts;
+    if (table->shards_.empty()) {
+        parts.emplace_back(table, std::move(rows));
+    } else {
+        for (Table* part : table->parts()) {
+            parts.emplace_back(part, std::vector<Row>());
+        }
+        int pk_index = table->findPrimaryKeyIndex();
+        for (auto& row : rows) {
+            parts[table->shardIndex(row[pk_index])].second.push_back(std::move(row));
+        }
+    }
+    
+    for (const auto& [part, part_rows] : parts) {
+        // 在共享锁下一次检查整批的类型、主键和唯一约束，多个写者可以并行检查
+        {
+            std::shared_lock<TableLock> lock(part->mutex_, lockTimeout());
+            if (!lock.owns_lock()) {
+                return fail(Status::TIMEOUT);
+            }
+            Status::Code result = part->acceptsRows(part_rows, view());
+            if (result != Status::OK) {
+                return fail(result);
+            }
+        }
         
-        for (const auto& value : row) {
-            value.serialize(out);
+        // 同一事务内之前缓冲的行也不能有重复的键
+        auto it = inserts_.find(part);
+        if (it == inserts_.end()) {
+            continue;
+        }
+        for (const auto& row : part_rows) {
+            for (size_t i = 0; i < it->second.keys.size(); i++) {
+                if (it->second.keys[i].count(row[part->key_indexes_[i].column]) > 0) {
+                    return fail(Status::CONSTRAINT);
+                }
+            }
+        }
+    }
+    
+    // 整批通过检查后才缓冲，失败时不留下部分行
+    for (auto& [part, part_rows] : parts) {
+        if (part_rows.empty()) {
+            continue;
+        }
+        InsertBatch& batch = inserts_.try_emplace(part, &arena_).first->second;
+        if (batch.rows.empty()) {
+            batch.table_name = table_name;
+            batch.keys.resize(part->key_indexes_.size());
+        }
+        for (const auto& row : part_rows) {
+            for (size_t i = 0; i < batch.keys.size(); i++) {
+                batch.keys[i].insert(row[part->key_indexes_[i].column]);
+            }
+        }
+        if (batch.rows.empty()) {
+            batch.rows = std::move(part_rows);
+        } else {
+            std::move(part_rows.begin(), part_rows.end(), std::back_inserter(batch.rows));
         }
     }
+    return true;
 }
 
-std::unique_ptr<Table> Table::deserialize(std::istream& in) {
-    // Read table name
-    size_t name_len = 0;
-    in.read(reinterpret_cast<char*>(&name_len), sizeof(name_len));
+bool Transaction::update(const std::string& table_name, const Row& row, 
+                       const std::function<bool(const Row&)>& predicate) {
+    return update(table_name, Row(row), predicate);
+}
+
+bool Transaction::update(const std::string& table_name, Row&& row,
+                         const std::function<bool(const Row&)>& predicate) {
+    status_ = Status();
+    if (!active_) {
+        return fail(Status::INACTIVE);
+    }
     
-    std::string table_name(name_len, '\0');
-    in.read(&table_name[0], name_len);
+    Table* table = acquireTable(table_name);
+    if (!table) {
+        return fail(Status::NOT_FOUND);
+    }
     
-    // Read columns
-    size_t col_count = 0;
-    in.read(reinterpret_cast<char*>(&col_count), sizeof(col_count));
+    // Check if row size matches columns size
+    if (row.size() != table->getColumns().size()) {
+        return fail(Status::INVALID_ARGUMENT);
+    }
     
-    std::vector<Column> columns;
-    columns.reserve(col_count);
+    // 先应用缓冲的插入，再排队等待写锁并执行更新；分片表锁住所有分片
+    if (!applyInserts(table)) {
+        return false;
+    }
+    std::vector<std::unique_lock<TableLock>> locks;
+    if (!table->lockParts(locks, lockTimeout())) {
+        return fail(Status::TIMEOUT);
+    }
     
-    for (size_t i = 0; i < col_count; i++) {
-        Column col;
-        
-        // Read column name
-        size_t col_name_len = 0;
-        in.read(reinterpret_cast<char*>(&col_name_len), sizeof(col_name_len));
-        
-        std::string col_name(col_name_len, '\0');
-        in.read(&col_name[0], col_name_len);
-        col.name = std::move(col_name);
-        
-        // Read column type
-        in.read(reinterpret_cast<char*>(&col.type), sizeof(col.type));
+    try {
+        // 新行移入表之前先写入日志记录，被替换的行随后追加（格式同 encodeRows）
+        std::string payload;
+        if (wal_) {
+            ByteWriter out(payload);
+            out.putString(table_name);
+            putRow(out, row);
+        }
         
-        // Read constraints
-        in.read(reinterpret_cast<char*>(&col.primary_key), sizeof(col.primary_key));
-        in.read(reinterpret_cast<char*>(&col.not_null), sizeof(col.not_null));
-        in.read(reinterpret_cast<char*>(&col.unique), sizeof(col.unique));
+        // 有日志时记录被替换的行，保证日志与实际更新一致
+        std::vector<Row> original_rows;
+        Status::Code result = table->updateRows(std::move(row), predicate, view(), wal_ ? &original_rows : nullptr);
+        if (result != Status::OK) {
+            return fail(result);
+        }
+        markWritten(table);
         
-        columns.push_back(std::move(col));
+        if (wal_) {
+            ByteWriter out(payload);
+            putRows(out, original_rows);
+            logOperation(WriteAheadLog::UPDATE, payload);
+        }
+    } catch (...) {
+        return failOnException();
+    }
+    return true;
+}
+
+bool Transaction::updateColumns(const std::string& table_name, const ColumnChanges& changes,
+                                const std::function<bool(const Row&)>& predicate) {
+    status_ = Status();
+    if (!active_) {
+        return fail(Status::INACTIVE);
     }
     
-    // Create the table with name and columns
-    auto table = std::make_unique<Table>(table_name, columns);
+    Table* table = acquireTable(table_name);
+    if (!table) {
+        return fail(Status::NOT_FOUND);
+    }
     
-    // Read rows
-    size_t row_count = 0;
-    in.read(reinterpret_cast<char*>(&row_count), sizeof(row_count));
+    if (!applyInserts(table)) {
+        return false;
+    }
+    std::vector<std::unique_lock<TableLock>> locks;
+    if (!table->lockParts(locks, lockTimeout())) {
+        return fail(Status::TIMEOUT);
+    }
     
-    for (size_t i = 0; i < row_count; i++) {
-        // Read values in the row
-        size_t value_count = 0;
-        in.read(reinterpret_cast<char*>(&value_count), sizeof(value_count));
-        
-        Row row;
-        row.reserve(value_count);
+    try {
+        // 每行的新值不同，日志按行各记一条更新
+        std::vector<Row> original_rows;
+        std::vector<Row> updated_rows;
+        Status::Code result = table->changeRows(changes, predicate, view(), wal_ ? &original_rows : nullptr,
+                                                wal_ ? &updated_rows : nullptr);
+        if (result != Status::OK) {
+            return fail(result);
+        }
+        markWritten(table);
         
-        for (size_t j = 0; j < value_count; j++) {
-            row.push_back(Value::deserialize(in));
+        for (size_t i = 0; wal_ && i < updated_rows.size(); i++) {
+            logOperation(WriteAheadLog::UPDATE, encodeRows(table_name, &updated_rows[i], {original_rows[i]}));
+        }
+    } catch (...) {
+        return failOnException();
+    }
+    return true;
+}
+
+bool Transaction::remove(const std::string& table_name, 
+                       const std::function<bool(const Row&)>& predicate) {
+    status_ = Status();
+    if (!active_) {
+        return fail(Status::INACTIVE);
+    }
+    
+    Table* table = acquireTable(table_name);
+    if (!table) {
+        return fail(Status::NOT_FOUND);
+    }
+    
+    // 先应用缓冲的插入，再排队等待写锁并执行删除
+    if (!applyInserts(table)) {
+        return false;
+    }
+    std::vector<std::unique_lock<TableLock>> locks;
+    if (!table->lockParts(locks, lockTimeout())) {
+        return fail(Status::TIMEOUT);
+    }
+    
+    try {
+        // 有日志时记录被删除的行，保证日志与实际删除一致
+        std::vector<Row> deleted_rows;
+        Status::Code result = table->eraseRows(predicate, view(), wal_ ? &deleted_rows : nullptr);
+        if (result != Status::OK) {
+            return fail(result);
         }
+        markWritten(table);
         
-        // Insert the row directly without triggering constraints check
-        // since the data was already validated when it was first inserted
-        table->rows_.push_back(std::move(row));
+        if (wal_) {
+            logOperation(WriteAheadLog::REMOVE, encodeRows(table_name, nullptr, deleted_rows));
+        }
+    } catch (...) {
+        return failOnException();
+    }
+    return true;
+}
+
+std::vector<Row> Transaction::select(const std::string& table_name,
+                                   const std::function<bool(const Row&)>& predicate) {
+    status_ = Status();
+    if (!active_) {
+        fail(Status::INACTIVE);
+        return {};
     }
     
-    return table;
+    Table* table = acquireTable(table_name);
+    if (!table) {
+        fail(Status::NOT_FOUND);
+        return {};
+    }
+    if (!applyInserts(table)) {
+        return {};
+    }
+    std::vector<std::shared_lock<TableLock>> locks;
+    if (!table->lockParts(locks, lockTimeout())) {
+        fail(Status::TIMEOUT);
+        return {};
+    }
+    
+    // 大表按分块并行扫描，谓词抛出异常时返回空结果
+    try {
+        return table->selectRows(predicate, view());
+    } catch (...) {
+        failOnException();
+        return {};
+    }
 }
 
-// Database implementation
-Database::Database() = default;
+std::vector<Row> Transaction::project(const std::string& table_name,
+                                    const std::vector<std::string>& columns,
+                                    const std::function<bool(const Row&)>& predicate) {
+    status_ = Status();
+    if (!active_) {
+        fail(Status::INACTIVE);
+        return {};
+    }
+    
+    Table* table = acquireTable(table_name);
+    if (!table) {
+        fail(Status::NOT_FOUND);
+        return {};
+    }
+    
+    std::vector<size_t> indexes;
+    if (!table->findColumnIndexes(columns, indexes)) {
+        fail(Status::INVALID_ARGUMENT);
+        return {};
+    }
+    
+    std::vector<Row> result;
+    if (!scan(table_name, predicate, [&result, &indexes](const Row& row) {
+            Row projected;
+            projected.reserve(indexes.size());
+            for (size_t index : indexes) {
+                projected.push_back(row[index]);
+            }
+            result.push_back(std::move(projected));
+            return true;
+        })) {
+        return {};
+    }
+    
+    return result;
+}
 
-Database::~Database() = default;
+bool Transaction::scan(const std::string& table_name,
+                       const std::function<bool(const Row&)>& predicate, const RowVisitor& visitor) {
+    status_ = Status();
+    if (!active_) {
+        return fail(Status::INACTIVE);
+    }
+    
+    Table* table = acquireTable(table_name);
+    if (!table) {
+        return fail(Status::NOT_FOUND);
+    }
+    
+    // Own buffered inserts must be visible. Readers only wait for a write in
+    // progress, never for a transaction.
+    if (!applyInserts(table)) {
+        return false;
+    }
+    std::vector<std::shared_lock<TableLock>> locks;
+    if (!table->lockParts(locks, lockTimeout())) {
+        return fail(Status::TIMEOUT);
+    }
+    
+    // 访问器可能已处理部分行，出现异常时不重试
+    try {
+        table->scanRows(predicate, visitor, view());
+    } catch (...) {
+        return failOnException();
+    }
+    return true;
+}
 
-bool Database::createTable(const std::string& name, const std::vector<Column>& columns) {
-    std::lock_guard<std::mutex> lock(mutex_);
+std::vector<Row> Transaction::select(const std::string& table_name, const ColumnPredicate& predicate) {
+    std::vector<Row> result;
+    if (!scan(table_name, predicate, [&result](const Row& row) {
+            result.push_back(row);
+            return true;
+        })) {
+        return {};
+    }
+    
+    return result;
+}
+
+bool Transaction::scan(const std::string& table_name, const ColumnPredicate& predicate,
+                       const RowVisitor& visitor) {
+    status_ = Status();
+    if (!active_) {
+        return fail(Status::INACTIVE);
+    }
+    
+    Table* table = acquireTable(table_name);
+    if (!table) {
+        return fail(Status::NOT_FOUND);
+    }
+    
+    if (!applyInserts(table)) {
+        return false;
+    }
+    
+    // Shards are evaluated one at a time, each under its own read lock
+    bool stopped = false;
+    RowVisitor until_stopped = [&](const Row& row) { return !(stopped = !visitor(row)); };
+    auto deadline = std::chrono::steady_clock::now() + lockTimeout();
+    for (Table* part : table->parts()) {
+        std::shared_lock<TableLock> lock(part->mutex_, deadline);
+        if (!lock.owns_lock()) {
+            return fail(Status::TIMEOUT);
+        }
+        std::vector<uint64_t> selection;
+        if (!part->evaluate(predicate, view(), selection)) {
+            return fail(Status::INVALID_ARGUMENT);
+        }
+        
+        try {
+            part->scanSelected(selection, until_stopped);
+        } catch (...) {
+            return failOnException();
+        }
+        if (stopped) {
+            break;
+        }
+    }
+    return true;
+}
+
+std::vector<Row> Transaction::select(const std::string& table_name, const Expression& filter) {
+    std::vector<Row> result;
+    if (!scan(table_name, filter, [&result](const Row& row) {
+            result.push_back(row);
+            return true;
+        })) {
+        return {};
+    }
+    
+    return result;
+}
+
+bool Transaction::scan(const std::string& table_name, const Expression& filter, const RowVisitor& visitor) {
+    status_ = Status();
+    if (!active_) {
+        return fail(Status::INACTIVE);
+    }
     
-    if (tables_.find(name) != tables_.end()) {
-        return false; // Table already exists
+    Table* table = acquireTable(table_name);
+    if (!table) {
+        return fail(Status::NOT_FOUND);
+    }
+    
+    expression::Evaluator evaluator;
+    if (!expression::compile(filter, table->getColumns(), evaluator)) {
+        return fail(Status::INVALID_ARGUMENT);
+    }
+    if (!applyInserts(table)) {
+        return false;
+    }
+    std::vector<std::shared_lock<TableLock>> locks;
+    if (!table->lockParts(locks, lockTimeout())) {
+        return fail(Status::TIMEOUT);
     }
     
-    tables_[name] = std::make_unique<Table>(name, columns);
+    try {
+        table->scanFiltered(filter, evaluator, visitor, view());
+    } catch (...) {
+        return failOnException();
+    }
     return true;
 }
 
-bool Database::dropTable(const std::string& name) {
-    std::lock_guard<std::mutex> lock(mutex_);
+bool Transaction::updateColumns(const std::string& table_name, const ColumnChanges& changes,
+                                const Expression& filter) {
+    status_ = Status();
+    if (!active_) {
+        return fail(Status::INACTIVE);
+    }
+    Table* table = acquireTable(table_name);
+    if (!table) {
+        return fail(Status::NOT_FOUND);
+    }
+    
+    expression::Evaluator evaluator;
+    if (!expression::compile(filter, table->getColumns(), evaluator)) {
+        return fail(Status::INVALID_ARGUMENT);
+    }
+    
+    // Updates record before-images row by row, so evaluate the filter per row
+    return updateColumns(table_name, changes, evaluator);
+}
+
+bool Transaction::aggregate(const std::string& table_name, const std::vector<Aggregate>& aggregates,
+                            const std::vector<std::string>& group_by, const Expression& filter,
+                            std::vector<Row>& out) {
+    status_ = Status();
+    if (!active_) {
+        return fail(Status::INACTIVE);
+    }
     
-    auto it = tables_.find(name);
-    if (it == tables_.end()) {
-        return false; // Table doesn't exist
+    Table* table = acquireTable(table_name);
+    if (!table) {
+        return fail(Status::NOT_FOUND);
+    }
+    
+    Table::Groups groups;
+    expression::Evaluator evaluator;
+    if (!table->prepareAggregate(aggregates, group_by, groups) ||
+        !expression::compile(filter, table->getColumns(), evaluator)) {
+        return fail(Status::INVALID_ARGUMENT);
+    }
+    if (!applyInserts(table)) {
+        return false;
+    }
+    std::vector<std::shared_lock<TableLock>> locks;
+    if (!table->lockParts(locks, lockTimeout())) {
+        return fail(Status::TIMEOUT);
     }
     
-    tables_.erase(it);
+    table->collectGroups(filter, evaluator, view(), groups);
+    Table::finishGroups(groups, out);
     return true;
 }
 
-Table* Database::getTable(const std::string& name) {
-    std::lock_guard<std::mutex> lock(mutex_);
+std::vector<Row> Transaction::select(const std::string& table_name, const Expression& filter,
+                                     const std::vector<OrderBy>& order, size_t limit, size_t offset) {
+    status_ = Status();
+    if (!active_) {
+        fail(Status::INACTIVE);
+        return {};
+    }
     
-    auto it = tables_.find(name);
-    if (it == tables_.end()) {
-        return nullptr; // Table doesn't exist
+    Table* table = acquireTable(table_name);
+    if (!table) {
+        fail(Status::NOT_FOUND);
+        return {};
     }
     
-    return it->second.get();
-}
-
-std::shared_ptr<Transaction> Database::beginTransaction() {
-    return std::make_shared<Transaction>(this);
-}
-
-// Transaction implementation
-Transaction::Transaction(Database* db) : db_(db), active_(true) {}
-
-Transaction::~Transaction() {
-    if (active_) {
-        rollback();
+    Table::TopRows top;
+    expression::Evaluator evaluator;
+    if (!table->prepareOrder(order, limit, offset, top) ||
+        !expression::compile(filter, table->getColumns(), evaluator)) {
+        fail(Status::INVALID_ARGUMENT);
+        return {};
+    }
+    if (!applyInserts(table)) {
+        return {};
+    }
+    std::vector<std::shared_lock<TableLock>> locks;
+    if (!table->lockParts(locks, lockTimeout())) {
+        fail(Status::TIMEOUT);
+        return {};
     }
+    
+    table->collectTop(filter, evaluator, view(), top);
+    std::vector<Row> result;
+    Table::finishTop(top, limit, offset, result);
+    return result;
 }
 
-bool Transaction::commit() {
+bool Transaction::join(const std::string& table_name, const std::string& column, const std::string& right_table,
+                       const std::string& right_column, const JoinVisitor& visitor, const Expression& filter,
+                       const Expression& right_filter) {
+    status_ = Status();
     if (!active_) {
+        return fail(Status::INACTIVE);
+    }
+    
+    Table* left = acquireTable(table_name);
+    Table* right = acquireTable(right_table);
+    if (!left || !right) {
+        return fail(Status::NOT_FOUND);
+    }
+    
+    int col_index = left->findColumnIndex(column);
+    int right_index = right->findColumnIndex(right_column);
+    expression::Evaluator evaluator;
+    expression::Evaluator right_evaluator;
+    if (col_index < 0 || right_index < 0 || !expression::compile(filter, left->getColumns(), evaluator) ||
+        !expression::compile(right_filter, right->getColumns(), right_evaluator)) {
+        return fail(Status::INVALID_ARGUMENT);
+    }
+    if (!applyInserts(left) || !applyInserts(right)) {
         return false;
     }
+    std::vector<std::shared_lock<TableLock>> locks;
+    if (!left->lockJoin(*right, locks, lockTimeout())) {
+        return fail(Status::TIMEOUT);
+    }
     
-    active_ = false;
-    rollback_operations_.clear();
+    // 两侧使用同一快照，访问器抛出异常时返回失败
+    try {
+        left->joinRows(col_index, view(), evaluator, *right, right_index, view(), right_evaluator, visitor);
+    } catch (...) {
+        return failOnException();
+    }
     return true;
 }
 
-void Transaction::rollback() {
+bool Transaction::remove(const std::string& table_name, const ColumnPredicate& predicate) {
+    status_ = Status();
     if (!active_) {
-        return;
+        return fail(Status::INACTIVE);
+    }
+    Table* table = acquireTable(table_name);
+    if (!table) {
+        return fail(Status::NOT_FOUND);
     }
     
-    active_ = false;
-    
-    // Apply rollback operations in reverse order
-    for (auto it = rollback_operations_.rbegin(); it != rollback_operations_.rend(); ++it) {
-        for (auto op_it = it->second.rbegin(); op_it != it->second.rend(); ++op_it) {
-            (*op_it)();
-        }
+    int col_index = table->findColumnIndex(predicate.column);
+    if (col_index < 0) {
+        return fail(Status::INVALID_ARGUMENT);
     }
     
-    rollback_operations_.clear();
+    // Deletes record before-images row by row, so evaluate the predicate per row
+    return remove(table_name, [&predicate, col_index](const Row& row) {
+        return predicate.matches(row[col_index]);
+    });
 }
 
-bool Transaction::insert(const std::string& table_name, const Row& row) {
+std::vector<Row> Transaction::lookup(const std::string& table_name, const std::string& column,
+                                   const Value& value) {
+    status_ = Status();
     if (!active_) {
-        return false;
+        fail(Status::INACTIVE);
+        return {};
     }
     
-    Table* table = db_->getTable(table_name);
+    Table* table = acquireTable(table_name);
     if (!table) {
-        return false;
+        fail(Status::NOT_FOUND);
+        return {};
     }
     
-    // Check if row size matches columns size
-    if (row.size() != table->getColumns().size()) {
-        return false;
+    int col_index = table->findColumnIndex(column);
+    if (col_index < 0) {
+        fail(Status::INVALID_ARGUMENT);
+        return {};
+    }
+    if (!applyInserts(table)) {
+        return {};
     }
     
-    // 使用直接锁定技术和超时控制
-    auto start_time = std::chrono::steady_clock::now();
-    auto timeout = std::chrono::milliseconds(500); // 最多等待500毫秒
-    
-    bool write_success = false;
-    bool result = false;
-    
-    while (std::chrono::steady_clock::now() - start_time < timeout) {
-        try {
-            std::unique_lock<std::shared_mutex> lock(table->mutex_, std::try_to_lock);
-            if (lock.owns_lock()) {
-                // 检查主键约束
-                int pk_index = table->findPrimaryKeyIndex();
-                bool constraint_violated = false;
-                
-                if (pk_index >= 0) {
-                    for (const auto& existing_row : table->rows_) {
-                        if (existing_row[pk_index] == row[pk_index]) {
-                            constraint_violated = true; // 主键约束冲突
-                            break;
-                        }
-                    }
-                }
-                
-                // 检查唯一约束
-                if (!constraint_violated) {
-                    const auto& columns = table->getColumns();
-                    for (size_t i = 0; i < columns.size(); i++) {
-                        if (columns[i].unique) {
-                            for (const auto& existing_row : table->rows_) {
-                                if (existing_row[i] == row[i]) {
-                                    constraint_violated = true; // 唯一约束冲突
-                                    break;
-                                }
-                            }
-                            if (constraint_violated) break;
-                        }
-                    }
-                }
-                
-                // 如果没有约束冲突，则插入行
-                if (!constraint_violated) {
-                    table->rows_.push_back(row);
-                    
-                    // 添加回滚操作
-                    rollback_operations_[table_name].push_back([table, row]() {
-                        std::unique_lock<std::shared_mutex> lock(table->mutex_);
-                        table->rows_.erase(
-                            std::remove_if(table->rows_.begin(), table->rows_.end(), 
-                                [&row](const Row& r) { return r == row; }),
-                            table->rows_.end()
-                        );
-                    });
-                    
-                    result = true;
-                }
-                
-                write_success = true;
-                break;
-            }
-        } catch (...) {
-            // 忽略异常，继续尝试
+    std::vector<Row> result;
+    auto deadline = std::chrono::steady_clock::now() + lockTimeout();
+    for (Table* part : table->parts()) {
+        std::shared_lock<TableLock> lock(part->mutex_, deadline);
+        if (!lock.owns_lock()) {
+            fail(Status::TIMEOUT);
+            return {};
+        }
+        for (size_t pos : part->lookupPositions(col_index, value, view())) {
+            result.push_back(part->rowAt(pos));
         }
-        std::this_thread::sleep_for(std::chrono::milliseconds(10));
     }
-    
-    return write_success && result;
+    return result;
 }
 
-bool Transaction::update(const std::string& table_name, const Row& row, 
-                       const std::function<bool(const Row&)>& predicate) {
+std::vector<Row> Transaction::range(const std::string& table_name, const std::string& column,
+                                  const Value& lo, const Value& hi) {
+    status_ = Status();
     if (!active_) {
-        return false;
+        fail(Status::INACTIVE);
+        return {};
     }
     
-    Table* table = db_->getTable(table_name);
+    Table* table = acquireTable(table_name);
     if (!table) {
-        return false;
+        fail(Status::NOT_FOUND);
+        return {};
     }
     
-    // Check if row size matches columns size
-    if (row.size() != table->getColumns().size()) {
-        return false;
+    int col_index = table->findColumnIndex(column);
+    if (col_index < 0) {
+        fail(Status::INVALID_ARGUMENT);
+        return {};
+    }
+    if (!applyInserts(table)) {
+        return {};
     }
     
-    // 使用直接锁定技术和超时控制
-    auto start_time = std::chrono::steady_clock::now();
-    auto timeout = std::chrono::milliseconds(500); // 最多等待500毫秒
-    
-    // 首先读取需要更新的行用于回滚
-    std::vector<Row> original_rows;
-    {
-        bool read_success = false;
-        while (std::chrono::steady_clock::now() - start_time < timeout) {
-            try {
-                std::shared_lock<std::shared_mutex> lock(table->mutex_, std::try_to_lock);
-                if (lock.owns_lock()) {
-                    for (const auto& existing_row : table->rows_) {
-                        if (predicate(existing_row)) {
-                            original_rows.push_back(existing_row);
-                        }
-                    }
-                    read_success = true;
-                    break;
-                }
-            } catch (...) {
-                // 忽略异常，继续尝试
-            }
-            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    std::vector<Row> result;
+    auto deadline = std::chrono::steady_clock::now() + lockTimeout();
+    for (Table* part : table->parts()) {
+        std::shared_lock<TableLock> lock(part->mutex_, deadline);
+        if (!lock.owns_lock()) {
+            fail(Status::TIMEOUT);
+            return {};
         }
-        
-        if (!read_success) {
-            return false; // 超时无法读取
+        for (size_t pos : part->rangePositions(col_index, lo, hi, view())) {
+            result.push_back(part->rowAt(pos));
         }
     }
-    
-    // 然后获取写锁并执行更新
-    {
-        bool write_success = false;
-        bool result = false;
-        
-        while (std::chrono::steady_clock::now() - start_time < timeout) {
-            try {
-                std::unique_lock<std::shared_mutex> lock(table->mutex_, std::try_to_lock);
-                if (lock.owns_lock()) {
-                    result = false; // 重置结果
-                    
-                    // 执行更新
-                    for (auto& existing_row : table->rows_) {
-                        if (predicate(existing_row)) {
-                            existing_row = row;
-                            result = true;
-                        }
-                    }
-                    
-                    // 如果更新成功，添加回滚操作
-                    if (result && !original_rows.empty()) {
-                        for (const auto& original_row : original_rows) {
-                            rollback_operations_[table_name].push_back([table, original_row]() {
-                                std::unique_lock<std::shared_mutex> lock(table->mutex_);
-                                for (auto& r : table->rows_) {
-                                    // 使用主键识别行（如果有）
-                                    int pk_index = table->findPrimaryKeyIndex();
-                                    if (pk_index >= 0) {
-                                        if (r[pk_index] == original_row[pk_index]) {
-                                            r = original_row;
-                                            break;
-                                        }
-                                    } else if (r == original_row) { // 否则使用整行比较
-                                        r = original_row;
-                                        break;
-                                    }
-                                }
-                            });
-                        }
-                    }
-                    
-                    write_success = true;
-                    break;
-                }
-            } catch (...) {
-                // 忽略异常，继续尝试
-            }
-            std::this_thread::sleep_for(std::chrono::milliseconds(10));
-        }
-        
-        return write_success && result;
+    if (table->shards_.size() > 1) {
+        std::stable_sort(result.begin(), result.end(), [col_index](const Row& a, const Row& b) {
+            return a[col_index] < b[col_index];
+        });
     }
+    return result;
 }
 
-bool Transaction::remove(const std::string& table_name, 
-                       const std::function<bool(const Row&)>& predicate) {
-    if (!active_) {
-        return false;
+// Database serialization
+bool Database::saveToFile(const std::string& filename, const SnapshotOptions& options) const {
+    auto start = std::chrono::steady_clock::now();
+    std::shared_ptr<WriteAheadLog> wal;
+    {
+        std::lock_guard<std::mutex> lock(const_cast<std::mutex&>(mutex_));
+        wal = wal_;
     }
     
-    Table* table = db_->getTable(table_name);
-    if (!table) {
+    SnapshotResult result;
+    if (!writeSnapshot(filename, options, wal.get(), nullptr, result)) {
         return false;
     }
     
-    // 使用直接锁定技术和超时控制
-    auto start_time = std::chrono::steady_clock::now();
-    auto timeout = std::chrono::milliseconds(500); // 最多等待500毫秒
-    
-    // 首先读取需要删除的行用于回滚
-    std::vector<Row> deleted_rows;
+    // Only drop log records once the snapshot holding them is durable
+    if (wal && !wal->checkpoint(result.lsn, result.unfinished_logs)) {
+        return false;
+    }
+    metrics_->save_time.record(std::chrono::steady_clock::now() - start);
+    return true;
+}
+
+bool Database::writeSnapshot(const std::string& filename, const SnapshotOptions& options, WriteAheadLog* wal,
+                             const CheckpointBlocks* base, SnapshotResult& result) const {
+    // Capture every table at one point in time. Captures share row chunks and
+    // columns with the live tables, so writers are only held up for the
+    // pointer copies and not for encoding or I/O. The capture holds what was
+    // committed at read_ts; transactions still running or committing past it
+    // are reported so their log records survive the checkpoint. Tables base
+    // holds at their current change count are left out.
+    std::vector<Table::Snapshot> tables;
+    std::vector<std::pair<std::string, SnapshotEntry>> unloaded;
+    std::vector<CheckpointBlock> captured;
     {
-        bool read_success = false;
-        while (std::chrono::steady_clock::now() - start_time < timeout) {
-            try {
-                std::shared_lock<std::shared_mutex> lock(table->mutex_, std::try_to_lock);
-                if (lock.owns_lock()) {
-                    for (const auto& existing_row : table->rows_) {
-                        if (predicate(existing_row)) {
-                            deleted_rows.push_back(existing_row);
-                        }
-                    }
-                    read_success = true;
-                    break;
-                }
-            } catch (...) {
-                // 忽略异常，继续尝试
-            }
-            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        std::lock_guard<std::mutex> lock(const_cast<std::mutex&>(mutex_));
+        // Tables are locked in address order, as joins lock their two tables, so
+        // the two never wait for each other behind queued writers
+        std::vector<Table*> locked;
+        for (const auto& [name, table] : *tables_) {
+            locked.push_back(table.get());
         }
+        std::sort(locked.begin(), locked.end(), std::less<Table*>());
+        std::vector<std::shared_lock<TableLock>> table_locks;
+        for (Table* table : locked) {
+            table->lockParts(table_locks);
+        }
+        uint64_t read_ts = clock_->capture(result.unfinished_logs);
         
-        if (!read_success) {
-            return false; // 超时无法读取
+        // A commit past read_ts may already have stamped versions the capture
+        // skips, its tables must not count as saved at their change count
+        bool settled = clock_->settled(read_ts);
+        auto unchanged = [&](const std::string& name, uint64_t table_id, uint64_t changes) {
+            if (!base) {
+                return false;
+            }
+            auto it = base->find(name);
+            return it != base->end() && it->second.entry.table_id == table_id && it->second.changes == changes;
+        };
+        for (const auto& [name, table] : *tables_) {
+            uint64_t changes = table->changeCount();
+            if (unchanged(name, table->id_, changes)) {
+                result.unchanged.push_back(name);
+                continue;
+            }
+            tables.push_back(table->snapshot(read_ts));
+            CheckpointBlock block;
+            block.entry.table_id = table->id_;
+            block.changes = settled ? changes : kUnknownChanges;
+            captured.push_back(block);
         }
-    }
-    
-    // 然后获取写锁并执行删除
-    {
-        bool write_success = false;
-        bool result = false;
-        
-        while (std::chrono::steady_clock::now() - start_time < timeout) {
-            try {
-                std::unique_lock<std::shared_mutex> lock(table->mutex_, std::try_to_lock);
-                if (lock.owns_lock()) {
-                    // 记录原始大小
-                    size_t original_size = table->rows_.size();
-                    
-                    // 执行删除
-                    table->rows_.erase(
-                        std::remove_if(table->rows_.begin(), table->rows_.end(), predicate),
-                        table->rows_.end()
-                    );
-                    
-                    result = table->rows_.size() < original_size;
-                    
-                    // 如果删除成功，添加回滚操作
-                    if (result && !deleted_rows.empty()) {
-                        rollback_operations_[table_name].push_back([table, deleted_rows]() {
-                            std::unique_lock<std::shared_mutex> lock(table->mutex_);
-                            for (const auto& row : deleted_rows) {
-                                table->rows_.push_back(row);
-                            }
-                        });
-                    }
-                    
-                    write_success = true;
-                    break;
-                }
-            } catch (...) {
-                // 忽略异常，继续尝试
+        if (wal) {
+            result.lsn = wal->appendedLsn();
+        }
+        for (const auto& [name, entry] : unloaded_) {
+            if (unchanged(name, entry.table_id, 0)) {
+                result.unchanged.push_back(name);
+            } else {
+                unloaded.emplace_back(name, entry);
             }
-            std::this_thread::sleep_for(std::chrono::milliseconds(10));
         }
-        
-        return write_success && result;
     }
-}
-
-std::vector<Row> Transaction::select(const std::string& table_name,
-                                   const std::function<bool(const Row&)>& predicate) {
-    if (!active_) {
-        return {};
+    
+    // Split tables, or each shard of a table, into row ranges; the first
+    // piece also holds the block header and the last one closes the block
+    struct Piece {
+        size_t table;
+        const Table::Snapshot* part;
+        size_t begin;
+        size_t end;
+        bool first;
+        bool last;
+    };
+    std::vector<Piece> pieces;
+    for (size_t t = 0; t < tables.size(); t++) {
+        tables[t].row_count = tables[t].countVisible();
+        std::vector<const Table::Snapshot*> parts;
+        if (tables[t].shards.empty()) {
+            parts.push_back(&tables[t]);
+        }
+        for (const auto& shard : tables[t].shards) {
+            parts.push_back(&shard);
+        }
+        for (size_t p = 0; p < parts.size(); p++) {
+            size_t begin = 0;
+            do {
+                size_t end = std::min(parts[p]->positions, begin + kSnapshotPieceRows);
+                pieces.push_back({t, parts[p], begin, end, p == 0 && begin == 0,
+                                  p + 1 == parts.size() && end == parts[p]->positions});
+                begin = end;
+            } while (begin < parts[p]->positions);
+        }
     }
     
-    Table* table = db_->getTable(table_name);
-    if (!table) {
-        return {};
+    // Write next to the target and rename over it, so a crash never leaves a
+    // half-written snapshot and a mapped old snapshot stays readable
+    std::string temp_path = filename + ".tmp";
+    int fd = ::open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return false;
     }
     
-    // 限制尝试时间，避免无限等待
-    auto start_time = std::chrono::steady_clock::now();
-    auto timeout = std::chrono::milliseconds(500); // 最多等待500毫秒
-
-    while (std::chrono::steady_clock::now() - start_time < timeout) {
-        try {
-            // 使用RAII锁模式而不是手动加锁解锁
-            std::shared_lock<std::shared_mutex> lock(table->mutex_, std::try_to_lock);
-            if (lock.owns_lock()) {
-                std::vector<Row> result;
-                for (const auto& row : table->rows_) {
-                    if (predicate(row)) {
-                        result.push_back(row);
-                    }
+    std::string buffer(kSnapshotHeaderSize, '\0');
+    std::string directory;
+    ByteWriter directory_out(directory);
+    uint64_t offset = kSnapshotHeaderSize;
+    uint64_t block_offset = 0;
+    uint32_t block_checksum = 0;
+    
+    auto flush = [&](size_t threshold) {
+        if (buffer.size() < threshold) {
+            return true;
+        }
+        bool written = writeAll(fd, buffer.data(), buffer.size());
+        buffer.clear();
+        return written;
+    };
+    auto addEntry = [&](const std::string& name, uint64_t start, uint64_t size, uint32_t checksum,
+                        uint8_t encoding, CheckpointBlock block) {
+        directory_out.putString(name);
+        directory_out.putU64(start);
+        directory_out.putU64(size);
+        directory_out.putU32(checksum);
+        directory_out.putU8(encoding);
+        block.entry.offset = start;
+        block.entry.size = size;
+        block.entry.checksum = checksum;
+        block.entry.encoding = encoding;
+        result.written.emplace_back(name, std::move(block));
+    };
+    
+    const bool compress = options.compression == SnapshotOptions::COMPRESSION_LZ4;
+    const uint8_t encoding = compress ? kCompressedBlock : kPlainBlock;
+    bool ok = encodeOrdered(pieces.size(),
+        [&](size_t index, std::string& out) {
+            const Piece& piece = pieces[index];
+            if (!compress) {
+                if (piece.first) {
+                    tables[piece.table].encodeHeader(out);
                 }
-                return result;
+                piece.part->encodeRows(piece.begin, piece.end, out);
+                return;
             }
-        } catch (...) {
-            // 忽略任何异常并继续尝试
+            
+            // Pieces compress independently on the workers
+            std::string raw;
+            if (piece.first) {
+                tables[piece.table].encodeHeader(raw);
+                putFrame(out, raw);
+                raw.clear();
+            }
+            piece.part->encodeColumns(piece.begin, piece.end, raw);
+            putFrame(out, raw);
+        },
+        [&](size_t index, const std::string& data) {
+            const Piece& piece = pieces[index];
+            if (piece.first) {
+                block_offset = offset;
+                block_checksum = 0;
+            }
+            block_checksum = crc32(data.data(), data.size(), block_checksum);
+            buffer.append(data);
+            offset += data.size();
+            if (piece.last) {
+                addEntry(tables[piece.table].name, block_offset, offset - block_offset, block_checksum, encoding,
+                         captured[piece.table]);
+            }
+            return flush(kSnapshotWriteBuffer);
+        });
+    size_t table_count = tables.size() + unloaded.size();
+    tables.clear();
+    
+    // Tables never accessed since loading are copied over still encoded
+    for (const auto& [name, entry] : unloaded) {
+        if (!ok) {
+            break;
         }
-        // 短暂休眠后重试
-        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        ok = flush(0) && writeAll(fd, entry.file->data() + entry.offset, entry.size);
+        CheckpointBlock block;
+        block.entry.table_id = entry.table_id;
+        block.changes = 0;
+        addEntry(name, offset, entry.size, entry.checksum, entry.encoding, block);
+        offset += entry.size;
     }
     
-    // 如果超时，返回空结果
-    return {};
-}
-
-// Database serialization
-bool Database::saveToFile(const std::string& filename) const {
-    std::ofstream file(filename, std::ios::binary);
-    if (!file.is_open()) {
+    ok = ok && flush(0) && writeAll(fd, directory.data(), directory.size());
+    
+    std::string header;
+    ByteWriter header_out(header);
+    header_out.putBytes(kSnapshotMagic, sizeof(kSnapshotMagic));
+    header_out.putU32(kSnapshotVersion);
+    header_out.putU32(static_cast<uint32_t>(table_count));
+    header_out.putU64(offset);
+    header_out.putU64(directory.size());
+    header_out.putU32(crc32(directory.data(), directory.size()));
+    header_out.putU32(crc32(header.data(), header.size()));
+    
+    ok = ok && ::lseek(fd, 0, SEEK_SET) == 0 && writeAll(fd, header.data(), header.size()) && ::fsync(fd) == 0;
+    ok = ::close(fd) == 0 && ok;
+    if (!ok || std::rename(temp_path.c_str(), filename.c_str()) != 0) {
+        std::remove(temp_path.c_str());
         return false;
     }
     
-    // Make a copy of the tables map to avoid const issues
-    std::unordered_map<std::string, std::unique_ptr<Table>> tables_copy;
-    std::vector<std::string> table_names;
-    
+    syncDirectoryOf(filename);
+    metrics_->saved_bytes.add(offset + directory.size());
+    return true;
+}
+
+bool Database::checkpoint(const std::string& manifest, const SnapshotOptions& options) {
+    auto start = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> checkpoint_lock(checkpoint_mutex_);
+    std::shared_ptr<WriteAheadLog> wal;
+    CheckpointBlocks base;
     {
-        std::lock_guard<std::mutex> lock(const_cast<std::mutex&>(mutex_));
-        
-        // Get the table names
-        table_names.reserve(tables_.size());
-        for (const auto& [name, _] : tables_) {
-            table_names.push_back(name);
+        std::lock_guard<std::mutex> lock(mutex_);
+        wal = wal_;
+        if (checkpoint_manifest_ == manifest) {
+            base = checkpoint_;
         }
     }
     
-    // Write number of tables
-    size_t table_count = table_names.size();
-    file.write(reinterpret_cast<const char*>(&table_count), sizeof(table_count));
+    // The manifest on disk names the segments in use until it is replaced.
+    // New segments never reuse a name still there, so a crash at any point
+    // leaves the old manifest and its segments intact.
+    std::vector<std::string> old_segments;
+    std::vector<ManifestEntry> old_entries;
+    if (!readManifest(manifest, old_segments, old_entries)) {
+        old_segments.clear();
+    }
+    std::string segment;
+    for (uint64_t n = 1; segment.empty() || ::access(siblingPath(manifest, segment).c_str(), F_OK) == 0; n++) {
+        segment = baseName(manifest) + "." + std::to_string(n);
+    }
     
-    // Write each table
-    for (const auto& name : table_names) {
-        Table* table = nullptr;
-        {
-            std::lock_guard<std::mutex> lock(const_cast<std::mutex&>(mutex_));
-            auto it = tables_.find(name);
-            if (it != tables_.end()) {
-                table = it->second.get();
-            }
+    SnapshotResult result;
+    if (!writeSnapshot(siblingPath(manifest, segment), options, wal.get(), &base, result)) {
+        return false;
+    }
+    
+    CheckpointBlocks blocks;
+    for (auto& [name, block] : result.written) {
+        block.segment = segment;
+        blocks[name] = std::move(block);
+    }
+    for (const auto& name : result.unchanged) {
+        blocks[name] = base.at(name);
+    }
+    
+    std::vector<std::string> segments;
+    std::unordered_map<std::string, uint32_t> segment_ids;
+    std::vector<ManifestEntry> entries;
+    for (const auto& [name, block] : blocks) {
+        auto id = segment_ids.emplace(block.segment, static_cast<uint32_t>(segments.size()));
+        if (id.second) {
+            segments.push_back(block.segment);
         }
-        
-        if (table) {
-            table->serialize(file);
+        ManifestEntry entry;
+        entry.name = name;
+        entry.segment = id.first->second;
+        entry.offset = block.entry.offset;
+        entry.size = block.entry.size;
+        entry.checksum = block.entry.checksum;
+        entry.encoding = block.entry.encoding;
+        entries.push_back(entry);
+    }
+    if (!writeManifest(manifest, segments, entries)) {
+        std::remove(siblingPath(manifest, segment).c_str());
+        return false;
+    }
+    
+    // Segments only the old manifest used go, the new one too if it holds nothing
+    old_segments.push_back(segment);
+    for (const auto& old : old_segments) {
+        if (segment_ids.count(old) == 0) {
+            std::remove(siblingPath(manifest, old).c_str());
         }
     }
     
-    return file.good();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        checkpoint_manifest_ = manifest;
+        checkpoint_ = std::move(blocks);
+    }
+    if (wal && !wal->checkpoint(result.lsn, result.unfinished_logs)) {
+        return false;
+    }
+    metrics_->save_time.record(std::chrono::steady_clock::now() - start);
+    return true;
 }
 
 bool Database::loadFromFile(const std::string& filename) {
+    auto start = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(mutex_);
+    
     std::ifstream file(filename, std::ios::binary);
     if (!file.is_open()) {
-        return false;
+        // With a log, a missing snapshot means everything is still in the log
+        if (!wal_) {
+            return false;
+        }
+        clearTables();
+        return replayWal();
     }
     
-    std::lock_guard<std::mutex> lock(mutex_);
+    file.seekg(0, std::ios::end);
+    uint64_t size = static_cast<uint64_t>(file.tellg());
+    file.seekg(0);
+    
+    char magic[sizeof(kSnapshotMagic)] = {};
+    file.read(magic, sizeof(magic));
+    bool is_snapshot = file.gcount() == sizeof(magic) && std::memcmp(magic, kSnapshotMagic, sizeof(magic)) == 0;
+    bool is_manifest = file.gcount() == sizeof(magic) && std::memcmp(magic, kManifestMagic, sizeof(magic)) == 0;
+    file.seekg(0);
+    file.clear();
     
     // Clear existing tables
-    tables_.clear();
+    clearTables();
+    
+    bool ok = is_manifest ? openManifest(filename) : is_snapshot ? openSnapshot(filename) : loadLegacyFile(file);
+    if (!ok) {
+        clearTables();
+        return false;
+    }
+    if (wal_ && !replayWal()) {
+        return false;
+    }
+    
+    // Tables of a snapshot are decoded later, on first access
+    metrics_->loaded_bytes.add(size);
+    metrics_->load_time.record(std::chrono::steady_clock::now() - start);
+    return true;
+}
+
+void Database::clearTables() {
+    std::atomic_store(&tables_, std::make_shared<const Catalog>());
+    unloaded_.clear();
+    checkpoint_manifest_.clear();
+    checkpoint_.clear();
+}
+
+bool Database::openSnapshot(const std::string& filename) {
+    auto file = MappedFile::open(filename);
+    if (!file || file->size() < kSnapshotHeaderSize) {
+        return false;
+    }
     
-    // Read number of tables
-    size_t table_count = 0;
-    file.read(reinterpret_cast<char*>(&table_count), sizeof(table_count));
+    // Only the header and directory are read here, tables load on first access
+    ByteReader header(file->data(), kSnapshotHeaderSize);
+    const char* magic = nullptr;
+    uint32_t version = 0, table_count = 0, directory_crc = 0, header_crc = 0;
+    uint64_t directory_offset = 0, directory_size = 0;
+    header.getBytes(sizeof(kSnapshotMagic), magic);
+    header.getU32(version);
+    header.getU32(table_count);
+    header.getU64(directory_offset);
+    header.getU64(directory_size);
+    header.getU32(directory_crc);
+    header.getU32(header_crc);
     
-    // Read each table
-    for (size_t i = 0; i < table_count; i++) {
-        auto table = Table::deserialize(file);
-        if (table) {
-            tables_[table->getName()] = std::move(table);
-        } else {
+    if (version == 0 || version > kSnapshotVersion || crc32(file->data(), kSnapshotHeaderSize - 4) != header_crc ||
+        directory_offset > file->size() || directory_size > file->size() - directory_offset) {
+        return false;
+    }
+    
+    const char* directory_data = file->data() + directory_offset;
+    if (crc32(directory_data, directory_size) != directory_crc) {
+        return false;
+    }
+    
+    // Version 1 entries end at the checksum, their blocks are all plain
+    ByteReader directory(directory_data, directory_size);
+    for (uint32_t i = 0; i < table_count; i++) {
+        std::string name;
+        SnapshotEntry entry;
+        if (!directory.getString(name) || !directory.getU64(entry.offset) || !directory.getU64(entry.size) ||
+            !directory.getU32(entry.checksum) || (version >= 2 && !directory.getU8(entry.encoding)) ||
+            entry.offset > directory_offset || entry.size > directory_offset - entry.offset) {
+            unloaded_.clear();
             return false;
         }
+        entry.table_id = Table::nextId();
+        entry.file = file;
+        unloaded_[name] = entry;
+    }
+    return true;
+}
+
+bool Database::openManifest(const std::string& filename) {
+    std::vector<std::string> segments;
+    std::vector<ManifestEntry> entries;
+    if (!readManifest(filename, segments, entries)) {
+        return false;
+    }
+    std::vector<std::shared_ptr<MappedFile>> files;
+    for (const auto& segment : segments) {
+        auto file = MappedFile::open(siblingPath(filename, segment));
+        if (!file) {
+            return false;
+        }
+        files.push_back(std::move(file));
+    }
+    
+    // Blocks are checked against their segment when first decoded, like a
+    // snapshot's, and start out saved by this manifest
+    for (const auto& manifest_entry : entries) {
+        const auto& file = files[manifest_entry.segment];
+        if (manifest_entry.offset > file->size() || manifest_entry.size > file->size() - manifest_entry.offset) {
+            unloaded_.clear();
+            checkpoint_.clear();
+            return false;
+        }
+        SnapshotEntry entry;
+        entry.offset = manifest_entry.offset;
+        entry.size = manifest_entry.size;
+        entry.checksum = manifest_entry.checksum;
+        entry.encoding = manifest_entry.encoding;
+        entry.table_id = Table::nextId();
+        
+        CheckpointBlock block;
+        block.segment = segments[manifest_entry.segment];
+        block.entry = entry;
+        block.changes = 0;
+        checkpoint_[manifest_entry.name] = block;
+        
+        entry.file = file;
+        unloaded_[manifest_entry.name] = entry;
+    }
+    checkpoint_manifest_ = filename;
+    return true;
+}
+
+bool Database::loadLegacyFile(std::istream& file) {
+    // Files written before the snapshot format: native size_t counts and
+    // eagerly decoded tables
+    try {
+        size_t table_count = 0;
+        file.read(reinterpret_cast<char*>(&table_count), sizeof(table_count));
+        if (!file) {
+            return false;
+        }
+        
+        for (size_t i = 0; i < table_count; i++) {
+            auto table = Table::deserialize(file);
+            if (!table) {
+                return false;
+            }
+            adoptTable(std::move(table));
+        }
+    } catch (const std::exception&) {
+        // Corrupt lengths can ask for impossible allocations
+        return false;
     }
     
     return file.good();
 }
 
+bool Database::replayWal() {
+    return WriteAheadLog::replay(wal_->path(), [this](WriteAheadLog::RecordType type, const std::string& payload) {
+        return applyLogRecord(type, payload);
+    });
+}
+
+DatabaseStats Database::stats() const {
+    DatabaseStats stats;
+    stats.scans = metrics_->scans.load();
+    stats.rows_scanned = metrics_->rows_scanned.load();
+    stats.rows_returned = metrics_->rows_returned.load();
+    stats.commits = metrics_->commits.load();
+    stats.rollbacks = metrics_->rollbacks.load();
+    stats.lock_timeouts = metrics_->lock_timeouts.load();
+    metrics_->commit_time.read(stats.commit_time);
+    stats.saved_bytes = metrics_->saved_bytes.load();
+    stats.loaded_bytes = metrics_->loaded_bytes.load();
+    metrics_->save_time.read(stats.save_time);
+    metrics_->load_time.read(stats.load_time);
+    
+    for (const auto& [name, table] : *catalog()) {
+        TableLock::Stats locks = table->lockStats();
+        stats.locks.acquisitions += locks.acquisitions;
+        stats.locks.contended += locks.contended;
+        stats.locks.timeouts += locks.timeouts;
+        stats.locks.wait_time += locks.wait_time;
+        stats.locks.max_wait = std::max(stats.locks.max_wait, locks.max_wait);
+    }
+    return stats;
+}
+
 std::vector<std::string> Database::getTableNames() const {
     std::lock_guard<std::mutex> lock(const_cast<std::mutex&>(mutex_));
     
     std::vector<std::string> names;
-    names.reserve(tables_.size());
+    names.reserve(tables_->size() + unloaded_.size());
     
-    for (const auto& [name, _] : tables_) {
+    for (const auto& [name, _] : *tables_) {
+        names.push_back(name);
+    }
+    for (const auto& [name, _] : unloaded_) {
         names.push_back(name);
     }
     
@@ -16,12 +16,16 @@ void read_worker(localdb::Database* db, const std::string& table_name, int threa
         // Begin a transaction
         auto transaction = db->beginTransaction();
         
-        // Select all rows
-        auto rows = transaction->select(table_name, [](const localdb::Row&) {
+        // Count all rows without copying them
+        size_t row_count = 0;
+        transaction->scan(table_name, [](const localdb::Row&) {
             return true; // Select all rows
+        }, [&row_count](const localdb::Row&) {
+            row_count++;
+            return true;
         });
         
-        std::cout << "Thread " << thread_id << " read " << rows.size() << " rows" << std::endl;
+        std::cout << "Thread " << thread_id << " read " << row_count << " rows" << std::endl;
         
         // Commit the transaction
         transaction->commit();
@@ -0,0 +1,48 @@
+#include "metrics.h"
+#include <algorithm>
+
+namespace localdb {
+
+size_t metricSlot() {
+    static std::atomic<size_t> next{0};
+    thread_local size_t slot = next.fetch_add(1, std::memory_order_relaxed) % kMetricSlots;
+    return slot;
+}
+
+uint64_t Counter::load() const {
+    uint64_t total = 0;
+    for (const auto& slot : slots_) {
+        total += slot.value.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+void Histogram::record(std::chrono::nanoseconds duration) {
+    uint64_t ns = static_cast<uint64_t>(std::max<int64_t>(duration.count(), 0));
+    size_t bucket = 0;
+    for (uint64_t us = ns / 1000; us > 0 && bucket + 1 < DatabaseStats::kBuckets; us >>= 1) {
+        bucket++;
+    }
+
+    Slot& slot = slots_[metricSlot()];
+    slot.count.fetch_add(1, std::memory_order_relaxed);
+    slot.total_ns.fetch_add(ns, std::memory_order_relaxed);
+    slot.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    uint64_t max = slot.max_ns.load(std::memory_order_relaxed);
+    while (ns > max && !slot.max_ns.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {
+    }
+}
+
+void Histogram::read(DatabaseStats::Histogram& out) const {
+    out = DatabaseStats::Histogram();
+    for (const auto& slot : slots_) {
+        out.count += slot.count.load(std::memory_order_relaxed);
+        out.total += std::chrono::nanoseconds(slot.total_ns.load(std::memory_order_relaxed));
+        out.max = std::max(out.max, std::chrono::nanoseconds(slot.max_ns.load(std::memory_order_relaxed)));
+        for (size_t i = 0; i < DatabaseStats::kBuckets; i++) {
+            out.buckets[i] += slot.buckets[i].load(std::memory_order_relaxed);
+        }
+    }
+}
+
+} // namespace localdb
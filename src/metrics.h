@@ -0,0 +1,74 @@
+#ifndef LOCALDB_METRICS_H
+#define LOCALDB_METRICS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include "localdb.h"
+
+namespace localdb {
+
+// Threads count into one of a few cache-line sized slots, picked once per
+// thread, so concurrent writers rarely share a line. Reads sum the slots and
+// may miss adds still in flight.
+constexpr size_t kMetricSlots = 16;
+size_t metricSlot();
+
+class Counter {
+public:
+    void add(uint64_t n = 1) { slots_[metricSlot()].value.fetch_add(n, std::memory_order_relaxed); }
+    uint64_t load() const;
+
+private:
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> value{0};
+    };
+    Slot slots_[kMetricSlots];
+};
+
+class Histogram {
+public:
+    void record(std::chrono::nanoseconds duration);
+    void read(DatabaseStats::Histogram& out) const;
+
+    // Time from construction to destruction
+    class Timer {
+    public:
+        explicit Timer(Histogram& histogram)
+            : histogram_(histogram), start_(std::chrono::steady_clock::now()) {}
+        ~Timer() { histogram_.record(std::chrono::steady_clock::now() - start_); }
+
+    private:
+        Histogram& histogram_;
+        std::chrono::steady_clock::time_point start_;
+    };
+
+private:
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> count{0};
+        std::atomic<uint64_t> total_ns{0};
+        std::atomic<uint64_t> max_ns{0};
+        std::atomic<uint64_t> buckets[DatabaseStats::kBuckets] = {};
+    };
+    Slot slots_[kMetricSlots];
+};
+
+// Counters of one Database, shared with its tables and transactions
+struct Metrics {
+    Counter scans;
+    Counter rows_scanned;
+    Counter rows_returned;
+    Counter commits;
+    Counter rollbacks;
+    Counter lock_timeouts;
+    Histogram commit_time;
+    Counter saved_bytes;
+    Counter loaded_bytes;
+    Histogram save_time;
+    Histogram load_time;
+};
+
+} // namespace localdb
+
+#endif // LOCALDB_METRICS_H
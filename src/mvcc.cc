@@ -0,0 +1,80 @@
+#include "mvcc.h"
+#include <algorithm>
+
+namespace localdb {
+
+uint64_t VersionClock::beginSnapshot() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint64_t read_ts = visible_.load();
+    snapshots_.insert(read_ts);
+    open_snapshots_++;
+    return read_ts;
+}
+
+void VersionClock::endSnapshot(uint64_t read_ts) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = snapshots_.find(read_ts);
+    if (it != snapshots_.end()) {
+        snapshots_.erase(it);
+        open_snapshots_--;
+    }
+}
+
+uint64_t VersionClock::horizon() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint64_t visible = visible_.load();
+    return snapshots_.empty() ? visible : std::min(*snapshots_.begin(), visible);
+}
+
+uint64_t VersionClock::nextTag() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return kPendingBit | next_tag_++;
+}
+
+uint64_t VersionClock::beginCommit(uint64_t log_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint64_t ts = ++allocated_;
+    committing_[ts] = {log_id, false};
+    return ts;
+}
+
+void VersionClock::endCommit(uint64_t ts) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = committing_.find(ts);
+    if (it == committing_.end()) {
+        return;
+    }
+    it->second.done = true;
+
+    // Advance past every finished commit that no unfinished one precedes
+    uint64_t visible = visible_.load();
+    while (!committing_.empty() && committing_.begin()->second.done) {
+        visible = committing_.begin()->first;
+        unfinished_logs_.erase(committing_.begin()->second.log_id);
+        committing_.erase(committing_.begin());
+    }
+    visible_.store(visible, std::memory_order_release);
+}
+
+void VersionClock::logStarted(uint64_t log_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    unfinished_logs_.insert(log_id);
+}
+
+void VersionClock::logAbandoned(uint64_t log_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    unfinished_logs_.erase(log_id);
+}
+
+uint64_t VersionClock::capture(std::vector<uint64_t>& unfinished_logs) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    unfinished_logs.assign(unfinished_logs_.begin(), unfinished_logs_.end());
+    return visible_.load();
+}
+
+bool VersionClock::settled(uint64_t ts) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return allocated_ == ts;
+}
+
+} // namespace localdb
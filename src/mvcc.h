@@ -0,0 +1,78 @@
+#ifndef LOCALDB_MVCC_H
+#define LOCALDB_MVCC_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <set>
+#include <unordered_set>
+#include <vector>
+
+namespace localdb {
+
+// Every row version carries a begin and an end stamp. A stamp is either a
+// commit timestamp or the pending tag of a running transaction. Tags have the
+// top bit set, so they compare greater than any timestamp a reader uses.
+// Stamp 0 marks versions written while no snapshot was open, which every
+// reader sees.
+constexpr uint64_t kPendingBit = uint64_t(1) << 63;
+constexpr uint64_t kInfinity = ~uint64_t(0);      // Open end, or the begin of a rolled back version
+constexpr uint64_t kNoTransaction = kPendingBit;  // Tag of readers outside a transaction
+
+// Commit timestamps and open snapshots, shared by the tables of one Database
+class VersionClock {
+public:
+    // Register a snapshot of everything committed so far
+    uint64_t beginSnapshot();
+    void endSnapshot(uint64_t read_ts);
+
+    // No snapshot is open, so nobody can see a version once it is replaced
+    bool quiescent() const { return open_snapshots_.load() == 0; }
+
+    // Latest timestamp whose commit, and every earlier one, has finished
+    uint64_t visible() const { return visible_.load(std::memory_order_acquire); }
+
+    // Versions that ended at or before this are invisible to every reader
+    uint64_t horizon();
+
+    // Pending tag for a new transaction
+    uint64_t nextTag();
+
+    // Commit timestamps are handed out in order and become visible once all
+    // earlier commits have stamped their versions. log_id is the transaction's
+    // write-ahead log id, 0 if it logged nothing.
+    uint64_t beginCommit(uint64_t log_id = 0);
+    void endCommit(uint64_t ts);
+
+    // Logged transactions whose changes are not visible yet
+    void logStarted(uint64_t log_id);
+    void logAbandoned(uint64_t log_id);
+
+    // visible() together with the logged transactions it does not include
+    uint64_t capture(std::vector<uint64_t>& unfinished_logs);
+
+    // No commit later than ts has a timestamp yet, so none can have stamped
+    // versions a snapshot at ts misses
+    bool settled(uint64_t ts);
+
+private:
+    struct Commit {
+        uint64_t log_id;
+        bool done;
+    };
+
+    std::mutex mutex_;
+    std::atomic<uint64_t> visible_{0};
+    std::atomic<size_t> open_snapshots_{0};
+    uint64_t allocated_ = 0;
+    uint64_t next_tag_ = 1;
+    std::map<uint64_t, Commit> committing_;
+    std::multiset<uint64_t> snapshots_;
+    std::unordered_set<uint64_t> unfinished_logs_;
+};
+
+} // namespace localdb
+
+#endif // LOCALDB_MVCC_H
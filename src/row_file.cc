@@ -0,0 +1,231 @@
+#include "row_file.h"
+#include <algorithm>
+#include <cstdint>
+#include <iomanip>
+#include <istream>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+
+namespace localdb {
+
+namespace {
+
+const char kRowFileMagic[8] = {'L', 'D', 'B', 'R', 'O', 'W', 'S', '1'};
+
+} // namespace
+
+Value parseValue(const std::string& text, Column::Type type) {
+    switch (type) {
+        case Column::INT:
+            return Value(std::stoi(text));
+        case Column::FLOAT:
+            return Value(std::stod(text));
+        case Column::TEXT:
+            return Value(text);
+        case Column::BLOB: {
+            // Parse hex string to blob
+            std::vector<uint8_t> blob;
+            for (size_t i = 0; i < text.length(); i += 2) {
+                std::string byte = text.substr(i, 2);
+                blob.push_back(static_cast<uint8_t>(std::stoi(byte, nullptr, 16)));
+            }
+            return Value(blob);
+        }
+        default:
+            throw std::runtime_error("Unsupported value type");
+    }
+}
+
+bool readCsvRecord(std::istream& in, std::vector<std::string>& fields, std::vector<bool>& nulls) {
+    std::string line;
+    if (!std::getline(in, line)) {
+        return false;
+    }
+
+    fields.clear();
+    nulls.clear();
+    std::string field;
+    bool quoted = false;
+    bool in_quotes = false;
+    size_t i = 0;
+    while (true) {
+        if (i == line.size()) {
+            if (in_quotes && std::getline(in, line)) {
+                field += '\n';
+                i = 0;
+                continue;
+            }
+            break;
+        }
+
+        char c = line[i++];
+        if (in_quotes) {
+            if (c != '"') {
+                field += c;
+            } else if (i < line.size() && line[i] == '"') {
+                field += '"';
+                i++;
+            } else {
+                in_quotes = false;
+            }
+        } else if (c == '"') {
+            in_quotes = quoted = true;
+        } else if (c == ',') {
+            nulls.push_back(!quoted && field.empty());
+            fields.push_back(std::move(field));
+            field.clear();
+            quoted = false;
+        } else if (c != '\r' || i < line.size()) {
+            field += c;
+        }
+    }
+    nulls.push_back(!quoted && field.empty());
+    fields.push_back(std::move(field));
+    return true;
+}
+
+bool readCsvRows(std::istream& in, const std::vector<Column>& columns,
+                 const std::function<bool(Row&&)>& sink, std::string& error) {
+    std::vector<std::string> fields;
+    std::vector<bool> nulls;
+    for (size_t record = 1; readCsvRecord(in, fields, nulls); ++record) {
+        // In a one-column table an empty line is a NULL row, not a blank line
+        if (fields.size() == 1 && nulls[0] && columns.size() > 1) {
+            continue;
+        }
+        if (record == 1 && fields.size() == columns.size() &&
+            std::equal(fields.begin(), fields.end(), columns.begin(),
+                       [](const std::string& field, const Column& col) { return field == col.name; })) {
+            continue;
+        }
+        if (fields.size() != columns.size()) {
+            error = "Record " + std::to_string(record) + ": expected " + std::to_string(columns.size()) +
+                    " values, got " + std::to_string(fields.size());
+            return false;
+        }
+
+        Row row;
+        row.reserve(columns.size());
+        for (size_t i = 0; i < columns.size(); ++i) {
+            try {
+                row.push_back(nulls[i] ? Value() : parseValue(fields[i], columns[i].type));
+            } catch (const std::exception& e) {
+                error = "Record " + std::to_string(record) + ": error parsing value for column '" +
+                        columns[i].name + "': " + e.what();
+                return false;
+            }
+        }
+        if (!sink(std::move(row))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool readBinaryRows(std::istream& in, const std::vector<Column>& columns,
+                    const std::function<bool(Row&&)>& sink, std::string& error) {
+    char magic[sizeof(kRowFileMagic)];
+    if (!in.read(magic, sizeof(magic)) || !std::equal(magic, magic + sizeof(magic), kRowFileMagic)) {
+        error = "Not a binary row file";
+        return false;
+    }
+
+    uint32_t count;
+    for (size_t record = 1; in.read(reinterpret_cast<char*>(&count), sizeof(count)); ++record) {
+        if (count != columns.size()) {
+            error = "Record " + std::to_string(record) + ": expected " + std::to_string(columns.size()) +
+                    " values, got " + std::to_string(count);
+            return false;
+        }
+        Row row;
+        row.reserve(count);
+        try {
+            for (uint32_t i = 0; i < count; ++i) {
+                row.push_back(Value::deserialize(in));
+            }
+        } catch (const std::exception& e) {
+            error = "Record " + std::to_string(record) + ": " + e.what();
+            return false;
+        }
+        if (!in) {
+            error = "Record " + std::to_string(record) + ": truncated";
+            return false;
+        }
+        if (!sink(std::move(row))) {
+            return false;
+        }
+    }
+    if (in.gcount() != 0) {
+        error = "Truncated row file";
+        return false;
+    }
+    return true;
+}
+
+void writeCsvValue(std::ostream& out, const Value& value) {
+    std::string text;
+    switch (value.type) {
+        case Value::INT:
+            out << value.asInt();
+            return;
+        case Value::FLOAT:
+            out << value.asFloat();
+            return;
+        case Value::TEXT:
+            text = value.asText();
+            break;
+        case Value::BLOB: {
+            std::ostringstream hex;
+            hex << std::hex << std::setfill('0');
+            for (uint8_t byte : value.asBlob()) {
+                hex << std::setw(2) << static_cast<int>(byte);
+            }
+            text = hex.str();
+            break;
+        }
+        default:
+            return;
+    }
+
+    if (!text.empty() && text.find_first_of(",\"\r\n") == std::string::npos) {
+        out << text;
+        return;
+    }
+    out << '"';
+    for (char c : text) {
+        if (c == '"') out << '"';
+        out << c;
+    }
+    out << '"';
+}
+
+void writeCsvHeader(std::ostream& out, const std::vector<Column>& columns) {
+    for (size_t i = 0; i < columns.size(); ++i) {
+        if (i > 0) out << ',';
+        out << columns[i].name;
+    }
+    out << '\n';
+}
+
+void writeCsvRow(std::ostream& out, const Row& row) {
+    for (size_t i = 0; i < row.size(); ++i) {
+        if (i > 0) out << ',';
+        writeCsvValue(out, row[i]);
+    }
+    out << '\n';
+}
+
+void writeBinaryHeader(std::ostream& out) {
+    out.write(kRowFileMagic, sizeof(kRowFileMagic));
+}
+
+void writeBinaryRow(std::ostream& out, const Row& row) {
+    uint32_t count = static_cast<uint32_t>(row.size());
+    out.write(reinterpret_cast<const char*>(&count), sizeof(count));
+    for (const auto& value : row) {
+        value.serialize(out);
+    }
+}
+
+} // namespace localdb
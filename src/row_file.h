@@ -0,0 +1,46 @@
+#ifndef LOCALDB_ROW_FILE_H
+#define LOCALDB_ROW_FILE_H
+
+#include <functional>
+#include <iosfwd>
+#include <string>
+#include <vector>
+#include "localdb.h"
+
+namespace localdb {
+
+// Row files the CLI imports and exports. CSV holds one record per row, with
+// a header line of column names. Binary row files start with a tag, then hold
+// each row as a uint32 value count followed by the values in the snapshot's
+// value encoding.
+
+// Parse text as a value of a column type, BLOBs as hex. Throws on malformed text.
+Value parseValue(const std::string& text, Column::Type type);
+
+// Read one CSV record into fields, reading on while a quoted field spans
+// lines. Quotes inside a quoted field are doubled. An empty unquoted field
+// is NULL. False at the end of the input.
+bool readCsvRecord(std::istream& in, std::vector<std::string>& fields, std::vector<bool>& nulls);
+
+// Pass the rows of a CSV file to sink. Blank lines are skipped, except for a
+// one-column table where they hold NULL, and so is a first line naming the
+// columns. False with error set on a malformed record, or false when sink is.
+bool readCsvRows(std::istream& in, const std::vector<Column>& columns,
+                 const std::function<bool(Row&&)>& sink, std::string& error);
+
+// Pass the rows of a binary row file to sink, as readCsvRows does
+bool readBinaryRows(std::istream& in, const std::vector<Column>& columns,
+                    const std::function<bool(Row&&)>& sink, std::string& error);
+
+// Write a value as a CSV field that readCsvRecord reads back as the same
+// value. Floats are written at the stream's precision.
+void writeCsvValue(std::ostream& out, const Value& value);
+void writeCsvHeader(std::ostream& out, const std::vector<Column>& columns);
+void writeCsvRow(std::ostream& out, const Row& row);
+
+void writeBinaryHeader(std::ostream& out);
+void writeBinaryRow(std::ostream& out, const Row& row);
+
+} // namespace localdb
+
+#endif // LOCALDB_ROW_FILE_H
@@ -0,0 +1,81 @@
+#include "localdb.h"
+#include <algorithm>
+
+namespace localdb {
+
+const std::chrono::steady_clock::time_point TableLock::kNoWait = std::chrono::steady_clock::time_point::min();
+
+bool TableLock::acquire(bool exclusive, const std::chrono::steady_clock::time_point* deadline) {
+    std::unique_lock<std::mutex> guard(mutex_);
+    
+    // Callers already queued go first, even if the lock is free right now
+    if (queue_.empty() && available(exclusive)) {
+        take(exclusive);
+        stats_.acquisitions++;
+        return true;
+    }
+    if (deadline == &kNoWait) {
+        return false;
+    }
+    
+    Waiter waiter;
+    waiter.exclusive = exclusive;
+    queue_.push_back(&waiter);
+    auto start = std::chrono::steady_clock::now();
+    auto granted = [&waiter] { return waiter.granted; };
+    if (!deadline) {
+        waiter.cv.wait(guard, granted);
+    } else if (!waiter.cv.wait_until(guard, *deadline, granted)) {
+        queue_.erase(std::find(queue_.begin(), queue_.end(), &waiter));
+        stats_.timeouts++;
+        
+        // A writer leaving the head of the queue may unblock readers behind it
+        grantWaiters();
+        return false;
+    }
+    
+    auto waited = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+    stats_.acquisitions++;
+    stats_.contended++;
+    stats_.wait_time += waited;
+    stats_.max_wait = std::max(stats_.max_wait, waited);
+    return true;
+}
+
+void TableLock::release(bool exclusive) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    if (exclusive) {
+        writer_ = false;
+    } else {
+        readers_--;
+    }
+    grantWaiters();
+}
+
+void TableLock::take(bool exclusive) {
+    if (exclusive) {
+        writer_ = true;
+    } else {
+        readers_++;
+    }
+}
+
+void TableLock::grantWaiters() {
+    // Grant from the head: one writer, or every reader up to the next writer.
+    // The waiter needs mutex_ to return, so notifying under it is safe even
+    // though the waiter and its condition variable live on the waiter's stack.
+    while (!queue_.empty() && available(queue_.front()->exclusive)) {
+        Waiter* waiter = queue_.front();
+        queue_.pop_front();
+        take(waiter->exclusive);
+        waiter->granted = true;
+        waiter->cv.notify_one();
+    }
+}
+
+TableLock::Stats TableLock::stats() const {
+    std::lock_guard<std::mutex> guard(mutex_);
+    return stats_;
+}
+
+} // namespace localdb
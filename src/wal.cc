@@ -0,0 +1,338 @@
+#include "wal.h"
+#include "format.h"
+#include <algorithm>
+#include <iterator>
+#include <cstdio>
+#include <fstream>
+#include <unordered_set>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace localdb {
+
+namespace {
+
+constexpr size_t kRecordHeaderSize = sizeof(uint32_t) * 2 + sizeof(uint64_t) + sizeof(uint8_t);
+
+// Visit every intact record in file order and return the end offset of the
+// last one. Scanning stops at the first short or corrupt record.
+uint64_t scanRecords(const std::string& path,
+                     const std::function<bool(uint64_t txn_id, uint8_t type, const std::string& payload)>& visitor) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file.is_open()) {
+        return 0;
+    }
+    uint64_t file_size = static_cast<uint64_t>(file.tellg());
+    file.seekg(0);
+
+    uint64_t offset = 0;
+    std::string payload;
+    while (offset + kRecordHeaderSize <= file_size) {
+        char header[kRecordHeaderSize];
+        if (!file.read(header, sizeof(header))) {
+            break;
+        }
+
+        uint32_t size = 0;
+        uint32_t checksum = 0;
+        uint64_t txn_id = 0;
+        uint8_t type = 0;
+        ByteReader reader(header, sizeof(header));
+        reader.getU32(size);
+        reader.getU32(checksum);
+        reader.getU64(txn_id);
+        reader.getU8(type);
+
+        if (size > file_size - offset - kRecordHeaderSize) {
+            break;
+        }
+        payload.resize(size);
+        if (size > 0 && !file.read(&payload[0], size)) {
+            break;
+        }
+        if (crc32(payload.data(), size, crc32(header + 8, kRecordHeaderSize - 8)) != checksum) {
+            break;
+        }
+
+        offset += kRecordHeaderSize + size;
+        if (!visitor(txn_id, type, payload)) {
+            break;
+        }
+    }
+
+    return offset;
+}
+
+// Frame a record: u32 payload size | u32 crc | u64 transaction id | u8 type | payload
+void encodeRecord(uint64_t txn_id, uint8_t type, const std::string& payload, std::string& out) {
+    // The checksum covers the transaction id, type and payload
+    std::string covered;
+    ByteWriter writer(covered);
+    writer.putU64(txn_id);
+    writer.putU8(type);
+    uint32_t checksum = crc32(payload.data(), payload.size(), crc32(covered.data(), covered.size()));
+
+    ByteWriter out_writer(out);
+    out_writer.putU32(static_cast<uint32_t>(payload.size()));
+    out_writer.putU32(checksum);
+    out_writer.putBytes(covered.data(), covered.size());
+    out_writer.putBytes(payload.data(), payload.size());
+}
+
+} // namespace
+
+WriteAheadLog::WriteAheadLog(const std::string& path, const WalOptions& options)
+    : path_(path), options_(options) {}
+
+WriteAheadLog::~WriteAheadLog() {
+    // The flusher answers every waiter before it stops
+    if (flusher_.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        waiters_cv_.notify_all();
+        flusher_.join();
+    }
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        flushed_cv_.wait(lock, [this] { return !flushing_; });
+        if (fd_ >= 0 && !failed_ && !buffer_.empty()) {
+            flushLocked(lock);
+        }
+    }
+    if (fd_ >= 0) {
+        ::close(fd_);
+    }
+}
+
+bool WriteAheadLog::open() {
+    uint64_t max_txn_id = 0;
+    uint64_t valid_end = scanRecords(path_, [&max_txn_id](uint64_t txn_id, uint8_t, const std::string&) {
+        max_txn_id = std::max(max_txn_id, txn_id);
+        return true;
+    });
+
+    fd_ = ::open(path_.c_str(), O_WRONLY | O_CREAT, 0644);
+    if (fd_ < 0) {
+        return false;
+    }
+
+    // Cut off a partially written record so new records follow intact ones
+    if (::ftruncate(fd_, static_cast<off_t>(valid_end)) != 0 ||
+        ::lseek(fd_, 0, SEEK_END) < 0) {
+        ::close(fd_);
+        fd_ = -1;
+        return false;
+    }
+
+    base_lsn_ = 0;
+    appended_lsn_ = valid_end;
+    flushed_lsn_ = valid_end;
+    next_txn_id_ = max_txn_id + 1;
+    return true;
+}
+
+uint64_t WriteAheadLog::nextTransactionId() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return next_txn_id_++;
+}
+
+uint64_t WriteAheadLog::append(uint64_t txn_id, RecordType type, const std::string& payload) {
+    std::string record;
+    encodeRecord(txn_id, type, payload, record);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    buffer_.append(record);
+    appended_lsn_ += record.size();
+    return appended_lsn_;
+}
+
+bool WriteAheadLog::sync(uint64_t lsn) {
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    // Wait for a running flush; it may already cover this record
+    while (true) {
+        if (failed_) {
+            return false;
+        }
+        if (flushed_lsn_ >= lsn) {
+            return true;
+        }
+        if (!flushing_) {
+            break;
+        }
+        flushed_cv_.wait(lock);
+    }
+
+    return flushLocked(lock);
+}
+
+void WriteAheadLog::syncAsync(uint64_t lsn, std::function<void(bool)> done) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!flusher_.joinable()) {
+            flusher_ = std::thread([this] { flushLoop(); });
+        }
+        waiters_.emplace(lsn, std::move(done));
+    }
+    waiters_cv_.notify_one();
+}
+
+void WriteAheadLog::flushLoop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        waiters_cv_.wait(lock, [this] { return stopping_ || !waiters_.empty(); });
+        if (waiters_.empty()) {
+            return;
+        }
+
+        // One flush covers every waiter so far; one by a committer in sync()
+        // may already cover them
+        if (!failed_ && flushed_lsn_ < waiters_.rbegin()->first) {
+            if (flushing_) {
+                flushed_cv_.wait(lock, [this] { return !flushing_; });
+                continue;
+            }
+            flushLocked(lock);
+        }
+
+        std::vector<std::function<void(bool)>> ready;
+        auto end = failed_ ? waiters_.end() : waiters_.upper_bound(flushed_lsn_);
+        for (auto it = waiters_.begin(); it != end; ++it) {
+            ready.push_back(std::move(it->second));
+        }
+        waiters_.erase(waiters_.begin(), end);
+        bool ok = !failed_;
+
+        lock.unlock();
+        for (auto& done : ready) {
+            done(ok);
+        }
+        lock.lock();
+    }
+}
+
+bool WriteAheadLog::flushLocked(std::unique_lock<std::mutex>& lock) {
+    flushing_ = true;
+
+    // Give other committers a chance to join this group
+    if (options_.group_commit_window.count() > 0) {
+        lock.unlock();
+        std::this_thread::sleep_for(options_.group_commit_window);
+        lock.lock();
+    }
+
+    std::string batch;
+    batch.swap(buffer_);
+    uint64_t target = appended_lsn_;
+    lock.unlock();
+
+    bool ok = writeAll(fd_, batch.data(), batch.size());
+    if (ok && options_.sync_mode == WalOptions::SYNC_COMMIT) {
+        ok = ::fdatasync(fd_) == 0;
+    }
+
+    lock.lock();
+    flushing_ = false;
+    if (ok) {
+        flushed_lsn_ = target;
+    } else {
+        // The file may now end in a partial batch, stop accepting commits
+        failed_ = true;
+    }
+    flushed_cv_.notify_all();
+    return ok;
+}
+
+uint64_t WriteAheadLog::appendedLsn() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return appended_lsn_;
+}
+
+bool WriteAheadLog::checkpoint(uint64_t lsn, const std::vector<uint64_t>& retained) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    flushed_cv_.wait(lock, [this] { return !flushing_; });
+    if (fd_ < 0 || failed_) {
+        return false;
+    }
+
+    // Write out buffered records so the file holds the whole log
+    if (!writeAll(fd_, buffer_.data(), buffer_.size()) || ::fdatasync(fd_) != 0) {
+        failed_ = true;
+        return false;
+    }
+    buffer_.clear();
+    flushed_lsn_ = appended_lsn_;
+
+    lsn = std::max(lsn, base_lsn_);
+
+    // Records of transactions the snapshot does not cover survive the cut
+    std::string head;
+    if (!retained.empty()) {
+        uint64_t offset = base_lsn_;
+        scanRecords(path_, [&](uint64_t txn_id, uint8_t type, const std::string& payload) {
+            if (offset >= lsn) {
+                return false;
+            }
+            offset += kRecordHeaderSize + payload.size();
+            if (std::find(retained.begin(), retained.end(), txn_id) != retained.end()) {
+                encodeRecord(txn_id, type, payload, head);
+            }
+            return true;
+        });
+    }
+
+    std::string tail;
+    {
+        std::ifstream file(path_, std::ios::binary);
+        file.seekg(static_cast<std::streamoff>(lsn - base_lsn_));
+        tail.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        if (tail.size() != appended_lsn_ - lsn) {
+            return false;
+        }
+    }
+
+    // Replace the log with its tail, then switch to the new file
+    std::string temp_path = path_ + ".tmp";
+    int temp_fd = ::open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (temp_fd < 0) {
+        return false;
+    }
+    if (!writeAll(temp_fd, head.data(), head.size()) || !writeAll(temp_fd, tail.data(), tail.size()) ||
+        ::fsync(temp_fd) != 0 ||
+        std::rename(temp_path.c_str(), path_.c_str()) != 0) {
+        ::close(temp_fd);
+        std::remove(temp_path.c_str());
+        return false;
+    }
+    syncDirectoryOf(path_);
+
+    ::close(fd_);
+    fd_ = temp_fd;
+    base_lsn_ = lsn - head.size();
+    return true;
+}
+
+bool WriteAheadLog::replay(const std::string& path, const RecordVisitor& visitor) {
+    // First pass finds committed transactions, the second applies them
+    std::unordered_set<uint64_t> committed;
+    scanRecords(path, [&committed](uint64_t txn_id, uint8_t type, const std::string&) {
+        if (type == COMMIT) {
+            committed.insert(txn_id);
+        }
+        return true;
+    });
+
+    bool ok = true;
+    scanRecords(path, [&](uint64_t txn_id, uint8_t type, const std::string& payload) {
+        if (type == COMMIT || (txn_id != 0 && committed.count(txn_id) == 0)) {
+            return true;
+        }
+        ok = visitor(static_cast<RecordType>(type), payload);
+        return ok;
+    });
+    return ok;
+}
+
+} // namespace localdb
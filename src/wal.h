@@ -0,0 +1,100 @@
+#ifndef LOCALDB_WAL_H
+#define LOCALDB_WAL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include "localdb.h"
+
+namespace localdb {
+
+// Append-only redo log. Each record is framed as
+//   u32 payload size | u32 crc | u64 transaction id | u8 type | payload
+// in little-endian, with the crc covering everything after it. Operations are
+// logged while the table write lock is held, so log order matches apply
+// order; a transaction's operations only take effect on replay once its
+// COMMIT record is present.
+// Records with transaction id 0 (schema changes) apply unconditionally.
+class WriteAheadLog {
+public:
+    enum RecordType : uint8_t {
+        INSERT = 1,
+        UPDATE,
+        REMOVE,
+        COMMIT,
+        CREATE_TABLE,
+        DROP_TABLE,
+        CREATE_INDEX,
+        DROP_INDEX
+    };
+
+    using RecordVisitor = std::function<bool(RecordType type, const std::string& payload)>;
+
+    WriteAheadLog(const std::string& path, const WalOptions& options);
+    ~WriteAheadLog();
+
+    // Open the log for appending, dropping a torn tail left by a crash
+    bool open();
+
+    const std::string& path() const { return path_; }
+
+    // Transaction ids continue after the largest id already in the log
+    uint64_t nextTransactionId();
+
+    // Buffer a record and return its log sequence number (end offset)
+    uint64_t append(uint64_t txn_id, RecordType type, const std::string& payload);
+
+    // Make every record up to lsn durable. Concurrent callers share one
+    // write and fsync: the first becomes the leader and flushes for all.
+    bool sync(uint64_t lsn);
+
+    // Call done once every record up to lsn is durable, with false if the log
+    // failed first. A background thread, started on first use, flushes for
+    // all waiting callers in one batch and runs done.
+    void syncAsync(uint64_t lsn, std::function<void(bool)> done);
+
+    // Sequence number of the last buffered record
+    uint64_t appendedLsn();
+
+    // Drop every record before lsn once a snapshot covers them. Records of
+    // the retained transactions, still running when the snapshot was taken,
+    // are kept.
+    bool checkpoint(uint64_t lsn, const std::vector<uint64_t>& retained = {});
+
+    // Replay committed operations and schema changes in log order
+    static bool replay(const std::string& path, const RecordVisitor& visitor);
+
+private:
+    bool flushLocked(std::unique_lock<std::mutex>& lock);
+    void flushLoop();
+
+    std::string path_;
+    WalOptions options_;
+    int fd_ = -1;
+
+    std::mutex mutex_;
+    std::condition_variable flushed_cv_;
+    std::string buffer_;          // Records not yet written to the file
+    uint64_t base_lsn_ = 0;       // Sequence number of file offset 0
+    uint64_t appended_lsn_ = 0;   // End of the last buffered record
+    uint64_t flushed_lsn_ = 0;    // End of the last durable record
+    uint64_t next_txn_id_ = 1;
+    bool flushing_ = false;
+    bool failed_ = false;
+
+    // Callbacks of syncAsync keyed by the lsn they wait for
+    std::multimap<uint64_t, std::function<void(bool)>> waiters_;
+    std::condition_variable waiters_cv_;
+    std::thread flusher_;
+    bool stopping_ = false;
+};
+
+} // namespace localdb
+
+#endif // LOCALDB_WAL_H
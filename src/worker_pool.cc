@@ -0,0 +1,103 @@
+#include "worker_pool.h"
+#include <algorithm>
+
+namespace localdb {
+
+WorkerPool::WorkerPool(size_t threads) {
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency()) - 1;
+    }
+    for (size_t i = 0; i < threads; i++) {
+        workers_.emplace_back([this] { work(); });
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    work_cv_.notify_all();
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+}
+
+void WorkerPool::run(size_t count, const std::function<void(size_t)>& task) {
+    if (count <= 1 || workers_.empty()) {
+        for (size_t i = 0; i < count; i++) {
+            task(i);
+        }
+        return;
+    }
+
+    auto job = std::make_shared<Job>();
+    job->task = &task;
+    job->count = count;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        jobs_.push_back(job);
+    }
+    if (count - 1 < workers_.size()) {
+        for (size_t i = 0; i + 1 < count; i++) {
+            work_cv_.notify_one();
+        }
+    } else {
+        work_cv_.notify_all();
+    }
+
+    drain(*job);
+
+    // Wait for tasks other threads have claimed but not finished
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto it = std::find(jobs_.begin(), jobs_.end(), job);
+    if (it != jobs_.end()) {
+        jobs_.erase(it);
+    }
+    done_cv_.wait(lock, [&job] { return job->finished.load() == job->count; });
+    if (job->error) {
+        std::rethrow_exception(job->error);
+    }
+}
+
+void WorkerPool::drain(Job& job) {
+    size_t index;
+    while ((index = job.next.fetch_add(1)) < job.count) {
+        try {
+            (*job.task)(index);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!job.error) {
+                job.error = std::current_exception();
+            }
+        }
+
+        if (job.finished.fetch_add(1) + 1 == job.count) {
+            // Taking the mutex orders the notify after the caller's check
+            std::lock_guard<std::mutex> lock(mutex_);
+            done_cv_.notify_all();
+        }
+    }
+}
+
+void WorkerPool::work() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        work_cv_.wait(lock, [this] { return stop_ || !jobs_.empty(); });
+        if (stop_) {
+            return;
+        }
+
+        // Jobs run oldest first; one with every task claimed leaves the queue
+        std::shared_ptr<Job> job = jobs_.front();
+        if (job->next.load() >= job->count) {
+            jobs_.pop_front();
+            continue;
+        }
+        lock.unlock();
+        drain(*job);
+        lock.lock();
+    }
+}
+
+} // namespace localdb
@@ -0,0 +1,61 @@
+#ifndef LOCALDB_WORKER_POOL_H
+#define LOCALDB_WORKER_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace localdb {
+
+// Threads shared by the scans of one Database. A job is a range of task
+// indexes that the caller and any idle worker claim one at a time from a
+// shared counter, so a fast thread keeps taking morsels while a slow one
+// finishes its own. The caller runs tasks too, which lets tasks start jobs
+// of their own without waiting for a free worker.
+class WorkerPool {
+public:
+    // Workers besides the calling thread; 0 sizes the pool to the hardware
+    explicit WorkerPool(size_t threads = 0);
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    // Threads a job can use at once, the caller included
+    size_t concurrency() const { return workers_.size() + 1; }
+
+    // Run task(i) for every i in [0, count) and return once all finished.
+    // The first exception a task throws is rethrown here.
+    void run(size_t count, const std::function<void(size_t)>& task);
+
+private:
+    struct Job {
+        const std::function<void(size_t)>* task;
+        size_t count;
+        std::atomic<size_t> next{0};
+        std::atomic<size_t> finished{0};
+        std::exception_ptr error;   // Guarded by the pool mutex
+    };
+
+    // Claim and run tasks of a job until none are left
+    void drain(Job& job);
+    void work();
+
+    std::mutex mutex_;
+    std::condition_variable work_cv_;
+    std::condition_variable done_cv_;
+    std::deque<std::shared_ptr<Job>> jobs_;
+    bool stop_ = false;
+    std::vector<std::thread> workers_;
+};
+
+} // namespace localdb
+
+#endif // LOCALDB_WORKER_POOL_H
@@ -0,0 +1,26 @@
+# Run a batch script through the CLI in an empty directory holding the
+# fixtures, and compare its output, without timings, and exit code with
+# the expected ones.
+#   cmake -DCLI=... -DSCRIPT=... -DEXPECTED=... -DEXIT_CODE=... -DWORK_DIR=... -P run_batch.cmake
+file(REMOVE_RECURSE ${WORK_DIR})
+file(MAKE_DIRECTORY ${WORK_DIR})
+get_filename_component(FIXTURES ${SCRIPT} DIRECTORY)
+file(GLOB CSV_FIXTURES ${FIXTURES}/*.csv)
+file(COPY ${CSV_FIXTURES} DESTINATION ${WORK_DIR})
+
+execute_process(
+  COMMAND ${CLI} --batch ${SCRIPT}
+  WORKING_DIRECTORY ${WORK_DIR}
+  OUTPUT_VARIABLE output
+  ERROR_VARIABLE output
+  RESULT_VARIABLE result
+)
+string(REGEX REPLACE " in [0-9.]+s \\([0-9]+ [a-z]+/s\\)" "" output "${output}")
+file(READ ${EXPECTED} expected)
+
+if(NOT result EQUAL EXIT_CODE)
+  message(FATAL_ERROR "Exit code ${result}, expected ${EXIT_CODE}. Output:\n${output}")
+endif()
+if(NOT output STREQUAL expected)
+  message(FATAL_ERROR "Output differs from ${EXPECTED}:\n${output}")
+endif()
@@ -4,6 +4,13 @@
 #include <vector>
 #include <stdexcept>
 #include <fstream>
+#include <thread>
+#include <iterator>
+#include <mutex>
+#include <set>
+#include <atomic>
+#include <future>
+#include <algorithm>
 
 namespace {
 
@@ -106,6 +113,15 @@ TEST_F(DatabaseTest, DatabaseTableOperations) {
     });
     EXPECT_EQ(all_users.size(), 2);
     
+    // Index a column and look it up through a transaction
+    EXPECT_TRUE(db.createIndex("users", "age"));
+    EXPECT_FALSE(db.createIndex("non_existent", "age"));
+    auto tx = db.beginTransaction();
+    EXPECT_EQ(tx->lookup("users", "age", localdb::Value(30)).size(), 1);
+    EXPECT_EQ(tx->range("users", "age", localdb::Value(20), localdb::Value(40)).size(), 2);
+    tx->commit();
+    EXPECT_TRUE(db.dropIndex("users", "age"));
+    
     // Drop table
     EXPECT_TRUE(db.dropTable("users"));
 }
@@ -159,6 +175,268 @@ TEST_F(DatabaseTest, MultipleTablesInteraction) {
     EXPECT_EQ(all_users.size(), 2);
 }
 
+// Test hash and index nested-loop joins agree with a nested loop over both tables
+TEST_F(DatabaseTest, TableJoins) {
+    std::vector<localdb::Column> order_columns = {
+        {"order_id", localdb::Column::INT, true, true, true},
+        {"customer_id", localdb::Column::INT, false, false, false},
+        {"quantity", localdb::Column::INT, false, false, false}
+    };
+    
+    for (size_t shards : {1, 4}) {
+        localdb::Database db;
+        ASSERT_TRUE(db.createTable("customers", user_columns, localdb::Table::ROW_ORIENTED, shards));
+        ASSERT_TRUE(db.createTable("orders", order_columns, localdb::Table::COLUMNAR));
+        localdb::Table* customers = db.getTable("customers");
+        localdb::Table* orders = db.getTable("orders");
+        for (int i = 0; i < 200; i++) {
+            ASSERT_TRUE(customers->insert(createUserRow(i, "Customer " + std::to_string(i), i % 30)));
+        }
+        for (int i = 0; i < 1000; i++) {
+            localdb::Row order = {localdb::Value(i), localdb::Value(i % 250), localdb::Value(i % 40)};
+            if (i % 100 == 0) {
+                order[1] = localdb::Value();
+            }
+            ASSERT_TRUE(orders->insert(order));
+        }
+        
+        using Pairs = std::multiset<std::pair<int, int>>;
+        auto reference = [&](size_t left_column, size_t right_column) {
+            Pairs pairs;
+            auto all = [](const localdb::Row&) { return true; };
+            for (const auto& c : customers->select(all)) {
+                for (const auto& o : orders->select(all)) {
+                    if (c[left_column].type != localdb::Value::NULL_TYPE && c[left_column] == o[right_column]) {
+                        pairs.insert({c[0].asInt(), o[0].asInt()});
+                    }
+                }
+            }
+            return pairs;
+        };
+        auto joined = [&](const std::string& left_column, const std::string& right_column) {
+            Pairs pairs;
+            size_t visited = customers->join(left_column, *orders, right_column,
+                [&pairs](const localdb::Row& c, const localdb::Row& o) {
+                    pairs.insert({c[0].asInt(), o[0].asInt()});
+                    return true;
+                });
+            EXPECT_EQ(visited, pairs.size());
+            return pairs;
+        };
+        
+        // The customer key is probed from the order side, other columns hash
+        EXPECT_EQ(customers->explainJoin("id", *orders, "customer_id"), "index nested loop probing customers.id");
+        EXPECT_EQ(joined("id", "customer_id"), reference(0, 1));
+        EXPECT_EQ(reference(0, 1).size(), 800 - 8);
+        EXPECT_EQ(customers->explainJoin("age", *orders, "quantity"), "hash join building customers");
+        EXPECT_EQ(joined("age", "quantity"), reference(2, 2));
+        ASSERT_TRUE(db.createIndex("orders", "quantity", localdb::Table::HASH));
+        EXPECT_EQ(customers->explainJoin("age", *orders, "quantity"), "index nested loop probing orders.quantity");
+        EXPECT_EQ(joined("age", "quantity"), reference(2, 2));
+        
+        // Filters restrict each side, the visitor can stop the join
+        localdb::Expression young;
+        localdb::Expression large;
+        ASSERT_TRUE(localdb::Expression::parse("age < 5", user_columns, young));
+        ASSERT_TRUE(localdb::Expression::parse("quantity >= 2", order_columns, large));
+        size_t filtered = customers->join("age", *orders, "quantity", [](const localdb::Row& c, const localdb::Row& o) {
+            EXPECT_LT(c[2].asInt(), 5);
+            EXPECT_EQ(c[2], o[2]);
+            return true;
+        }, young, large);
+        EXPECT_EQ(filtered, 3 * (200 / 30 + 1) * 25);
+        size_t visited = 0;
+        customers->join("id", *orders, "customer_id", [&visited](const localdb::Row&, const localdb::Row&) {
+            return ++visited < 3;
+        });
+        EXPECT_EQ(visited, 3);
+        EXPECT_EQ(customers->join("missing", *orders, "customer_id", [](const localdb::Row&, const localdb::Row&) {
+            return true;
+        }), 0);
+        
+        // A self-join locks the table once
+        EXPECT_EQ(customers->join("id", *customers, "id", [](const localdb::Row& a, const localdb::Row& b) {
+            return a[0] == b[0];
+        }), 200);
+        
+        // Transactions join their own snapshot, including buffered inserts
+        auto tx = db.beginTransaction();
+        EXPECT_TRUE(tx->insert("orders", {localdb::Value(5000), localdb::Value(7), localdb::Value(1)}));
+        size_t orders_of_7 = 0;
+        EXPECT_TRUE(tx->join("customers", "id", "orders", "customer_id", [&](const localdb::Row& c, const localdb::Row&) {
+            orders_of_7 += c[0].asInt() == 7;
+            return true;
+        }));
+        EXPECT_EQ(orders_of_7, 5);
+        EXPECT_FALSE(tx->join("customers", "id", "missing", "customer_id",
+                              [](const localdb::Row&, const localdb::Row&) { return true; }));
+        tx->rollback();
+    }
+}
+
+// Test table lookups racing catalog changes, and tables held past a drop
+TEST_F(DatabaseTest, ConcurrentCatalog) {
+    localdb::Database db;
+    ASSERT_TRUE(db.createTable("users", user_columns));
+    
+    std::atomic<bool> done{false};
+    std::atomic<int> inserted{0};
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 4; t++) {
+        readers.emplace_back([&, t]() {
+            for (int i = 0; !done.load(); i++) {
+                auto tx = db.beginTransaction();
+                if (tx->insert("users", createUserRow(t * 1000000 + i, "User", i)) && tx->commit()) {
+                    inserted++;
+                }
+                EXPECT_TRUE(db.acquireTable("users") != nullptr);
+            }
+        });
+    }
+    for (int i = 0; i < 200; i++) {
+        std::string name = "scratch_" + std::to_string(i % 5);
+        db.createTable(name, product_columns);
+        db.dropTable(name);
+    }
+    while (inserted.load() < 100) {
+        std::this_thread::yield();
+    }
+    done = true;
+    for (auto& reader : readers) {
+        reader.join();
+    }
+    EXPECT_EQ(db.getTable("users")->select([](const localdb::Row&) { return true; }).size(), inserted.load());
+    
+    // A dropped table outlives the drop while a transaction or caller holds it
+    std::shared_ptr<localdb::Table> held = db.acquireTable("users");
+    auto tx = db.beginTransaction();
+    EXPECT_TRUE(tx->insert("users", createUserRow(-1, "Dropped", 1)));
+    EXPECT_TRUE(tx->update("users", createUserRow(-2, "Changed", 2),
+                           [](const localdb::Row& row) { return row[0].asInt() == 0; }));
+    EXPECT_TRUE(db.dropTable("users"));
+    EXPECT_EQ(db.getTable("users"), nullptr);
+    EXPECT_EQ(tx->lookup("users", "id", localdb::Value(-2)).size(), 1);
+    EXPECT_TRUE(tx->commit());
+    EXPECT_EQ(held->lookup("id", localdb::Value(-1)).size(), 1);
+    EXPECT_EQ(held->lookup("id", localdb::Value(-2)).size(), 1);
+    
+    // A table created under the old name is a new one
+    ASSERT_TRUE(db.createTable("users", user_columns));
+    EXPECT_NE(db.acquireTable("users"), held);
+    EXPECT_TRUE(db.getTable("users")->select([](const localdb::Row&) { return true; }).empty());
+}
+
+// Test engine counters for reads, transactions, lock timeouts and persistence
+TEST_F(DatabaseTest, EngineStats) {
+    const std::string test_file = "stats_database.bin";
+    localdb::Database db;
+    ASSERT_TRUE(db.createTable("users", user_columns));
+    localdb::Table* users = db.getTable("users");
+    for (int i = 0; i < 100; i++) {
+        ASSERT_TRUE(users->insert(createUserRow(i, "User " + std::to_string(i), i % 10)));
+    }
+    
+    localdb::DatabaseStats stats = db.stats();
+    EXPECT_EQ(stats.scans, 0);
+    EXPECT_EQ(stats.commits, 0);
+    
+    // A full scan examines every row, an index lookup only its candidates
+    EXPECT_EQ(users->select([](const localdb::Row& row) { return row[2].asInt() == 3; }).size(), 10);
+    EXPECT_EQ(users->lookup("id", localdb::Value(42)).size(), 1);
+    localdb::Expression filter;
+    ASSERT_TRUE(localdb::Expression::parse("id = 7", user_columns, filter));
+    EXPECT_EQ(users->count(filter), 1);
+    stats = db.stats();
+    EXPECT_EQ(stats.scans, 3);
+    EXPECT_EQ(stats.rows_scanned, 100 + 1 + 1);
+    EXPECT_EQ(stats.rows_returned, 10 + 1 + 1);
+    
+    auto tx = db.beginTransaction();
+    EXPECT_TRUE(tx->insert("users", createUserRow(100, "New", 1)));
+    EXPECT_TRUE(tx->commit());
+    tx = db.beginTransaction();
+    EXPECT_TRUE(tx->insert("users", createUserRow(101, "Gone", 1)));
+    tx->rollback();
+    
+    // A transaction gives up on a table another writer holds
+    {
+        std::unique_lock<localdb::TableLock> lock(users->mutex_);
+        tx = db.beginTransaction();
+        EXPECT_FALSE(tx->insert("users", createUserRow(102, "Blocked", 1)));
+        tx->rollback();
+    }
+    stats = db.stats();
+    EXPECT_EQ(stats.commits, 1);
+    EXPECT_EQ(stats.commit_time.count, 1);
+    EXPECT_EQ(stats.rollbacks, 2);
+    EXPECT_EQ(stats.lock_timeouts, 1);
+    EXPECT_EQ(stats.locks.timeouts, 1);
+    EXPECT_GT(stats.locks.acquisitions, 100);
+    
+    ASSERT_TRUE(db.saveToFile(test_file));
+    ASSERT_TRUE(db.loadFromFile(test_file));
+    stats = db.stats();
+    EXPECT_EQ(stats.save_time.count, 1);
+    EXPECT_EQ(stats.load_time.count, 1);
+    EXPECT_GT(stats.saved_bytes, 0);
+    EXPECT_EQ(stats.loaded_bytes, stats.saved_bytes);
+    uint64_t bucketed = 0;
+    for (uint64_t count : stats.save_time.buckets) {
+        bucketed += count;
+    }
+    EXPECT_EQ(bucketed, 1);
+    EXPECT_LE(stats.save_time.max, stats.save_time.total);
+    
+    std::remove(test_file.c_str());
+}
+
+// Test ordered selects walk an ordered index and see a transaction's own writes
+TEST_F(DatabaseTest, OrderedSelect) {
+    localdb::Database db;
+    ASSERT_TRUE(db.createTable("users", user_columns));
+    localdb::Table* users = db.getTable("users");
+    for (int i = 0; i < 1000; i++) {
+        ASSERT_TRUE(users->insert(createUserRow(i, "User " + std::to_string(i), i % 100)));
+    }
+    ASSERT_TRUE(db.createIndex("users", "age"));
+    auto ids = [](const std::vector<localdb::Row>& rows) {
+        std::vector<int> result;
+        for (const auto& row : rows) {
+            result.push_back(row[0].asInt());
+        }
+        return result;
+    };
+    
+    // The index walk stops after the run of ages that fills the limit, a
+    // sort key without an index scans every row
+    localdb::Expression all;
+    uint64_t scanned = db.stats().rows_scanned;
+    EXPECT_EQ(ids(users->select(all, {{"age", true}}, 5)), std::vector<int>({99, 199, 299, 399, 499}));
+    EXPECT_EQ(db.stats().rows_scanned - scanned, 10);
+    scanned = db.stats().rows_scanned;
+    EXPECT_EQ(ids(users->select(all, {{"age"}}, 3, 19)), std::vector<int>({901, 2, 102}));
+    EXPECT_EQ(db.stats().rows_scanned - scanned, 30);
+    scanned = db.stats().rows_scanned;
+    EXPECT_EQ(ids(users->select(all, {{"name", true}}, 2)), std::vector<int>({999, 998}));
+    EXPECT_EQ(db.stats().rows_scanned - scanned, 1000);
+    
+    // A transaction sees its own inserts and updates, others the committed rows
+    auto tx = db.beginTransaction();
+    ASSERT_TRUE(tx->insert("users", createUserRow(5000, "New", 150)));
+    ASSERT_TRUE(tx->updateColumns("users", {{"age", localdb::Value(200)}},
+                                  [](const localdb::Row& row) { return row[0].asInt() == 0; }));
+    auto other = db.beginTransaction();
+    EXPECT_EQ(ids(tx->select("users", all, {{"age", true}}, 3)), std::vector<int>({0, 5000, 99}));
+    EXPECT_EQ(ids(other->select("users", all, {{"age", true}}, 3)), std::vector<int>({99, 199, 299}));
+    EXPECT_EQ(ids(tx->select("users", all, {{"age"}}, 1)), std::vector<int>({100}));
+    EXPECT_EQ(ids(other->select("users", all, {{"age"}}, 1)), std::vector<int>({0}));
+    EXPECT_TRUE(tx->select("users", all, {{"missing"}}, 1).empty());
+    EXPECT_TRUE(tx->select("missing", all, {{"age"}}, 1).empty());
+    EXPECT_TRUE(tx->commit());
+    other->rollback();
+    EXPECT_EQ(ids(users->select(all, {{"age", true}}, 2)), std::vector<int>({0, 5000}));
+}
+
 // Test Database Transactions
 TEST_F(DatabaseTest, Transactions) {
     localdb::Database db;
@@ -322,6 +600,67 @@ TEST_F(DatabaseTest, TransactionUpdateAndDelete) {
     EXPECT_EQ(charlie_rows.size(), 0);
 }
 
+// Test large scans run in morsels on the database worker pool and keep table order
+TEST_F(DatabaseTest, ParallelScans) {
+    localdb::Database db;
+    
+    for (auto layout : {localdb::Table::ROW_ORIENTED, localdb::Table::COLUMNAR}) {
+        const std::string name = layout == localdb::Table::COLUMNAR ? "columnar" : "rows";
+        ASSERT_TRUE(db.createTable(name, user_columns, layout));
+        localdb::Table* table = db.getTable(name);
+        std::vector<localdb::Row> rows;
+        for (int i = 0; i < 50000; i++) {
+            rows.push_back(createUserRow(i, "User " + std::to_string(i), i % 100));
+        }
+        ASSERT_TRUE(table->insertBatch(std::move(rows)));
+        
+        std::mutex mutex;
+        std::set<std::thread::id> threads;
+        auto even = [&](const localdb::Row& row) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                threads.insert(std::this_thread::get_id());
+            }
+            return row[0].asInt() % 2 == 0;
+        };
+        auto selected = table->select(even);
+        ASSERT_EQ(selected.size(), 25000);
+        for (size_t i = 0; i < selected.size(); i++) {
+            ASSERT_EQ(selected[i][0].asInt(), static_cast<int>(i * 2));
+        }
+        if (std::thread::hardware_concurrency() > 1) {
+            EXPECT_GT(threads.size(), 1);
+        }
+        
+        // Writes match in parallel too, inside and outside transactions
+        EXPECT_TRUE(table->remove([](const localdb::Row& row) { return row[2].asInt() >= 50; }));
+        auto tx = db.beginTransaction();
+        EXPECT_TRUE(tx->updateColumns(name, {{"age", localdb::Value(7)}}, [](const localdb::Row& row) {
+            return row[0].asInt() % 1000 == 0;
+        }));
+        auto sevens = tx->select(name, [](const localdb::Row& row) { return row[2].asInt() == 7; });
+        EXPECT_EQ(sevens.size(), 500 + 50);
+        EXPECT_EQ(table->select([](const localdb::Row& row) { return row[2].asInt() == 7; }).size(), 500);
+        
+        // A throwing predicate fails the read instead of escaping a worker
+        EXPECT_TRUE(tx->select(name, [](const localdb::Row& row) -> bool {
+            if (row[0].asInt() == 40000) {
+                throw std::runtime_error("predicate failed");
+            }
+            return true;
+        }).empty());
+        
+        // Aggregates merge per-morsel partials and see the transaction's writes
+        std::vector<localdb::Row> groups;
+        ASSERT_TRUE(tx->aggregate(name, {{localdb::Aggregate::COUNT, ""}}, {"age"}, localdb::Expression(), groups));
+        ASSERT_EQ(groups.size(), 50);
+        EXPECT_EQ(groups[0][1].asInt(), 500 - 50);
+        EXPECT_EQ(groups[7][1].asInt(), 500 + 50);
+        EXPECT_TRUE(tx->commit());
+        EXPECT_EQ(table->select([](const localdb::Row&) { return true; }).size(), 25000);
+    }
+}
+
 // Test for database disk operations
 TEST_F(DatabaseTest, DiskOperations) {
     localdb::Database db;
@@ -426,6 +765,382 @@ TEST_F(DatabaseTest, EmptyDatabaseDiskOperations) {
     std::remove(test_file.c_str());
 }
 
+// Test snapshots keep layout and indexes, and tables decode on first access
+TEST_F(DatabaseTest, LazySnapshotLoading) {
+    const std::string test_file = "lazy_snapshot.bin";
+    {
+        localdb::Database db;
+        EXPECT_TRUE(db.createTable("users", user_columns));
+        EXPECT_TRUE(db.createTable("products", product_columns, localdb::Table::COLUMNAR));
+        EXPECT_TRUE(db.createIndex("users", "age", localdb::Table::HASH));
+        
+        auto tx = db.beginTransaction();
+        for (int i = 1; i <= 50; i++) {
+            tx->insert("users", createUserRow(i, "User " + std::to_string(i) + std::string(20, 'x'), 20 + i % 5));
+            localdb::Row product = createProductRow(i, "Product", i * 1.5);
+            if (i % 10 == 0) {
+                product[2] = localdb::Value();
+            }
+            tx->insert("products", product);
+        }
+        tx->commit();
+        EXPECT_TRUE(db.saveToFile(test_file));
+    }
+    
+    localdb::Database db;
+    ASSERT_TRUE(db.loadFromFile(test_file));
+    EXPECT_EQ(db.getTableNames().size(), 2);
+    
+    auto users = db.getTable("users");
+    ASSERT_NE(users, nullptr);
+    EXPECT_TRUE(users->hasIndex("age"));
+    EXPECT_EQ(users->lookup("age", localdb::Value(22)).size(), 10);
+    EXPECT_EQ(users->lookup("id", localdb::Value(7))[0][1].asText(), "User 7" + std::string(20, 'x'));
+    
+    // Saving while "products" is still undecoded copies its block as is
+    EXPECT_TRUE(db.saveToFile(test_file));
+    localdb::Database reloaded;
+    ASSERT_TRUE(reloaded.loadFromFile(test_file));
+    auto products = reloaded.getTable("products");
+    ASSERT_NE(products, nullptr);
+    EXPECT_EQ(products->getLayout(), localdb::Table::COLUMNAR);
+    EXPECT_EQ(products->count({"price", localdb::ColumnPredicate::GT, localdb::Value(0.0)}), 45);
+    EXPECT_EQ(products->lookup("product_id", localdb::Value(10))[0][2].type, localdb::Value::NULL_TYPE);
+    EXPECT_FALSE(reloaded.createTable("users", user_columns));
+    EXPECT_TRUE(reloaded.dropTable("users"));
+    EXPECT_EQ(reloaded.getTableNames().size(), 1);
+    
+    std::remove(test_file.c_str());
+}
+
+// Test compressed snapshots round-trip every layout and mix with plain blocks
+TEST_F(DatabaseTest, CompressedSnapshot) {
+    const std::string plain_file = "plain_snapshot.bin";
+    const std::string compressed_file = "compressed_snapshot.bin";
+    localdb::SnapshotOptions lz4;
+    lz4.compression = localdb::SnapshotOptions::COMPRESSION_LZ4;
+    {
+        localdb::Database db;
+        EXPECT_TRUE(db.createTable("users", user_columns, localdb::Table::ROW_ORIENTED, 3));
+        EXPECT_TRUE(db.createTable("products", product_columns, localdb::Table::COLUMNAR));
+        EXPECT_TRUE(db.createTable("empty", user_columns));
+        EXPECT_TRUE(db.createIndex("users", "age"));
+        
+        // Enough rows for several pieces, with few distinct names
+        std::vector<localdb::Row> users;
+        for (int i = 0; i < 40000; i++) {
+            localdb::Row row = createUserRow(i - 20000, "City " + std::to_string(i % 7), i % 90);
+            if (i % 11 == 0) {
+                row[2] = localdb::Value();
+            }
+            users.push_back(row);
+        }
+        // Row-oriented tables keep values that do not match the column type
+        users[5][2] = localdb::Value(std::string("unknown"));
+        users[6][2] = localdb::Value(std::vector<uint8_t>{0, 1, 2});
+        EXPECT_TRUE(db.getTable("users")->insertBatch(std::move(users)));
+        
+        auto tx = db.beginTransaction();
+        for (int i = 1; i <= 500; i++) {
+            localdb::Row product = createProductRow(i, "Product " + std::to_string(i), i * 0.25);
+            if (i % 10 == 0) {
+                product[2] = localdb::Value();
+            }
+            tx->insert("products", product);
+        }
+        EXPECT_TRUE(tx->commit());
+        
+        EXPECT_TRUE(db.saveToFile(plain_file));
+        EXPECT_TRUE(db.saveToFile(compressed_file, lz4));
+    }
+    
+    std::ifstream plain_in(plain_file, std::ios::binary | std::ios::ate);
+    std::ifstream compressed_in(compressed_file, std::ios::binary | std::ios::ate);
+    EXPECT_LT(compressed_in.tellg() * 3, plain_in.tellg());
+    
+    auto allRows = [](localdb::Table* table) {
+        auto rows = table->select([](const localdb::Row&) { return true; });
+        std::sort(rows.begin(), rows.end());
+        return rows;
+    };
+    localdb::Database plain;
+    localdb::Database compressed;
+    ASSERT_TRUE(plain.loadFromFile(plain_file));
+    ASSERT_TRUE(compressed.loadFromFile(compressed_file));
+    for (const char* name : {"users", "products", "empty"}) {
+        ASSERT_NE(compressed.getTable(name), nullptr);
+        EXPECT_EQ(allRows(compressed.getTable(name)), allRows(plain.getTable(name)));
+    }
+    auto users = compressed.getTable("users");
+    EXPECT_EQ(users->getShardCount(), 3);
+    EXPECT_TRUE(users->hasIndex("age"));
+    EXPECT_EQ(users->lookup("id", localdb::Value(-19995))[0][2].asText(), "unknown");
+    EXPECT_EQ(compressed.getTable("products")->getLayout(), localdb::Table::COLUMNAR);
+    EXPECT_EQ(compressed.getTable("products")->lookup("product_id", localdb::Value(20))[0][2].type,
+              localdb::Value::NULL_TYPE);
+    EXPECT_TRUE(compressed.getTable("empty")->select([](const localdb::Row&) { return true; }).empty());
+    
+    // Undecoded blocks keep their encoding when saved with other options
+    localdb::Database mixed;
+    ASSERT_TRUE(mixed.loadFromFile(plain_file));
+    ASSERT_NE(mixed.getTable("users"), nullptr);
+    EXPECT_TRUE(mixed.saveToFile(compressed_file, lz4));
+    ASSERT_TRUE(compressed.loadFromFile(compressed_file));
+    ASSERT_NE(compressed.getTable("products"), nullptr);
+    EXPECT_EQ(allRows(compressed.getTable("products")), allRows(plain.getTable("products")));
+    EXPECT_TRUE(compressed.saveToFile(plain_file));
+    ASSERT_TRUE(plain.loadFromFile(plain_file));
+    EXPECT_EQ(allRows(plain.getTable("users")), allRows(compressed.getTable("users")));
+    
+    std::remove(plain_file.c_str());
+    std::remove(compressed_file.c_str());
+}
+
+// Test incremental checkpoints only write the tables changed since the last one
+TEST_F(DatabaseTest, IncrementalCheckpoint) {
+    const std::string manifest = "checkpoint.manifest";
+    auto segmentSize = [&](int n) -> long {
+        std::ifstream file(manifest + "." + std::to_string(n), std::ios::binary | std::ios::ate);
+        return file.is_open() ? static_cast<long>(file.tellg()) : -1;
+    };
+    auto rowCount = [](localdb::Table* table) {
+        return table->select([](const localdb::Row&) { return true; }).size();
+    };
+    {
+        localdb::Database db;
+        EXPECT_TRUE(db.createTable("users", user_columns, localdb::Table::ROW_ORIENTED, 2));
+        EXPECT_TRUE(db.createTable("products", product_columns, localdb::Table::COLUMNAR));
+        EXPECT_TRUE(db.createTable("archive", user_columns));
+        auto tx = db.beginTransaction();
+        for (int i = 1; i <= 1000; i++) {
+            tx->insert("users", createUserRow(i, "User " + std::to_string(i), 20 + i % 50));
+            tx->insert("archive", createUserRow(i, "Archived " + std::to_string(i), i % 7));
+        }
+        tx->insert("products", createProductRow(1, "Widget", 9.5));
+        EXPECT_TRUE(tx->commit());
+        EXPECT_TRUE(db.checkpoint(manifest));
+        long full_size = segmentSize(1);
+        EXPECT_GT(full_size, 0);
+        
+        // Only the changed table goes into the next segment
+        tx = db.beginTransaction();
+        EXPECT_TRUE(tx->insert("products", createProductRow(2, "Gadget", 3.0)));
+        EXPECT_TRUE(tx->commit());
+        EXPECT_TRUE(db.checkpoint(manifest));
+        EXPECT_GT(segmentSize(2), 0);
+        EXPECT_LT(segmentSize(2) * 10, full_size);
+        
+        // Nothing changed, so nothing is written
+        EXPECT_TRUE(db.checkpoint(manifest));
+        EXPECT_EQ(segmentSize(3), -1);
+        
+        // Index changes and drops count too; a segment nobody uses goes away
+        EXPECT_TRUE(db.createIndex("users", "age"));
+        EXPECT_TRUE(db.dropTable("archive"));
+        EXPECT_TRUE(db.getTable("products")->remove([](const localdb::Row&) { return true; }) > 0);
+        EXPECT_TRUE(db.getTable("products")->insert(createProductRow(3, "Gizmo", 1.0)));
+        EXPECT_TRUE(db.checkpoint(manifest));
+        EXPECT_EQ(segmentSize(1), -1);
+        EXPECT_EQ(segmentSize(2), -1);
+        EXPECT_GT(segmentSize(3), 0);
+    }
+    
+    localdb::Database db;
+    ASSERT_TRUE(db.loadFromFile(manifest));
+    EXPECT_EQ(db.getTableNames().size(), 2);
+    ASSERT_NE(db.getTable("users"), nullptr);
+    EXPECT_EQ(rowCount(db.getTable("users")), 1000);
+    EXPECT_TRUE(db.getTable("users")->hasIndex("age"));
+    EXPECT_EQ(db.getTable("products")->lookup("product_id", localdb::Value(3))[0][1].asText(), "Gizmo");
+    EXPECT_EQ(rowCount(db.getTable("products")), 1);
+    
+    // Decoding a table does not make it dirty, changing it does
+    localdb::SnapshotOptions lz4;
+    lz4.compression = localdb::SnapshotOptions::COMPRESSION_LZ4;
+    EXPECT_TRUE(db.checkpoint(manifest, lz4));
+    EXPECT_EQ(segmentSize(1), -1);
+    EXPECT_TRUE(db.getTable("users")->insert(createUserRow(1001, "Late", 30)));
+    EXPECT_TRUE(db.checkpoint(manifest, lz4));
+    EXPECT_GT(segmentSize(1), 0);
+    
+    localdb::Database reloaded;
+    ASSERT_TRUE(reloaded.loadFromFile(manifest));
+    EXPECT_EQ(rowCount(reloaded.getTable("users")), 1001);
+    EXPECT_EQ(rowCount(reloaded.getTable("products")), 1);
+    
+    // A full snapshot still copies blocks straight out of the segments
+    EXPECT_TRUE(reloaded.saveToFile("checkpoint_full.bin"));
+    localdb::Database full;
+    ASSERT_TRUE(full.loadFromFile("checkpoint_full.bin"));
+    EXPECT_EQ(rowCount(full.getTable("users")), 1001);
+    
+    std::remove(manifest.c_str());
+    std::remove((manifest + ".1").c_str());
+    std::remove((manifest + ".3").c_str());
+    std::remove("checkpoint_full.bin");
+}
+
+// Test checkpoints racing commits never lose a commit to a skipped table
+TEST_F(DatabaseTest, ConcurrentCheckpoint) {
+    const std::string manifest = "concurrent.manifest";
+    {
+        localdb::Database db;
+        EXPECT_TRUE(db.createTable("users", user_columns));
+        EXPECT_TRUE(db.createTable("products", product_columns));
+        std::atomic<bool> stop{false};
+        std::vector<std::thread> writers;
+        for (int t = 0; t < 4; t++) {
+            writers.emplace_back([&, t] {
+                for (int i = 0; !stop.load() || i < 100; i++) {
+                    auto tx = db.beginTransaction();
+                    tx->insert(t % 2 == 0 ? "users" : "products", createUserRow(t * 100000 + i, "Row", i));
+                    tx->commit();
+                }
+            });
+        }
+        for (int i = 0; i < 20; i++) {
+            EXPECT_TRUE(db.checkpoint(manifest));
+        }
+        stop = true;
+        for (auto& writer : writers) {
+            writer.join();
+        }
+        EXPECT_TRUE(db.checkpoint(manifest));
+        
+        localdb::Database reloaded;
+        ASSERT_TRUE(reloaded.loadFromFile(manifest));
+        for (const char* name : {"users", "products"}) {
+            EXPECT_EQ(reloaded.getTable(name)->select([](const localdb::Row&) { return true; }).size(),
+                      db.getTable(name)->select([](const localdb::Row&) { return true; }).size());
+        }
+    }
+    
+    for (int n = 1; n <= 30; n++) {
+        std::remove((manifest + "." + std::to_string(n)).c_str());
+    }
+    std::remove(manifest.c_str());
+}
+
+// Test corrupt snapshots are rejected or isolated to the damaged table
+TEST_F(DatabaseTest, ConcurrentSnapshotSave) {
+    const std::string test_file = "concurrent_snapshot.bin";
+    constexpr int initial_rows = 40000;
+    
+    localdb::Database db;
+    EXPECT_TRUE(db.createTable("users", user_columns));
+    EXPECT_TRUE(db.createTable("products", product_columns, localdb::Table::COLUMNAR));
+    auto users = db.getTable("users");
+    auto products = db.getTable("products");
+    for (int i = 0; i < initial_rows; i++) {
+        ASSERT_TRUE(users->insert(createUserRow(i, "User " + std::to_string(i), i % 50)));
+        ASSERT_TRUE(products->insert(createProductRow(i, "Product " + std::to_string(i), i * 0.5)));
+    }
+    
+    // Writers keep going while snapshots are captured, encoded and written
+    std::atomic<bool> done{false};
+    std::thread writer([&]() {
+        for (int i = initial_rows; !done; i++) {
+            int target = i % initial_rows;
+            users->insert(createUserRow(i, "User " + std::to_string(i), i % 50));
+            products->update(createProductRow(target, "Updated", -1.0),
+                             [target](const localdb::Row& row) { return row[0].asInt() == target; });
+        }
+    });
+    for (int round = 0; round < 3; round++) {
+        EXPECT_TRUE(db.saveToFile(test_file));
+        
+        localdb::Database loaded;
+        ASSERT_TRUE(loaded.loadFromFile(test_file));
+        auto saved_users = loaded.getTable("users")->select([](const localdb::Row&) { return true; });
+        EXPECT_GE(saved_users.size(), static_cast<size_t>(initial_rows));
+        for (size_t i = 0; i < saved_users.size(); i += 997) {
+            EXPECT_EQ(saved_users[i][1].asText(), "User " + std::to_string(saved_users[i][0].asInt()));
+        }
+        EXPECT_EQ(loaded.getTable("products")->count({"product_id", localdb::ColumnPredicate::GE, localdb::Value(0)}),
+                  static_cast<size_t>(initial_rows));
+    }
+    done = true;
+    writer.join();
+    
+    // Once writers stop the snapshot matches the live tables exactly
+    EXPECT_TRUE(db.saveToFile(test_file));
+    localdb::Database loaded;
+    ASSERT_TRUE(loaded.loadFromFile(test_file));
+    localdb::ColumnPredicate all_users{"id", localdb::ColumnPredicate::GE, localdb::Value(0)};
+    EXPECT_EQ(loaded.getTable("users")->count(all_users), users->count(all_users));
+    auto saved = loaded.getTable("products")->select([](const localdb::Row&) { return true; });
+    auto live = products->select([](const localdb::Row&) { return true; });
+    ASSERT_EQ(saved.size(), live.size());
+    for (size_t i = 0; i < saved.size(); i++) {
+        EXPECT_EQ(saved[i][1].asText(), live[i][1].asText());
+        EXPECT_EQ(saved[i][2].asFloat(), live[i][2].asFloat());
+    }
+    
+    std::remove(test_file.c_str());
+}
+
+TEST_F(DatabaseTest, CorruptSnapshot) {
+    const std::string test_file = "corrupt_snapshot.bin";
+    {
+        localdb::Database db;
+        EXPECT_TRUE(db.createTable("users", user_columns));
+        auto tx = db.beginTransaction();
+        tx->insert("users", createUserRow(1, "Alice", 25));
+        tx->commit();
+        EXPECT_TRUE(db.saveToFile(test_file));
+    }
+    
+    std::string bytes;
+    {
+        std::ifstream file(test_file, std::ios::binary);
+        bytes.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+    auto writeVariant = [&](size_t offset) {
+        std::string corrupted = bytes;
+        corrupted[offset] ^= 0x5A;
+        std::ofstream file(test_file, std::ios::binary | std::ios::trunc);
+        file.write(corrupted.data(), static_cast<std::streamsize>(corrupted.size()));
+    };
+    
+    // A damaged table block is only detected when the table is first used
+    writeVariant(50);
+    localdb::Database db;
+    ASSERT_TRUE(db.loadFromFile(test_file));
+    EXPECT_EQ(db.getTableNames().size(), 1);
+    EXPECT_EQ(db.getTable("users"), nullptr);
+    
+    // Damaged headers and directories fail the load
+    writeVariant(12);
+    EXPECT_FALSE(db.loadFromFile(test_file));
+    writeVariant(bytes.size() - 2);
+    EXPECT_FALSE(db.loadFromFile(test_file));
+    EXPECT_TRUE(db.getTableNames().empty());
+    
+    std::remove(test_file.c_str());
+}
+
+// Test files in the pre-snapshot format still load
+TEST_F(DatabaseTest, LegacyFileLoading) {
+    const std::string test_file = "legacy_format.bin";
+    {
+        localdb::Table table("users", user_columns);
+        table.insert(createUserRow(1, "Alice", 25));
+        table.insert(createUserRow(2, "Bob", 30));
+        
+        std::ofstream file(test_file, std::ios::binary);
+        size_t table_count = 1;
+        file.write(reinterpret_cast<const char*>(&table_count), sizeof(table_count));
+        table.serialize(file);
+    }
+    
+    localdb::Database db;
+    ASSERT_TRUE(db.loadFromFile(test_file));
+    ASSERT_NE(db.getTable("users"), nullptr);
+    EXPECT_EQ(db.getTable("users")->lookup("id", localdb::Value(2))[0][1].asText(), "Bob");
+    
+    std::remove(test_file.c_str());
+}
+
 // Test for disk operations with invalid file
 TEST_F(DatabaseTest, InvalidFileDiskOperations) {
     localdb::Database db;
@@ -520,10 +1235,368 @@ TEST_F(DatabaseTest, ModifyAfterLoading) {
     auto all_users_reloaded = tx4->select("users", [](const localdb::Row&) { return true; });
     EXPECT_EQ(all_users_reloaded.size(), 2);
     
+    // Key indexes are rebuilt on load
+    EXPECT_FALSE(tx4->insert("users", createUserRow(1, "Duplicate", 40)));
+    
     tx4->commit();
     
     // Clean up
     std::remove(test_file.c_str());
 }
 
-}  // namespace 
\ No newline at end of file
+// Test committed transactions survive through the write-ahead log alone
+TEST_F(DatabaseTest, WalReplay) {
+    const std::string snapshot_file = "wal_test.bin";
+    const std::string wal_file = "wal_test.wal";
+    std::remove(snapshot_file.c_str());
+    std::remove(wal_file.c_str());
+    
+    {
+        localdb::Database db;
+        ASSERT_TRUE(db.enableWal(wal_file));
+        EXPECT_TRUE(db.createTable("users", user_columns));
+        EXPECT_TRUE(db.createIndex("users", "age"));
+        
+        auto tx = db.beginTransaction();
+        tx->insert("users", createUserRow(1, "Alice", 25));
+        tx->insert("users", createUserRow(2, "Bob", 30));
+        tx->insert("users", createUserRow(3, "Charlie", 35));
+        EXPECT_TRUE(tx->commit());
+        
+        auto tx2 = db.beginTransaction();
+        tx2->update("users", createUserRow(2, "Bob", 31), [](const localdb::Row& row) {
+            return row[0].asInt() == 2;
+        });
+        tx2->remove("users", [](const localdb::Row& row) { return row[0].asInt() == 3; });
+        EXPECT_TRUE(tx2->commit());
+        
+        // Rolled back and unfinished transactions must not be replayed
+        auto rolled_back = db.beginTransaction();
+        rolled_back->insert("users", createUserRow(4, "Dave", 40));
+        rolled_back->rollback();
+        
+        auto unfinished = db.beginTransaction();
+        unfinished->insert("users", createUserRow(5, "Eve", 45));
+        
+        // No snapshot is ever written; simulate a crash by dropping the database
+        db.disableWal();
+    }
+    
+    localdb::Database recovered;
+    ASSERT_TRUE(recovered.enableWal(wal_file));
+    ASSERT_TRUE(recovered.loadFromFile(snapshot_file));
+    
+    auto table = recovered.getTable("users");
+    ASSERT_NE(table, nullptr);
+    EXPECT_TRUE(table->hasIndex("age"));
+    auto rows = table->select([](const localdb::Row&) { return true; });
+    ASSERT_EQ(rows.size(), 2);
+    EXPECT_EQ(table->lookup("id", localdb::Value(2))[0][2].asInt(), 31);
+    EXPECT_TRUE(table->lookup("id", localdb::Value(3)).empty());
+    EXPECT_TRUE(table->lookup("id", localdb::Value(4)).empty());
+    EXPECT_TRUE(table->lookup("id", localdb::Value(5)).empty());
+    
+    // New transactions keep logging after the replayed ones
+    auto tx = recovered.beginTransaction();
+    tx->insert("users", createUserRow(6, "Frank", 50));
+    EXPECT_TRUE(tx->commit());
+    recovered.disableWal();
+    
+    localdb::Database reopened;
+    ASSERT_TRUE(reopened.enableWal(wal_file));
+    ASSERT_TRUE(reopened.loadFromFile(snapshot_file));
+    EXPECT_EQ(reopened.getTable("users")->select([](const localdb::Row&) { return true; }).size(), 3);
+    reopened.disableWal();
+    
+    std::remove(wal_file.c_str());
+}
+
+// Test saving checkpoints the log and replay continues from the snapshot
+TEST_F(DatabaseTest, WalCheckpoint) {
+    const std::string snapshot_file = "wal_checkpoint.bin";
+    const std::string wal_file = "wal_checkpoint.wal";
+    std::remove(snapshot_file.c_str());
+    std::remove(wal_file.c_str());
+    
+    {
+        localdb::Database db;
+        ASSERT_TRUE(db.enableWal(wal_file));
+        EXPECT_TRUE(db.createTable("users", user_columns));
+        for (int i = 1; i <= 20; i++) {
+            auto tx = db.beginTransaction();
+            tx->insert("users", createUserRow(i, "User " + std::to_string(i), 20 + i));
+            EXPECT_TRUE(tx->commit());
+        }
+        
+        std::ifstream before(wal_file, std::ios::binary | std::ios::ate);
+        auto size_before = before.tellg();
+        EXPECT_TRUE(db.saveToFile(snapshot_file));
+        std::ifstream after(wal_file, std::ios::binary | std::ios::ate);
+        EXPECT_LT(after.tellg(), size_before);
+        
+        auto tx = db.beginTransaction();
+        tx->remove("users", [](const localdb::Row& row) { return row[0].asInt() <= 5; });
+        EXPECT_TRUE(tx->commit());
+        db.disableWal();
+    }
+    
+    // Leave a torn record at the end of the log, as a crash mid-write would
+    {
+        std::ofstream wal(wal_file, std::ios::binary | std::ios::app);
+        wal.write("\x40\x00\x00\x00garbage", 11);
+    }
+    
+    localdb::Database recovered;
+    ASSERT_TRUE(recovered.enableWal(wal_file));
+    ASSERT_TRUE(recovered.loadFromFile(snapshot_file));
+    EXPECT_EQ(recovered.getTable("users")->select([](const localdb::Row&) { return true; }).size(), 15);
+    recovered.disableWal();
+    
+    std::remove(snapshot_file.c_str());
+    std::remove(wal_file.c_str());
+}
+
+// Test a checkpoint keeps the records of transactions the snapshot missed
+TEST_F(DatabaseTest, WalCheckpointOpenTransaction) {
+    const std::string snapshot_file = "wal_open_txn.bin";
+    const std::string wal_file = "wal_open_txn.wal";
+    std::remove(snapshot_file.c_str());
+    std::remove(wal_file.c_str());
+    
+    {
+        localdb::Database db;
+        ASSERT_TRUE(db.enableWal(wal_file));
+        EXPECT_TRUE(db.createTable("users", user_columns));
+        {
+            auto tx = db.beginTransaction();
+            tx->insert("users", createUserRow(1, "Alice", 25));
+            EXPECT_TRUE(tx->commit());
+        }
+        
+        // Logged but not committed while the snapshot is taken
+        auto open = db.beginTransaction();
+        EXPECT_TRUE(open->insert("users", createUserRow(2, "Bob", 30)));
+        EXPECT_TRUE(open->update("users", createUserRow(1, "Alice", 26), [](const localdb::Row& row) {
+            return row[0].asInt() == 1;
+        }));
+        EXPECT_TRUE(db.saveToFile(snapshot_file));
+        EXPECT_TRUE(open->commit());
+        db.disableWal();
+    }
+    
+    localdb::Database recovered;
+    ASSERT_TRUE(recovered.enableWal(wal_file));
+    ASSERT_TRUE(recovered.loadFromFile(snapshot_file));
+    auto table = recovered.getTable("users");
+    ASSERT_NE(table, nullptr);
+    EXPECT_EQ(table->select([](const localdb::Row&) { return true; }).size(), 2);
+    EXPECT_EQ(table->lookup("id", localdb::Value(1))[0][2].asInt(), 26);
+    recovered.disableWal();
+    
+    std::remove(snapshot_file.c_str());
+    std::remove(wal_file.c_str());
+}
+
+// Test column-wise and moved updates are replayed from the log
+TEST_F(DatabaseTest, WalUpdateColumns) {
+    const std::string wal_file = "wal_update_columns.wal";
+    std::remove(wal_file.c_str());
+    
+    {
+        localdb::Database db;
+        ASSERT_TRUE(db.enableWal(wal_file));
+        EXPECT_TRUE(db.createTable("users", user_columns));
+        auto tx = db.beginTransaction();
+        for (int i = 1; i <= 5; i++) {
+            EXPECT_TRUE(tx->insert("users", createUserRow(i, "User " + std::to_string(i), 20 + i)));
+        }
+        EXPECT_TRUE(tx->commit());
+        
+        tx = db.beginTransaction();
+        EXPECT_TRUE(tx->updateColumns("users", {{"age", localdb::Value(99)}}, [](const localdb::Row& row) {
+            return row[0].asInt() <= 3;
+        }));
+        EXPECT_TRUE(tx->update("users", createUserRow(5, "Eve", 55), [](const localdb::Row& row) {
+            return row[0].asInt() == 5;
+        }));
+        EXPECT_TRUE(tx->commit());
+        db.disableWal();
+    }
+    
+    localdb::Database recovered;
+    ASSERT_TRUE(recovered.enableWal(wal_file));
+    ASSERT_TRUE(recovered.loadFromFile("wal_update_columns.missing"));
+    auto table = recovered.getTable("users");
+    ASSERT_NE(table, nullptr);
+    EXPECT_EQ(table->select([](const localdb::Row& row) { return row[2].asInt() == 99; }).size(), 3);
+    EXPECT_EQ(table->lookup("id", localdb::Value(2))[0][1].asText(), "User 2");
+    EXPECT_EQ(table->lookup("id", localdb::Value(5))[0][1].asText(), "Eve");
+    EXPECT_EQ(table->lookup("id", localdb::Value(4))[0][2].asInt(), 24);
+    recovered.disableWal();
+    
+    std::remove(wal_file.c_str());
+}
+
+// Test sharded tables survive snapshots and log replay
+TEST_F(DatabaseTest, ShardedTablePersistence) {
+    const std::string snapshot_file = "sharded.bin";
+    const std::string wal_file = "sharded.wal";
+    std::remove(snapshot_file.c_str());
+    std::remove(wal_file.c_str());
+    
+    {
+        localdb::Database db;
+        ASSERT_TRUE(db.enableWal(wal_file));
+        EXPECT_TRUE(db.createTable("users", user_columns, localdb::Table::ROW_ORIENTED, 3));
+        EXPECT_TRUE(db.createIndex("users", "age"));
+        auto tx = db.beginTransaction();
+        for (int i = 1; i <= 30; i++) {
+            EXPECT_TRUE(tx->insert("users", createUserRow(i, "User " + std::to_string(i), 20 + i)));
+        }
+        EXPECT_FALSE(tx->insert("users", createUserRow(3, "Duplicate", 1)));
+        EXPECT_TRUE(tx->commit());
+        EXPECT_TRUE(db.saveToFile(snapshot_file));
+        
+        // Logged after the snapshot: one row moves shard, a few go away
+        tx = db.beginTransaction();
+        EXPECT_TRUE(tx->update("users", createUserRow(100, "Moved", 50), [](const localdb::Row& row) {
+            return row[0].asInt() == 1;
+        }));
+        EXPECT_TRUE(tx->remove("users", [](const localdb::Row& row) {
+            return row[0].asInt() > 25 && row[0].asInt() <= 30;
+        }));
+        EXPECT_EQ(tx->lookup("users", "id", localdb::Value(100)).size(), 1);
+        EXPECT_TRUE(tx->commit());
+        db.disableWal();
+    }
+    
+    localdb::Database recovered;
+    ASSERT_TRUE(recovered.enableWal(wal_file));
+    ASSERT_TRUE(recovered.loadFromFile(snapshot_file));
+    auto table = recovered.getTable("users");
+    ASSERT_NE(table, nullptr);
+    EXPECT_EQ(table->getShardCount(), 3);
+    EXPECT_TRUE(table->hasIndex("age"));
+    EXPECT_EQ(table->select([](const localdb::Row&) { return true; }).size(), 25);
+    EXPECT_TRUE(table->lookup("id", localdb::Value(1)).empty());
+    EXPECT_EQ(table->lookup("id", localdb::Value(100)).size(), 1);
+    EXPECT_EQ(table->range("age", localdb::Value(21), localdb::Value(25)).size(), 4);
+    recovered.disableWal();
+    
+    std::remove(snapshot_file.c_str());
+    std::remove(wal_file.c_str());
+}
+
+// Test concurrent committers with group commit are all replayed
+TEST_F(DatabaseTest, WalGroupCommit) {
+    const std::string wal_file = "wal_group.wal";
+    std::remove(wal_file.c_str());
+    
+    localdb::WalOptions options;
+    options.group_commit_window = std::chrono::microseconds(200);
+    {
+        localdb::Database db;
+        ASSERT_TRUE(db.enableWal(wal_file, options));
+        EXPECT_TRUE(db.createTable("users", user_columns));
+        
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; t++) {
+            threads.emplace_back([&db, t, this]() {
+                for (int i = 0; i < 25; i++) {
+                    int id = t * 100 + i;
+                    auto tx = db.beginTransaction();
+                    if (!tx->insert("users", createUserRow(id, "User", id)) || !tx->commit()) {
+                        ADD_FAILURE() << "commit failed for " << id;
+                    }
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        db.disableWal();
+    }
+    
+    localdb::Database recovered;
+    ASSERT_TRUE(recovered.enableWal(wal_file));
+    ASSERT_TRUE(recovered.loadFromFile("wal_group_missing.bin"));
+    EXPECT_EQ(recovered.getTable("users")->select([](const localdb::Row&) { return true; }).size(), 100);
+    recovered.disableWal();
+    
+    std::remove(wal_file.c_str());
+}
+
+
+// Test async commits are visible at once and durable once their future is ready
+TEST_F(DatabaseTest, WalAsyncCommit) {
+    const std::string wal_file = "wal_async.wal";
+    std::remove(wal_file.c_str());
+    
+    localdb::WalOptions options;
+    options.group_commit_window = std::chrono::microseconds(200);
+    {
+        localdb::Database db;
+        ASSERT_TRUE(db.enableWal(wal_file, options));
+        EXPECT_TRUE(db.createTable("users", user_columns));
+        
+        // One caller pipelines commits without waiting for the disk
+        std::vector<std::future<bool>> durable;
+        for (int i = 0; i < 200; i++) {
+            auto tx = db.beginTransaction();
+            EXPECT_TRUE(tx->insert("users", createUserRow(i, "User", i)));
+            durable.push_back(tx->commitAsync());
+            EXPECT_EQ(db.getTable("users")->lookup("id", localdb::Value(i)).size(), 1);
+        }
+        
+        // Callbacks from several threads, mixed with waiting commits
+        std::atomic<int> callbacks{0};
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; t++) {
+            threads.emplace_back([&, t]() {
+                for (int i = 0; i < 25; i++) {
+                    int id = 1000 + t * 100 + i;
+                    auto tx = db.beginTransaction();
+                    tx->insert("users", createUserRow(id, "User", id));
+                    bool committed = i % 5 == 0 ? tx->commit() : tx->commitAsync([&](bool ok) {
+                        EXPECT_TRUE(ok);
+                        callbacks++;
+                    });
+                    EXPECT_TRUE(committed);
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        for (auto& future : durable) {
+            EXPECT_TRUE(future.get());
+        }
+        
+        // Failed commits report at once, read-only ones are durable trivially
+        auto tx = db.beginTransaction();
+        auto other = db.beginTransaction();
+        EXPECT_TRUE(tx->insert("users", createUserRow(5000, "First", 0)));
+        EXPECT_TRUE(other->insert("users", createUserRow(5000, "Second", 0)));
+        EXPECT_TRUE(other->commit());
+        EXPECT_FALSE(tx->commitAsync().get());
+        EXPECT_FALSE(tx->commitAsync([](bool) { ADD_FAILURE() << "called for a failed commit"; }));
+        tx = db.beginTransaction();
+        EXPECT_TRUE(tx->commitAsync().get());
+        
+        // Dropping the log answers every callback still waiting
+        tx.reset();
+        other.reset();
+        db.disableWal();
+        EXPECT_EQ(callbacks.load(), 80);
+    }
+    
+    localdb::Database recovered;
+    ASSERT_TRUE(recovered.enableWal(wal_file));
+    ASSERT_TRUE(recovered.loadFromFile("wal_async_missing.bin"));
+    EXPECT_EQ(recovered.getTable("users")->select([](const localdb::Row&) { return true; }).size(), 301);
+    recovered.disableWal();
+    
+    std::remove(wal_file.c_str());
+}
+
+}  // namespace
@@ -0,0 +1,186 @@
+#include <gtest/gtest.h>
+#include "localdb.h"
+#include "row_file.h"
+#include <iomanip>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+class RowFileTest : public ::testing::Test {
+protected:
+    std::vector<localdb::Column> columns = {
+        {"id", localdb::Column::INT},
+        {"score", localdb::Column::FLOAT},
+        {"name", localdb::Column::TEXT},
+        {"data", localdb::Column::BLOB}
+    };
+
+    std::vector<localdb::Row> rows = {
+        {localdb::Value(1), localdb::Value(0.1), localdb::Value(std::string("plain")),
+         localdb::Value(std::vector<uint8_t>{0x00, 0xff})},
+        {localdb::Value(2), localdb::Value(-2.5), localdb::Value(std::string("comma, \"quoted\"\nand a new line")),
+         localdb::Value(std::vector<uint8_t>{})},
+        {localdb::Value(3), localdb::Value(), localdb::Value(std::string("")), localdb::Value()}
+    };
+
+    // Read rows back, empty with error set if the reader fails
+    std::vector<localdb::Row> readCsv(const std::string& text, std::string& error) {
+        std::istringstream in(text);
+        std::vector<localdb::Row> read;
+        if (!localdb::readCsvRows(in, columns, [&read](localdb::Row&& row) {
+                read.push_back(std::move(row));
+                return true;
+            }, error)) {
+            read.clear();
+        }
+        return read;
+    }
+
+    std::vector<localdb::Row> readBinary(const std::string& bytes, std::string& error) {
+        std::istringstream in(bytes);
+        std::vector<localdb::Row> read;
+        if (!localdb::readBinaryRows(in, columns, [&read](localdb::Row&& row) {
+                read.push_back(std::move(row));
+                return true;
+            }, error)) {
+            read.clear();
+        }
+        return read;
+    }
+};
+
+// Test quoting of single CSV fields and records spanning lines
+TEST_F(RowFileTest, CsvQuoting) {
+    auto field = [](const localdb::Value& value) {
+        std::ostringstream out;
+        localdb::writeCsvValue(out, value);
+        return out.str();
+    };
+    EXPECT_EQ(field(localdb::Value(std::string("plain"))), "plain");
+    EXPECT_EQ(field(localdb::Value(std::string("a,b"))), "\"a,b\"");
+    EXPECT_EQ(field(localdb::Value(std::string("say \"hi\""))), "\"say \"\"hi\"\"\"");
+    EXPECT_EQ(field(localdb::Value(std::string(""))), "\"\"");
+    EXPECT_EQ(field(localdb::Value()), "");
+    EXPECT_EQ(field(localdb::Value(std::vector<uint8_t>{0x0a, 0xbc})), "0abc");
+
+    std::istringstream in("1,\"two\nlines\",,\"\"\r\nnext\n");
+    std::vector<std::string> fields;
+    std::vector<bool> nulls;
+    ASSERT_TRUE(localdb::readCsvRecord(in, fields, nulls));
+    EXPECT_EQ(fields, (std::vector<std::string>{"1", "two\nlines", "", ""}));
+    EXPECT_EQ(nulls, (std::vector<bool>{false, false, true, false}));
+    ASSERT_TRUE(localdb::readCsvRecord(in, fields, nulls));
+    EXPECT_EQ(fields, (std::vector<std::string>{"next"}));
+    EXPECT_FALSE(localdb::readCsvRecord(in, fields, nulls));
+}
+
+// Test written CSV reads back as the same rows, header and blank lines skipped
+TEST_F(RowFileTest, CsvRoundTrip) {
+    std::ostringstream out;
+    out << std::setprecision(std::numeric_limits<double>::max_digits10);
+    localdb::writeCsvHeader(out, columns);
+    for (const auto& row : rows) {
+        localdb::writeCsvRow(out, row);
+    }
+    out << "\n";
+
+    std::string error;
+    auto read = readCsv(out.str(), error);
+    EXPECT_EQ(error, "");
+    ASSERT_EQ(read.size(), rows.size());
+    for (size_t i = 0; i < rows.size(); ++i) {
+        for (size_t c = 0; c < columns.size(); ++c) {
+            EXPECT_EQ(read[i][c].type, rows[i][c].type) << "row " << i << " column " << c;
+            EXPECT_TRUE(read[i][c] == rows[i][c] || rows[i][c].type == localdb::Value::NULL_TYPE)
+                << "row " << i << " column " << c;
+        }
+    }
+
+    // Without a header every line is a row
+    EXPECT_EQ(readCsv("4,1.5,x,\n", error).size(), 1);
+
+    // A NULL in a one-column table is written as an empty line and read back
+    std::vector<localdb::Column> single = {{"note", localdb::Column::TEXT}};
+    std::ostringstream one;
+    localdb::writeCsvHeader(one, single);
+    localdb::writeCsvRow(one, {localdb::Value(std::string("a"))});
+    localdb::writeCsvRow(one, {localdb::Value()});
+    localdb::writeCsvRow(one, {localdb::Value(std::string(""))});
+    std::istringstream in(one.str());
+    std::vector<localdb::Row> notes;
+    EXPECT_TRUE(localdb::readCsvRows(in, single, [&notes](localdb::Row&& row) {
+        notes.push_back(std::move(row));
+        return true;
+    }, error));
+    ASSERT_EQ(notes.size(), 3);
+    EXPECT_EQ(notes[0][0].asText(), "a");
+    EXPECT_EQ(notes[1][0].type, localdb::Value::NULL_TYPE);
+    EXPECT_EQ(notes[2][0].type, localdb::Value::TEXT);
+    EXPECT_EQ(notes[2][0].asText(), "");
+}
+
+// Test malformed CSV records are reported with their record number
+TEST_F(RowFileTest, CsvErrors) {
+    std::string error;
+    EXPECT_TRUE(readCsv("1,2.0,x\n", error).empty());
+    EXPECT_EQ(error, "Record 1: expected 4 values, got 3");
+
+    EXPECT_TRUE(readCsv("1,2.0,x,\nabc,2.0,y,\n", error).empty());
+    EXPECT_EQ(error.rfind("Record 2: error parsing value for column 'id'", 0), 0) << error;
+
+    // A sink refusing a row stops the read without an error
+    std::istringstream in("1,2.0,x,\n2,2.0,y,\n");
+    size_t seen = 0;
+    error.clear();
+    EXPECT_FALSE(localdb::readCsvRows(in, columns, [&seen](localdb::Row&&) { return ++seen < 1; }, error));
+    EXPECT_EQ(seen, 1);
+    EXPECT_EQ(error, "");
+}
+
+// Test binary row files round trip and reject truncated or foreign input
+TEST_F(RowFileTest, BinaryRoundTrip) {
+    std::ostringstream out;
+    localdb::writeBinaryHeader(out);
+    for (const auto& row : rows) {
+        localdb::writeBinaryRow(out, row);
+    }
+    std::string bytes = out.str();
+
+    std::string error;
+    auto read = readBinary(bytes, error);
+    EXPECT_EQ(error, "");
+    ASSERT_EQ(read.size(), rows.size());
+    for (size_t i = 0; i < rows.size(); ++i) {
+        for (size_t c = 0; c < columns.size(); ++c) {
+            EXPECT_EQ(read[i][c].type, rows[i][c].type) << "row " << i << " column " << c;
+        }
+    }
+    EXPECT_EQ(read[1][2].asText(), rows[1][2].asText());
+    EXPECT_EQ(read[0][3].asBlob(), rows[0][3].asBlob());
+
+    // Header only is an empty file
+    EXPECT_TRUE(readBinary(bytes.substr(0, 8), error).empty());
+    EXPECT_EQ(error, "");
+
+    // Cut inside a value, and inside the next value count
+    EXPECT_TRUE(readBinary(bytes.substr(0, bytes.size() - 1), error).empty());
+    EXPECT_EQ(error.rfind("Record 3", 0), 0) << error;
+    std::ostringstream extra;
+    extra << bytes << '\x04' << '\x00';
+    EXPECT_TRUE(readBinary(extra.str(), error).empty());
+    EXPECT_EQ(error, "Truncated row file");
+
+    EXPECT_TRUE(readBinary("id,score,name,data\n", error).empty());
+    EXPECT_EQ(error, "Not a binary row file");
+
+    std::ostringstream wide;
+    localdb::writeBinaryHeader(wide);
+    localdb::writeBinaryRow(wide, {localdb::Value(1)});
+    EXPECT_TRUE(readBinary(wide.str(), error).empty());
+    EXPECT_EQ(error, "Record 1: expected 4 values, got 1");
+}
+
+} // namespace
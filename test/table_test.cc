@@ -1,7 +1,9 @@
 #include <gtest/gtest.h>
 #include "localdb.h"
+#include <algorithm>
 #include <string>
 #include <vector>
+#include <functional>
 #include <stdexcept>
 #include <thread>
 #include <future>
@@ -94,6 +96,28 @@ TEST_F(TableTest, TableInsert) {
     EXPECT_FALSE(table.insert(invalid_row));
 }
 
+// Test batch inserts are checked as a whole
+TEST_F(TableTest, TableInsertBatch) {
+    for (size_t shards : {1, 4}) {
+        localdb::Table table("test_table", columns, localdb::Table::ROW_ORIENTED, shards);
+        EXPECT_TRUE(table.insert(createRow(1, "Alice", 25)));
+        
+        // A key repeated in the batch or already in the table rejects all rows
+        EXPECT_FALSE(table.insertBatch({createRow(2, "Bob", 30), createRow(2, "Bobby", 31)}));
+        EXPECT_FALSE(table.insertBatch({createRow(3, "Charlie", 35), createRow(1, "Again", 40)}));
+        EXPECT_EQ(table.select([](const localdb::Row&) { return true; }).size(), 1);
+        
+        std::vector<localdb::Row> rows;
+        for (int i = 2; i <= 1000; i++) {
+            rows.push_back(createRow(i, "User " + std::to_string(i), i % 80));
+        }
+        EXPECT_TRUE(table.insertBatch(std::move(rows)));
+        EXPECT_EQ(table.select([](const localdb::Row&) { return true; }).size(), 1000);
+        EXPECT_EQ(table.lookup("id", localdb::Value(500))[0][1].asText(), "User 500");
+        EXPECT_FALSE(table.insert(createRow(1000, "Duplicate", 1)));
+    }
+}
+
 // Test Table selection
 TEST_F(TableTest, TableSelect) {
     localdb::Table table("test_table", columns);
@@ -176,6 +200,50 @@ TEST_F(TableTest, TableUpdate) {
     EXPECT_FALSE(result);
 }
 
+// Test moving rows in, emplacing them and updating single columns
+TEST_F(TableTest, TableMoveAndColumnUpdate) {
+    for (size_t shards : {1, 3}) {
+        localdb::Table table("test_table", columns, localdb::Table::ROW_ORIENTED, shards);
+        localdb::Row row = createRow(1, "A name long enough to live on the heap", 25);
+        EXPECT_TRUE(table.insert(std::move(row)));
+        EXPECT_TRUE(table.emplace(2, "Bob", 30));
+        EXPECT_TRUE(table.emplace(3, std::string("Charlie"), 35));
+        EXPECT_FALSE(table.emplace(3, "Duplicate", 40));
+        EXPECT_FALSE(table.emplace(4, "Missing age"));
+        EXPECT_TRUE(table.update(createRow(2, "Bobby", 31), [](const localdb::Row& row) {
+            return row[0].asInt() == 2;
+        }));
+        
+        // Only the named columns change, each row keeps its other cells
+        EXPECT_TRUE(table.updateColumns({{"age", localdb::Value(50)}}, [](const localdb::Row& row) {
+            return row[0].asInt() >= 2;
+        }));
+        auto bob = table.lookup("id", localdb::Value(2));
+        ASSERT_EQ(bob.size(), 1);
+        EXPECT_EQ(bob[0][1].asText(), "Bobby");
+        EXPECT_EQ(bob[0][2].asInt(), 50);
+        EXPECT_EQ(table.lookup("id", localdb::Value(3))[0][1].asText(), "Charlie");
+        EXPECT_EQ(table.lookup("id", localdb::Value(1))[0][2].asInt(), 25);
+        
+        // Keys stay unique, and a changed key can move the row
+        EXPECT_FALSE(table.updateColumns({{"id", localdb::Value(9)}}, [](const localdb::Row& row) {
+            return row[0].asInt() >= 2;
+        }));
+        EXPECT_FALSE(table.updateColumns({{"id", localdb::Value(1)}}, [](const localdb::Row& row) {
+            return row[0].asInt() == 3;
+        }));
+        EXPECT_FALSE(table.updateColumns({{"missing", localdb::Value(1)}}, [](const localdb::Row&) { return true; }));
+        EXPECT_TRUE(table.updateColumns({{"id", localdb::Value(30)}, {"name", localdb::Value("Chuck")}},
+                                        [](const localdb::Row& row) { return row[0].asInt() == 3; }));
+        EXPECT_TRUE(table.lookup("id", localdb::Value(3)).empty());
+        auto chuck = table.lookup("id", localdb::Value(30));
+        ASSERT_EQ(chuck.size(), 1);
+        EXPECT_EQ(chuck[0][1].asText(), "Chuck");
+        EXPECT_EQ(chuck[0][2].asInt(), 50);
+        EXPECT_EQ(table.select([](const localdb::Row&) { return true; }).size(), 3);
+    }
+}
+
 // Test Table remove
 TEST_F(TableTest, TableRemove) {
     localdb::Table table("test_table", columns);
@@ -209,6 +277,689 @@ TEST_F(TableTest, TableRemove) {
     EXPECT_FALSE(result);
 }
 
+// Test UNIQUE and PRIMARY KEY constraints are enforced through the key indexes
+TEST_F(TableTest, TableKeyConstraints) {
+    std::vector<localdb::Column> unique_columns = {
+        {"id", localdb::Column::INT, true, true, true},
+        {"email", localdb::Column::TEXT, false, true, true},
+        {"age", localdb::Column::INT, false, false, false}
+    };
+    localdb::Table table("test_table", unique_columns);
+    
+    EXPECT_TRUE(table.insert(createRow(1, "a@example.com", 25)));
+    EXPECT_TRUE(table.insert(createRow(2, "b@example.com", 30)));
+    
+    // Duplicate unique column
+    EXPECT_FALSE(table.insert(createRow(3, "a@example.com", 35)));
+    
+    // Update may keep its own key but not take another row's key
+    EXPECT_TRUE(table.update(createRow(2, "b@example.com", 31), [](const localdb::Row& row) {
+        return row[0].asInt() == 2;
+    }));
+    EXPECT_FALSE(table.update(createRow(2, "a@example.com", 31), [](const localdb::Row& row) {
+        return row[0].asInt() == 2;
+    }));
+    
+    // Writing one key into several rows is rejected
+    EXPECT_FALSE(table.update(createRow(5, "c@example.com", 40), [](const localdb::Row&) {
+        return true;
+    }));
+    
+    // Keys freed by update and remove can be reused
+    EXPECT_TRUE(table.update(createRow(4, "d@example.com", 31), [](const localdb::Row& row) {
+        return row[0].asInt() == 2;
+    }));
+    EXPECT_TRUE(table.insert(createRow(2, "b@example.com", 30)));
+    EXPECT_TRUE(table.remove([](const localdb::Row& row) {
+        return row[0].asInt() == 1;
+    }));
+    EXPECT_TRUE(table.insert(createRow(1, "a@example.com", 26)));
+    EXPECT_FALSE(table.insert(createRow(4, "e@example.com", 50)));
+    
+    auto all_rows = table.select([](const localdb::Row&) {
+        return true;
+    });
+    EXPECT_EQ(all_rows.size(), 3);
+}
+
+// Test secondary index lookups and range scans
+TEST_F(TableTest, TableIndexLookup) {
+    localdb::Table table("test_table", columns);
+    
+    table.insert(createRow(1, "Alice", 25));
+    table.insert(createRow(2, "Bob", 30));
+    table.insert(createRow(3, "Charlie", 30));
+    table.insert(createRow(4, "Dave", 40));
+    
+    EXPECT_TRUE(table.createIndex("age", localdb::Table::ORDERED));
+    EXPECT_TRUE(table.createIndex("name", localdb::Table::HASH));
+    EXPECT_FALSE(table.createIndex("age", localdb::Table::HASH));
+    EXPECT_FALSE(table.createIndex("missing"));
+    EXPECT_TRUE(table.hasIndex("age"));
+    
+    // Point lookups through secondary, key and no index
+    auto age_rows = table.lookup("age", localdb::Value(30));
+    ASSERT_EQ(age_rows.size(), 2);
+    EXPECT_EQ(age_rows[0][0].asInt(), 2);
+    EXPECT_EQ(age_rows[1][0].asInt(), 3);
+    EXPECT_EQ(table.lookup("name", localdb::Value(std::string("Dave"))).size(), 1);
+    EXPECT_EQ(table.lookup("id", localdb::Value(4))[0][1].asText(), "Dave");
+    EXPECT_EQ(table.lookup("id", localdb::Value(5)).size(), 0);
+    
+    // Inclusive range in key order
+    auto range_rows = table.range("age", localdb::Value(26), localdb::Value(40));
+    ASSERT_EQ(range_rows.size(), 3);
+    EXPECT_EQ(range_rows[2][0].asInt(), 4);
+    EXPECT_EQ(table.range("id", localdb::Value(2), localdb::Value(3)).size(), 2);
+    
+    // Inverted bounds are empty with or without an index
+    EXPECT_EQ(table.range("age", localdb::Value(50), localdb::Value(20)).size(), 0);
+    EXPECT_EQ(table.range("name", localdb::Value(std::string("Z")), localdb::Value(std::string("A"))).size(), 0);
+    
+    // Indexes follow updates and removes
+    table.update(createRow(2, "Bob", 45), [](const localdb::Row& row) {
+        return row[0].asInt() == 2;
+    });
+    table.remove([](const localdb::Row& row) {
+        return row[0].asInt() == 1;
+    });
+    EXPECT_EQ(table.lookup("age", localdb::Value(30)).size(), 1);
+    EXPECT_EQ(table.lookup("age", localdb::Value(45))[0][0].asInt(), 2);
+    EXPECT_EQ(table.range("age", localdb::Value(0), localdb::Value(100)).size(), 3);
+    EXPECT_EQ(table.lookup("name", localdb::Value(std::string("Alice"))).size(), 0);
+    
+    EXPECT_TRUE(table.dropIndex("age"));
+    EXPECT_FALSE(table.hasIndex("age"));
+    EXPECT_EQ(table.lookup("age", localdb::Value(30)).size(), 1);
+}
+
+// Test streaming scan and column projection
+TEST_F(TableTest, TableScanAndProject) {
+    localdb::Table table("test_table", columns);
+    
+    table.insert(createRow(1, "Alice", 25));
+    table.insert(createRow(2, "Bob", 30));
+    table.insert(createRow(3, "Charlie", 35));
+    
+    // Aggregate in place without copying rows
+    int age_sum = 0;
+    size_t visited = table.scan([](const localdb::Row& row) {
+        return row[0].asInt() > 1;
+    }, [&age_sum](const localdb::Row& row) {
+        age_sum += row[2].asInt();
+        return true;
+    });
+    EXPECT_EQ(visited, 2);
+    EXPECT_EQ(age_sum, 65);
+    
+    // Returning false from the visitor stops the scan
+    visited = table.scan([](const localdb::Row&) {
+        return true;
+    }, [](const localdb::Row&) {
+        return false;
+    });
+    EXPECT_EQ(visited, 1);
+    
+    auto names = table.project({"name", "id"}, [](const localdb::Row& row) {
+        return row[2].asInt() >= 30;
+    });
+    ASSERT_EQ(names.size(), 2);
+    ASSERT_EQ(names[0].size(), 2);
+    EXPECT_EQ(names[0][0].asText(), "Bob");
+    EXPECT_EQ(names[1][1].asInt(), 3);
+    
+    EXPECT_EQ(table.project({"missing"}, [](const localdb::Row&) {
+        return true;
+    }).size(), 0);
+}
+
+// Test the columnar layout through the regular row API
+TEST_F(TableTest, ColumnarTable) {
+    localdb::Table table("test_table", columns, localdb::Table::COLUMNAR);
+    EXPECT_EQ(table.getLayout(), localdb::Table::COLUMNAR);
+    
+    EXPECT_TRUE(table.insert(createRow(1, "Alice", 25)));
+    EXPECT_TRUE(table.insert(createRow(2, "Bob", 30)));
+    EXPECT_TRUE(table.insert(createRow(3, "Charlie", 35)));
+    EXPECT_FALSE(table.insert(createRow(1, "Duplicate", 40)));
+    
+    // Cells must match the column type or be NULL
+    localdb::Row mistyped = createRow(4, "Dave", 40);
+    mistyped[2] = localdb::Value(std::string("forty"));
+    EXPECT_FALSE(table.insert(mistyped));
+    localdb::Row with_null = createRow(4, "Dave", 40);
+    with_null[2] = localdb::Value();
+    EXPECT_TRUE(table.insert(with_null));
+    
+    auto rows = table.select([](const localdb::Row& row) {
+        return row[0].asInt() >= 2;
+    });
+    ASSERT_EQ(rows.size(), 3);
+    EXPECT_EQ(rows[1][1].asText(), "Charlie");
+    EXPECT_EQ(rows[2][2].type, localdb::Value::NULL_TYPE);
+    
+    // Grow a TEXT cell past its old length, then remove a row
+    std::string long_name(100, 'x');
+    EXPECT_TRUE(table.update(createRow(2, long_name, 31), [](const localdb::Row& row) {
+        return row[0].asInt() == 2;
+    }));
+    EXPECT_TRUE(table.remove([](const localdb::Row& row) {
+        return row[0].asInt() == 1;
+    }));
+    EXPECT_EQ(table.lookup("id", localdb::Value(2))[0][1].asText(), long_name);
+    EXPECT_TRUE(table.createIndex("age"));
+    EXPECT_EQ(table.range("age", localdb::Value(30), localdb::Value(40)).size(), 2);
+    
+    // Stream a column straight out of the typed arrays
+    long long age_sum = 0;
+    size_t null_count = 0;
+    EXPECT_TRUE(table.readColumn("age", [&](const localdb::ColumnView& view) {
+        EXPECT_EQ(view.type, localdb::Column::INT);
+        for (size_t i = 0; i < view.size; i++) {
+            if (view.isNull(i)) {
+                null_count++;
+            } else {
+                age_sum += view.ints[i];
+            }
+        }
+    }));
+    EXPECT_EQ(age_sum, 66);
+    EXPECT_EQ(null_count, 1);
+    
+    std::vector<std::string> names;
+    EXPECT_TRUE(table.readColumn("name", [&](const localdb::ColumnView& view) {
+        for (size_t i = 0; i < view.size; i++) {
+            names.emplace_back(view.bytesAt(i));
+        }
+    }));
+    ASSERT_EQ(names.size(), 3);
+    EXPECT_EQ(names[0], long_name);
+    EXPECT_FALSE(table.readColumn("missing", [](const localdb::ColumnView&) {}));
+}
+
+// Test column reads gather ROW_ORIENTED tables
+TEST_F(TableTest, RowTableReadColumn) {
+    localdb::Table table("test_table", columns);
+    table.insert(createRow(1, "Alice", 25));
+    table.insert(createRow(2, "Bob", 30));
+    
+    size_t size = 0;
+    EXPECT_TRUE(table.readColumn("age", [&](const localdb::ColumnView& view) {
+        size = view.size;
+        EXPECT_EQ(view.ints[1], 30);
+    }));
+    EXPECT_EQ(size, 2);
+    
+    // A cell that does not match the column type cannot be gathered
+    localdb::Row mistyped = createRow(3, "Charlie", 35);
+    mistyped[2] = localdb::Value(3.5);
+    table.insert(mistyped);
+    EXPECT_FALSE(table.readColumn("age", [](const localdb::ColumnView&) {}));
+}
+
+// Test column predicates agree with a row-by-row scan on both layouts
+TEST_F(TableTest, ColumnPredicateFilters) {
+    std::vector<localdb::Column> metric_columns = {
+        {"id", localdb::Column::INT, true, true, true},
+        {"name", localdb::Column::TEXT, false, false, false},
+        {"score", localdb::Column::FLOAT, false, false, false}
+    };
+    const localdb::ColumnPredicate::Op ops[] = {
+        localdb::ColumnPredicate::EQ, localdb::ColumnPredicate::NE, localdb::ColumnPredicate::LT,
+        localdb::ColumnPredicate::LE, localdb::ColumnPredicate::GT, localdb::ColumnPredicate::GE
+    };
+    
+    for (auto layout : {localdb::Table::ROW_ORIENTED, localdb::Table::COLUMNAR}) {
+        localdb::Table table("metrics", metric_columns, layout);
+        
+        // Enough rows for full SIMD blocks and a partial tail, with some NULLs
+        for (int i = 0; i < 1000; i++) {
+            localdb::Row row = {localdb::Value(i), localdb::Value("n" + std::to_string(i % 10)),
+                                localdb::Value((i % 7) * 0.5)};
+            if (i % 13 == 0) {
+                row[1] = localdb::Value();
+                row[2] = localdb::Value();
+            }
+            ASSERT_TRUE(table.insert(row));
+        }
+        
+        std::vector<localdb::ColumnPredicate> predicates;
+        for (auto op : ops) {
+            predicates.push_back({"id", op, localdb::Value(500)});
+            predicates.push_back({"score", op, localdb::Value(1.5)});
+            predicates.push_back({"score", op, localdb::Value(2)});
+            predicates.push_back({"name", op, localdb::Value(std::string("n4"))});
+        }
+        
+        for (const auto& predicate : predicates) {
+            int col_index = predicate.column == "id" ? 0 : predicate.column == "name" ? 1 : 2;
+            auto expected = table.select([&](const localdb::Row& row) {
+                return predicate.matches(row[col_index]);
+            });
+            auto actual = table.select(predicate);
+            ASSERT_EQ(actual.size(), expected.size()) << predicate.column << " op " << predicate.op;
+            EXPECT_EQ(table.count(predicate), expected.size());
+            for (size_t i = 0; i < actual.size(); i++) {
+                EXPECT_EQ(actual[i][0], expected[i][0]);
+            }
+        }
+        
+        // Mismatched constant types and unknown columns select nothing
+        EXPECT_EQ(table.count({"name", localdb::ColumnPredicate::EQ, localdb::Value(4)}), 0);
+        EXPECT_EQ(table.count({"missing", localdb::ColumnPredicate::EQ, localdb::Value(4)}), 0);
+        
+        // Early stop, then remove through a predicate
+        size_t visited = 0;
+        table.scan({"id", localdb::ColumnPredicate::GE, localdb::Value(0)}, [&](const localdb::Row&) {
+            return ++visited < 10;
+        });
+        EXPECT_EQ(visited, 10);
+        
+        EXPECT_TRUE(table.remove({"id", localdb::ColumnPredicate::LT, localdb::Value(900)}));
+        EXPECT_FALSE(table.remove({"id", localdb::ColumnPredicate::LT, localdb::Value(900)}));
+        EXPECT_EQ(table.count({"id", localdb::ColumnPredicate::GE, localdb::Value(0)}), 100);
+        EXPECT_EQ(table.lookup("id", localdb::Value(950)).size(), 1);
+        EXPECT_TRUE(table.insert({localdb::Value(1), localdb::Value("again"), localdb::Value(1.0)}));
+    }
+}
+
+// Test structured filters agree with a row-by-row scan on every access path
+TEST_F(TableTest, ExpressionFilters) {
+    using localdb::Expression;
+    using localdb::ColumnPredicate;
+    std::vector<localdb::Column> metric_columns = {
+        {"id", localdb::Column::INT, true, true, true},
+        {"name", localdb::Column::TEXT, false, false, false},
+        {"score", localdb::Column::FLOAT, false, false, false}
+    };
+    
+    struct Case {
+        const char* text;
+        std::function<bool(const localdb::Row&)> reference;
+    };
+    auto score = [](const localdb::Row& row) {
+        return row[2].type == localdb::Value::INT ? row[2].asInt() : row[2].asFloat();
+    };
+    std::vector<Case> cases = {
+        {"id = 42", [](const localdb::Row& row) { return row[0].asInt() == 42; }},
+        {"id > 100 AND id <= 120", [](const localdb::Row& row) {
+            return row[0].asInt() > 100 && row[0].asInt() <= 120; }},
+        {"score >= 2 AND score < 3 AND NOT name = 'n4'", [&](const localdb::Row& row) {
+            return row[2].type != localdb::Value::NULL_TYPE && score(row) >= 2 && score(row) < 3 &&
+                   !(row[1].type == localdb::Value::TEXT && row[1].asText() == "n4"); }},
+        {"score = 1", [&](const localdb::Row& row) { return row[2].type != localdb::Value::NULL_TYPE && score(row) == 1; }},
+        {"name = \"n3\" OR (id < 5 AND score != 0)", [&](const localdb::Row& row) {
+            return (row[1].type == localdb::Value::TEXT && row[1].asText() == "n3") ||
+                   (row[0].asInt() < 5 && row[2].type != localdb::Value::NULL_TYPE && score(row) != 0); }},
+        {"name >= 'n8'", [](const localdb::Row& row) {
+            return row[1].type == localdb::Value::TEXT && row[1].asText() >= "n8"; }},
+        {"not id < 990", [](const localdb::Row& row) { return row[0].asInt() >= 990; }}
+    };
+    
+    for (size_t shards : {1, 4}) {
+        for (auto layout : {localdb::Table::ROW_ORIENTED, localdb::Table::COLUMNAR}) {
+            localdb::Table table("metrics", metric_columns, layout, shards);
+            for (int i = 0; i < 1000; i++) {
+                localdb::Row row = {localdb::Value(i), localdb::Value("n" + std::to_string(i % 10)),
+                                    localdb::Value((i % 7) * 0.5)};
+                if (i % 13 == 0) {
+                    row[1] = localdb::Value();
+                    row[2] = localdb::Value();
+                } else if (i % 11 == 0 && layout == localdb::Table::ROW_ORIENTED) {
+                    row[2] = localdb::Value(i % 4);   // Row tables also hold INT cells here
+                }
+                ASSERT_TRUE(table.insert(row));
+            }
+            
+            for (bool indexed : {false, true}) {
+                if (indexed) {
+                    ASSERT_TRUE(table.createIndex("score"));
+                    ASSERT_TRUE(table.createIndex("name", localdb::Table::HASH));
+                }
+                for (const auto& c : cases) {
+                    Expression filter;
+                    ASSERT_TRUE(Expression::parse(c.text, metric_columns, filter)) << c.text;
+                    auto expected = table.select(c.reference);
+                    auto actual = table.select(filter);
+                    ASSERT_EQ(actual.size(), expected.size()) << c.text << " on " << table.explain(filter);
+                    EXPECT_EQ(table.count(filter), expected.size());
+                    
+                    // Table order, as select with a function predicate returns
+                    for (size_t i = 0; i < actual.size() && shards == 1; i++) {
+                        EXPECT_EQ(actual[i][0], expected[i][0]) << c.text;
+                    }
+                }
+            }
+        }
+    }
+    
+    // The planner prefers key lookups, then indexes, then vectorized filters
+    localdb::Table table("metrics", metric_columns, localdb::Table::COLUMNAR);
+    auto explain = [&](const std::string& text) {
+        Expression filter;
+        EXPECT_TRUE(Expression::parse(text, metric_columns, filter)) << text;
+        return table.explain(filter);
+    };
+    EXPECT_EQ(explain("score > 1 AND id = 3"), "index lookup on id");
+    EXPECT_EQ(explain("score > 1 AND name = 'x'"), "vectorized filter on score, name");
+    EXPECT_EQ(explain("score > 1 OR id = 3"), "full scan");
+    ASSERT_TRUE(table.createIndex("score"));
+    EXPECT_EQ(explain("name = 'x' AND score > 1"), "index range on score");
+    EXPECT_EQ(explain("id != 3 AND NOT score > 1"), "vectorized filter on id");
+    
+    localdb::Table sharded("metrics", metric_columns, localdb::Table::ROW_ORIENTED, 4);
+    EXPECT_EQ(sharded.explain(Expression::compare("id", ColumnPredicate::EQ, localdb::Value(3))),
+              "4 shards, each index lookup on id");
+    EXPECT_EQ(sharded.explain(Expression()), "4 shards, each full scan");
+    
+    // Built filters, early stop and rejected input
+    ASSERT_TRUE(table.insert({localdb::Value(1), localdb::Value("a"), localdb::Value(1.5)}));
+    ASSERT_TRUE(table.insert({localdb::Value(2), localdb::Value("b"), localdb::Value(2.5)}));
+    Expression built = Expression::anyOf({Expression::compare("id", ColumnPredicate::EQ, localdb::Value(1)),
+                                          Expression::negate(Expression::compare("score", ColumnPredicate::LT,
+                                                                                 localdb::Value(2)))});
+    EXPECT_EQ(table.count(built), 2);
+    size_t visited = 0;
+    EXPECT_EQ(table.scan(Expression(), [&visited](const localdb::Row&) { return ++visited < 1; }), 1);
+    EXPECT_EQ(table.count(Expression::compare("missing", ColumnPredicate::EQ, localdb::Value(1))), 0);
+    EXPECT_EQ(table.explain(Expression::compare("missing", ColumnPredicate::EQ, localdb::Value(1))), "");
+    
+    Expression parsed;
+    EXPECT_TRUE(Expression::parse("2 >= 2", metric_columns, parsed));
+    EXPECT_EQ(table.count(parsed), 1);
+    EXPECT_FALSE(Expression::parse("id = abc", metric_columns, parsed));
+    EXPECT_FALSE(Expression::parse("missing = 1", metric_columns, parsed));
+    EXPECT_FALSE(Expression::parse("(id = 1", metric_columns, parsed));
+    EXPECT_FALSE(Expression::parse("id = 1 AND", metric_columns, parsed));
+    EXPECT_FALSE(Expression::parse("name = 'open", metric_columns, parsed));
+    // A column index past the last column, even one too long for an integer, is a parse failure
+    EXPECT_FALSE(Expression::parse("9 = 1", metric_columns, parsed));
+    EXPECT_FALSE(Expression::parse("99999999999999999999999 = 1", metric_columns, parsed));
+}
+
+// Test aggregates with and without groups agree with a client-side pass
+TEST_F(TableTest, TableAggregate) {
+    using localdb::Aggregate;
+    std::vector<Aggregate> aggregates = {
+        {Aggregate::COUNT, ""}, {Aggregate::COUNT, "age"}, {Aggregate::SUM, "age"},
+        {Aggregate::AVG, "age"}, {Aggregate::MIN, "name"}, {Aggregate::MAX, "age"}
+    };
+    
+    for (size_t shards : {1, 3}) {
+        for (auto layout : {localdb::Table::ROW_ORIENTED, localdb::Table::COLUMNAR}) {
+            localdb::Table table("test_table", columns, layout, shards);
+            for (int i = 0; i < 10000; i++) {
+                localdb::Row row = createRow(i, "g" + std::to_string(i % 3), i % 50);
+                if (i % 7 == 0) {
+                    row[2] = localdb::Value();
+                }
+                ASSERT_TRUE(table.insert(row));
+            }
+            
+            std::vector<localdb::Row> result;
+            ASSERT_TRUE(table.aggregate(aggregates, {}, localdb::Expression(), result));
+            ASSERT_EQ(result.size(), 1);
+            int count = 0;
+            int sum = 0;
+            for (int i = 0; i < 10000; i++) {
+                if (i % 7 != 0) {
+                    count++;
+                    sum += i % 50;
+                }
+            }
+            EXPECT_EQ(result[0][0].asInt(), 10000);
+            EXPECT_EQ(result[0][1].asInt(), count);
+            EXPECT_EQ(result[0][2].asInt(), sum);
+            EXPECT_DOUBLE_EQ(result[0][3].asFloat(), static_cast<double>(sum) / count);
+            EXPECT_EQ(result[0][4].asText(), "g0");
+            EXPECT_EQ(result[0][5].asInt(), 49);
+            
+            // Groups come back in key order, each with its own aggregates
+            localdb::Expression filter;
+            ASSERT_TRUE(localdb::Expression::parse("id < 30", columns, filter));
+            ASSERT_TRUE(table.aggregate({{Aggregate::COUNT, ""}, {Aggregate::MIN, "id"}}, {"name"}, filter, result));
+            ASSERT_EQ(result.size(), 3);
+            for (int g = 0; g < 3; g++) {
+                EXPECT_EQ(result[g][0].asText(), "g" + std::to_string(g));
+                EXPECT_EQ(result[g][1].asInt(), 10);
+                EXPECT_EQ(result[g][2].asInt(), g);
+            }
+            
+            // No matching rows: COUNT is 0 and the others are NULL
+            ASSERT_TRUE(localdb::Expression::parse("id < 0", columns, filter));
+            ASSERT_TRUE(table.aggregate(aggregates, {}, filter, result));
+            ASSERT_EQ(result.size(), 1);
+            EXPECT_EQ(result[0][0].asInt(), 0);
+            EXPECT_EQ(result[0][2].type, localdb::Value::NULL_TYPE);
+            EXPECT_EQ(result[0][5].type, localdb::Value::NULL_TYPE);
+            ASSERT_TRUE(table.aggregate(aggregates, {"age"}, filter, result));
+            EXPECT_TRUE(result.empty());
+        }
+    }
+    
+    // Sums leave INT for FLOAT once they overflow, bad columns are rejected
+    localdb::Table table("test_table", columns);
+    ASSERT_TRUE(table.insert(createRow(1, "a", 2000000000)));
+    ASSERT_TRUE(table.insert(createRow(2, "b", 2000000000)));
+    std::vector<localdb::Row> result;
+    ASSERT_TRUE(table.aggregate({{Aggregate::SUM, "age"}}, {}, localdb::Expression(), result));
+    EXPECT_EQ(result[0][0].type, localdb::Value::FLOAT);
+    EXPECT_DOUBLE_EQ(result[0][0].asFloat(), 4e9);
+    EXPECT_FALSE(table.aggregate({{Aggregate::SUM, "name"}}, {}, localdb::Expression(), result));
+    EXPECT_FALSE(table.aggregate({{Aggregate::MAX, "missing"}}, {}, localdb::Expression(), result));
+    EXPECT_FALSE(table.aggregate({{Aggregate::COUNT, ""}}, {"missing"}, localdb::Expression(), result));
+    
+    Aggregate parsed;
+    EXPECT_TRUE(Aggregate::parse("avg(age)", parsed));
+    EXPECT_EQ(parsed.function, Aggregate::AVG);
+    EXPECT_EQ(parsed.column, "age");
+    EXPECT_TRUE(Aggregate::parse("COUNT(*)", parsed));
+    EXPECT_TRUE(parsed.column.empty());
+    EXPECT_FALSE(Aggregate::parse("SUM(*)", parsed));
+    EXPECT_FALSE(Aggregate::parse("MEDIAN(age)", parsed));
+    EXPECT_FALSE(Aggregate::parse("age", parsed));
+}
+
+// Test ordered selects with LIMIT and OFFSET match a full sort
+TEST_F(TableTest, TableOrderByLimit) {
+    using localdb::OrderBy;
+    auto sorted = [](std::vector<localdb::Row> rows, const std::vector<std::pair<size_t, bool>>& keys) {
+        std::stable_sort(rows.begin(), rows.end(), [&keys](const localdb::Row& a, const localdb::Row& b) {
+            for (const auto& [column, descending] : keys) {
+                if (a[column] < b[column]) return !descending;
+                if (b[column] < a[column]) return descending;
+            }
+            return false;
+        });
+        return rows;
+    };
+    auto slice = [](const std::vector<localdb::Row>& rows, size_t limit, size_t offset) {
+        std::vector<localdb::Row> part;
+        for (size_t i = offset; i < rows.size() && i - offset < limit; i++) {
+            part.push_back(rows[i]);
+        }
+        return part;
+    };
+    
+    for (size_t shards : {1, 3}) {
+        for (auto layout : {localdb::Table::ROW_ORIENTED, localdb::Table::COLUMNAR}) {
+            for (bool indexed : {false, true}) {
+                localdb::Table table("test_table", columns, layout, shards);
+                if (indexed) {
+                    ASSERT_TRUE(table.createIndex("age"));
+                }
+                for (int i = 0; i < 10000; i++) {
+                    localdb::Row row = createRow(i, "n" + std::to_string(i % 7), (i * 37) % 100);
+                    if (i % 11 == 0) {
+                        row[2] = localdb::Value();
+                    }
+                    ASSERT_TRUE(table.insert(row));
+                }
+                ASSERT_TRUE(table.update(createRow(20000, "moved", 5), [](const localdb::Row& row) {
+                    return row[0].asInt() == 3;
+                }));
+                
+                // Ties keep the order an unordered select returns, NULLs sort first
+                localdb::Expression all;
+                std::vector<localdb::Row> rows = table.select(all);
+                auto by_age = sorted(rows, {{2, false}});
+                EXPECT_EQ(table.select(all, {{"age"}}, 25), slice(by_age, 25, 0));
+                EXPECT_EQ(table.select(all, {{"age"}}, 25)[0][2].type, localdb::Value::NULL_TYPE);
+                EXPECT_EQ(table.select(all, {{"age"}}), by_age);
+                auto by_age_desc = sorted(rows, {{2, true}});
+                EXPECT_EQ(table.select(all, {{"age", true}}, 10, 95), slice(by_age_desc, 10, 95));
+                auto by_name_age = sorted(rows, {{1, true}, {2, false}});
+                EXPECT_EQ(table.select(all, {{"name", true}, {"age"}}, 50, 3), slice(by_name_age, 50, 3));
+                
+                // Filters narrowed by the primary key or an age range still sort
+                localdb::Expression filter;
+                ASSERT_TRUE(localdb::Expression::parse("id < 500 AND age >= 40", columns, filter));
+                auto filtered = sorted(table.select(filter), {{2, true}});
+                EXPECT_EQ(table.select(filter, {{"age", true}}, 7), slice(filtered, 7, 0));
+                ASSERT_TRUE(localdb::Expression::parse("age > 90 OR name = 'moved'", columns, filter));
+                filtered = sorted(table.select(filter), {{2, false}});
+                EXPECT_EQ(table.select(filter, {{"age"}}, 30, 2), slice(filtered, 30, 2));
+                ASSERT_TRUE(localdb::Expression::parse("age >= 98", columns, filter));
+                filtered = sorted(table.select(filter), {{2, true}});
+                EXPECT_EQ(table.select(filter, {{"age", true}}, 12), slice(filtered, 12, 0));
+                
+                // LIMIT alone keeps table order; edge limits and bad columns give nothing
+                EXPECT_EQ(table.select(all, {}, 5, 10), slice(rows, 5, 10));
+                EXPECT_TRUE(table.select(all, {{"age"}}, 0).empty());
+                EXPECT_TRUE(table.select(all, {{"age"}}, 10, 20000).empty());
+                EXPECT_EQ(table.select(all, {{"id"}}, localdb::Table::kNoLimit, 9999).size(), 1);
+                EXPECT_TRUE(table.select(all, {{"missing"}}, 10).empty());
+            }
+        }
+    }
+    
+    std::vector<OrderBy> order;
+    EXPECT_TRUE(OrderBy::parse("age desc, name", order));
+    ASSERT_EQ(order.size(), 2);
+    EXPECT_EQ(order[0].column, "age");
+    EXPECT_TRUE(order[0].descending);
+    EXPECT_EQ(order[1].column, "name");
+    EXPECT_FALSE(order[1].descending);
+    EXPECT_TRUE(OrderBy::parse(" id ASC ", order));
+    EXPECT_FALSE(order[0].descending);
+    EXPECT_FALSE(OrderBy::parse("", order));
+    EXPECT_FALSE(OrderBy::parse("age, , name", order));
+    EXPECT_FALSE(OrderBy::parse("age UP", order));
+    EXPECT_FALSE(OrderBy::parse("age DESC name", order));
+}
+
+// Test a sharded table behaves like one table
+TEST_F(TableTest, ShardedTable) {
+    EXPECT_THROW(localdb::Table("no_key", {{"a", localdb::Column::INT}}, localdb::Table::ROW_ORIENTED, 4),
+                 std::runtime_error);
+    
+    for (auto layout : {localdb::Table::ROW_ORIENTED, localdb::Table::COLUMNAR}) {
+        localdb::Table table("sharded", columns, layout, 4);
+        EXPECT_EQ(table.getShardCount(), 4);
+        EXPECT_TRUE(table.createIndex("age"));
+        EXPECT_TRUE(table.hasIndex("age"));
+        
+        // Inserts from several threads land in different shards
+        std::vector<std::thread> writers;
+        for (int t = 0; t < 4; t++) {
+            writers.emplace_back([&table, t, this] {
+                for (int i = t; i < 400; i += 4) {
+                    table.insert(createRow(i, "User " + std::to_string(i), i % 50));
+                }
+            });
+        }
+        for (auto& writer : writers) {
+            writer.join();
+        }
+        EXPECT_FALSE(table.insert(createRow(7, "Duplicate", 1)));
+        
+        auto all = [](const localdb::Row&) { return true; };
+        EXPECT_EQ(table.select(all).size(), 400);
+        EXPECT_EQ(table.count({"age", localdb::ColumnPredicate::LT, localdb::Value(10)}), 80);
+        EXPECT_EQ(table.lookup("id", localdb::Value(123)).size(), 1);
+        EXPECT_EQ(table.lookup("age", localdb::Value(3)).size(), 8);
+        
+        // Range results come back in value order across shards
+        auto ids = table.range("id", localdb::Value(100), localdb::Value(109));
+        ASSERT_EQ(ids.size(), 10);
+        for (int i = 0; i < 10; i++) {
+            EXPECT_EQ(ids[i][0].asInt(), 100 + i);
+        }
+        
+        size_t visited = 0;
+        table.scan(all, [&visited](const localdb::Row&) { return ++visited < 5; });
+        EXPECT_EQ(visited, 5);
+        
+        int64_t sum = 0;
+        EXPECT_TRUE(table.readColumn("age", [&sum](const localdb::ColumnView& view) {
+            for (size_t i = 0; i < view.size; i++) {
+                sum += view.ints[i];
+            }
+        }));
+        EXPECT_EQ(sum, 8 * (49 * 50 / 2));
+        
+        // A changed primary key moves the row between shards
+        EXPECT_TRUE(table.update(createRow(1000, "Moved", 1), [](const localdb::Row& row) {
+            return row[0].asInt() == 5;
+        }));
+        EXPECT_TRUE(table.lookup("id", localdb::Value(5)).empty());
+        EXPECT_EQ(table.lookup("id", localdb::Value(1000)).size(), 1);
+        EXPECT_FALSE(table.update(createRow(6, "Taken", 1), [](const localdb::Row& row) {
+            return row[0].asInt() == 1000;
+        }));
+        
+        // A value of the wrong type is rejected before any shard changes
+        auto moved = [](const localdb::Row& row) { return row[0].asInt() == 1000; };
+        if (layout == localdb::Table::COLUMNAR) {
+            EXPECT_FALSE(table.updateColumns({{"age", localdb::Value("old")}}, moved));
+            EXPECT_EQ(table.lookup("id", localdb::Value(1000))[0][2].asInt(), 1);
+        }
+        EXPECT_TRUE(table.updateColumns({{"age", localdb::Value(2)}}, moved));
+        EXPECT_EQ(table.lookup("id", localdb::Value(1000))[0][2].asInt(), 2);
+        
+        EXPECT_TRUE(table.remove([](const localdb::Row& row) { return row[0].asInt() < 100; }));
+        EXPECT_TRUE(table.remove({"age", localdb::ColumnPredicate::EQ, localdb::Value(49)}));
+        EXPECT_EQ(table.select(all).size(), 400 - 99 - 6);
+    }
+}
+
+// Test table locks are granted in arrival order and report waiting
+TEST_F(TableTest, TableLockFairness) {
+    localdb::Table table("test_table", columns);
+    ASSERT_TRUE(table.beginRead());
+    
+    // A writer queues behind the reader; once it does, readers can no longer barge in
+    auto writer = std::async(std::launch::async, [&table] {
+        bool locked = table.beginWrite();
+        if (locked) {
+            table.endWrite();
+        }
+        return locked;
+    });
+    while (table.mutex_.try_lock_shared()) {
+        table.mutex_.unlock_shared();
+        std::this_thread::yield();
+    }
+    
+    // A reader arriving behind the queued writer waits for it and times out
+    EXPECT_FALSE(table.beginRead(std::chrono::milliseconds(20)));
+    
+    table.endRead();
+    EXPECT_TRUE(writer.get());
+    
+    // The lock is free again for readers and writers
+    ASSERT_TRUE(table.beginRead(std::chrono::milliseconds(0)));
+    table.endRead();
+    ASSERT_TRUE(table.beginWrite(std::chrono::milliseconds(0)));
+    table.endWrite();
+    
+    auto stats = table.lockStats();
+    EXPECT_EQ(stats.contended, 1);
+    EXPECT_EQ(stats.timeouts, 1);
+    EXPECT_GE(stats.max_wait, std::chrono::milliseconds(20));
+    EXPECT_GE(stats.wait_time, stats.max_wait);
+}
+
 // Test multi-threaded table access
 TEST_F(TableTest, ThreadedAccess) {
 }
@@ -110,6 +110,42 @@ TEST_F(TransactionTest, TransactionSelect) {
     transaction->commit();
 }
 
+// Test Transaction Scan and Project
+TEST_F(TransactionTest, TransactionScan) {
+    {
+        auto tx = db.beginTransaction();
+        tx->insert("users", createUserRow(1, "Alice", 25));
+        tx->insert("users", createUserRow(2, "Bob", 30));
+        tx->commit();
+    }
+    
+    auto transaction = db.beginTransaction();
+    
+    size_t count = 0;
+    EXPECT_TRUE(transaction->scan("users", [](const localdb::Row&) {
+        return true;
+    }, [&count](const localdb::Row&) {
+        count++;
+        return true;
+    }));
+    EXPECT_EQ(count, 2);
+    
+    EXPECT_FALSE(transaction->scan("non_existent", [](const localdb::Row&) {
+        return true;
+    }, [](const localdb::Row&) {
+        return true;
+    }));
+    
+    auto ages = transaction->project("users", {"age"}, [](const localdb::Row& row) {
+        return row[0].asInt() == 2;
+    });
+    ASSERT_EQ(ages.size(), 1);
+    ASSERT_EQ(ages[0].size(), 1);
+    EXPECT_EQ(ages[0][0].asInt(), 30);
+    
+    transaction->commit();
+}
+
 // Test Transaction Update
 TEST_F(TransactionTest, TransactionUpdate) {
     // Insert some data
@@ -225,6 +261,506 @@ TEST_F(TransactionTest, TransactionRollback) {
     EXPECT_EQ(alice_rows[0][2].asInt(), 25);
 }
 
+// Test rolled back writes release their keys
+TEST_F(TransactionTest, TransactionRollbackKeys) {
+    {
+        auto tx = db.beginTransaction();
+        tx->insert("users", createUserRow(1, "Alice", 25));
+        tx->insert("users", createUserRow(2, "Bob", 30));
+        tx->commit();
+    }
+    
+    auto transaction = db.beginTransaction();
+    EXPECT_TRUE(transaction->insert("users", createUserRow(3, "Charlie", 35)));
+    EXPECT_TRUE(transaction->remove("users", [](const localdb::Row& row) {
+        return row[0].asInt() == 1;
+    }));
+    transaction->rollback();
+    
+    // Key 3 was released and key 1 is held again by the restored row
+    auto tx = db.beginTransaction();
+    EXPECT_TRUE(tx->insert("users", createUserRow(3, "Charlie", 35)));
+    EXPECT_FALSE(tx->insert("users", createUserRow(1, "Duplicate", 40)));
+    tx->commit();
+    
+    auto table = db.getTable("users");
+    auto all_rows = table->select([](const localdb::Row&) {
+        return true;
+    });
+    EXPECT_EQ(all_rows.size(), 3);
+}
+
+// Test batch inserts in a transaction are buffered all or nothing
+TEST_F(TransactionTest, TransactionInsertBatch) {
+    auto transaction = db.beginTransaction();
+    EXPECT_TRUE(transaction->insert("users", createUserRow(1, "Alice", 25)));
+    EXPECT_FALSE(transaction->insertBatch("users", {createUserRow(2, "Bob", 30), createUserRow(1, "Again", 31)}));
+    EXPECT_FALSE(transaction->insertBatch("users", {createUserRow(3, "Charlie", 35), createUserRow(3, "Chuck", 36)}));
+    
+    std::vector<localdb::Row> rows;
+    for (int i = 2; i <= 100; i++) {
+        rows.push_back(createUserRow(i, "User " + std::to_string(i), 20 + i % 40));
+    }
+    EXPECT_TRUE(transaction->insertBatch("users", std::move(rows)));
+    EXPECT_EQ(transaction->select("users", [](const localdb::Row&) { return true; }).size(), 100);
+    EXPECT_TRUE(transaction->commit());
+    
+    EXPECT_EQ(db.getTable("users")->select([](const localdb::Row&) { return true; }).size(), 100);
+}
+
+// Test structured filters see the transaction's own writes and snapshot
+TEST_F(TransactionTest, TransactionExpressionSelect) {
+    auto table = db.getTable("users");
+    ASSERT_TRUE(table->createIndex("age"));
+    EXPECT_TRUE(table->emplace(1, "Alice", 25));
+    EXPECT_TRUE(table->emplace(2, "Bob", 30));
+    
+    localdb::Expression filter;
+    ASSERT_TRUE(localdb::Expression::parse("age >= 30 AND NOT name = 'Dave'", user_columns, filter));
+    EXPECT_EQ(table->explain(filter), "index range on age");
+    
+    auto transaction = db.beginTransaction();
+    EXPECT_TRUE(transaction->insert("users", createUserRow(3, "Charlie", 35)));
+    EXPECT_TRUE(transaction->insert("users", createUserRow(4, "Dave", 40)));
+    auto rows = transaction->select("users", filter);
+    ASSERT_EQ(rows.size(), 2);
+    EXPECT_EQ(rows[0][0].asInt(), 2);
+    EXPECT_EQ(rows[1][0].asInt(), 3);
+    
+    // Others see only committed rows, unknown columns fail the read
+    EXPECT_EQ(table->count(filter), 1);
+    EXPECT_TRUE(transaction->select("users", localdb::Expression::compare(
+        "missing", localdb::ColumnPredicate::EQ, localdb::Value(1))).empty());
+    EXPECT_TRUE(transaction->commit());
+    EXPECT_EQ(table->count(filter), 2);
+}
+
+// Test column-wise updates see and respect the transaction snapshot
+TEST_F(TransactionTest, TransactionUpdateColumns) {
+    auto table = db.getTable("users");
+    EXPECT_TRUE(table->emplace(1, "Alice", 25));
+    EXPECT_TRUE(table->emplace(2, "Bob", 30));
+    
+    auto transaction = db.beginTransaction();
+    EXPECT_TRUE(transaction->insert("users", createUserRow(3, "Charlie", 35)));
+    EXPECT_TRUE(transaction->updateColumns("users", {{"age", localdb::Value(40)}}, [](const localdb::Row& row) {
+        return row[0].asInt() != 1;
+    }));
+    EXPECT_EQ(transaction->lookup("users", "id", localdb::Value(3))[0][2].asInt(), 40);
+    EXPECT_EQ(table->lookup("id", localdb::Value(2))[0][2].asInt(), 30);
+    
+    // A concurrent column update of a row this transaction changed conflicts
+    auto other = db.beginTransaction();
+    EXPECT_FALSE(other->updateColumns("users", {{"name", localdb::Value("Robert")}}, [](const localdb::Row& row) {
+        return row[0].asInt() == 2;
+    }));
+    other->rollback();
+    
+    EXPECT_TRUE(transaction->commit());
+    auto bob = table->lookup("id", localdb::Value(2));
+    ASSERT_EQ(bob.size(), 1);
+    EXPECT_EQ(bob[0][1].asText(), "Bob");
+    EXPECT_EQ(bob[0][2].asInt(), 40);
+    EXPECT_EQ(table->lookup("id", localdb::Value(1))[0][2].asInt(), 25);
+}
+
+// Test updating columns of the rows a structured filter matches
+TEST_F(TransactionTest, TransactionExpressionUpdate) {
+    auto table = db.getTable("users");
+    EXPECT_TRUE(table->emplace(1, "Alice", 25));
+    EXPECT_TRUE(table->emplace(2, "Bob", 30));
+    EXPECT_TRUE(table->emplace(3, "Charlie", 35));
+    
+    localdb::Expression filter;
+    ASSERT_TRUE(localdb::Expression::parse("age >= 30 AND NOT name = 'Charlie'", user_columns, filter));
+    auto transaction = db.beginTransaction();
+    EXPECT_TRUE(transaction->updateColumns("users", {{"name", localdb::Value("Robert")}}, filter));
+    EXPECT_FALSE(transaction->updateColumns("users", {{"age", localdb::Value(1)}},
+                                            localdb::Expression::compare("missing", localdb::ColumnPredicate::EQ,
+                                                                         localdb::Value(1))));
+    EXPECT_EQ(transaction->status().code, localdb::Status::INVALID_ARGUMENT);
+    EXPECT_TRUE(transaction->commit());
+    
+    EXPECT_EQ(table->lookup("id", localdb::Value(1))[0][1].asText(), "Alice");
+    EXPECT_EQ(table->lookup("id", localdb::Value(2))[0][1].asText(), "Robert");
+    EXPECT_EQ(table->lookup("id", localdb::Value(3))[0][1].asText(), "Charlie");
+}
+
+// Test rollback only undoes the transaction's own rows, not equal ones
+TEST_F(TransactionTest, TransactionRollbackEqualRows) {
+    ASSERT_TRUE(db.createTable("events", {{"kind", localdb::Column::TEXT}, {"count", localdb::Column::INT}}));
+    auto table = db.getTable("events");
+    localdb::Row event = {localdb::Value("click"), localdb::Value(1)};
+    EXPECT_TRUE(table->insert(event));
+    EXPECT_TRUE(table->insert(event));
+    
+    auto transaction = db.beginTransaction();
+    EXPECT_TRUE(transaction->insert("events", event));
+    EXPECT_TRUE(transaction->update("events", {localdb::Value("click"), localdb::Value(2)},
+                                    [](const localdb::Row& row) { return row[1].asInt() == 1; }));
+    EXPECT_EQ(transaction->select("events", [](const localdb::Row&) { return true; }).size(), 3);
+    transaction->rollback();
+    
+    auto rows = table->select([](const localdb::Row&) { return true; });
+    ASSERT_EQ(rows.size(), 2);
+    EXPECT_EQ(rows[0], event);
+    EXPECT_EQ(rows[1], event);
+}
+
+// Test transactions on a columnar table
+TEST_F(TransactionTest, ColumnarTransactions) {
+    EXPECT_TRUE(db.createTable("metrics", user_columns, localdb::Table::COLUMNAR));
+    {
+        auto tx = db.beginTransaction();
+        tx->insert("metrics", createUserRow(1, "Alice", 25));
+        tx->insert("metrics", createUserRow(2, "Bob", 30));
+        tx->commit();
+    }
+    
+    auto transaction = db.beginTransaction();
+    EXPECT_TRUE(transaction->insert("metrics", createUserRow(3, "Charlie", 35)));
+    EXPECT_TRUE(transaction->update("metrics", createUserRow(1, "Alice", 26), [](const localdb::Row& row) {
+        return row[0].asInt() == 1;
+    }));
+    EXPECT_TRUE(transaction->remove("metrics", [](const localdb::Row& row) {
+        return row[0].asInt() == 2;
+    }));
+    transaction->rollback();
+    
+    auto table = db.getTable("metrics");
+    auto all_rows = table->select([](const localdb::Row&) {
+        return true;
+    });
+    ASSERT_EQ(all_rows.size(), 2);
+    EXPECT_EQ(table->lookup("id", localdb::Value(1))[0][2].asInt(), 25);
+    EXPECT_EQ(table->lookup("id", localdb::Value(2)).size(), 1);
+    EXPECT_EQ(table->lookup("id", localdb::Value(3)).size(), 0);
+}
+
+// Test column predicates through a transaction, including rollback of a delete
+TEST_F(TransactionTest, TransactionColumnPredicate) {
+    {
+        auto tx = db.beginTransaction();
+        tx->insert("users", createUserRow(1, "Alice", 25));
+        tx->insert("users", createUserRow(2, "Bob", 30));
+        tx->insert("users", createUserRow(3, "Charlie", 35));
+        tx->commit();
+    }
+    
+    localdb::ColumnPredicate older = {"age", localdb::ColumnPredicate::GE, localdb::Value(30)};
+    auto transaction = db.beginTransaction();
+    auto rows = transaction->select("users", older);
+    ASSERT_EQ(rows.size(), 2);
+    EXPECT_EQ(rows[0][1].asText(), "Bob");
+    
+    EXPECT_TRUE(transaction->remove("users", older));
+    EXPECT_TRUE(transaction->select("users", older).empty());
+    EXPECT_FALSE(transaction->remove("users", {"missing", localdb::ColumnPredicate::EQ, localdb::Value(1)}));
+    transaction->rollback();
+    
+    auto table = db.getTable("users");
+    EXPECT_EQ(table->count(older), 2);
+}
+
+// Test a transaction reads the snapshot it began with
+TEST_F(TransactionTest, SnapshotIsolation) {
+    {
+        auto tx = db.beginTransaction();
+        tx->insert("users", createUserRow(1, "Alice", 25));
+        tx->insert("users", createUserRow(2, "Bob", 30));
+        tx->commit();
+    }
+    auto all = [](const localdb::Row&) { return true; };
+    
+    auto reader = db.beginTransaction();
+    auto writer = db.beginTransaction();
+    EXPECT_TRUE(writer->insert("users", createUserRow(3, "Charlie", 35)));
+    EXPECT_TRUE(writer->update("users", createUserRow(1, "Alice", 26), [](const localdb::Row& row) {
+        return row[0].asInt() == 1;
+    }));
+    
+    // Uncommitted writes are only visible to the writer
+    EXPECT_EQ(reader->select("users", all).size(), 2);
+    EXPECT_EQ(writer->select("users", all).size(), 3);
+    EXPECT_EQ(writer->lookup("users", "id", localdb::Value(1))[0][2].asInt(), 26);
+    EXPECT_TRUE(writer->commit());
+    
+    // Writes committed after the reader began, in or outside a transaction, stay invisible
+    auto table = db.getTable("users");
+    EXPECT_TRUE(table->remove([](const localdb::Row& row) { return row[0].asInt() == 2; }));
+    auto rows = reader->select("users", all);
+    ASSERT_EQ(rows.size(), 2);
+    EXPECT_EQ(reader->lookup("users", "id", localdb::Value(1))[0][2].asInt(), 25);
+    EXPECT_EQ(reader->lookup("users", "id", localdb::Value(2)).size(), 1);
+    EXPECT_TRUE(reader->lookup("users", "id", localdb::Value(3)).empty());
+    EXPECT_EQ(reader->select("users", {"age", localdb::ColumnPredicate::GE, localdb::Value(30)}).size(), 1);
+    EXPECT_TRUE(reader->commit());
+    
+    EXPECT_EQ(table->select(all).size(), 2);
+    EXPECT_EQ(table->lookup("id", localdb::Value(1))[0][2].asInt(), 26);
+}
+
+// Test the first of two writers to change a row wins
+TEST_F(TransactionTest, WriteConflict) {
+    {
+        auto tx = db.beginTransaction();
+        tx->insert("users", createUserRow(1, "Alice", 25));
+        tx->commit();
+    }
+    auto alice = [](const localdb::Row& row) { return row[0].asInt() == 1; };
+    
+    auto first = db.beginTransaction();
+    auto second = db.beginTransaction();
+    EXPECT_TRUE(first->update("users", createUserRow(1, "Alice", 26), alice));
+    EXPECT_FALSE(second->update("users", createUserRow(1, "Alice", 27), alice));
+    EXPECT_FALSE(second->remove("users", alice));
+    EXPECT_FALSE(db.getTable("users")->update(createUserRow(1, "Alice", 28), alice));
+    
+    // A committed change made after the snapshot still conflicts
+    EXPECT_TRUE(first->commit());
+    EXPECT_FALSE(second->update("users", createUserRow(1, "Alice", 27), alice));
+    second->rollback();
+    
+    auto third = db.beginTransaction();
+    EXPECT_TRUE(third->update("users", createUserRow(1, "Alice", 27), alice));
+    EXPECT_TRUE(third->commit());
+    EXPECT_EQ(db.getTable("users")->lookup("id", localdb::Value(1))[0][2].asInt(), 27);
+}
+
+// Test a failed operation reports why it failed
+TEST_F(TransactionTest, OperationStatus) {
+    auto alice = [](const localdb::Row& row) { return row[0].asInt() == 1; };
+    auto tx = db.beginTransaction();
+    EXPECT_TRUE(tx->insert("users", createUserRow(1, "Alice", 25)));
+    EXPECT_TRUE(tx->status().ok());
+    EXPECT_FALSE(tx->insert("missing", createUserRow(2, "Bob", 30)));
+    EXPECT_EQ(tx->status().code, localdb::Status::NOT_FOUND);
+    EXPECT_FALSE(tx->insert("users", {localdb::Value(2)}));
+    EXPECT_EQ(tx->status().code, localdb::Status::INVALID_ARGUMENT);
+    EXPECT_FALSE(tx->remove("users", [](const localdb::Row& row) { return row[0].asInt() == 9; }));
+    EXPECT_EQ(tx->status().code, localdb::Status::NO_MATCH);
+    EXPECT_TRUE(tx->commit());
+    EXPECT_FALSE(tx->insert("users", createUserRow(2, "Bob", 30)));
+    EXPECT_EQ(tx->status().code, localdb::Status::INACTIVE);
+    
+    // A committed key is a constraint violation, one being changed a conflict
+    auto first = db.beginTransaction();
+    auto second = db.beginTransaction();
+    EXPECT_FALSE(first->insert("users", createUserRow(1, "Duplicate", 26)));
+    EXPECT_EQ(first->status().code, localdb::Status::CONSTRAINT);
+    EXPECT_FALSE(first->status().retryable());
+    EXPECT_TRUE(first->update("users", createUserRow(1, "Alice", 26), alice));
+    EXPECT_FALSE(second->update("users", createUserRow(1, "Alice", 27), alice));
+    EXPECT_EQ(second->status().code, localdb::Status::CONFLICT);
+    EXPECT_TRUE(second->status().retryable());
+    EXPECT_TRUE(first->commit());
+    second->rollback();
+    
+    // An exception from a predicate aborts the operation with its message
+    tx = db.beginTransaction();
+    auto rows = tx->select("users", [](const localdb::Row&) -> bool { throw std::runtime_error("bad predicate"); });
+    EXPECT_TRUE(rows.empty());
+    EXPECT_EQ(tx->status().code, localdb::Status::ABORTED);
+    EXPECT_EQ(tx->status().toString(), "ABORTED: bad predicate");
+    tx->rollback();
+    
+    // The lock wait honours the transaction's timeout and deadline
+    auto users = db.getTable("users");
+    {
+        std::unique_lock<localdb::TableLock> lock(users->mutex_);
+        localdb::TransactionOptions options;
+        options.lock_timeout = std::chrono::milliseconds(1);
+        tx = db.beginTransaction(options);
+        int attempts = 0;
+        EXPECT_FALSE(localdb::performTransactionOperation(*tx, [&] {
+            attempts++;
+            return tx->insert("users", createUserRow(2, "Blocked", 30));
+        }));
+        EXPECT_EQ(attempts, 3);
+        EXPECT_EQ(tx->status().code, localdb::Status::TIMEOUT);
+        tx->rollback();
+        
+        options = localdb::TransactionOptions();
+        options.deadline = std::chrono::steady_clock::now();
+        tx = db.beginTransaction(options);
+        auto start = std::chrono::steady_clock::now();
+        EXPECT_FALSE(tx->remove("users", alice));
+        EXPECT_EQ(tx->status().code, localdb::Status::TIMEOUT);
+        EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(400));
+        tx->rollback();
+        
+        // Reads time out too, with no rows, and are retried like writes
+        ASSERT_TRUE(db.createTable("teams", {{"id", localdb::Column::INT}}));
+        options = localdb::TransactionOptions();
+        options.lock_timeout = std::chrono::milliseconds(1);
+        tx = db.beginTransaction(options);
+        attempts = 0;
+        std::vector<localdb::Row> rows;
+        EXPECT_FALSE(localdb::performTransactionOperation(*tx, [&] {
+            attempts++;
+            rows = tx->select("users", [](const localdb::Row&) { return true; });
+            return tx->status().ok();
+        }));
+        EXPECT_EQ(attempts, 3);
+        EXPECT_TRUE(rows.empty());
+        EXPECT_EQ(tx->status().code, localdb::Status::TIMEOUT);
+        EXPECT_TRUE(tx->lookup("users", "id", localdb::Value(1)).empty());
+        EXPECT_EQ(tx->status().code, localdb::Status::TIMEOUT);
+        EXPECT_TRUE(tx->range("users", "id", localdb::Value(0), localdb::Value(9)).empty());
+        EXPECT_EQ(tx->status().code, localdb::Status::TIMEOUT);
+        size_t joined = 0;
+        auto count_joined = [&joined](const localdb::Row&, const localdb::Row&) {
+            joined++;
+            return true;
+        };
+        EXPECT_FALSE(tx->join("teams", "id", "users", "id", count_joined));
+        EXPECT_EQ(tx->status().code, localdb::Status::TIMEOUT);
+        EXPECT_FALSE(tx->join("users", "id", "users", "id", count_joined));
+        EXPECT_EQ(tx->status().code, localdb::Status::TIMEOUT);
+        EXPECT_EQ(joined, 0);
+        EXPECT_TRUE(tx->join("teams", "id", "teams", "id", count_joined));
+        tx->rollback();
+    }
+    
+    // Only timeouts are retried
+    tx = db.beginTransaction();
+    int attempts = 0;
+    EXPECT_FALSE(localdb::performTransactionOperation(*tx, [&] {
+        attempts++;
+        return tx->insert("users", createUserRow(1, "Again", 30));
+    }));
+    EXPECT_EQ(attempts, 1);
+    EXPECT_EQ(tx->status().code, localdb::Status::CONSTRAINT);
+    
+    // A commit losing a buffered key to a newer commit conflicts
+    tx = db.beginTransaction();
+    EXPECT_TRUE(tx->insert("users", createUserRow(3, "Carol", 35)));
+    {
+        auto other = db.beginTransaction();
+        EXPECT_TRUE(other->insert("users", createUserRow(3, "Dave", 40)));
+        EXPECT_TRUE(other->commit());
+    }
+    EXPECT_FALSE(tx->commit());
+    EXPECT_EQ(tx->status().code, localdb::Status::CONFLICT);
+}
+
+// Test versions kept for an open snapshot are reclaimed after it ends
+TEST_F(TransactionTest, VersionCollection) {
+    EXPECT_TRUE(db.createTable("metrics", user_columns, localdb::Table::COLUMNAR));
+    auto table = db.getTable("metrics");
+    for (int i = 0; i < 100; i++) {
+        table->insert(createUserRow(i, "User " + std::to_string(i), i));
+    }
+    localdb::ColumnPredicate all = {"age", localdb::ColumnPredicate::GE, localdb::Value(0)};
+    
+    auto reader = db.beginTransaction();
+    for (int round = 1; round <= 50; round++) {
+        for (int i = 0; i < 100; i++) {
+            EXPECT_TRUE(table->update(createUserRow(i, "User " + std::to_string(i), i + round * 100),
+                                      [i](const localdb::Row& row) { return row[0].asInt() == i; }));
+        }
+    }
+    
+    // The reader still sees the original ages after 5000 newer versions
+    auto rows = reader->select("metrics", {"age", localdb::ColumnPredicate::LT, localdb::Value(100)});
+    EXPECT_EQ(rows.size(), 100);
+    EXPECT_TRUE(reader->commit());
+    
+    for (int i = 0; i < 100; i++) {
+        table->update(createUserRow(i, "User " + std::to_string(i), i),
+                      [i](const localdb::Row& row) { return row[0].asInt() == i; });
+    }
+    EXPECT_EQ(table->count(all), 100);
+    EXPECT_EQ(table->count({"age", localdb::ColumnPredicate::LT, localdb::Value(100)}), 100);
+    table->readColumn("age", [](const localdb::ColumnView& view) {
+        EXPECT_EQ(view.size, 100);
+    });
+}
+
+// Test rows built from recycled buffers and transactions outgrowing their inline arena
+TEST_F(TransactionTest, RecycledStorage) {
+    auto table = db.getTable("users");
+    std::string padding(40, 'x');
+    for (int i = 0; i < 200; i++) {
+        ASSERT_TRUE(table->insert(createUserRow(i, "User " + std::to_string(i) + padding, i)));
+    }
+    
+    // Each round ends 200 versions, collection hands their buffers to the next round
+    for (int round = 1; round <= 20; round++) {
+        auto tx = db.beginTransaction();
+        EXPECT_TRUE(tx->updateColumns("users", {{"age", localdb::Value(round)}},
+                                      [](const localdb::Row& row) { return row[0].asInt() % 2 == 0; }));
+        EXPECT_TRUE(tx->update("users", createUserRow(1, "Odd" + padding, round),
+                               [](const localdb::Row& row) { return row[0].asInt() == 1; }));
+        EXPECT_TRUE(tx->commit());
+    }
+    auto rows = table->select([](const localdb::Row&) { return true; });
+    ASSERT_EQ(rows.size(), 200);
+    for (const auto& row : rows) {
+        int id = row[0].asInt();
+        EXPECT_EQ(row[2].asInt(), id % 2 == 0 || id == 1 ? 20 : id);
+        EXPECT_EQ(row[1].asText(), (id == 1 ? "Odd" : "User " + std::to_string(id)) + padding);
+    }
+    
+    // Far more buffered keys than the inline arena holds
+    auto tx = db.beginTransaction();
+    for (int i = 1000; i < 3000; i++) {
+        EXPECT_TRUE(tx->insert("users", createUserRow(i, "Batch", i)));
+    }
+    EXPECT_FALSE(tx->insert("users", createUserRow(1500, "Duplicate", 0)));
+    EXPECT_TRUE(tx->commit());
+    EXPECT_EQ(table->select([](const localdb::Row&) { return true; }).size(), 2200);
+}
+
+// Test buffered inserts are validated again when they are applied
+TEST_F(TransactionTest, BufferedInsertConflict) {
+    auto first = db.beginTransaction();
+    auto second = db.beginTransaction();
+    EXPECT_TRUE(first->insert("users", createUserRow(1, "Alice", 25)));
+    EXPECT_FALSE(first->insert("users", createUserRow(1, "Duplicate", 26)));
+    
+    // Neither sees the other's buffered key, the first to commit keeps it
+    EXPECT_TRUE(second->insert("users", createUserRow(1, "Bob", 30)));
+    EXPECT_TRUE(second->insert("users", createUserRow(2, "Charlie", 35)));
+    EXPECT_TRUE(first->commit());
+    EXPECT_FALSE(second->commit());
+    
+    auto table = db.getTable("users");
+    auto rows = table->select([](const localdb::Row&) { return true; });
+    ASSERT_EQ(rows.size(), 1);
+    EXPECT_EQ(rows[0][1].asText(), "Alice");
+}
+
+// Test concurrent inserting transactions on one table all commit
+TEST_F(TransactionTest, ParallelInserts) {
+    const int threads = 8;
+    const int per_thread = 400;
+    std::vector<std::future<int>> writers;
+    for (int t = 0; t < threads; t++) {
+        writers.push_back(std::async(std::launch::async, [this, t, per_thread] {
+            int committed = 0;
+            for (int i = 0; i < per_thread; i += 4) {
+                auto tx = db.beginTransaction();
+                bool ok = true;
+                for (int j = i; j < i + 4; j++) {
+                    int id = t * per_thread + j;
+                    ok = tx->insert("users", createUserRow(id, "User " + std::to_string(id), j)) && ok;
+                }
+                committed += ok && tx->commit() ? 4 : 0;
+            }
+            return committed;
+        }));
+    }
+    
+    int committed = 0;
+    for (auto& writer : writers) {
+        committed += writer.get();
+    }
+    EXPECT_EQ(committed, threads * per_thread);
+    EXPECT_EQ(db.getTable("users")->select([](const localdb::Row&) { return true; }).size(),
+              static_cast<size_t>(threads * per_thread));
+}
+
 // Test Transaction Concurrency
 TEST_F(TransactionTest, TransactionConcurrency) {
     // Insert initial data
@@ -3,6 +3,7 @@
 #include <string>
 #include <vector>
 #include <stdexcept>
+#include <sstream>
 
 namespace {
 
@@ -148,6 +149,69 @@ TEST_F(ValueTest, ComparisonOperators) {
     EXPECT_TRUE(text_val1 < text_val3);
 }
 
+// Test inline and heap storage of TEXT and BLOB payloads
+TEST_F(ValueTest, InlineAndHeapStorage) {
+    std::string short_text(localdb::Value::kInlineCapacity, 'a');
+    std::string long_text(localdb::Value::kInlineCapacity + 1, 'b');
+    
+    localdb::Value empty_val(std::string(""));
+    localdb::Value short_val(short_text);
+    localdb::Value long_val(long_text);
+    EXPECT_FALSE(empty_val.isHeapAllocated());
+    EXPECT_FALSE(short_val.isHeapAllocated());
+    EXPECT_TRUE(long_val.isHeapAllocated());
+    EXPECT_EQ(empty_val.asText(), "");
+    EXPECT_EQ(short_val.textView(), short_text);
+    EXPECT_EQ(long_val.textView(), long_text);
+    
+    // Copies own their payload, moves hand it over
+    localdb::Value long_copy(long_val);
+    EXPECT_NE(long_copy.textView().data(), long_val.textView().data());
+    EXPECT_EQ(long_copy, long_val);
+    const char* long_data = long_val.textView().data();
+    localdb::Value long_move(std::move(long_val));
+    EXPECT_EQ(long_move.textView().data(), long_data);
+    
+    long_copy = short_val;
+    EXPECT_FALSE(long_copy.isHeapAllocated());
+    EXPECT_EQ(long_copy.asText(), short_text);
+    
+    // Blobs compare byte-wise as unsigned values
+    localdb::Value low_blob(std::vector<uint8_t>{0x01, 0xFF});
+    localdb::Value high_blob(std::vector<uint8_t>{0x80});
+    std::vector<uint8_t> big_blob(100, 0xAB);
+    localdb::Value big_val(big_blob);
+    EXPECT_TRUE(low_blob < high_blob);
+    EXPECT_EQ(big_val.asBlob(), big_blob);
+    EXPECT_EQ(big_val.blobView().size(), 100);
+    EXPECT_THROW(big_val.textView(), std::runtime_error);
+    
+    // Equal values hash equally regardless of storage
+    EXPECT_EQ(localdb::Value(long_text).hash(), long_move.hash());
+    EXPECT_NE(localdb::Value(std::string("x")).hash(), localdb::Value(std::vector<uint8_t>{'x'}).hash());
+}
+
+// Test Value serialization round trip
+TEST_F(ValueTest, SerializationRoundTrip) {
+    std::vector<localdb::Value> values;
+    values.emplace_back();
+    values.emplace_back(-7);
+    values.emplace_back(2.5);
+    values.emplace_back(std::string("short"));
+    values.emplace_back(std::string(1000, 'z'));
+    values.emplace_back(std::vector<uint8_t>{0x00, 0x10});
+    
+    std::stringstream stream;
+    for (const auto& value : values) {
+        value.serialize(stream);
+    }
+    for (const auto& value : values) {
+        localdb::Value loaded = localdb::Value::deserialize(stream);
+        EXPECT_EQ(loaded.type, value.type);
+        EXPECT_EQ(loaded, value);
+    }
+}
+
 // Test Value type exceptions
 TEST_F(ValueTest, TypeExceptions) {
     localdb::Value int_val(42);